@@ -34,6 +34,19 @@ public:
     void SetLinearFogStart(float start);
     void SetAmbientLighting(float ambient);
     void SetBloomThreshold(float threshold);
+    void SetDepthPrepass(bool on);
+    void SetSSAO(bool on);
+    void SetTerrainMeshMode(bool on); //terrain as a cached mesh, rebuilt as the camera moves: much faster on software GL
+    void SetAsyncLoading(bool on); //on by default: models/textures/terrain load in the background, drawn once they are ready
+    bool IsLoadingAssets(); //background loads still in flight, e.g. for a loading screen
+    void SetPostProcessSettings(const PostProcessSettings& settings);
+    void SetAntiAliasing(AAMode mode);
+    void SetRenderScale(float scale);
+    void SetDynamicResolution(bool on, float frameTimeBudgetMs = DEFAULT_FRAME_TIME_BUDGET_MS, float minScale = MIN_RENDER_SCALE);
+    void RequestFrameCapture(FrameCaptureCallback callback, CaptureSource source = CAPTURE_FINAL);
+    void BenchmarkGpuSort(); //prints keys/s of the gpu sort (bitonic vs radix), call outside of a frame
+    FrameGraphStats GetFrameGraphStats(); //passes culled and transient memory saved by aliasing, last frame
+    bool ConvertHeightmapToTiles(const char* imagePath, const char* outPath); //offline: heightmap image -> DrawClipmapTerrain file
 
     void SetSkybox(const std::vector<const char*>& faces);
 
@@ -83,6 +96,15 @@ public:
         Vec4 rotation = { 0,1,0,0 }
     );
 
+    //streamed around the camera from a tiled file (ConvertHeightmapToTiles), for maps too big for DrawTerrain
+    void DrawClipmapTerrain
+    (
+        const char* path,
+        Vec3 pos = { 0,0,0 },
+        Vec3 size = { 1,1,1 },
+        Vec4 rotation = { 0,1,0,0 }
+    );
+
     void DrawPointLight
     (
         Vec3 pos = {0,0,0},
@@ -92,6 +114,15 @@ public:
         bool shadows = false
     );
 
+    //Submit a batch of point lights for this frame
+    void SubmitPointLights(const PointLightDesc* lights, size_t count);
+    void SubmitPointLights(const std::vector<PointLightDesc>& lights);
+
+    //Persistent point lights are drawn every frame until destroyed
+    PointLightHandle CreatePointLight(const PointLightDesc& light);
+    void UpdatePointLight(PointLightHandle handle, const PointLightDesc& light);
+    void DestroyPointLight(PointLightHandle handle);
+
     void DrawDirLight
     (
         Vec3 dir = { 1.0f, -1.0f, 1.0f },
@@ -106,7 +137,8 @@ public:
         unsigned int particleCount,
         Vec3 pos = { 0.0f, 0.0f, 0.0f },
         Vec3 scale = { 1.0f, 1.0f, 1.0f },
-        Vec4 rotation = {0.0f, 1.0f, 0.0f, 0.0f}
+        Vec4 rotation = {0.0f, 1.0f, 0.0f, 0.0f},
+        const ParticlePhysics& physics = ParticlePhysics()
     );
 
     void SetDrawLightsDebug(bool on);
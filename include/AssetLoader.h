@@ -0,0 +1,40 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include "Definitions.h"
+
+//Job queue for loading assets without stalling the frame. A job runs on one of ASSET_LOADER_THREADS workers (file reads,
+//parsing, decoding, simplification: no GL) and returns its upload, which Update() runs on the render thread. An upload
+//is called again every frame until it returns false, so big assets go up a piece at a time, and Update() stops starting
+//new pieces once ASSET_UPLOAD_BUDGET_MS is spent.
+class AssetLoader
+{
+public:
+    typedef std::function<bool()> Upload;   //GL thread, one piece per call, false once it is done
+    typedef std::function<Upload()> Job;    //worker thread
+
+    AssetLoader();
+    ~AssetLoader(); //jobs that haven't started are dropped, running ones finish first
+
+    void Submit(Job job);
+    void Update(); //GL thread, once a frame
+    bool IsBusy(); //anything queued, running or waiting for its upload
+
+private:
+    void WorkerLoop();
+
+    std::vector<std::thread> workers;
+    std::mutex jobMutex;
+    std::condition_variable jobCondition;
+    std::deque<Job> jobs;
+    std::deque<Upload> finished; //returned by the workers, in the order they finished
+    std::deque<Upload> uploads;  //GL thread only, the front one is in progress
+    unsigned int running;
+    bool stopping;
+};
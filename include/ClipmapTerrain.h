@@ -0,0 +1,120 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+#include "Definitions.h"
+#include "MappedFile.h"
+
+class Shader;
+
+//TILED HEIGHTMAP FILE (ConvertHeightmap): header, one ClipmapFileLevel per level, then per level the tile min/max table and
+//the tiles. level l + 1 keeps every other sample of level l, so its samples sit exactly on level l vertices
+struct ClipmapFileHeader
+{
+    char magic[4];              //"KTHM"
+    uint32_t version;
+    uint32_t width, height;     //level 0 samples, one per model unit
+    uint32_t tileSize;          //CLIPMAP_TILE_SIZE
+    uint32_t levelCount;
+};
+
+struct ClipmapFileLevel
+{
+    uint32_t width, height;     //samples
+    uint32_t tilesX, tilesY;    //at least CLIPMAP_WINDOW_TILES + 1, samples past width/height repeat the edge
+    uint64_t rangeOffset;       //tilesX * tilesY min/max pairs (uint16), each over the tile plus its far border
+    uint64_t tileOffset;        //tilesX * tilesY tiles of tileSize^2 uint16 samples, rows of tiles, rows of samples
+};
+
+//Geometry clipmap over a tiled heightmap file that stays memory mapped, nothing is read until a tile is needed.
+//Every level keeps a window of CLIPMAP_WINDOW_TILES tiles (+1 for the far edge vertices) around the camera in its layer
+//of an R16 texture array. Tile (x, y) always lives in slot (x, y) mod (CLIPMAP_WINDOW_TILES + 2), so a window moves by
+//uploading one row/column of tiles, never by copying. Missing tiles are read on worker threads and uploaded a few per
+//frame; a window only steps once its next position is fully resident, until then the coarser levels cover for it.
+//Drawn as instances of one CLIPMAP_TILE_SIZE / 2 quad block, each level fills its window minus the finer level's.
+class ClipmapTerrain
+{
+public:
+    ClipmapTerrain(const char* path);   //opens the file and loads the coarsest level (small, covers the whole map)
+    ~ClipmapTerrain();                  //stops the streaming threads
+
+    //offline step: 8 or 16 bit grayscale image -> tiled file
+    static bool ConvertHeightmap(const char* imagePath, const char* outPath);
+
+    bool IsLoaded() const;
+
+    void BeginFrame(); //drops last frame's blocks
+    //blocks of one draw, appended to this frame's. the frame's first Select also streams toward that camera.
+    //returns <first, count> for the instanced draw
+    std::pair<unsigned int, unsigned int> Select(const glm::mat4& model, const glm::vec3& cameraPos,
+                                                 const std::function<bool(const AABB&)>& isVisible);
+    void Upload(); //after the frame's last Select
+
+    void Bind(Shader* shader) const; //heights on GL_TEXTURE9 + the window uniforms of vsTerrainClipmap
+    const MeshData& GetMeshData() const;
+    size_t GetResidentMemory() const; //texture + cpu tables, not the mapping
+
+private:
+    struct Level
+    {
+        ClipmapFileLevel info;
+        std::vector<uint16_t> ranges;       //copied at open, culling never touches the mapping
+        glm::ivec2 origin;                  //first tile of the active window
+        bool ready;                         //every tile of the active window is resident
+        std::vector<glm::ivec2> resident;   //per slot, tile held. -1 = none
+        std::vector<glm::ivec2> requested;  //per slot, tile being read. -1 = none
+    };
+
+    struct TileRequest
+    {
+        unsigned int level;
+        glm::ivec2 tile;
+    };
+
+    struct TileResult
+    {
+        unsigned int level;
+        glm::ivec2 tile;
+        std::vector<uint16_t> samples;
+    };
+
+    void Stream(const glm::vec3& cameraPos);                //model space
+    bool RequestWindow(unsigned int level, const glm::ivec2& origin); //true when all of it is resident
+    void UploadTile(const TileResult& result);
+    void ReadTile(const TileRequest& request, std::vector<uint16_t>& samples) const;
+    unsigned int GetSlot(const glm::ivec2& tile) const;
+    void WorkerLoop();
+    void SetupBuffers();
+
+    MappedFile file;
+    ClipmapFileHeader header;
+    std::vector<Level> levels;
+    glm::vec2 halfExtent;
+    bool loaded;
+
+    unsigned int heightTexture; //R16 array, layer per level
+    MeshData meshData;          //block grid + the instance buffer
+    unsigned int gridVBO, gridEBO, instanceVBO;
+
+    std::vector<glm::vec4> instances; //this frame's: block origin (level samples), level
+    unsigned int finestLevel;         //this frame's chain: finestLevel..coarsestLevel, each inside the next
+    unsigned int coarsestLevel;
+    bool streamedThisFrame;
+    bool overflowReported;
+
+    //streaming
+    std::vector<std::thread> workers;
+    std::mutex jobMutex;
+    std::condition_variable jobCondition;
+    std::deque<TileRequest> jobs;
+    std::vector<TileResult> results;
+    bool stopping;
+};
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <vector>
 #include "KoopaMath.h"
 
 struct AABB
@@ -50,6 +53,16 @@ struct PointLightGPU
 };
 */
 
+//point light shading stream (lightShadingSSBO, binding 4), std430 GPUPointLightShading in the lit shaders.
+//culling only reads the positionRange (vec4) stream, only visible lights are uploaded so there is no isActive flag
+struct PointLightShadingGPU
+{
+    uint32_t colorRG;           //packHalf2x16(r, g)
+    uint32_t colorBIntensity;   //packHalf2x16(b, intensity)
+    int32_t  shadowMapIndex;    //12 bytes
+};
+static_assert(sizeof(PointLightShadingGPU) == 12, "std430 layout (struct of scalars)");
+
 struct MeshData
 {
     unsigned int VAO;
@@ -58,6 +71,26 @@ struct MeshData
     AABB aabb;
 };
 
+class TerrainQuadtree;
+class TerrainMesh;
+class HeightPyramid;
+
+struct TerrainMeshPlacement
+{
+    TerrainMesh* mesh;
+    unsigned int usedFrame; //last frame a DrawTerrain took it, the others are deleted in SelectTerrainPatches
+};
+
+//DrawTerrain, one per heightmap: a single patch (instanced per quadtree node), the heightmap, its cpu min/max pyramid and quadtree
+struct TerrainData
+{
+    MeshData meshData;
+    unsigned int heightMapTexture = 0;
+    HeightPyramid* heights = nullptr;    //null if the heightmap failed to load
+    TerrainQuadtree* quadtree = nullptr;
+    std::vector<TerrainMeshPlacement> meshes; //terrain mesh mode only, one per place the heightmap is drawn at
+};
+
 struct Material
 {
     //the id of diffuse material texture
@@ -86,17 +119,112 @@ struct PBRMaterial
     unsigned int height;
 };
 
+//what the user submits. Plain data so a batch of these can be copied in one go.
+struct PointLightDesc
+{
+    Vec3 position;
+    Vec3 color = Vec3(1.0f, 1.0f, 1.0f);
+    float range = 1.0f;
+    float intensity = 1.0f;
+    bool castShadows = false;
+};
+
+//persistent lights stay in the scene until destroyed (no need to resubmit every frame)
+//low bits: slot, high bits: the slot's generation, so a handle kept after Destroy can't reach the slot's next light
+typedef unsigned int PointLightHandle;
+constexpr PointLightHandle INVALID_POINT_LIGHT_HANDLE = 0xFFFFFFFF;
+constexpr unsigned int POINT_LIGHT_HANDLE_INDEX_BITS = 20;
+constexpr unsigned int POINT_LIGHT_HANDLE_INDEX_MASK = (1u << POINT_LIGHT_HANDLE_INDEX_BITS) - 1;
+
 constexpr float PI = 3.14159265359f;
 
 constexpr unsigned int SCREEN_WIDTH = 1920;
 constexpr unsigned int SCREEN_HEIGHT = 1080;
 
+//dynamic resolution: every target stays SCREEN sized, the scene is drawn into the bottom left
+//(SCREEN * renderScale) corner and upscaled when the final image is made.
+constexpr float MIN_RENDER_SCALE = 0.5f;
+constexpr float DEFAULT_FRAME_TIME_BUDGET_MS = 16.0f;   //a little under 60hz
+constexpr unsigned int GPU_TIMER_QUERY_COUNT = 4;       //frames in flight before a timer result is read
+
+//frame graph: pooled transient textures nothing asked for in this many frames are freed
+constexpr unsigned int FG_POOL_IDLE_FRAMES = 60;
+
+//ssao runs at 1/SSAO_DOWNSCALE res (2 = half, 4 = quarter) with a rotating subset of the kernel each frame,
+//the rest of the kernel comes from the reprojected history.
+constexpr unsigned int SSAO_DOWNSCALE = 2;
+constexpr unsigned int SSAO_WIDTH = SCREEN_WIDTH / SSAO_DOWNSCALE;
+constexpr unsigned int SSAO_HEIGHT = SCREEN_HEIGHT / SSAO_DOWNSCALE;
+constexpr unsigned int SSAO_KERNEL_SIZE = 32;
+constexpr unsigned int SSAO_SAMPLES_PER_FRAME = 8; //must divide SSAO_KERNEL_SIZE
+
+//hdr scene + bloom chain format. true: R11G11B10F (4 bytes/px, no alpha), false: RGBA16F (8 bytes/px)
+constexpr bool HDR_PACKED_FORMAT = true;
+
 //max amount of point lights allowed
-constexpr unsigned int MAX_POINT_LIGHTS = 1024;
-constexpr unsigned int MAX_LIGHTS_PER_TILE = 256;
-constexpr unsigned int TILE_SIZE = 16;
+constexpr unsigned int MAX_POINT_LIGHTS = 65536;
 constexpr unsigned int MAX_SHADOW_CASTING_POINT_LIGHTS = 4;
 
+//particles: one pool shared by every emitter (32 bytes each + alive/dead list entries)
+constexpr unsigned int MAX_PARTICLES = 1u << 20;
+constexpr unsigned int MAX_PARTICLE_SPAWN_REQUESTS = 1024; //emitters that can spawn in the same frame
+constexpr unsigned int MAX_PARTICLE_EMITTERS = 4096;        //live emitters, one gpu state slot each
+constexpr unsigned int PARTICLE_COUNT_READBACKS = 3;        //alive count copies in flight for the sort bound, never waited on
+constexpr float PARTICLE_GRAVITY = 3.81f;
+constexpr float PARTICLE_COLLISION_THICKNESS = 0.5f;     //how far behind the depth buffer still counts as touching it
+
+//emitter LOD: off screen emitters aren't drawn and only step every PARTICLE_OFFSCREEN_UPDATE_INTERVAL frames (with the
+//summed dt), past PARTICLE_LOD_DISTANCE the spawn rate drops with distance (down to PARTICLE_MIN_LOD of it)
+constexpr unsigned int PARTICLE_OFFSCREEN_UPDATE_INTERVAL = 4;
+constexpr float PARTICLE_LOD_DISTANCE = 50.0f;
+constexpr float PARTICLE_MIN_LOD = 0.1f;
+
+//gpu sort (GpuSort, SORT_AUTO): bitonic up to this many keys, radix above
+constexpr unsigned int GPU_SORT_BITONIC_MAX_KEYS = 1u << 14;
+
+//terrain quadtree (TerrainQuadtree): leaves are TERRAIN_LEAF_SIZE heightmap texels across, nodes split until their patch at
+//TERRAIN_MAX_TESS_LEVEL has triangle edges of about TERRAIN_TARGET_EDGE_PIXELS. tcsTerrain rounds edge levels to powers of
+//two between the min and max level, so neighbors up to log2(TERRAIN_MIN_TESS_LEVEL) quadtree levels apart stay crack free.
+//the cut is balanced to that: nodes next to one more than TERRAIN_MIN_TESS_LEVEL times smaller are split
+constexpr unsigned int TERRAIN_LEAF_SIZE = 64;
+constexpr unsigned int TERRAIN_MAX_PATCHES = 4096;     //per heightmap per frame
+constexpr float TERRAIN_TARGET_EDGE_PIXELS = 8.0f;
+constexpr float TERRAIN_MIN_TESS_LEVEL = 4.0f;
+constexpr float TERRAIN_MAX_TESS_LEVEL = 64.0f;
+constexpr float TERRAIN_HEIGHT_SCALE = 64.0f;          //texel [0, 1] -> height, same as tesTerrain
+constexpr float TERRAIN_HEIGHT_OFFSET = -16.0f;
+constexpr unsigned int TERRAIN_HEIGHT_CELL_SIZE = 4;   //texels per HeightPyramid level 0 cell (per axis)
+//terrain in shadow maps (tcsTerrainShadow): a fixed grid of equal nodes over the whole map, at most TERRAIN_SHADOW_GRID_PATCHES,
+//tessellated per shadow map to triangle edges of about TERRAIN_SHADOW_TARGET_EDGE_TEXELS
+constexpr unsigned int TERRAIN_SHADOW_GRID_PATCHES = 1024;
+constexpr float TERRAIN_SHADOW_TARGET_EDGE_TEXELS = 4.0f;
+//terrain mesh mode (TerrainMesh, SetTerrainMeshMode): csTerrainMesh builds the cut as TERRAIN_MESH_PATCH_RESOLUTION^2 quads
+//per patch instead of tessellating, again once the camera is TERRAIN_MESH_REBUILD_DISTANCE from where it was built
+constexpr unsigned int TERRAIN_MESH_PATCH_RESOLUTION = 32;   //same as csTerrainMesh
+constexpr float TERRAIN_MESH_REBUILD_DISTANCE = 32.0f;
+//buffers per placement are sized for the cut (+1/4), at most this many patches. a patch is 33^2 vertices * 44 bytes + 32^2 * 6
+//indices * 4 bytes = ~72KB, so ~37MB at the cap. a cut needing more is selected again with a coarser error until it fits
+constexpr unsigned int TERRAIN_MESH_MAX_PATCHES = 512;
+
+//clipmap terrain (ClipmapTerrain, DrawClipmapTerrain): every level keeps a window of CLIPMAP_WINDOW_TILES x CLIPMAP_WINDOW_TILES
+//tiles around the camera resident, one layer of a texture array each. sample spacing doubles per level
+constexpr unsigned int CLIPMAP_TILE_SIZE = 64;          //samples per tile side (file and texture)
+constexpr unsigned int CLIPMAP_WINDOW_TILES = 4;        //even, the window is centered on the camera tile
+constexpr unsigned int CLIPMAP_MAX_LEVELS = 10;            //the coarsest has to fit one window: maps up to 256 << 9 samples a side
+constexpr unsigned int CLIPMAP_STREAM_THREADS = 2;
+constexpr unsigned int CLIPMAP_UPLOADS_PER_FRAME = 8;   //tiles, the rest wait for the next frame
+constexpr unsigned int CLIPMAP_MAX_BLOCKS = 4096;       //per file per frame
+constexpr float CLIPMAP_MORPH_WIDTH = 16.0f;            //samples along the window edge blended into the next level
+
+//clustered forward+ (froxels): TILE_SIZE x TILE_SIZE pixels x CLUSTER_Z_SLICES exponential depth slices
+constexpr unsigned int TILE_SIZE = 32;
+constexpr unsigned int CLUSTER_Z_SLICES = 24;
+constexpr unsigned int CLUSTER_GRID_X = (SCREEN_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+constexpr unsigned int CLUSTER_GRID_Y = (SCREEN_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+constexpr unsigned int CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_Z_SLICES;
+//size of the compact light index list shared by all clusters (room for an average of 16 lights per cluster)
+constexpr unsigned int CLUSTER_LIGHT_INDEX_CAPACITY = CLUSTER_COUNT * 16;
+
 //camera
 constexpr float DEFAULT_EXPOSURE = 0.5f;
 constexpr float DEFAULT_NEAR = 0.1f;
@@ -116,13 +244,87 @@ enum FogType
     EXPONENTIAL_SQUARED = 2
 };
 
+enum ToneMapType
+{
+    EXPOSURE_TONEMAP = 0,
+    REINHARD_TONEMAP = 1,
+    FILMIC_TONEMAP = 2
+};
+
+//each mode only allocates the targets it needs (SetAntiAliasing)
+enum AAMode
+{
+    AA_NONE = 0,
+    AA_MSAA_2X = 1,
+    AA_MSAA_4X = 2,
+    AA_MSAA_8X = 3,
+    AA_FXAA = 4,    //single sample, FXAA on the final LDR image
+    AA_TAA = 5      //single sample, jittered projection + history resolve with gbuffer velocity
+};
+
+//what the frame graph did last frame (GetFrameGraphStats)
+struct FrameGraphStats
+{
+    unsigned int passCount = 0;
+    unsigned int culledPassCount = 0;   //passes nobody read from, skipped
+    size_t transientMemory = 0;         //bytes the surviving passes' transient textures would need without aliasing
+    size_t poolMemory = 0;              //bytes the pool actually holds for them
+};
+
+//every stage runs in the one post process dispatch, disabled ones are skipped per pixel
+struct PostProcessSettings
+{
+    bool bloom = true;
+    ToneMapType toneMap = EXPOSURE_TONEMAP;
+    bool gammaCorrection = true;
+    bool fog = false;               //fog from the gbuffer instead of per fragment in the lit pass (uses the SetFog* params)
+    bool vignette = false;
+    float vignetteStrength = 0.35f;
+};
+
+//per emitter physics (CreateParticleEmitter). collisions are against the depth buffer, so only where particles are on screen
+struct ParticlePhysics
+{
+    float gravity = PARTICLE_GRAVITY;   //units/s^2, down
+    float drag = 0.0f;                  //velocity falls off by exp(-drag * t)
+    float restitution = 0.5f;           //how much of the speed into a surface bounces back (0 = stops, 1 = elastic)
+    bool collisions = true;
+};
+
+//frame capture (RequestFrameCapture): the readback lands in a ring of CAPTURE_PBO_COUNT pixel buffers and is
+//handed to the callback a few frames later, on the capture worker thread.
+constexpr unsigned int CAPTURE_PBO_COUNT = 3;
+enum CaptureSource
+{
+    CAPTURE_FINAL,  //what ends up on screen, RGB8
+    CAPTURE_HDR     //lit scene before post processing (render res), RGB half float
+};
+
+struct CapturedFrame
+{
+    CaptureSource source;
+    unsigned int width, height;
+    const void* pixels;     //bottom row first, tightly packed. only valid inside the callback
+};
+typedef std::function<void(const CapturedFrame&)> FrameCaptureCallback;
+
+//asset loading (AssetLoader, SetAsyncLoading): models, textures and heightmaps are parsed and decoded on ASSET_LOADER_THREADS
+//workers, their GL uploads run at the start of a frame until ASSET_UPLOAD_BUDGET_MS is used up, the rest waits a frame
+constexpr unsigned int ASSET_LOADER_THREADS = 2;
+constexpr float ASSET_UPLOAD_BUDGET_MS = 2.0f;
+//what a texture samples as until its image is uploaded, neutral for what it is bound as
+constexpr unsigned char PLACEHOLDER_TEXEL_GREY[4] = { 128, 128, 128, 255 };
+constexpr unsigned char PLACEHOLDER_TEXEL_FLAT_NORMAL[4] = { 128, 128, 255, 255 };
+constexpr unsigned char PLACEHOLDER_TEXEL_BLACK[4] = { 0, 0, 0, 255 };
+constexpr unsigned char PLACEHOLDER_TEXEL_WHITE[4] = { 255, 255, 255, 255 };
+
 //directional light shadow frustum settings
 constexpr float D_FRUSTUM_SIZE = 10.0f;
 constexpr float D_NEAR_PLANE = 1.0f;
 constexpr float D_FAR_PLANE = 10.5f;
 
-//amount off passes of gaussian blur in bloom
-constexpr unsigned int BLUR_PASSES = 5;
+//bloom mip chain levels (mip 0 is half res, each level halves again)
+constexpr unsigned int BLOOM_MIP_COUNT = 6;
 
 //sphere vertex generation
 constexpr unsigned int SPHERE_X_SEGMENTS = 64;
@@ -130,5 +332,7 @@ constexpr unsigned int SPHERE_Y_SEGMENTS = 64;
 
 //LOD
 constexpr unsigned int MINIMUM_VERTEX_COUNT_FOR_LOD = 100;
+constexpr float MODEL_LOD_TRIANGLE_RATIO = 0.35f;   //ModelMesh::SimplifyLOD arguments for every imported mesh, part of the mesh cache key
+constexpr float MODEL_LOD_TARGET_ERROR = 0.03f;
 
 constexpr bool FRUSTUM_CULLING = true;
\ No newline at end of file
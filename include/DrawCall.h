@@ -19,6 +19,7 @@ public:
 	//Draw
 	void Render(Shader* shader, bool tempDontCull = false);
 	void RenderLOD(Shader* shader, bool tempDontCull = false);
+	void RenderPatches(Shader* shader, unsigned int first, unsigned int count); //terrain: other instances than this frame's (shadow grid), no culling
 
 	//For "fs1" lighting shader
 	void BindMaterialUniforms(Shader* shader);
@@ -31,6 +32,13 @@ public:
 
 	const char* GetHeightMapPath();
 	void SetHeightMapPath(const char* path);
+	void SetInstanceRange(unsigned int first, unsigned int count); //terrain: this frame's patches (TerrainQuadtree::Select)
+	const char* GetClipmapPath();
+	void SetClipmapPath(const char* path); //instances are the clipmap's blocks (ClipmapTerrain::Select)
+
+	const glm::mat4& GetModelMatrix() const;
+
+	bool HasAlpha() const;
 
 	//frustum culling
 	AABB GetWorldAABB() const;
@@ -49,6 +57,10 @@ private:
 
 	//for terrain
 	const char* heightMapPath;
+	const char* clipmapPath;
+	bool instanced;
+	unsigned int firstInstance;
+	unsigned int instanceCount;
 
 	//General flags
 	bool usingCulling;
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "Definitions.h"
+
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+//Asynchronous readback. Capture() copies into a persistently mapped pixel buffer and drops a fence, nothing waits.
+//Poll() (once a frame) hands buffers whose fence has signaled to the worker thread, which runs the callback
+//straight from the mapped memory and frees the slot. The frame never blocks on the GPU or on encoding.
+class FrameCapture
+{
+public:
+    FrameCapture();
+    ~FrameCapture(); //finishes in flight captures, then stops the worker
+
+    void Request(CaptureSource source, FrameCaptureCallback callback);
+    bool HasPending(CaptureSource source) const;
+
+    //issue the copy for every pending request of that source. texture 0 = read the bound read framebuffer
+    void Capture(CaptureSource source, unsigned int texture, unsigned int width, unsigned int height);
+    void Poll();
+
+private:
+    enum SlotState { SLOT_FREE, SLOT_IN_FLIGHT, SLOT_ENCODING };
+
+    struct Slot
+    {
+        unsigned int PBO;
+        void* mapped;
+        GLsync fence;
+        std::atomic<int> state;
+        CapturedFrame frame;
+        FrameCaptureCallback callback;
+    };
+
+    struct PendingRequest
+    {
+        CaptureSource source;
+        FrameCaptureCallback callback;
+    };
+
+    void SetupBuffers(); //first capture only, so never capturing costs no memory
+    void WorkerLoop();
+
+    Slot slots[CAPTURE_PBO_COUNT];
+    bool buffersCreated;
+    std::vector<PendingRequest> pending;
+
+    //worker
+    std::thread worker;
+    std::mutex jobMutex;
+    std::condition_variable jobCondition;
+    std::deque<Slot*> jobs;
+    bool stopping;
+};
+
+//encoders, safe to call from the capture callback
+namespace CaptureWriter
+{
+    bool WritePNG(const CapturedFrame& frame, const char* path); //CAPTURE_FINAL frames
+    bool WriteEXR(const CapturedFrame& frame, const char* path); //CAPTURE_HDR frames
+}
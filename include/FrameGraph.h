@@ -0,0 +1,94 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "Definitions.h"
+
+#include <vector>
+#include <functional>
+
+//Frame graph: the frame is rebuilt every frame as a list of passes that declare what they read and write.
+//Compile() drops passes nobody consumes and works out each transient texture's first/last use.
+//Execute() runs the surviving passes in the order they were added, hands transient textures out of a pool
+//right before their first use and takes them back after their last use (so later passes with the same desc
+//reuse the memory), and places glMemoryBarrier after compute writes only where something reads them.
+
+typedef unsigned int FGResource;
+
+enum FGPassType { FG_RASTER, FG_COMPUTE };
+
+struct FGTextureDesc
+{
+    unsigned int width, height;
+    GLenum internalFormat;
+    unsigned int levels = 1;
+    GLenum minFilter = GL_LINEAR;
+
+    bool operator==(const FGTextureDesc& o) const
+    {
+        return width == o.width && height == o.height && internalFormat == o.internalFormat &&
+               levels == o.levels && minFilter == o.minFilter;
+    }
+};
+
+class FrameGraph
+{
+public:
+    FrameGraph();
+    ~FrameGraph(); //frees the pool
+
+    //BUILD (every frame)
+    void Reset();
+    FGResource CreateTexture(const char* name, const FGTextureDesc& desc); //transient, only valid inside passes using it
+    FGResource ImportTexture(const char* name, unsigned int texture);      //owned elsewhere (gbuffer, histories...)
+    FGResource ImportBuffer(const char* name, unsigned int buffer);
+    //sideEffect passes are never culled (they write something outside the graph, e.g. the screen)
+    void AddPass(const char* name, FGPassType type, const std::vector<FGResource>& reads, const std::vector<FGResource>& writes,
+                 std::function<void()> execute, bool sideEffect = false);
+
+    //RUN
+    void Compile();
+    void Execute();
+
+    unsigned int GetTexture(FGResource resource) const; //GL handle, transients only inside their passes
+    FrameGraphStats GetStats() const; //of the last compiled frame, valid until the next Reset()
+
+private:
+    struct Resource
+    {
+        const char* name;
+        bool transient;
+        bool buffer;
+        FGTextureDesc desc;
+        unsigned int handle;
+        int firstPass, lastPass;    //-1 when no surviving pass uses it
+        GLbitfield pendingBarrier;  //set by compute writes, flushed before the next pass touching it
+    };
+
+    struct Pass
+    {
+        const char* name;
+        FGPassType type;
+        std::vector<FGResource> reads;
+        std::vector<FGResource> writes;
+        std::function<void()> execute;
+        bool sideEffect;
+        bool culled;
+    };
+
+    struct PooledTexture
+    {
+        FGTextureDesc desc;
+        unsigned int handle;
+        bool inUse;
+        unsigned int lastUsedFrame;
+    };
+
+    unsigned int AcquireTexture(const FGTextureDesc& desc);
+    void ReleaseTexture(unsigned int handle);
+    void TrimPool(); //frees textures no pass asked for in FG_POOL_IDLE_FRAMES (disabled features)
+
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+    std::vector<PooledTexture> pool;
+    unsigned int frameIndex;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glad/glad.h>
+
+class ComputeShader;
+
+enum GpuSortAlgorithm
+{
+    SORT_AUTO,      //bitonic up to GPU_SORT_BITONIC_MAX_KEYS, radix above
+    SORT_BITONIC,   //in place, O(n log^2 n), few dispatches: wins on small buffers
+    SORT_RADIX      //4 bits per pass (count, scan, stable scatter), O(n): wins on large buffers
+};
+
+//Sorts uint keys ascending on the GPU, each key dragging a uint value along (an index into whatever is being ordered:
+//particles, transparent draws...). The element count is read from a GPU buffer so it can come straight out of a
+//compute pass without a readback, maxCount is a cpu side upper bound that sizes the dispatches and the scratch.
+//Uses SSBO bindings 11-16. 0xFFFFFFFF is reserved (bitonic pads with it).
+class GpuSort
+{
+public:
+    //shaders are the renderer's (csSort* in shaderSources.h)
+    GpuSort(ComputeShader* bitonicLocalShader, ComputeShader* bitonicStepShader,
+            ComputeShader* radixCountShader, ComputeShader* radixScanShader, ComputeShader* radixScatterShader);
+    ~GpuSort();
+
+    //keyBuffer/valueBuffer hold at least maxCount uints, count = min(countBuffer[countIndex], maxCount) (uints).
+    //whatever wrote them must already be visible (GL_SHADER_STORAGE_BARRIER_BIT), the caller places the barrier after
+    //only the low keyBits bits take part (radix: one pass per 4 bits, rounded up to whole bytes)
+    void Sort(unsigned int keyBuffer, unsigned int valueBuffer, unsigned int countBuffer, unsigned int countIndex,
+              unsigned int maxCount, unsigned int keyBits = 32, GpuSortAlgorithm algorithm = SORT_AUTO);
+
+    //sorts random keys a few times and returns keys per second (gpu time only), checks the result once
+    double Benchmark(unsigned int keyCount, GpuSortAlgorithm algorithm, unsigned int iterations = 10);
+
+private:
+    void SortBitonic(unsigned int keyBuffer, unsigned int valueBuffer, unsigned int countIndex, unsigned int maxCount);
+    void SortRadix(unsigned int keyBuffer, unsigned int valueBuffer, unsigned int countIndex, unsigned int maxCount, unsigned int keyBits);
+    void EnsureScratch(unsigned int maxCount); //radix ping pong + histogram, grows only
+
+    ComputeShader* bitonicLocalShader;
+    ComputeShader* bitonicStepShader;
+    ComputeShader* radixCountShader;
+    ComputeShader* radixScanShader;
+    ComputeShader* radixScatterShader;
+
+    unsigned int scratchKeys;
+    unsigned int scratchValues;
+    unsigned int histogram;
+    unsigned int scratchCapacity;
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+#include "Definitions.h"
+
+//CPU copy of a terrain heightmap reduced to min/max mips (SetupTerrainBuffers keeps it after the pixels are freed).
+//Level 0 holds one min/max per TERRAIN_HEIGHT_CELL_SIZE x TERRAIN_HEIGHT_CELL_SIZE texels, every level above halves
+//that, so any rectangle is answered from at most 2x2 cells. Values are the raw 8 bit texels, 2 bytes per cell.
+//Model space like the terrain mesh: x/z in [-halfExtent, halfExtent], one texel per unit, heights as in tesTerrain.
+class HeightPyramid
+{
+public:
+    //pixels: the loaded heightmap, only the first channel is used
+    HeightPyramid(const unsigned char* pixels, int width, int height, int channels);
+
+    //min/max height tesTerrain can output over the model space rectangle [lo, hi] (x, z). min > max if it is off the map
+    glm::vec2 GetHeightRange(const glm::vec2& lo, const glm::vec2& hi) const;
+    AABB GetBounds() const;             //whole terrain, model space
+    glm::vec2 GetHalfExtent() const;
+    size_t GetMemoryUsage() const;      //bytes
+
+private:
+    struct Cell
+    {
+        uint8_t min;
+        uint8_t max;
+    };
+
+    struct Level
+    {
+        int width;
+        int height;
+        std::vector<Cell> cells;
+    };
+
+    int width;
+    int height;
+    std::vector<Level> levels;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+//Read only view of a whole file through the OS page cache. Nothing is read up front, pages come in when they are
+//first touched, so big files cost address space, not memory. Safe to read from any thread once open.
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const char* path); //false (and an error printed) if it can't be opened or is empty
+    void Close();
+
+    const uint8_t* GetData() const;
+    size_t GetSize() const;
+
+private:
+    const uint8_t* data;
+    size_t size;
+
+    //platform handles
+    void* fileHandle;
+    void* mappingHandle;
+    int fd;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Definitions.h"
+#include "MappedFile.h"
+
+//KMESH FILE (<source>.kmesh, written by Model after an import): header, one KMeshEntry per mesh, then the data. every
+//offset is in bytes from the start of the file and 16 byte aligned, vertices/indices are stored exactly as they are uploaded
+struct KMeshHeader
+{
+    char magic[4];          //"KMSH"
+    uint32_t version;
+    uint64_t sourceHash;    //the rest of the header is the cache key (MeshCacheKey)
+    uint32_t importFlags;
+    uint32_t vertexSize;
+    float lodRatio;
+    float lodError;
+    uint32_t meshCount;
+    uint32_t reserved;
+};
+
+struct KMeshRange
+{
+    uint64_t offset;
+    uint64_t count;         //elements
+};
+
+struct KMeshTextureRef      //strings are offset/length into the file, not terminated
+{
+    uint32_t typeOffset, typeLength;
+    uint32_t pathOffset, pathLength;
+};
+
+struct KMeshEntry
+{
+    KMeshRange vertices;
+    KMeshRange indices;     //uint32
+    KMeshRange lodVertices; //count 0 = no LOD
+    KMeshRange lodIndices;
+    KMeshRange textures;    //KMeshTextureRef
+    float aabbMin[3];
+    float aabbMax[3];
+};
+
+//what the cache was made from, any difference means it is stale
+struct MeshCacheKey
+{
+    uint64_t sourceHash;    //MeshCache::HashFile of the source
+    uint32_t importFlags;   //assimp post process flags
+    uint32_t vertexSize;    //sizeof(Vertex)
+    float lodRatio;         //ModelMesh::CreateLOD arguments
+    float lodError;
+};
+
+//one mesh to write, pointing into the caller's arrays
+struct MeshCacheMesh
+{
+    const void* vertices;
+    size_t vertexCount;
+    const unsigned int* indices;
+    size_t indexCount;
+    const void* lodVertices;
+    size_t lodVertexCount;
+    const unsigned int* lodIndices;
+    size_t lodIndexCount;
+    std::vector<std::pair<std::string, std::string>> textures; //type, path
+    AABB aabb;
+};
+
+//Binary cache of an imported model, so repeat loads skip assimp and the LOD simplification. The cache stays memory mapped
+//while it is read, the ranges go to glBufferData straight from the mapping.
+class MeshCache
+{
+public:
+    static uint64_t HashFile(const char* path); //FNV-1a of the contents, 0 if it can't be read
+    static std::string GetCachePath(const std::string& sourcePath);
+    static bool Write(const std::string& sourcePath, const MeshCacheKey& key, const std::vector<MeshCacheMesh>& meshes);
+
+    MeshCache();
+
+    bool Open(const std::string& sourcePath, const MeshCacheKey& key); //false if there is no cache or it doesn't match key
+    void Close();
+
+    unsigned int GetMeshCount() const;
+    const KMeshEntry& GetMesh(unsigned int index) const;
+    const void* GetRange(const KMeshRange& range) const; //into the mapping, valid until Close
+    std::string GetString(uint32_t offset, uint32_t length) const;
+
+private:
+    bool IsInside(uint64_t offset, uint64_t count, uint64_t elementSize) const;
+
+    MappedFile file;
+    const KMeshHeader* header;
+    const KMeshEntry* entries;
+};
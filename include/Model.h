@@ -1,15 +1,16 @@
 #pragma once
 
-#include <glad/glad.h> 
+#include <glad/glad.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#include <stb_image.h>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
 #include "ModelMesh.h"
+#include "MeshCache.h"
+#include "Setup.h"
 #include "Shader.h"
 
 #include <string>
@@ -19,62 +20,202 @@
 #include <map>
 #include <vector>
 using namespace std;
-    
-inline unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false);
+
+constexpr unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
 
 class Model
 {
 public:
-    // model data 
+    // model data
     vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<ModelMesh>    meshes;
     string directory;
     bool gammaCorrection;
 
-    // constructor, expects a filepath to a 3D model.
-    Model(string const& path, bool gamma = false) : gammaCorrection(gamma)
+    // constructor, expects a filepath to a 3D model. imports and uploads right away
+    Model(string const& path, bool gamma = false, bool flipTextures = false) : gammaCorrection(gamma), loaded(false)
     {
-        loadModel(path);
+        Import(path, flipTextures);
+        while (UploadNext()) {}
     }
 
-    std::vector<ModelMesh> GetMeshes() const
+    // empty until Import() and UploadNext() have run, so the import can happen on a loader thread (AssetLoader)
+    Model() : gammaCorrection(false), loaded(false)
     {
-        return this->meshes;
     }
 
-private:
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const& path)
+    // everything before GL: the mesh cache or assimp, LOD simplification, texture decoding. no GL calls, any thread
+    void Import(string const& path, bool flipTextures)
     {
-        // read file via ASSIMP
-        Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-        // check for errors
-        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
-        {
-            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
-        }
         // retrieve the directory path of the filepath
         directory = path.substr(0, path.find_last_of('/'));
 
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        // a matching .kmesh next to the source skips assimp and the LOD simplification
+        MeshCacheKey key = { MeshCache::HashFile(path.c_str()), MODEL_IMPORT_FLAGS, sizeof(Vertex), MODEL_LOD_TRIANGLE_RATIO, MODEL_LOD_TARGET_ERROR };
+        if (key.sourceHash != 0 && cache.Open(path, key))
+        {
+            for (unsigned int i = 0; i < cache.GetMeshCount(); i++)
+            {
+                const KMeshEntry& e = cache.GetMesh(i);
+
+                PendingMesh mesh;
+                mesh.cached = &e;
+                const KMeshTextureRef* refs = (const KMeshTextureRef*)cache.GetRange(e.textures);
+                for (uint64_t t = 0; t < e.textures.count; t++)
+                {
+                    requestTexture(mesh, cache.GetString(refs[t].typeOffset, refs[t].typeLength), cache.GetString(refs[t].pathOffset, refs[t].pathLength));
+                }
+                mesh.aabb.min = Vec3(e.aabbMin[0], e.aabbMin[1], e.aabbMin[2]);
+                mesh.aabb.max = Vec3(e.aabbMax[0], e.aabbMax[1], e.aabbMax[2]);
+                pendingMeshes.push_back(std::move(mesh));
+            }
+        }
+        else
+        {
+            // read file via ASSIMP
+            Assimp::Importer importer;
+            const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
+            // check for errors
+            if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+            {
+                cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+                return;
+            }
+
+            // process ASSIMP's root node recursively
+            processNode(scene->mRootNode, scene);
+
+            if (key.sourceHash != 0) writeCache(path, key);
+        }
+
+        // decode every texture once, they are uploaded before the meshes that use them
+        for (PendingTexture& texture : pendingTextures)
+        {
+            texture.image = TextureSetup::DecodeImage((directory + '/' + texture.path).c_str(), flipTextures);
+        }
+    }
+
+    // GL thread: uploads one pending texture or mesh per call, returns false once everything is uploaded (IsLoaded)
+    bool UploadNext()
+    {
+        if (loaded) return false;
+
+        if (nextTexture < pendingTextures.size())
+        {
+            PendingTexture& pending = pendingTextures[nextTexture++];
+            Texture texture;
+            glGenTextures(1, &texture.id);
+            TextureSetup::UploadImage(texture.id, pending.image);
+            texture.type = pending.type;
+            texture.path = pending.path;
+            textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
+            pending.image = TextureSetup::DecodedImage();
+            return true;
+        }
+
+        if (nextMesh < pendingMeshes.size())
+        {
+            PendingMesh& pending = pendingMeshes[nextMesh++];
+
+            // a path used by several material slots keeps the type it was first loaded as
+            vector<Texture> textures;
+            for (const pair<string, string>& t : pending.textures)
+            {
+                for (const Texture& loadedTexture : textures_loaded)
+                {
+                    if (loadedTexture.path == t.second)
+                    {
+                        textures.push_back(loadedTexture);
+                        break;
+                    }
+                }
+            }
+
+            // no cpu copy is kept, from the cache the data goes straight from the mapping
+            if (pending.cached)
+            {
+                const KMeshEntry& e = *pending.cached;
+                ModelMesh modelMesh((const Vertex*)cache.GetRange(e.vertices), (size_t)e.vertices.count,
+                                    (const unsigned int*)cache.GetRange(e.indices), (size_t)e.indices.count, textures, pending.aabb);
+                if (e.lodIndices.count != 0)
+                {
+                    modelMesh.SetLOD((const Vertex*)cache.GetRange(e.lodVertices), (size_t)e.lodVertices.count,
+                                     (const unsigned int*)cache.GetRange(e.lodIndices), (size_t)e.lodIndices.count);
+                }
+                meshes.push_back(modelMesh);
+            }
+            else
+            {
+                ModelMesh modelMesh(pending.vertices.data(), pending.vertices.size(), pending.indices.data(), pending.indices.size(), textures, pending.aabb);
+                if (!pending.lodIndices.empty())
+                {
+                    modelMesh.SetLOD(pending.lodVertices.data(), pending.lodVertices.size(), pending.lodIndices.data(), pending.lodIndices.size());
+                }
+                meshes.push_back(modelMesh);
+                pending = PendingMesh();
+            }
+            return true;
+        }
+
+        // done, drop what was only kept for the upload
+        cache.Close();
+        vector<PendingMesh>().swap(pendingMeshes);
+        vector<PendingTexture>().swap(pendingTextures);
+        loaded = true;
+        return false;
     }
 
+    bool IsLoaded() const
+    {
+        return this->loaded;
+    }
+
+    std::vector<ModelMesh> GetMeshes() const
+    {
+        return this->meshes;
+    }
+
+private:
+    // a mesh between Import() and UploadNext()
+    struct PendingMesh
+    {
+        vector<Vertex> vertices;
+        vector<unsigned int> indices;
+        vector<Vertex> lodVertices;         // empty if the mesh is too small for a LOD
+        vector<unsigned int> lodIndices;
+        const KMeshEntry* cached = nullptr; // read from the mesh cache instead, the vectors stay empty
+        vector<pair<string, string>> textures; // type, path
+        AABB aabb;
+    };
+
+    struct PendingTexture
+    {
+        string type;
+        string path;
+        TextureSetup::DecodedImage image;
+    };
+
+    vector<PendingMesh> pendingMeshes;
+    vector<PendingTexture> pendingTextures; // one per path
+    size_t nextMesh = 0;
+    size_t nextTexture = 0;
+    MeshCache cache;                        // stays mapped until the cached meshes are uploaded
+    bool loaded;
+
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
     void processNode(aiNode* node, const aiScene* scene)
     {
         // process each mesh located at the current node
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
         {
-            // the node object only contains indices to index the actual objects in the scene. 
+            // the node object only contains indices to index the actual objects in the scene.
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            ModelMesh modelMesh = processMesh(mesh, scene);
-            modelMesh.CreateLOD(0.35f, 0.03f, 0);
-            meshes.push_back(modelMesh);
-                    
+            PendingMesh pending = processMesh(mesh, scene);
+            ModelMesh::SimplifyLOD(pending.vertices, pending.indices, MODEL_LOD_TRIANGLE_RATIO, MODEL_LOD_TARGET_ERROR, 0, pending.lodVertices, pending.lodIndices);
+            pending.aabb = ModelMesh::ComputeAABB(pending.vertices);
+            pendingMeshes.push_back(std::move(pending));
+
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for (unsigned int i = 0; i < node->mNumChildren; i++)
@@ -84,13 +225,13 @@ private:
 
     }
 
-    ModelMesh processMesh(aiMesh* mesh, const aiScene* scene)
+    PendingMesh processMesh(aiMesh* mesh, const aiScene* scene)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
-                            
+        PendingMesh result;
+        vector<Vertex>& vertices = result.vertices;
+        vector<unsigned int>& indices = result.indices;
+
         // walk through each of the mesh's vertices
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
@@ -113,7 +254,7 @@ private:
             if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
             {
                 glm::vec2 vec;
-                // a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't 
+                // a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't
                 // use models where a vertex can have multiple texture coordinates so we always take the first set (0).
                 vec.x = mesh->mTextureCoords[0][i].x;
                 vec.y = mesh->mTextureCoords[0][i].y;
@@ -145,60 +286,70 @@ private:
         // process materials
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
-        // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
+        // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER.
         // Same applies to other texture as the following list summarizes:
         // diffuse: texture_diffuseN
         // specular: texture_specularN
         // normal: texture_normalN
-        
+
         // 1. diffuse maps
-        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+        loadMaterialTextures(result, material, aiTextureType_DIFFUSE, "texture_diffuse");
         // 2. specular maps
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        loadMaterialTextures(result, material, aiTextureType_SPECULAR, "texture_specular");
         // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+        loadMaterialTextures(result, material, aiTextureType_HEIGHT, "texture_normal");
         // 4. height maps
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-        textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+        loadMaterialTextures(result, material, aiTextureType_AMBIENT, "texture_height");
 
-        // return a mesh object created from the extracted mesh data
-        return ModelMesh(vertices, indices, textures);
+        // return the mesh data, uploaded later by UploadNext()
+        return result;
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
+    // checks all material textures of a given type and requests the textures that aren't requested yet.
+    void loadMaterialTextures(PendingMesh& mesh, aiMaterial* mat, aiTextureType type, string typeName)
     {
-        vector<Texture> textures;
         for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for (unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if (!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
-            }
+            requestTexture(mesh, typeName, str.C_Str());
+        }
+    }
+
+    void requestTexture(PendingMesh& mesh, string const& typeName, string const& path)
+    {
+        mesh.textures.push_back({ typeName, path });
+
+        // check if texture was requested before and if so, skip decoding it again (optimization)
+        for (const PendingTexture& texture : pendingTextures)
+        {
+            if (texture.path == path) return;
         }
-        return textures;
+        PendingTexture texture;
+        texture.type = typeName;
+        texture.path = path;
+        pendingTextures.push_back(std::move(texture));
+    }
+
+    void writeCache(string const& path, const MeshCacheKey& key)
+    {
+        vector<MeshCacheMesh> cacheMeshes;
+        for (const PendingMesh& mesh : pendingMeshes)
+        {
+            MeshCacheMesh m;
+            m.vertices = mesh.vertices.data();
+            m.vertexCount = mesh.vertices.size();
+            m.indices = mesh.indices.data();
+            m.indexCount = mesh.indices.size();
+            m.lodVertices = mesh.lodVertices.data();
+            m.lodVertexCount = mesh.lodVertices.size();
+            m.lodIndices = mesh.lodIndices.data();
+            m.lodIndexCount = mesh.lodIndices.size();
+            m.textures = mesh.textures;
+            m.aabb = mesh.aabb;
+            cacheMeshes.push_back(m);
+        }
+        MeshCache::Write(path, key, cacheMeshes);
     }
 
     //REMOVE THIS, WE WORK ON INDIVIDUAL MESHES ONLY
@@ -222,46 +373,6 @@ private:
     */
 };
 
-unsigned int TextureFromFile(const char* path, const string& directory, bool gamma)
-{
-    string filename = string(path);
-    filename = directory + '/' + filename;
-
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
-}
-
 
 // draws the model, and thus all its meshes
 //REMOVE THIS
@@ -46,6 +46,7 @@ public:
     vector<unsigned int> indices;
     vector<Texture>      textures;
     unsigned int VAO;
+    unsigned int indexCount;
     AABB aabb;
     std::optional<MeshData> lodMeshData;
 
@@ -55,11 +56,22 @@ public:
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->indexCount = static_cast<unsigned int>(this->indices.size());
 
         this->calculateAABB();
             
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
+    }
+
+    // from data Model prepared off the GL thread (or the mesh cache's mapping): no cpu copy is kept (vertices/indices stay empty)
+    ModelMesh(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount, vector<Texture> textures, const AABB& aabb)
+    {
+        this->textures = textures;
+        this->indexCount = static_cast<unsigned int>(indexCount);
+        this->aabb = aabb;
+
+        setupMesh(vertices, vertexCount, indices, indexCount);
     }
 
     Material GetMaterial()
@@ -104,7 +116,7 @@ public:
         MeshData m = MeshData();
 
         m.VAO = this->VAO;
-        m.indexCount = static_cast<unsigned int>(this->indices.size());
+        m.indexCount = this->indexCount;
         m.aabb = this->aabb;
 
         return m;
@@ -112,121 +124,112 @@ public:
 
     void CreateLOD(float triangleRatio, float targetError, unsigned int options)
     {
-        if (this->lodMeshData.has_value())
+        if (this->lodMeshData.has_value()) return;
+
+        vector<Vertex> lodVertices;
+        vector<unsigned int> lodIndices;
+        if (SimplifyLOD(this->vertices, this->indices, triangleRatio, targetError, options, lodVertices, lodIndices))
         {
-            return;
+            this->SetLOD(lodVertices.data(), lodVertices.size(), lodIndices.data(), lodIndices.size());
         }
-        else
-        {
-            if (this->vertices.size() <= MINIMUM_VERTEX_COUNT_FOR_LOD || triangleRatio >= 1.f)
-            {
-                //std::cout << "too little vertices or ratio > 1.\n";
-                return;
-            }
-            
-            //SIMPLIFY INDEX BUFFER---------------------------------------------------------
-            const size_t ic = this->indices.size();
-            const size_t vc = this->vertices.size();
-
-            const size_t targetIndexCount = std::max<size_t>(3, static_cast<size_t>(ic * triangleRatio) / 3 * 3);
-
-            //std::cout << "Target index count: " << targetIndexCount;
-
-            std::vector<unsigned int> lodIndices(ic); //worst case size is og size
-            /*
-            size_t written = meshopt_simplify( //return size of new indices
-                lodIndices.data(),
-                this->indices.data(),
-                ic,
-                &this->vertices[0].Position.x, //expects float* not Vertex* ()
-                vc,
-                sizeof(Vertex),
-                targetIndexCount,
-                targetError,
-                options,
-                nullptr
-                );
-            */
-
-            size_t written = meshopt_simplifySloppy( // Use the sloppy version
-                lodIndices.data(),
-                this->indices.data(),
-                ic,
-                &this->vertices[0].Position.x,
-                vc,
-                sizeof(Vertex),
-                targetIndexCount, // Target index count (error is ignored)
-                targetError, // This parameter is not used by sloppy version
-                nullptr // result error pointer (optional, maybe useful?)
-            );
+    }
 
-            lodIndices.resize(written);
-            lodIndices.shrink_to_fit();
-
-            //REMAP/SHIRNK VERTEX BUFFER---------------------------------------------------------
-            std::vector<unsigned int> remap(vc); //remap[oldVertexID] = newVertexID
-            size_t lodVertexCount = meshopt_generateVertexRemap(
-                remap.data(),
-                lodIndices.data(),
-                written,
-                this->vertices.data(), //Vertex is correct because we supply the stride
-                vc,
-                sizeof(Vertex)         
+    //cpu half of CreateLOD, no GL: safe on a loader thread. false if the mesh is too small to bother
+    static bool SimplifyLOD(const vector<Vertex>& vertices, const vector<unsigned int>& indices, float triangleRatio, float targetError,
+                            unsigned int options, vector<Vertex>& lodVertices, vector<unsigned int>& lodIndices)
+    {
+        if (vertices.size() <= MINIMUM_VERTEX_COUNT_FOR_LOD || triangleRatio >= 1.f)
+        {
+            //std::cout << "too little vertices or ratio > 1.\n";
+            return false;
+        }
+        
+        //SIMPLIFY INDEX BUFFER---------------------------------------------------------
+        const size_t ic = indices.size();
+        const size_t vc = vertices.size();
+
+        const size_t targetIndexCount = std::max<size_t>(3, static_cast<size_t>(ic * triangleRatio) / 3 * 3);
+
+        //std::cout << "Target index count: " << targetIndexCount;
+
+        lodIndices.resize(ic); //worst case size is og size
+        /*
+        size_t written = meshopt_simplify( //return size of new indices
+            lodIndices.data(),
+            this->indices.data(),
+            ic,
+            &this->vertices[0].Position.x, //expects float* not Vertex* ()
+            vc,
+            sizeof(Vertex),
+            targetIndexCount,
+            targetError,
+            options,
+            nullptr
             );
+        */
+
+        size_t written = meshopt_simplifySloppy( // Use the sloppy version
+            lodIndices.data(),
+            indices.data(),
+            ic,
+            &vertices[0].Position.x,
+            vc,
+            sizeof(Vertex),
+            targetIndexCount, // Target index count (error is ignored)
+            targetError, // This parameter is not used by sloppy version
+            nullptr // result error pointer (optional, maybe useful?)
+        );
+
+        lodIndices.resize(written);
+        lodIndices.shrink_to_fit();
+
+        //REMAP/SHIRNK VERTEX BUFFER---------------------------------------------------------
+        std::vector<unsigned int> remap(vc); //remap[oldVertexID] = newVertexID
+        size_t lodVertexCount = meshopt_generateVertexRemap(
+            remap.data(),
+            lodIndices.data(),
+            written,
+            vertices.data(), //Vertex is correct because we supply the stride
+            vc,
+            sizeof(Vertex)         
+        );
+
+        lodVertices.resize(lodVertexCount);
+        meshopt_remapVertexBuffer(lodVertices.data(), vertices.data(), vc,
+            sizeof(Vertex), remap.data());
+        meshopt_remapIndexBuffer(lodIndices.data(), lodIndices.data(), written,
+            remap.data());
+
+       // std::cout << "SUCCESS: old indexCount: " << ic << " New indexCount: " << lodIndices.size() << '\n';
+        return true;
+    }
 
-            std::vector<Vertex> lodVertices(lodVertexCount); 
-            meshopt_remapVertexBuffer(lodVertices.data(), vertices.data(), vc,
-                sizeof(Vertex), remap.data());
-            meshopt_remapIndexBuffer(lodIndices.data(), lodIndices.data(), written,
-                remap.data());
-
-            //BUILD--------------------
-            unsigned int lodVAO, lodVBO, lodEBO;
-            glGenVertexArrays(1, &lodVAO);
-            glGenBuffers(1, &lodVBO);
-            glGenBuffers(1, &lodEBO);
-
-            glBindVertexArray(lodVAO);
-
-            glBindBuffer(GL_ARRAY_BUFFER, lodVBO);
-            glBufferData(GL_ARRAY_BUFFER, lodVertices.size() * sizeof(Vertex), lodVertices.data(), GL_STATIC_DRAW);
-
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lodEBO);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, lodIndices.size() * sizeof(unsigned int), lodIndices.data(), GL_STATIC_DRAW);
-            
-            glEnableVertexAttribArray(0); //pos
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-
-            glEnableVertexAttribArray(1); //norm
-            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-
-            glEnableVertexAttribArray(2); //tex
-            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-
-            glEnableVertexAttribArray(3); //tan
-            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+    //uploads a simplified version (CreateLOD, or the mesh cache straight from its mapping)
+    void SetLOD(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount)
+    {
+        unsigned int lodVAO, lodVBO, lodEBO;
+        glGenVertexArrays(1, &lodVAO);
+        glGenBuffers(1, &lodVBO);
+        glGenBuffers(1, &lodEBO);
 
-            glEnableVertexAttribArray(4); //btan
-            glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        glBindVertexArray(lodVAO);
 
-            glEnableVertexAttribArray(5);
-            glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
+        glBindBuffer(GL_ARRAY_BUFFER, lodVBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
 
-            glEnableVertexAttribArray(6);
-            glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lodEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indices, GL_STATIC_DRAW);
 
-            glBindVertexArray(0);
+        setupAttributes();
+        glBindVertexArray(0);
 
-            //CREATE MESHDATA----------------
-            MeshData m = MeshData();
-            m.VAO = lodVAO;
-            m.indexCount = static_cast<unsigned int>(lodIndices.size());
-            m.aabb = this->aabb;
-            
-           // std::cout << "SUCCESS: old indexCount: " << ic << " New indexCount: " << m.indexCount << '\n';
+        //CREATE MESHDATA----------------
+        MeshData m = MeshData();
+        m.VAO = lodVAO;
+        m.indexCount = static_cast<unsigned int>(indexCount);
+        m.aabb = this->aabb;
 
-            this->lodMeshData = m;
-        }
+        this->lodMeshData = m;
     }
 
 private:
@@ -237,7 +240,7 @@ private:
     unsigned int VBO, EBO;
 
     // initializes all the buffer objects/arrays
-    void setupMesh()
+    void setupMesh(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount)
     {
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
@@ -248,12 +251,19 @@ private:
 
         // load data into vertex buffers
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
 
         //index buffer
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indices, GL_STATIC_DRAW);
 
+        setupAttributes();
+        glBindVertexArray(0);
+    }
+
+    // vertex layout of the bound VAO, the bound GL_ARRAY_BUFFER holds Vertex structs
+    static void setupAttributes()
+    {
         // set the vertex attribute pointers
         // vertex Positions
         glEnableVertexAttribArray(0);
@@ -277,16 +287,22 @@ private:
         // weights
         glEnableVertexAttribArray(6);
         glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-        glBindVertexArray(0);
     }
 
     void calculateAABB()
     {
-        if (this->vertices.empty())
+        this->aabb = ComputeAABB(this->vertices);
+    }
+
+public:
+    static AABB ComputeAABB(const vector<Vertex>& vertices)
+    {
+        AABB aabb;
+        if (vertices.empty())
         {
             aabb.min = Vec3(0.0f, 0.0f, 0.0f);
             aabb.max = Vec3(0.0f, 0.0f, 0.0f);
-            return;
+            return aabb;
         }
 
         const glm::vec3& firstPos = vertices[0].Position;
@@ -299,6 +315,7 @@ private:
             Vec3 currentPos = Vec3(currentPosGLM.x, currentPosGLM.y, currentPosGLM.z);
             aabb.expand(currentPos); 
         }
+        return aabb;
     }
 };
 
@@ -2,33 +2,38 @@
 
 #include <glm/glm.hpp>
 
-#include "helpers.h"
-
-class Shader;
-class ComputeShader;
+#include "Definitions.h"
 
+//CPU side record only, the particles live in the ParticleSystem pool.
+//while emitting it asks for particleCount / maxLife spawns per second, so about particleCount are alive at once.
 class ParticleEmitter
 {
 public:
-	ParticleEmitter(glm::mat4 model, unsigned int particleCount, double time);
-	~ParticleEmitter();
+	ParticleEmitter(glm::mat4 model, unsigned int particleCount, double time, const ParticlePhysics& physics, unsigned int slot);
+
+	float Step(float dt, bool visible);                  //dt to simulate this frame, 0 = skipped (off screen, see PARTICLE_OFFSCREEN_UPDATE_INTERVAL)
+	unsigned int RequestSpawns(float dt, float lod);    //advances the emitter, returns how many particles to spawn this frame
 
-	void Update(ComputeShader* particleShader, float dt);
-	void Render(Shader* shader);
+	bool DoneEmitting() const;
 
-	bool DoneEmitting();
+	AABB GetWorldBounds() const; //everywhere a particle can get to in its lifetime
+	const glm::mat4& GetModel() const;
+	unsigned int GetParticleCount() const;
+	unsigned int GetSlot() const;
+	const ParticlePhysics& GetPhysics() const;
+	float GetMaxLife() const;
+	float GetSpeed() const;
 private:
 	glm::mat4 model;
 	unsigned int particleCount;
-	unsigned int ssbo;
-	unsigned int vao;
+	unsigned int slot;      //gpu state index, stays the same for the emitter's whole life
 	double timeLeft;
 
 	float maxLife;
+	float speed;
+	float spawnAccumulator; //fraction of a spawn carried to the next frame
+	ParticlePhysics physics;
 
-	struct Particle
-	{
-		glm::vec4 positionLife;		  //16
-		glm::vec4 velocityActive;     //16 = 32
-	};
-};
\ No newline at end of file
+	float pendingDt;        //time not simulated yet while skipping frames
+	unsigned int skippedFrames;
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+#include "ParticleEmitter.h"
+
+class Shader;
+class ComputeShader;
+class GpuSort;
+
+//One preallocated pool of MAX_PARTICLES for every emitter. Which particles are alive/free is tracked on the GPU:
+//emission pops indices off the dead list (or takes never used ones), simulation moves survivors into the other alive
+//list and pushes the rest back onto the dead list. Adding/removing an emitter never touches GL.
+//The alive list is then sorted far to near by GpuSort so the blended draw comes out in order.
+//Emitters are culled by their bounds: particles of hidden emitters are kept at the back of the alive list, so drawing
+//and sorting only touch visible ones, and hidden emitters step at a lower rate. Distant ones spawn fewer particles.
+class ParticleSystem
+{
+public:
+    ParticleSystem();
+    ~ParticleSystem();
+
+    void AddEmitter(const glm::mat4& model, unsigned int particleCount, double duration, const ParticlePhysics& physics);
+    void RemoveFinishedEmitters();
+    size_t GetEmitterCount() const;
+    bool HasCollidingEmitters() const; //whether the gbuffer is needed
+
+    //collisions: the gbuffer (depth + normal) is bound to units 0/1 and current
+    void Simulate(ComputeShader* emitShader, ComputeShader* simulateShader, ComputeShader* finishShader, GpuSort* sorter,
+                  const std::function<bool(const AABB&)>& isVisible, const glm::vec3& cameraPos, bool collisions, float dt);
+    void Render(Shader* shader);
+
+    unsigned int GetParticleBuffer() const; //for the frame graph
+
+private:
+    struct Particle
+    {
+        glm::vec4 positionLife;     //16
+        glm::vec4 velocity;         //16 = 32
+    };
+
+    //std430, matches SpawnRequest in csParticleEmit
+    struct SpawnRequestGPU
+    {
+        glm::mat4 model;
+        float maxLife;
+        float speed;
+        uint32_t count;
+        uint32_t offset;            //first emission thread of this request
+        uint32_t emitter;           //slot
+        uint32_t pad[3];
+    };
+
+    //std430, matches EmitterState in csParticle
+    struct EmitterStateGPU
+    {
+        float dt;
+        uint32_t visible;
+        float gravity;
+        float drag;
+        float restitution;
+        uint32_t collisions;
+    };
+
+    std::vector<ParticleEmitter> emitters;
+    std::vector<SpawnRequestGPU> spawnRequests; //rebuilt every frame, capacity kept
+    std::vector<EmitterStateGPU> emitterStates; //by slot
+    std::vector<unsigned int> freeSlots;
+    unsigned int slotCount;                     //slots handed out so far (high water mark)
+
+    unsigned int particleSSBO;
+    unsigned int aliveListSSBO[2];  //[0] is read this frame, simulation writes [1], then they swap
+    unsigned int deadListSSBO;
+    unsigned int counterSSBO;       //ParticleCounters in the shaders, also the indirect dispatch/draw args
+    unsigned int spawnSSBO;
+    unsigned int sortKeySSBO;       //camera distance key per alive list slot
+    unsigned int emitterStateSSBO;
+    unsigned int emptyVAO;          //vertex shader fetches from the SSBOs
+
+    unsigned int frameSeed;
+
+    //sort bound: alive now <= an alive count the gpu copied back + every spawn requested since that copy
+    unsigned int countReadbackBuffer;                       //persistently mapped, one aliveCount per copy
+    const uint32_t* countReadback;
+    GLsync countFences[PARTICLE_COUNT_READBACKS];           //0 = slot free
+    uint64_t countSpawnTotals[PARTICLE_COUNT_READBACKS];    //spawnTotal when the slot was copied
+    unsigned int countReadbackIndex;
+    uint64_t spawnTotal;                                    //spawns requested so far
+    int64_t aliveMinusSpawns;                               //newest copied aliveCount - spawnTotal at its copy, 0 at the start
+};
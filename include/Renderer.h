@@ -4,6 +4,7 @@
 #include "Definitions.h"
 #include <glm/gtc/matrix_transform.hpp>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
 class Shader;
@@ -11,7 +12,12 @@ class ComputeShader;
 class DrawCall;
 class Camera;
 class Model;
-class ParticleEmitter;
+class ParticleSystem;
+class FrameGraph;
+class FrameCapture;
+class GpuSort;
+class ClipmapTerrain;
+class AssetLoader;
 
 class Renderer
 {
@@ -47,10 +53,15 @@ public:
     void DrawSphere(Vec3 pos, Vec3 size, Vec4 rotation);
     void DrawModel(const char* path, bool flipTexture, Vec3 pos, Vec3 size, Vec4 rotation);
     void DrawTerrain(const char* path, Vec3 pos, Vec3 size, Vec4 rotation);
-    void CreateParticleEmitter(double duration, unsigned int count, Vec3 pos, Vec3 size, Vec4 rotation);
+    void DrawClipmapTerrain(const char* path, Vec3 pos, Vec3 size, Vec4 rotation); //path: tiled file (ClipmapTerrain::ConvertHeightmap)
+    void CreateParticleEmitter(double duration, unsigned int count, Vec3 pos, Vec3 size, Vec4 rotation, const ParticlePhysics& physics = ParticlePhysics());
 
     //Lighting
     void AddPointLightToFrame(Vec3 pos, Vec3 col, float range, float intensity, bool shadow);
+    void AddPointLightsToFrame(const PointLightDesc* lights, size_t count);
+    PointLightHandle CreatePersistentPointLight(const PointLightDesc& light);
+    void UpdatePersistentPointLight(PointLightHandle handle, const PointLightDesc& light);
+    void DestroyPersistentPointLight(PointLightHandle handle);
     void AddDirLightToFrame(Vec3 dir, Vec3 col, float intensity, bool shadow);
     bool drawDebugLights;
 
@@ -74,6 +85,22 @@ public:
     void SetLinearFogStart(float start);
     void SetAmbientLighting(float ambient);
     void SetBloomThreshold(float threshold);
+    void SetDepthPrepass(bool on);
+    void SetSSAO(bool on);
+    void SetTerrainMeshMode(bool on); //DrawTerrain as a compute built mesh (TerrainMesh) instead of hardware tessellation
+    void SetAsyncLoading(bool on); //off: assets load on the render thread the first time they are used, stalling that frame
+    bool IsLoadingAssets();
+    void SetPostProcessSettings(const PostProcessSettings& settings);
+    void SetAntiAliasing(AAMode mode);
+    void SetRenderScale(float scale); //fixed internal resolution, turns dynamic resolution off
+    void SetDynamicResolution(bool on, float frameTimeBudgetMs = DEFAULT_FRAME_TIME_BUDGET_MS, float minScale = MIN_RENDER_SCALE);
+
+    //Capture: callback runs on the capture worker thread a few frames later (see CaptureWriter for png/exr)
+    void RequestFrameCapture(FrameCaptureCallback callback, CaptureSource source = CAPTURE_FINAL);
+
+    //prints keys/s of both GpuSort algorithms over a range of sizes (stalls, call outside of a frame)
+    void BenchmarkGpuSort();
+    FrameGraphStats GetFrameGraphStats() const; //last rendered frame
 
 private:
     //CONSTRUCTOR 
@@ -81,36 +108,54 @@ private:
     void InitializeDirLight();
     void SetupVertexBuffers();
     void SetupFramebuffers();
+    void SetupAntiAliasingTargets();  //only what the current mode uses
+    void DeleteAntiAliasingTargets();
+    unsigned int GetMSAASamples();    //0 when the mode isn't MSAA
     void SetupSSAOData();
     void SetupEnvironmentCubeMap();
     void SetupIBLMaps();
 
     //RENDER PASSES
+    void BuildFrameGraph(); //declares this frame's passes, see EndRenderFrame()
     void RenderShadowMaps();
-    void RenderSSAO();
+    void RenderGBuffer();
+    void RenderSSAO(unsigned int rawTexture, unsigned int resultTexture);
     void RenderMainScene();
     void DrawLightsDebug();
     void DrawSkybox();
-    void BlurBrightScene();
-    void DrawFinalQuad();
+    void UpdateDynamicResolution();   //reads the gpu timer, picks this frame's renderScale
+    void ApplyRenderScale(float scale);
+    void ResolveTAA();
+    void BlurBrightScene(unsigned int bloomTexture, unsigned int upsampleTexture);
+    void PostProcess(unsigned int bloomTexture, unsigned int outputTexture);
+    void DrawFinalQuad(unsigned int outputTexture); //post output -> screen
+    void SimulateParticles(bool collisions); //collisions: the gbuffer was rendered this frame
+    void SelectTerrainPatches();            //before any pass, every pass then draws the same patches (shadow maps: the shadow grid)
+    void SendTerrainExtent(Shader* shader, const char* path);
+    void RenderTerrainShadow(DrawCall* d, Shader* shader); //shadow grid, shader's light uniforms already set
     void CleanUpParticles();
+    void UploadPointLights();
     void DoTileCulling();
 
     //SHADER OBJECTS
     Shader* lightingShader; 
     Shader* debugLightShader;
-    Shader* screenShader;
-    Shader* brightShader; //takes in a hdr scene and extracts the bright parts.
     Shader* dirShadowShader;
     Shader* cascadeShadowShader;
     Shader* pointShadowShader;
+    Shader* terrainCascadeShadowShader;
+    Shader* terrainPointShadowShader;
     Shader* vsmPointBlurShader;
     Shader* skyShader;
-    Shader* blurShader;
     Shader* terrainShader;
     Shader* geometryPassShader;
+    Shader* terrainGeometryPassShader;
+    Shader* terrainClipmapShader;
+    Shader* terrainClipmapGeometryPassShader;
     Shader* ssaoShader;
-    Shader* ssaoBlurShader;
+    Shader* ssaoTemporalShader;
+    Shader* fxaaShader;
+    Shader* ssaoUpsampleShader;
     Shader* particleShader;
     Shader* equiToCubeShader;
     Shader* irradianceShader;
@@ -118,16 +163,35 @@ private:
     Shader* brdfShader;
     ComputeShader* c;
     ComputeShader* particleUpdateComputeShader;
+    ComputeShader* particleEmitShader;
+    ComputeShader* particleFinishShader;
+    ComputeShader* sortBitonicLocalShader;
+    ComputeShader* sortBitonicStepShader;
+    ComputeShader* sortRadixCountShader;
+    ComputeShader* sortRadixScanShader;
+    ComputeShader* sortRadixScatterShader;
+    ComputeShader* bloomDownsampleShader; //first level also extracts the bright parts
+    ComputeShader* bloomUpsampleShader;
+    ComputeShader* postProcessShader; //bloom composite + fog + tonemap + vignette + gamma, one write per pixel
+    ComputeShader* taaResolveShader;
+    ComputeShader* terrainMeshShader;
+
+    //FRAME GRAPH (owns the transient targets: ssao raw/result, bloom down/upsample chains, post output)
+    FrameGraph* frameGraph;
+    FrameCapture* frameCapture; //PBO ring + worker, idle until the first request
+    AssetLoader* assetLoader;   //models, textures and heightmaps requested by Draw*/SetCurrent*, see SetAsyncLoading
 
     //COMMAND BUFFER
     std::vector<DrawCall*> drawCalls;
-    std::vector<ParticleEmitter*> particleEmitters;
+    ParticleSystem* particleSystem; //one particle pool + the emitter records
+    GpuSort* gpuSort;               //particle depth order, usable by anything else that needs a gpu sort
 
     //MATERIAL
     Material currentMaterial;
     PBRMaterial currentPBRMaterial;
     std::unordered_map<const char*, unsigned int> textureToID;
-    void AddToTextureMap(const char* path); //stores texture to map if its not already there
+    std::unordered_set<const char*> loadingTextures; //in textureToID as a placeholder until their upload
+    bool AddToTextureMap(const char* path, const unsigned char placeholder[4]); //stores texture to map if its not already there, false while it loads
 
     //SKYBOX
     unsigned int currentSkyboxTexture;
@@ -141,25 +205,28 @@ private:
 
     //MODELS & TERRAIN
     std::unordered_map<const char*, Model*> pathToModel; //path to model : model*   
-    std::unordered_map<const char*, std::pair<MeshData, unsigned int>> pathToTerrainMeshDataAndTextureID; //path : <Meshdata, texture>
+    std::unordered_map<const char*, TerrainData> pathToTerrainData; //path : <Meshdata, texture, quadtree>
+    std::unordered_map<const char*, ClipmapTerrain*> pathToClipmap; //tiled file path : streamed clipmap
+    std::unordered_set<const char*> loadingTerrains; //not in pathToTerrainData until their upload
 
     //LIGHTING DATA
     float ambientLighting;
     float bloomThreshold;
     void SetAndSendAllLightsToFalse();
     //point
-    struct PointLightGPU
-    {
-        glm::vec4 positionRange;
-        glm::vec4 colorIntensity;
-        uint32_t  isActive;
-        int32_t  shadowMapIndex;
-        uint32_t  pad0, pad1;
-    };
-    unsigned int lightSSBO, indexSSBO, countSSBO;
+    //GPU light data is split in two streams: positionRange (vec4) for culling + PointLightShadingGPU, shading reads both
+    unsigned int lightCullSSBO, lightShadingSSBO, indexSSBO, clusterGridSSBO;
     ComputeShader* tileCullShader;
-    PointLightGPU pointLights[MAX_POINT_LIGHTS];
-    unsigned int currentFramePointLightCount;
+    ComputeShader* clusterScanShader;
+    std::vector<PointLightDesc> framePointLights;       //submitted this frame, cleared at end of frame
+    std::vector<PointLightDesc> persistentPointLights;  //indexed by PointLightHandle
+    std::vector<bool> persistentPointLightAlive;
+    std::vector<unsigned int> persistentPointLightGenerations; //bumped on destroy, part of the handle
+    std::vector<unsigned int> freePointLightSlots;
+    bool IsPointLightHandleValid(PointLightHandle handle) const;
+    std::vector<glm::vec4> pointLightCullData;                  //visible lights, built and uploaded once in UploadPointLights()
+    std::vector<PointLightShadingGPU> pointLightShadingData;    //parallel to pointLightCullData
+    unsigned int currentFramePointLightCount;                   //amount of visible lights
     unsigned int currentFrameShadowArrayIndex;
     float SHADOW_PROJECTION_FAR = 25.0f, SHADOW_PROJECTION_NEAR = 0.1f;
 
@@ -185,9 +252,9 @@ private:
     //cascade
     unsigned int CASCADE_SHADOW_WIDTH = 1024, CASCADE_SHADOW_HEIGHT = 1024;
     std::vector<float> cascadeLevels;
-    std::vector<float> cascadeMultipliers;
     std::vector<glm::vec4> GetFrustumCornersWorldSpace(const glm::mat4& proj, const glm::mat4& view);
-    glm::mat4 CalculateLightSpaceCascadeMatrix(float near, float far, int index);
+    glm::mat4 CalculateLightSpaceCascadeMatrix(float near, float far);
+    bool IsShadowCasterVisible(DrawCall* d, glm::vec4* frustumPlanes); //terrain is tested per quadtree node
     std::vector<glm::mat4> GetCascadeMatrices();
     void RenderCascadedShadowMap();
     //point
@@ -198,13 +265,19 @@ private:
 
     //FRUSTUM CULLING
     bool IsAABBVisible(const AABB& worldAABB, glm::vec4* frustumPlanes);
+    bool IsSphereVisible(const glm::vec3& center, float radius, glm::vec4* frustumPlanes);
     void GetFrustumPlanes(const glm::mat4& vp, glm::vec4* frustumPlanes);
     glm::vec4 cameraFrustumPlanes[6];
+    glm::vec3 cameraPosition;
+    float cameraPixelsPerUnit;  //render target pixels covered by one unit at distance 1 (terrain LOD)
 
     //SSAO
     std::vector<glm::vec3> ssaoKernel;
     std::vector<glm::vec3> ssaoNoise = {};
     unsigned int ssaoNoiseTexture;
+    unsigned int ssaoFrameIndex;            //rotates the kernel subset / noise
+    unsigned int ssaoHistoryIndex;          //which history target was written last frame
+    glm::mat4 ssaoPrevViewProjection;       //for reprojecting the history
 
     //MESH DATA
     MeshData triangleMeshData;
@@ -216,19 +289,42 @@ private:
     unsigned int terrainVAO;
 
     //FRAMEBUFFERS/TEXTURES
-    unsigned int hdrFBO, hdrMSAAFBO, hdrTextureRGBA, hdrMSAATextureRGBA;
-    unsigned int twoPassBlurFBOs[2], twoPassBlurTexturesRGBA[2];
-    unsigned int halfResBrightFBO, halfResBrightTextureRGBA;
+    unsigned int hdrFBO, hdrTextureRGBA;
+    unsigned int hdrMSAAFBO, hdrMSAATextureRGBA, hdrMSAARBO; //0 unless an MSAA mode is on
+    unsigned int gVelocityTextureRG, taaHistoryTextureRGBA[2]; //0 unless TAA is on
+    unsigned int sceneColorTexture; //what bloom + post read: hdrTextureRGBA, or the TAA resolve
+    unsigned int postProcessFBO;
     unsigned int dirShadowMapFBO, dirShadowMapTextureDepth;
     unsigned int cascadeShadowMapFBO, cascadeShadowMapTextureArrayDepth;
     unsigned int pointShadowMapFBO, pointShadowMapTextureArrayRG; 
     unsigned int vsmBlurFBO[2], vsmBlurTextureArrayRG[2];
-    unsigned int gBufferFBO, gNormalTextureRGBA, gPositionTextureRGBA; 
-    unsigned int ssaoFBO, ssaoBlurFBO, ssaoQuadTextureR, ssaoBlurTextureR;
+    unsigned int gBufferFBO, gNormalTextureRG, gDepthTexture; 
+    unsigned int ssaoFBO, ssaoBlurFBO; //low res raw / full res upsample, targets come from the frame graph
+    unsigned int ssaoHistoryFBO[2], ssaoHistoryTextureRG[2];
     unsigned int T1;
 
 
     //MISC DATA
     Vec4 clearColor;
-    bool msaa;
+    AAMode antiAliasing;
+    //DYNAMIC RESOLUTION
+    float renderScale;                  //internal res = SCREEN * renderScale (rounded to 8 px)
+    glm::vec2 renderScaleXY, prevRenderScaleXY; //exact used fraction of each target after rounding
+    glm::vec2 sceneColorScale;          //used fraction of sceneColorTexture (1 after TAA upsampling)
+    unsigned int renderWidth, renderHeight;
+    bool dynamicResolution;
+    float frameTimeBudgetMs;
+    float minRenderScale;
+    unsigned int gpuTimerQueries[GPU_TIMER_QUERY_COUNT];
+    unsigned int gpuTimerFrame;
+    //TAA
+    unsigned int taaFrameIndex;
+    unsigned int taaHistoryIndex;
+    bool taaHistoryValid;
+    glm::mat4 taaPrevViewProjection; //unjittered
+    bool depthPrepass; //gbuffer depth is reused by the main pass (GL_EQUAL, no msaa)
+    bool ssao;
+    bool terrainMeshMode;
+    bool asyncLoading;
+    PostProcessSettings postProcess;
 };
\ No newline at end of file
@@ -5,6 +5,19 @@
 #include "Definitions.h"
 #include <glm/glm.hpp>
 
+class HeightPyramid;
+
+namespace TextureSetup
+{
+    struct DecodedImage
+    {
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        std::vector<unsigned char> pixels; //empty if the file failed to load
+    };
+}
+
 namespace VertexBufferSetup
 {
     MeshData SetupTriangleBuffers();
@@ -13,31 +26,39 @@ namespace VertexBufferSetup
     MeshData SetupPlaneBuffers();
     MeshData SetupScreenQuadBuffers();
     MeshData SetupSkyboxBuffers();
-    //return <VAO, texture id>
-    std::pair<MeshData, unsigned int> SetupTerrainBuffers(const char* path);
+    //patch mesh + heightmap texture + min/max pyramid and quadtree (kept on the cpu for bounds and patch selection)
+    TerrainData SetupTerrainBuffers(const char* path);
+    //the GL half, for a heightmap decoded and its pyramid built elsewhere (AssetLoader). heights null = failed to load
+    TerrainData SetupTerrainBuffers(const TextureSetup::DecodedImage& heightMap, HeightPyramid* heights);
 }
 
 namespace FramebufferSetup
 {
     //Note: RBO is lost.
     void SetupHDRFramebuffer(unsigned int& FBO, unsigned int& texture); //HDR buffer
-    void SetupMSAAHDRFramebuffer(unsigned int& FBO, unsigned int& texture); //HDR buffer, MSAA
-    void SetupHalfResBrightFramebuffer(unsigned int& FBO, unsigned int& texture); //only bright scene, half res
-    void SetupTwoPassBlurFramebuffers(unsigned int FBOs[2], unsigned int colorBuffers[2]); //hald res
+    void SetupMSAAHDRFramebuffer(unsigned int& FBO, unsigned int& texture, unsigned int& RBO, unsigned int samples); //HDR buffer, MSAA
     void SetupVSMTwoPassBlurFramebuffer(unsigned int& FBO, unsigned int& textureArray, unsigned int w, unsigned int h); //shadowmap res
     void SetupDirShadowMapFramebuffer(unsigned int& FBO, unsigned int& texture, unsigned int w, unsigned int h);
     void SetupCascadedShadowMapFramebuffer(unsigned int& FBO, unsigned int& textureArray, unsigned int w, unsigned int h, int numCascades);
     void SetupPointShadowMapFramebuffer(unsigned int& FBO, unsigned int w, unsigned int h);
-    void SetupGBufferFramebuffer(unsigned int& FBO, unsigned int& gNormal, unsigned int& gPosition);
-    void SetupSSAOFramebuffer(unsigned int& FBO, unsigned int& texture);
+    void SetupGBufferFramebuffer(unsigned int& FBO, unsigned int& gNormal, unsigned int& gDepth); //RG16 octahedral normals + sampleable depth
+    void SetupGBufferVelocityTexture(unsigned int gBufferFBO, unsigned int& texture); //attachment 1, TAA only
+    void SetupSSAOLowResFramebuffer(unsigned int& FBO, unsigned int& texture); //SSAO_WIDTH x SSAO_HEIGHT, RG = (occlusion, view z)
+    void SetupTransientFramebuffer(unsigned int& FBO); //no attachments, the pass attaches its frame graph texture
 
-    void SetupTiledSSBOs(unsigned int& lightSSBO, unsigned int& countSSBO, unsigned int& indexSSBO);
+    void SetupTiledSSBOs(unsigned int& lightCullSSBO, unsigned int& lightShadingSSBO, unsigned int& clusterGridSSBO, unsigned int& indexSSBO);
 }
 
 namespace TextureSetup
 {
     void SetupPointShadowMapTextureArray(unsigned int& textureArray, unsigned int w, unsigned int h);
     void SetupSSAONoiseTexture(unsigned int& texture, const std::vector<glm::vec3>& noise);
+    void SetupTAAHistoryTexture(unsigned int& texture); //full res, hdr format
+    unsigned int GetHDRInternalFormat(); //GL_R11F_G11F_B10F or GL_RGBA16F, see HDR_PACKED_FORMAT
     unsigned int LoadTexture(char const* path);
+    //LoadTexture in two halves: decoding touches no GL (any thread), the upload replaces whatever texture has
+    DecodedImage DecodeImage(char const* path, bool flip);
+    void UploadImage(unsigned int texture, const DecodedImage& image); //keeps the texture as it was if the image failed
+    unsigned int CreatePlaceholderTexture(const unsigned char texel[4]); //1x1 RGBA, stands in until UploadImage
     unsigned int LoadTextureCubeMap(const std::vector<const char*>& faces);
 }
\ No newline at end of file
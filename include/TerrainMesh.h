@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "Definitions.h"
+#include "TerrainQuadtree.h"
+
+class ComputeShader;
+
+//Terrain (DrawTerrain) without hardware tessellation, for software GL and cheaper passes. csTerrainMesh writes the quadtree's
+//cut for a camera (TerrainQuadtree::SelectMesh) into a vertex buffer with the usual mesh layout, every patch a grid of
+//TERRAIN_MESH_PATCH_RESOLUTION quads, so every pass draws it with its plain indexed program. Only rebuilt once the camera
+//is TERRAIN_MESH_REBUILD_DISTANCE away from where it was built, in between it costs nothing but the draws.
+class TerrainMesh
+{
+public:
+    TerrainMesh(TerrainQuadtree* quadtree, unsigned int heightMapTexture);
+    ~TerrainMesh();
+
+    //shader: the renderer's csTerrainMesh. rebuilds if the camera moved far enough or the terrain was placed elsewhere
+    void Update(ComputeShader* shader, const glm::mat4& model, const glm::vec3& cameraPos, float pixelsPerUnit);
+    const MeshData& GetMeshData() const; //model space triangles, bounds of the whole terrain
+    const glm::mat4& GetModel() const;   //where it was last built for
+
+private:
+    void Build(ComputeShader* shader, const glm::mat4& model, const glm::vec3& cameraPos, float pixelsPerUnit);
+    void EnsureCapacity(unsigned int patchCount); //grows only
+
+    TerrainQuadtree* quadtree;
+    unsigned int heightMapTexture;
+
+    std::vector<TerrainPatchGPU> patches;   //last build's cut
+    unsigned int patchSSBO;
+    unsigned int vertexBuffer;              //csTerrainMesh output, then the VBO
+    unsigned int indexBuffer;               //the same grid for every patch, offset by its vertices
+    unsigned int capacity;                  //patches the buffers hold
+    MeshData meshData;
+
+    bool built;
+    glm::mat4 builtModel;
+    glm::vec3 builtCameraPos;
+};
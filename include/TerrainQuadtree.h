@@ -0,0 +1,88 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <functional>
+#include <unordered_set>
+
+#include "Definitions.h"
+
+class HeightPyramid;
+
+//per instance, vsTerrain locations 1-3
+struct TerrainPatchGPU
+{
+    glm::vec4 node;         //x0, z0 (model space, not clipped to the heightmap), size
+    glm::vec4 neighbors;    //coarser neighbor size / node size across each edge: left, top (-z), right, bottom (+z). 1 = same or finer
+    glm::vec4 heights;      //min, max
+};
+
+//Quadtree over a terrain heightmap (DrawTerrain), node height bounds come from the terrain's HeightPyramid.
+//Each frame the nodes on screen are split until the node's patch at TERRAIN_MAX_TESS_LEVEL has triangle edges of about
+//TERRAIN_TARGET_EDGE_PIXELS, the nodes where that stops are this frame's patches. They are instances of one 4 corner quad,
+//the neighbor sizes they carry let tcsTerrain match edge tessellation across LOD borders.
+//Shadow maps see terrain the camera doesn't, they draw a fixed grid of equal nodes instead (GetShadowPatches).
+class TerrainQuadtree
+{
+public:
+    TerrainQuadtree(const HeightPyramid* heights);
+    ~TerrainQuadtree();
+
+    void BeginFrame(); //drops last frame's patches, not the shadow grid
+
+    //patches of one draw of this terrain, appended to this frame's. returns <first, count> for the instanced draw
+    std::pair<unsigned int, unsigned int> Select(const glm::mat4& model, const glm::vec3& cameraPos, float pixelsPerUnit,
+                                                 const std::function<bool(const AABB&)>& isVisible);
+    void Upload(); //after the frame's last Select
+
+    //the cut for a mesh kept over several frames (TerrainMesh): every node of the map, split for patches of patchResolution
+    //quads across instead of TERRAIN_MAX_TESS_LEVEL, coarser if it would be over TERRAIN_MESH_MAX_PATCHES. written to out,
+    //this frame's patches are left alone
+    void SelectMesh(const glm::mat4& model, const glm::vec3& cameraPos, float pixelsPerUnit, float patchResolution,
+                    std::vector<TerrainPatchGPU>& out);
+
+    //<first, count> of the shadow grid: the whole map in at most TERRAIN_SHADOW_GRID_PATCHES nodes, first in the buffer and never reselected
+    std::pair<unsigned int, unsigned int> GetShadowPatches() const;
+
+    unsigned int GetPatchBuffer() const;
+    glm::vec2 GetHalfExtent() const;    //model space xz covered: [-halfExtent, halfExtent]
+    AABB GetBounds() const;             //model space, real heights
+
+    //bounds queries down to the leaves, for shadow casters:
+    //whether any part of the terrain (placed by model) passes isVisible (world space bounds)
+    bool IsVisible(const glm::mat4& model, const std::function<bool(const AABB&)>& isVisible) const;
+    //largest z of the terrain in the space toSpace leads to (model included), over the xy rectangle [rectMin, rectMax] of that
+    //space. -FLT_MAX if none of it is over the rectangle
+    float GetMaxZ(const glm::mat4& toSpace, const glm::vec2& rectMin, const glm::vec2& rectMax) const;
+
+private:
+    void SelectCut(const glm::mat4& model, const glm::vec3& cameraPos, float pixelsPerUnit, float patchResolution,
+                   const std::function<bool(const AABB&)>& isVisible);
+    void SelectNode(unsigned int depth, unsigned int x, unsigned int y, const glm::mat4& model, const glm::vec3& cameraPos,
+                    float pixelsPerUnit, float patchResolution, const std::function<bool(const AABB&)>& isVisible);
+    void LimitNeighborRatio(const glm::mat4& model, const std::function<bool(const AABB&)>& isVisible);
+    void AddSelected(unsigned int depth, unsigned int x, unsigned int y, const glm::mat4& model,
+                     const std::function<bool(const AABB&)>& isVisible); //skipped if past the heightmap or not visible
+    void AppendSelected(std::vector<TerrainPatchGPU>& out, size_t maxSize); //the cut as patches, with neighbor ratios
+    bool IsNodeVisible(unsigned int depth, unsigned int x, unsigned int y, const glm::mat4& model,
+                       const std::function<bool(const AABB&)>& isVisible) const;
+    void GetNodeMaxZ(unsigned int depth, unsigned int x, unsigned int y, const glm::mat4& toSpace,
+                     const glm::vec2& rectMin, const glm::vec2& rectMax, float& maxZ) const;
+    AABB GetNodeBounds(unsigned int depth, unsigned int x, unsigned int y) const; //model space, clipped to the heightmap. empty past it
+    float GetNeighborRatio(const glm::vec2& point, float size) const;              //selected node holding point (model xz)
+    bool FindBiggerSelected(const glm::vec2& point, float size, glm::uvec3& node) const; //one bigger than size, if any
+
+    unsigned int maxDepth;      //depth of the leaves (TERRAIN_LEAF_SIZE texels across)
+    float rootSize;
+    glm::vec2 halfExtent;
+    const HeightPyramid* heights;
+
+    std::vector<TerrainPatchGPU> patches;           //the shadow grid, then this frame's, every Select appends
+    unsigned int shadowPatchCount;
+    std::vector<glm::uvec3> selected;               //(depth, x, y) of the current Select
+    std::unordered_set<uint64_t> selectedKeys;
+    unsigned int patchVBO;
+    bool overflowReported;
+};
@@ -23,6 +23,9 @@ namespace ShaderSources
     out mat3 TBN; //TangentSpace -> WorldSpace
     out vec4 FragPosClipSpace;
 
+    //depth prepass: must match vsGeometryPass bit for bit for GL_EQUAL
+    invariant gl_Position;
+
     void main()
     {
         gl_Position = projection * view * model * vec4(aPos, 1.0);
@@ -46,13 +49,19 @@ namespace ShaderSources
     #version 450 core
     layout (location = 0) out vec4 FragColor;   //COLOR_ATTACHMENT_0
 
+    //unpacked from the LightCull + LightShading streams by GetPointLight()
     struct GPUPointLight    
     {    
         vec4 positionRange;   
         vec4 colorIntensity; 
-        uint isActive;
         int shadowMapIndex;
-        uint pad0, pad1; //48
+    };
+
+    struct GPUPointLightShading
+    {
+        uint colorRG;           //half r, half g
+        uint colorBIntensity;   //half b, half intensity
+        int shadowMapIndex;     //12
     };
         
     vec3 CalcPointLight(GPUPointLight light, vec3 fragPos, vec3 viewDir, 
@@ -121,13 +130,13 @@ namespace ShaderSources
     uniform samplerCube prefilterMap;                //8
     //TERRAIN TEXTURE                                //9
     uniform sampler2D ssao;                          //10
+    uniform bool ssaoEnabled = true;                 //unit 10 is unbound when off
     uniform sampler2D brdfLUT;                       //11
     //pbrmaterial.height                             //12
     
     //SHARED UNIFORMS---------------------------------------------------------------------
     //light
     uniform bool usingPBR;
-    uniform int numPointLights;
     uniform DirLight dirLight;
     uniform float sceneAmbient;                     //updated every frame in SendOtherUniforms()
     //shadow
@@ -145,10 +154,10 @@ namespace ShaderSources
     uniform vec3 fogColor;             //updated every frame in SendOtherUniforms(). ({0,0,0} means fog is disabled)
     uniform float expFogDensity;                    //SendOTherUniforms()
     uniform float linearFogStart;                   //SendOtherUniforms()
-    //forward+
-    uniform uint tileSize = 16u;
+    //clustered forward+ (set once in InitializeShaders())
+    uniform uint tileSize = 32u;
     uniform uvec2 screen = uvec2(1920, 1080);
-    const uint MAX_LIGHTS_PER_TILE = 256u;
+    uniform uint clusterZSlices = 24u;
 
     //UNIQUE UNIFORMS --------------------------------------------------------------------
     //material properties (Set by SendMaterialUniforms())
@@ -171,21 +180,29 @@ namespace ShaderSources
 
     const float gamma = 2.2;
 
-    layout(std430, binding = 1) buffer Lights
+    layout(std430, binding = 1) buffer LightCull
     {
-        GPUPointLight lights[];  
+        vec4 lightPositionRange[];  
     };
 
-    layout(std430, binding = 2) buffer TileIndices
+    layout(std430, binding = 4) buffer LightShading
     {
-        uint indices[];
+        GPUPointLightShading lightShading[];  
+    };
+
+    layout(std430, binding = 2) buffer ClusterIndices
+    {
+        uint indices[]; //compact, every cluster owns indices[offset, offset + count)
     };
     
-    layout(std430, binding = 3) buffer TileCount
+    layout(std430, binding = 3) buffer ClusterGrid
     {
-        uint counts[];
+        uvec2 grid[]; //(offset, count)
     };
 
+    uint GetClusterID();
+    GPUPointLight GetPointLight(uint index);
+
     )"
     R"(
     void main()
@@ -198,30 +215,25 @@ namespace ShaderSources
         vec3 normal = ChooseNormal();
         vec3 specular = ChooseSpecular();
 
-        uvec2 pix = uvec2(gl_FragCoord.xy);
-        uvec2 tile = pix / tileSize;
-        uint tileID = tile.y * uint(screen.x / 16) + tile.x;
-    
-        uint lightsInTile = counts[tileID];
+        uvec2 cluster = grid[GetClusterID()];
+        uint lightsInCluster = cluster.y;
         
         //LIGHTS
         if (!usingPBR)
         {
-            for (uint i = 0u; i < lightsInTile; i++)
+            for (uint i = 0u; i < lightsInCluster; i++)
             {
-                uint lightIndex = indices[tileID * MAX_LIGHTS_PER_TILE + i];
+                uint lightIndex = indices[cluster.x + i];
 
-                GPUPointLight g = lights[lightIndex];
+                GPUPointLight g = GetPointLight(lightIndex);
 
                 color += CalcPointLight(g, FragPos, viewDir, diffuse, normal, specular);
             }
 
             color += CalcDirLight(dirLight, FragPos, viewDir, diffuse, normal, specular);
 
-            vec3 fragPosNDC = FragPosClipSpace.xyz / FragPosClipSpace.w; //perpective divide [-1,1]
-            fragPosNDC = fragPosNDC * 0.5f + 0.5f; //[0,1]
-            vec2 ssaoUV = fragPosNDC.xy;
-            float occlusion = texture(ssao, ssaoUV).r;
+            //same pixel grid as the ssao target (holds true at any render scale)
+            float occlusion = ssaoEnabled ? texelFetch(ssao, ivec2(gl_FragCoord.xy), 0).r : 1.0f;
 
             //Ambient lighting
             vec3 sceneAmbient = vec3(sceneAmbient) * diffuse * occlusion; 
@@ -241,11 +253,11 @@ namespace ShaderSources
             vec3 reflectionDir = reflect(-viewDir, N);
             
             //Calculate Lo = full integral for each point light (both spec and scatter components)
-            for (uint i = 0u; i < lightsInTile; i++)
+            for (uint i = 0u; i < lightsInCluster; i++)
             {
-                uint lightIndex = indices[tileID * MAX_LIGHTS_PER_TILE + i];
+                uint lightIndex = indices[cluster.x + i];
 
-                GPUPointLight g = lights[lightIndex];
+                GPUPointLight g = GetPointLight(lightIndex);
 
                 color += CalcPointLightPBR(g, FragPos, viewDir, albedo, N, metallic, roughness, ao);
             }
@@ -384,11 +396,6 @@ namespace ShaderSources
     R"(
     vec3 CalcPointLight(GPUPointLight light, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 normal, vec3 baseSpecular)
     {
-        if (light.isActive == 0u)
-        {
-            return vec3(0.0f, 0.0f, 0.0f);
-        }
-        
         vec3 lightDir = normalize(light.positionRange.xyz - fragPos);
 
         // diffuse shading
@@ -755,6 +762,32 @@ namespace ShaderSources
         
         return fogFactor;
     }
+
+    //froxel this fragment falls in. xy = screen tile, z = exponential view depth slice
+    uint GetClusterID()
+    {
+        uvec2 tile = uvec2(gl_FragCoord.xy) / tileSize;
+        uvec2 groupCount = (screen + tileSize - 1u) / tileSize;
+
+        float viewDepth = -(view * vec4(FragPos, 1.0f)).z;
+        float slice = log(max(viewDepth, nearPlane) / nearPlane) / log(farPlane / nearPlane) * float(clusterZSlices);
+        uint z = min(uint(slice), clusterZSlices - 1u);
+
+        return (z * groupCount.y + tile.y) * groupCount.x + tile.x;
+    }
+
+    GPUPointLight GetPointLight(uint index)
+    {
+        GPUPointLightShading packed = lightShading[index];
+        vec2 rg = unpackHalf2x16(packed.colorRG);
+        vec2 bIntensity = unpackHalf2x16(packed.colorBIntensity);
+
+        GPUPointLight l;
+        l.positionRange = lightPositionRange[index];
+        l.colorIntensity = vec4(rg, bIntensity);
+        l.shadowMapIndex = packed.shadowMapIndex;
+        return l;
+    }
     )";
 
     
@@ -1124,15 +1157,167 @@ namespace ShaderSources
     } 
     )";
 
-    const char* fsScreenQuad = R"(
+    //TAA: jittered hdr scene (render res) + reprojected history -> resolved hdr scene at output res
+    //(and next frame's history). doubles as the temporal upsampler for dynamic resolution.
+    const char* csTAAResolve = R"(
+    #version 450 core
+    layout(local_size_x = 8, local_size_y = 8) in;
+
+    uniform sampler2D currentColor;     //0
+    uniform sampler2D historyColor;     //1
+    uniform sampler2D velocityBuffer;   //2 (current uv - previous uv)
+    uniform sampler2D gDepth;           //3
+    layout(binding = 0) uniform writeonly image2D resolved;
+
+    uniform bool historyValid;
+    uniform vec2 renderScale = vec2(1.0f);  //used corner of the scene/gbuffer textures
+    uniform mat4 invViewProjection;     //unjittered, sky reprojection
+    uniform mat4 prevViewProjection;
+
+    const float currentWeight = 0.1f;
+
+    float Luma(vec3 c)
+    {
+        return dot(c, vec3(0.2126f, 0.7152f, 0.0722f));
+    }
+
+    void main()
+    {
+        ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+        ivec2 size = imageSize(resolved);
+        if (any(greaterThanEqual(pixel, size))) return;
+
+        vec2 uv = (vec2(pixel) + 0.5f) / vec2(size);
+
+        //render res texel under this output pixel
+        ivec2 renderSize = ivec2(vec2(textureSize(currentColor, 0)) * renderScale);
+        ivec2 renderPixel = min(ivec2(uv * vec2(renderSize)), renderSize - 1);
+        vec3 current = textureLod(currentColor, uv * renderScale, 0.0f).rgb;
+
+        //3x3 neighbourhood bounds, history is clamped into them (ghosting)
+        vec3 minCol = current;
+        vec3 maxCol = current;
+        for (int y = -1; y <= 1; y++)
+        {
+            for (int x = -1; x <= 1; x++)
+            {
+                vec3 c = texelFetch(currentColor, clamp(renderPixel + ivec2(x, y), ivec2(0), renderSize - 1), 0).rgb;
+                minCol = min(minCol, c);
+                maxCol = max(maxCol, c);
+            }
+        }
+
+        vec2 velocity;
+        if (texelFetch(gDepth, renderPixel, 0).r == 1.0f)
+        {
+            //sky isn't in the gbuffer, reproject a point on the far plane with the camera only
+            vec4 world = invViewProjection * vec4(uv * 2.0f - 1.0f, 1.0f, 1.0f);
+            vec4 prevClip = prevViewProjection * vec4(world.xyz / world.w, 1.0f);
+            velocity = uv - ((prevClip.xy / prevClip.w) * 0.5f + 0.5f);
+        }
+        else
+        {
+            velocity = texelFetch(velocityBuffer, renderPixel, 0).rg;
+        }
+
+        vec2 prevUV = uv - velocity;
+        vec3 result = current;
+
+        if (historyValid && all(greaterThanEqual(prevUV, vec2(0.0f))) && all(lessThanEqual(prevUV, vec2(1.0f))))
+        {
+            vec3 history = clamp(textureLod(historyColor, prevUV, 0.0f).rgb, minCol, maxCol);
+
+            //luma weighted so bright subpixel highlights don't flicker
+            float wc = currentWeight / (1.0f + Luma(current));
+            float wh = (1.0f - currentWeight) / (1.0f + Luma(history));
+            result = (current * wc + history * wh) / (wc + wh);
+        }
+
+        imageStore(resolved, pixel, vec4(result, 1.0f));
+    }
+    )";
+
+    //FXAA (console version), final LDR image -> screen
+    const char* fsFXAA = R"(
     #version 450 core
     out vec4 FragColor;
-  
+
     in vec2 TexCoords;
-    
+
+    uniform sampler2D screenTexture; //0
+
+    const float FXAA_SPAN_MAX = 8.0f;
+    const float FXAA_REDUCE_MUL = 1.0f / 8.0f;
+    const float FXAA_REDUCE_MIN = 1.0f / 128.0f;
+
+    void main()
+    {
+        vec2 texel = 1.0f / vec2(textureSize(screenTexture, 0));
+        const vec3 toLuma = vec3(0.299f, 0.587f, 0.114f);
+
+        float lumaNW = dot(texture(screenTexture, TexCoords + vec2(-1.0f, -1.0f) * texel).rgb, toLuma);
+        float lumaNE = dot(texture(screenTexture, TexCoords + vec2( 1.0f, -1.0f) * texel).rgb, toLuma);
+        float lumaSW = dot(texture(screenTexture, TexCoords + vec2(-1.0f,  1.0f) * texel).rgb, toLuma);
+        float lumaSE = dot(texture(screenTexture, TexCoords + vec2( 1.0f,  1.0f) * texel).rgb, toLuma);
+        vec3 rgbM = texture(screenTexture, TexCoords).rgb;
+        float lumaM = dot(rgbM, toLuma);
+
+        float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+        float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+
+        //edge direction
+        vec2 dir;
+        dir.x = -((lumaNW + lumaNE) - (lumaSW + lumaSE));
+        dir.y =  ((lumaNW + lumaSW) - (lumaNE + lumaSE));
+
+        float dirReduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * 0.25f * FXAA_REDUCE_MUL, FXAA_REDUCE_MIN);
+        float rcpDirMin = 1.0f / (min(abs(dir.x), abs(dir.y)) + dirReduce);
+        dir = clamp(dir * rcpDirMin, vec2(-FXAA_SPAN_MAX), vec2(FXAA_SPAN_MAX)) * texel;
+
+        vec3 rgbA = 0.5f * (texture(screenTexture, TexCoords + dir * (1.0f / 3.0f - 0.5f)).rgb +
+                            texture(screenTexture, TexCoords + dir * (2.0f / 3.0f - 0.5f)).rgb);
+        vec3 rgbB = rgbA * 0.5f + 0.25f * (texture(screenTexture, TexCoords + dir * -0.5f).rgb +
+                                           texture(screenTexture, TexCoords + dir *  0.5f).rgb);
+
+        float lumaB = dot(rgbB, toLuma);
+        FragColor = vec4((lumaB < lumaMin || lumaB > lumaMax) ? rgbA : rgbB, 1.0f);
+    }
+    )";
+
+    //POST PROCESS (bloom composite, fog, tonemap, vignette, gamma) in one pass -> LDR output image
+    const char* csPostProcess = R"(
+    #version 450 core
+    layout(local_size_x = 8, local_size_y = 8) in;
+
     uniform sampler2D hdrBuffer;    //0
-    uniform sampler2D blurBuffer;   //1
+    uniform sampler2D blurBuffer;   //1 (upsample chain mip 0, holds the whole chain)
+    uniform sampler2D gDepth;       //2 (only read for fog)
+    uniform mat4 invProjection;
+    layout(rgba8, binding = 0) uniform writeonly image2D outputImage;
+
     uniform float exposure;
+    uniform float bloomStrength = 1.0f;
+
+    //dynamic resolution: used corner of the scene (+ bloom) texture and of the gbuffer.
+    //they differ after TAA, which already outputs full res.
+    uniform vec2 sceneScale = vec2(1.0f);
+    uniform vec2 renderScale = vec2(1.0f);
+
+    //PostProcessSettings, SendOtherUniforms()
+    uniform bool bloom;
+    uniform int toneMap;            //ToneMapType
+    uniform bool gammaCorrection;
+    uniform bool fog;
+    uniform bool vignette;
+    uniform float vignetteStrength;
+
+    //fog (same params as the lit pass)
+    uniform int fogType;
+    uniform vec3 fogColor;
+    uniform float expFogDensity;
+    uniform float linearFogStart;
+    uniform float nearPlane;
+    uniform float farPlane;
 
     vec3 reinhardMap(vec3 hdrCol)
     {
@@ -1165,84 +1350,207 @@ namespace ShaderSources
     
         return toneMapped;
     }
-            
-        
+
+    vec3 ViewPosFromDepth(vec2 uv, float depth)
+    {
+        vec4 ndc = vec4(uv * 2.0f - 1.0f, depth * 2.0f - 1.0f, 1.0f);
+        vec4 view = invProjection * ndc;
+        return view.xyz / view.w;
+    }
+
+    float FogFactor(float dist)
+    {
+        float distRatio = (4.0f * dist) / farPlane;
+
+        switch (fogType)
+        {
+            case 0: return clamp((farPlane - dist) / (farPlane - (nearPlane + linearFogStart)), 0.0f, 1.0f);
+            case 1: return exp(-distRatio * expFogDensity);
+            default: return exp(-distRatio * expFogDensity * distRatio * expFogDensity);
+        }
+    }
+
     void main()
     {
         const float gamma = 2.2;
-            
-        vec3 hdrCol = texture(hdrBuffer, TexCoords).rgb;  
-        vec3 blurCol = texture(blurBuffer, TexCoords).rgb;
-        hdrCol += blurCol;
-        //vec3 mapped = reinhardMap(hdrCol);
-        vec3 mapped = exposureMap(hdrCol, exposure);           
-        //vec3 mapped = cinematicMap(hdrCol, exposure);  
-        mapped = pow(mapped, vec3(1.0 / gamma)); //gamma correction
-        FragColor = vec4(mapped, 1.0f);
+
+        ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+        ivec2 size = imageSize(outputImage);
+        if (any(greaterThanEqual(pixel, size))) return;
+
+        vec2 uv = (vec2(pixel) + 0.5f) / vec2(size);
+
+        //bilinear upscale from the render res corner (exact texel fetch when sceneScale is 1)
+        vec3 hdrCol = textureLod(hdrBuffer, uv * sceneScale, 0.0f).rgb;
+
+        if (fog)
+        {
+            //depth stays 1 where nothing was drawn, sky stays unfogged like in the lit pass
+            float depth = texelFetch(gDepth, ivec2(uv * renderScale * vec2(textureSize(gDepth, 0))), 0).r;
+            if (depth < 1.0f)
+                hdrCol = mix(fogColor, hdrCol, FogFactor(length(ViewPosFromDepth(uv, depth))));
+        }
+
+        if (bloom)
+            hdrCol += textureLod(blurBuffer, uv * sceneScale, 0.0f).rgb * bloomStrength;
+
+        vec3 mapped;
+        switch (toneMap)
+        {
+            case 1:  mapped = reinhardMap(hdrCol * exposure); break;
+            case 2:  mapped = cinematicMap(hdrCol, exposure); break;
+            default: mapped = exposureMap(hdrCol, exposure); break;
+        }
+
+        if (vignette)
+        {
+            vec2 d = uv - 0.5f;
+            mapped *= 1.0f - vignetteStrength * smoothstep(0.2f, 0.8f, dot(d, d) * 2.0f);
+        }
+
+        if (gammaCorrection)
+            mapped = pow(mapped, vec3(1.0 / gamma)); //gamma correction
+
+        imageStore(outputImage, pixel, vec4(mapped, 1.0f));
     }
     )";
 
-    const char* fsBright = R"(
+    //BLOOM (mip chain, mip 0 is half res) ---------------------------------------------------
+    //13 tap downsample (Jimenez 2014, CoD: Advanced Warfare). The source texels for the whole 8x8
+    //output tile (+2 texel border) are fetched once into shared memory, every tap is then a 2x2 box from there.
+    const char* csBloomDownsample = R"(
     #version 450 core
-    out vec4 FragColor;
-        
-    in vec2 TexCoords;
-        
-    uniform sampler2D hdrScene; //0
+    layout(local_size_x = 8, local_size_y = 8) in;
+
+    uniform sampler2D source;                                           //0
+    layout(binding = 0) uniform writeonly image2D destination; //mip being written (format from glBindImageTexture)
+
+    uniform int sourceLevel;
+    uniform ivec2 sourceSize;       //used part of the source level (dynamic resolution)
+    uniform bool firstPass;         //hdr scene -> mip 0: threshold + karis average
     uniform float bloomThreshold;
-    
-    void main()
+
+    const int TILE = 8;
+    const int SHARED_SIZE = TILE * 2 + 4; //20x20 source texels per 8x8 outputs
+    shared vec3 tile[SHARED_SIZE][SHARED_SIZE];
+
+    //bilinear tap at a source texel corner = average of the 4 texels around it
+    vec3 Box(ivec2 lid, ivec2 offset)
     {
-        vec3 scene = texture(hdrScene, TexCoords).rgb;
-        float luminance = dot(scene, vec3(0.2126, 0.7152, 0.0722));   
-        
-        vec3 result = luminance > bloomThreshold ? scene : vec3(0);    
-        FragColor = vec4(result, 1.0f);
+        ivec2 p = 2 * lid + offset + 2;
+        return 0.25f * (tile[p.y][p.x] + tile[p.y][p.x + 1] + tile[p.y + 1][p.x] + tile[p.y + 1][p.x + 1]);
     }
- 
-    )";
 
-    const char* fsBlur = R"(
-    #version 450 core
-    out vec4 FragColor;
-        
-    in vec2 TexCoords;
-        
-    uniform sampler2D scene;
-    uniform bool horizontal;
+    float KarisWeight(vec3 c)
+    {
+        return 1.0f / (1.0f + dot(c, vec3(0.2126f, 0.7152f, 0.0722f)));
+    }
 
-    float weights[5] = float[] (0.227027f, 0.1945946f, 0.1216216f, 0.054054f, 0.016216f); //gaussian
-        
     void main()
     {
-        vec2 texOffset = 1.0f / textureSize(scene, 0); //size of one texel
-        vec3 result = vec3(0.0f);
-            
-        //Contribution of the current fragment
-        result += texture(scene, TexCoords).rgb * weights[0];
-            
-        if (horizontal)
+        ivec2 base = ivec2(gl_WorkGroupID.xy) * TILE * 2 - 2;
+
+        //cooperative load, 64 threads -> 400 texels
+        for (uint t = gl_LocalInvocationIndex; t < uint(SHARED_SIZE * SHARED_SIZE); t += uint(TILE * TILE))
         {
-            for (int i = 1; i < 5; i++)
+            ivec2 s = ivec2(int(t) % SHARED_SIZE, int(t) / SHARED_SIZE);
+            vec3 c = texelFetch(source, clamp(base + s, ivec2(0), sourceSize - 1), sourceLevel).rgb;
+
+            if (firstPass)
             {
-                vec2 currentSampleOffset = vec2(texOffset.x * i, 0.0f);
-                result += texture(scene, TexCoords + currentSampleOffset).rgb * weights[i];
-                result += texture(scene, TexCoords - currentSampleOffset).rgb * weights[i];
+                float luminance = dot(c, vec3(0.2126f, 0.7152f, 0.0722f));
+                c = luminance > bloomThreshold ? c : vec3(0.0f);
             }
+
+            tile[s.y][s.x] = c;
         }
-        else
+        barrier();
+
+        ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+        if (any(greaterThanEqual(dst, imageSize(destination)))) return;
+
+        ivec2 lid = ivec2(gl_LocalInvocationID.xy);
+
+        //  a . b . c
+        //  . j . k .
+        //  d . e . f
+        //  . l . m .
+        //  g . h . i
+        vec3 a = Box(lid, ivec2(-2, -2));
+        vec3 b = Box(lid, ivec2( 0, -2));
+        vec3 c = Box(lid, ivec2( 2, -2));
+        vec3 d = Box(lid, ivec2(-2,  0));
+        vec3 e = Box(lid, ivec2( 0,  0));
+        vec3 f = Box(lid, ivec2( 2,  0));
+        vec3 g = Box(lid, ivec2(-2,  2));
+        vec3 h = Box(lid, ivec2( 0,  2));
+        vec3 i = Box(lid, ivec2( 2,  2));
+        vec3 j = Box(lid, ivec2(-1, -1));
+        vec3 k = Box(lid, ivec2( 1, -1));
+        vec3 l = Box(lid, ivec2(-1,  1));
+        vec3 m = Box(lid, ivec2( 1,  1));
+
+        //5 overlapping 2x2 groups. center gets 0.5, corners 0.125 each
+        vec3 groups[5] = vec3[](
+            (j + k + l + m) * 0.25f,
+            (a + b + d + e) * 0.25f,
+            (b + c + e + f) * 0.25f,
+            (d + e + g + h) * 0.25f,
+            (e + f + h + i) * 0.25f
+        );
+        float groupWeights[5] = float[](0.5f, 0.125f, 0.125f, 0.125f, 0.125f);
+
+        vec3 result = vec3(0.0f);
+        float total = 0.0f;
+        for (int n = 0; n < 5; n++)
+        {
+            //karis average on the first downsample stops single bright pixels from flickering
+            float w = groupWeights[n] * (firstPass ? KarisWeight(groups[n]) : 1.0f);
+            result += groups[n] * w;
+            total += w;
+        }
+
+        imageStore(destination, dst, vec4(result / total, 1.0f));
+    }
+    )";
+
+    //3x3 tent upsample of mip (level + 1), added onto mip (level)
+    const char* csBloomUpsample = R"(
+    #version 450 core
+    layout(local_size_x = 8, local_size_y = 8) in;
+
+    uniform sampler2D bloomMips;                                //0, downsample chain
+    uniform sampler2D source;                                   //1, the level below: the downsample chain's smallest, then this chain's
+    layout(binding = 0) uniform writeonly image2D destination;  //upsample chain level sourceLevel - 1 (format from glBindImageTexture)
+
+    uniform int sourceLevel; //destination level + 1. nothing read in a dispatch is written in it, the chains ping-pong
+
+    void main()
+    {
+        ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+        ivec2 size = imageSize(destination);
+        if (any(greaterThanEqual(dst, size))) return;
+
+        vec2 uv = (vec2(dst) + 0.5f) / vec2(size);
+        vec2 texel = 1.0f / vec2(textureSize(bloomMips, sourceLevel));
+
+        //  1 2 1
+        //  2 4 2  / 16
+        //  1 2 1
+        vec3 result = vec3(0.0f);
+        for (int y = -1; y <= 1; y++)
         {
-            for (int i = 1; i < 5; i++)
+            for (int x = -1; x <= 1; x++)
             {
-                vec2 currentSampleOffset = vec2(0.0f, texOffset.y * i);
-                result += texture(scene, TexCoords + currentSampleOffset).rgb * weights[i];
-                result += texture(scene, TexCoords - currentSampleOffset).rgb * weights[i];
+                float w = float((2 - abs(x)) * (2 - abs(y)));
+                result += textureLod(source, uv + vec2(x, y) * texel, float(sourceLevel)).rgb * w;
             }
         }
+        result /= 16.0f;
 
-        FragColor = vec4(result, 1.0f);
+        vec3 current = texelFetch(bloomMips, dst, sourceLevel - 1).rgb;
+        imageStore(destination, dst, vec4(current + result, 1.0f));
     }
- 
     )";
 
     const char* vsDirShadow = R"(
@@ -1396,17 +1704,31 @@ namespace ShaderSources
     }
     )";
 
+    //one instance per quadtree node picked this frame (TerrainQuadtree), the 4 vertices are the patch corners
     const char* vsTerrain = R"(
     #version 450 core
-    layout (location = 0) in vec3 aPos;
-    layout (location = 1) in vec2 aTexCoords;
+    layout (location = 0) in vec2 aCorner;     //TL (0,0), TR (1,0), BL (0,1), BR (1,1)
+    layout (location = 1) in vec4 aNode;       //x0, z0, size (model space)
+    layout (location = 2) in vec4 aNeighbors;  //coarser neighbor size / size: left, top, right, bottom
+    layout (location = 3) in vec2 aHeights;    //min/max height under the node
+
+    uniform vec2 halfExtent; //the heightmap covers [-halfExtent, halfExtent] in model xz, one texel per unit
 
     out vec2 TexCoords_VS_OUT;
+    out vec4 Node_VS_OUT;
+    out vec4 Neighbors_VS_OUT;
+    out vec2 Heights_VS_OUT;
 
     void main()
     {
-        TexCoords_VS_OUT = aTexCoords;
-	    gl_Position = vec4(aPos, 1.0f);
+        //nodes on the far edge can stick out of the heightmap (the root is a power of two)
+        vec2 xz = clamp(aNode.xy + aCorner * aNode.z, -halfExtent, halfExtent);
+
+        TexCoords_VS_OUT = (xz + halfExtent) / (2.0f * halfExtent);
+        Node_VS_OUT = aNode;
+        Neighbors_VS_OUT = aNeighbors;
+        Heights_VS_OUT = aHeights;
+	    gl_Position = vec4(xz.x, 0.0f, xz.y, 1.0f);
     }
     )";
 
@@ -1417,25 +1739,74 @@ namespace ShaderSources
 
     in vec2 TexCoords_VS_OUT[]; //since were working in patches
     out vec2 TexCoords_TCS_OUT[]; //likewise
-            
-    const int MIN_TESS_LEVEL = 16;
-    const int MAX_TESS_LEVEL = 64;
-    const float MIN_DISTANCE = 15.0f;
-    const float MAX_DISTANCE = 200.0f;
 
+    //same for every corner
+    in vec4 Node_VS_OUT[];
+    in vec4 Neighbors_VS_OUT[];
+    in vec2 Heights_VS_OUT[];
+
+    //same as TERRAIN_MIN/MAX_TESS_LEVEL, TERRAIN_HEIGHT_SCALE/OFFSET
+    const float MIN_TESS_LEVEL = 4.0f;
+    const float MAX_TESS_LEVEL = 64.0f;
+    const float heightScale = 64.0f;
+    const float heightOffset = -16.0f;
+
+    uniform sampler2D heightMap;
     uniform mat4 model;
-    uniform mat4 view;
+    uniform vec3 viewPos;
+    uniform vec4 frustumPlanes[6];  //world space, normals point inwards
+    uniform float pixelsPerUnit;    //render target pixels covered by one unit at distance 1
+    uniform float targetEdgePixels;
+    uniform vec2 halfExtent;
 
-    void main()
+    vec3 WorldPoint(vec2 xz)
+    {
+        xz = clamp(xz, -halfExtent, halfExtent);
+        float height = textureLod(heightMap, (xz + halfExtent) / (2.0f * halfExtent), 0.0f).r * heightScale + heightOffset;
+        return vec3(model * vec4(xz.x, height, xz.y, 1.0f));
+    }
+
+    //screen size of the edge (at its middle) / target, rounded up to a power of two so halves of a coarser edge line up
+    float EdgeLevel(vec2 a, vec2 b)
+    {
+        vec3 pa = WorldPoint(a);
+        vec3 pb = WorldPoint(b);
+        float pixels = distance(pa, pb) * pixelsPerUnit / max(distance(viewPos, (pa + pb) * 0.5f), 1e-3f);
+        return exp2(ceil(log2(clamp(pixels / targetEdgePixels, MIN_TESS_LEVEL, MAX_TESS_LEVEL))));
+    }
+
+    //edge starting at a along axis. next to a node ratio times bigger, that node's whole edge picks the level
+    //(both sides compute the same one) and this edge takes its share
+    float SharedEdgeLevel(vec2 a, vec2 axis, float size, float ratio)
+    {
+        float coarseSize = size * ratio;
+        float along = dot(a + halfExtent, axis);
+        vec2 start = a - axis * (along - floor(along / coarseSize) * coarseSize);
+        return max(EdgeLevel(start, start + axis * coarseSize) / ratio, 1.0f);
+    }
+
+    bool PatchVisible(vec4 node, vec2 heights)
     {
-        //NOTE: gl_in[] is a built-in, read-only array that contains all the vertices of the current patch. 
-        //      (the data includes position and other per-vertex attributes)
+        vec2 lo = clamp(node.xy, -halfExtent, halfExtent);
+        vec2 hi = clamp(node.xy + node.z, -halfExtent, halfExtent);
+
+        //model space box -> world space center + extents
+        mat3 m = mat3(model);
+        mat3 absM = mat3(abs(m[0]), abs(m[1]), abs(m[2]));
+        vec3 center = vec3(model * vec4((lo.x + hi.x) * 0.5f, (heights.x + heights.y) * 0.5f, (lo.y + hi.y) * 0.5f, 1.0f));
+        vec3 extents = absM * (vec3(hi.x - lo.x, heights.y - heights.x, hi.y - lo.y) * 0.5f);
+
+        for (int i = 0; i < 6; i++)
+        {
+            vec3 n = frustumPlanes[i].xyz;
+            if (dot(n, center) + frustumPlanes[i].w + dot(abs(n), extents) < 0.0f) return false;
+        }
+        return true;
+    }
 
-        //NOTE:  gl_in[0] : TL WORLD
-        //       gl_in[1] : TR WORLD
-        //       gl_in[2] : BL WORLD
-        //       gl_in[3] : BR WORLD
-        //           Since we defined them in this order in vertex buffer creation. (See cpp code)
+    void main()
+    {
+        //NOTE:  gl_in[0] : TL, gl_in[1] : TR, gl_in[2] : BL, gl_in[3] : BR (see vsTerrain)
 
         //pass through
         gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;
@@ -1445,38 +1816,32 @@ namespace ShaderSources
         //0 controls tessellation level
         if (gl_InvocationID == 0)
         {
-            //TL WORLD
-            vec4 viewSpacePos00 = view * model * gl_in[0].gl_Position; //see note but this is the position of a vertex of the current patch
-            //TR WORLD
-            vec4 viewSpacePos01 = view * model * gl_in[1].gl_Position;
-            //BL WORLD
-            vec4 viewSpacePos10 = view * model * gl_in[2].gl_Position;
-            //BR WORLD
-            vec4 viewSpacePos11 = view * model * gl_in[3].gl_Position;
-                
-            //note: distance from the camera [0,1]
-            //TL WORLD
-            float distance00 = clamp((abs(viewSpacePos00.z) - MIN_DISTANCE) / (MAX_DISTANCE - MIN_DISTANCE), 0.0f, 1.0f);
-            //TR WORLD
-            float distance01 = clamp((abs(viewSpacePos01.z) - MIN_DISTANCE) / (MAX_DISTANCE - MIN_DISTANCE), 0.0f, 1.0f);
-            //BL WORLD
-            float distance10 = clamp((abs(viewSpacePos10.z) - MIN_DISTANCE) / (MAX_DISTANCE - MIN_DISTANCE), 0.0f, 1.0f);
-            //BR WORLD
-            float distance11 = clamp((abs(viewSpacePos11.z) - MIN_DISTANCE) / (MAX_DISTANCE - MIN_DISTANCE), 0.0f, 1.0f);
-
-            //interpolate tesselation based on closer vertex-------------------------------------------------
-                
-            //NOTE: OL-0  is left side of cube. So take the min of the distances of the TL and BL vertices.
+            vec4 node = Node_VS_OUT[0];
+            vec4 ratio = Neighbors_VS_OUT[0];
+
+            //level 0 discards the patch
+            if (!PatchVisible(node, Heights_VS_OUT[0]))
+            {
+                gl_TessLevelOuter[0] = 0.0f;
+                gl_TessLevelOuter[1] = 0.0f;
+                gl_TessLevelOuter[2] = 0.0f;
+                gl_TessLevelOuter[3] = 0.0f;
+                gl_TessLevelInner[0] = 0.0f;
+                gl_TessLevelInner[1] = 0.0f;
+                return;
+            }
+
+            //NOTE: OL-0  is left side of cube (TL, BL).
             //NOTE: refer to diagram on openGL wiki, but with 0,0 at the top left.
             //       why? Try mentally overlaying the origina diagram on flat terrain. The coords dont match.
             //       +y is tess space is like -z in world space. This is why top and bottom are swapped.
-            float tessLevel0 = mix(MAX_TESS_LEVEL, MIN_TESS_LEVEL, min(distance00, distance10));
-            //Ol-1: top. TL and TR
-            float tessLevel1 = mix(MAX_TESS_LEVEL, MIN_TESS_LEVEL, min(distance00, distance01));
-            //Ol-2: right. BR and TR
-            float tessLevel2 = mix(MAX_TESS_LEVEL, MIN_TESS_LEVEL, min(distance01, distance11));
-            //Ol-3: bottom. BL and BR
-            float tessLevel3 = mix(MAX_TESS_LEVEL, MIN_TESS_LEVEL, min(distance11, distance10));
+            //edge levels only depend on the edge itself (and the neighbor's size), so both patches along it agree
+            vec2 tl = node.xy;
+            float size = node.z;
+            float tessLevel0 = SharedEdgeLevel(tl, vec2(0.0f, 1.0f), size, ratio.x);                      //left
+            float tessLevel1 = SharedEdgeLevel(tl, vec2(1.0f, 0.0f), size, ratio.y);                      //top
+            float tessLevel2 = SharedEdgeLevel(tl + vec2(size, 0.0f), vec2(0.0f, 1.0f), size, ratio.z);   //right
+            float tessLevel3 = SharedEdgeLevel(tl + vec2(0.0f, size), vec2(1.0f, 0.0f), size, ratio.w);   //bottom
 
             gl_TessLevelOuter[0] = tessLevel0;  //left
             gl_TessLevelOuter[1] = tessLevel1;  //top  'bot' in local tessCoords
@@ -1492,7 +1857,7 @@ namespace ShaderSources
     //tesselation eval, for each tesselated vertex
     const char* tesTerrain = R"(
     #version 450 core
-    layout (quads, fractional_odd_spacing, cw) in;
+    layout (quads, equal_spacing, cw) in; //power of two levels from tcsTerrain, no fractional morphing across LOD borders
 
     uniform sampler2D heightMap;
     uniform mat4 model;
@@ -1515,6 +1880,9 @@ namespace ShaderSources
     const vec2 worldTexelSize = vec2(1.0f, 1.0f);
     //For simplicity, texturesize is equivalnt to world size.
 
+    //shared by the lit and the gbuffer terrain programs, depth has to match for the prepass
+    invariant gl_Position;
+
     void main()
     {
         //get tess coords [0,1]
@@ -1605,72 +1973,429 @@ namespace ShaderSources
     }
     )";
 
-    const char* fsTerrain = R"(
+    //terrain in shadow maps: the quadtree's shadow grid (TerrainQuadtree::GetShadowPatches), equal nodes over the whole map,
+    //tessellated for the shadow map's texels instead of the screen's. equal sizes, so an edge's level only depends on the edge
+    const char* tcsTerrainShadow = R"(
     #version 450 core
+    layout (vertices = 4) out;
 
-    in float Height;
-    in vec3 Normal;
+    in vec2 TexCoords_VS_OUT[];
+    out vec2 TexCoords_TCS_OUT[];
 
-    out vec4 FragColor;
+    in vec4 Node_VS_OUT[];
+    in vec2 Heights_VS_OUT[];
 
-    void main()
+    //same as TERRAIN_MAX_TESS_LEVEL, TERRAIN_HEIGHT_SCALE/OFFSET
+    const float MAX_TESS_LEVEL = 64.0f;
+    const float heightScale = 64.0f;
+    const float heightOffset = -16.0f;
+
+    uniform sampler2D heightMap;
+    uniform mat4 model;
+    uniform vec4 frustumPlanes[6];  //the shadow map's, world space, normals point inwards
+    uniform bool perspective;       //point light face, else a cascade (orthographic: texel size is the same everywhere)
+    uniform vec3 lightPos;          //perspective only
+    uniform float texelsPerUnit;    //shadow map texels covered by one unit (at distance 1 when perspective)
+    uniform float targetEdgeTexels;
+    uniform vec2 halfExtent;
+
+    vec3 WorldPoint(vec2 xz)
     {
-        float h = (Height + 16)/64.0f;
-        //FragColor = vec4(h, h, h, 1.0);
-        FragColor = vec4(Normal, 1.0);
-    }             
-    )";
+        xz = clamp(xz, -halfExtent, halfExtent);
+        float height = textureLod(heightMap, (xz + halfExtent) / (2.0f * halfExtent), 0.0f).r * heightScale + heightOffset;
+        return vec3(model * vec4(xz.x, height, xz.y, 1.0f));
+    }
 
-    const char* vsGeometryPass = R"(
-    #version 450 core
+    float EdgeLevel(vec2 a, vec2 b)
+    {
+        vec3 pa = WorldPoint(a);
+        vec3 pb = WorldPoint(b);
+        float texels = distance(pa, pb) * texelsPerUnit;
+        if (perspective) texels /= max(distance(lightPos, (pa + pb) * 0.5f), 1e-3f);
+        return exp2(ceil(log2(clamp(texels / targetEdgeTexels, 1.0f, MAX_TESS_LEVEL))));
+    }
 
-    layout (location = 0) in vec3 aPos;
-    layout (location = 1) in vec3 aNormal;
+    bool PatchVisible(vec4 node, vec2 heights)
+    {
+        vec2 lo = clamp(node.xy, -halfExtent, halfExtent);
+        vec2 hi = clamp(node.xy + node.z, -halfExtent, halfExtent);
 
-    out vec3 FragPos;
-    out vec3 Normal;
+        mat3 m = mat3(model);
+        mat3 absM = mat3(abs(m[0]), abs(m[1]), abs(m[2]));
+        vec3 center = vec3(model * vec4((lo.x + hi.x) * 0.5f, (heights.x + heights.y) * 0.5f, (lo.y + hi.y) * 0.5f, 1.0f));
+        vec3 extents = absM * (vec3(hi.x - lo.x, heights.y - heights.x, hi.y - lo.y) * 0.5f);
 
-    uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
+        for (int i = 0; i < 6; i++)
+        {
+            vec3 n = frustumPlanes[i].xyz;
+            if (dot(n, center) + frustumPlanes[i].w + dot(abs(n), extents) < 0.0f) return false;
+        }
+        return true;
+    }
 
     void main()
     {
-	    //Frag pos in view space
-	    vec4 viewSpaceFragPos = view * model * vec4(aPos, 1.0f);
-	    FragPos = viewSpaceFragPos.xyz; //view space
+        gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;
+        TexCoords_TCS_OUT[gl_InvocationID] = TexCoords_VS_OUT[gl_InvocationID];
 
-	    //View space normal matrix
-	    mat3 normalMatrix = transpose(inverse(mat3(view * model)));
-	    Normal = normalMatrix * aNormal; //view space
+        if (gl_InvocationID == 0)
+        {
+            vec4 node = Node_VS_OUT[0];
+
+            //level 0 discards the patch
+            if (!PatchVisible(node, Heights_VS_OUT[0]))
+            {
+                gl_TessLevelOuter[0] = 0.0f;
+                gl_TessLevelOuter[1] = 0.0f;
+                gl_TessLevelOuter[2] = 0.0f;
+                gl_TessLevelOuter[3] = 0.0f;
+                gl_TessLevelInner[0] = 0.0f;
+                gl_TessLevelInner[1] = 0.0f;
+                return;
+            }
 
-	    gl_Position = projection * viewSpaceFragPos; //clip space
+            //same edge order as tcsTerrain
+            vec2 tl = node.xy;
+            float size = node.z;
+            float tessLevel0 = EdgeLevel(tl, tl + vec2(0.0f, size));                        //left
+            float tessLevel1 = EdgeLevel(tl, tl + vec2(size, 0.0f));                        //top
+            float tessLevel2 = EdgeLevel(tl + vec2(size, 0.0f), tl + vec2(size, size));     //right
+            float tessLevel3 = EdgeLevel(tl + vec2(0.0f, size), tl + vec2(size, size));     //bottom
+
+            gl_TessLevelOuter[0] = tessLevel0;
+            gl_TessLevelOuter[1] = tessLevel1;
+            gl_TessLevelOuter[2] = tessLevel2;
+            gl_TessLevelOuter[3] = tessLevel3;
+
+            gl_TessLevelInner[0] = max(tessLevel1, tessLevel3);
+            gl_TessLevelInner[1] = max(tessLevel0, tessLevel2);
+        }
     }
     )";
 
-    const char* fsGeometryPass = R"(
+    //position only. FragPos for fsPointShadow, fsCascadedShadow ignores it
+    const char* tesTerrainShadow = R"(
     #version 450 core
-    layout (location = 0) out vec4 gNormal;   //viewspace
-    layout (location = 1) out vec4 gPosition; //viewspace    
+    layout (quads, equal_spacing, cw) in;
 
+    uniform sampler2D heightMap;
+    uniform mat4 model;
+    uniform mat4 lightSpaceMatrix;
 
-    in vec3 FragPos;
-    in vec3 Normal;
+    const float heightScale = 64.0f;
+    const float heightOffset = -16.0f;
+
+    in vec2 TexCoords_TCS_OUT[];
+
+    out vec3 FragPos;
 
     void main()
     {
-        gNormal = vec4(normalize(Normal), 1.0f);
-        gPosition = vec4(FragPos, 1.0f);
-    }             
+        float u = gl_TessCoord.x;
+        float v = gl_TessCoord.y;
+
+        vec2 t0 = mix(TexCoords_TCS_OUT[0], TexCoords_TCS_OUT[1], u);
+        vec2 t1 = mix(TexCoords_TCS_OUT[2], TexCoords_TCS_OUT[3], u);
+        vec2 texCoord = mix(t0, t1, v);
+
+        //corners are flat model space points (vsTerrain), the height goes up +y
+        vec4 p0 = mix(gl_in[0].gl_Position, gl_in[1].gl_Position, u);
+        vec4 p1 = mix(gl_in[2].gl_Position, gl_in[3].gl_Position, u);
+        vec4 position = mix(p0, p1, v);
+        position.y = textureLod(heightMap, texCoord, 0.0f).r * heightScale + heightOffset;
+
+        FragPos = vec3(model * position);
+        gl_Position = lightSpaceMatrix * vec4(FragPos, 1.0f);
+    }
     )";
 
-    const char* vsSSAO = R"(
+    //terrain mesh mode (TerrainMesh): the quadtree's cut as plain vertices, a (resolution + 1)^2 grid per patch.
+    //edge vertices next to a coarser patch sit on its edge (between its vertices), so there are no cracks. same
+    //heights, texcoords and normals as tesTerrain, drawn by vs1/vsGeometryPass and the shadow programs
+    const char* csTerrainMesh = R"(
     #version 450 core
-    
-    layout (location = 0) in vec3 aPos;
-    layout (location = 1) in vec2 aTexCoords;
-    
-    out vec2 TexCoords;
+    layout (local_size_x = 8, local_size_y = 8) in; //one vertex each, z = patch
+
+    struct TerrainPatch //TerrainPatchGPU
+    {
+        vec4 node;      //x0, z0, size (model space)
+        vec4 neighbors; //coarser neighbor size / size: left, top, right, bottom
+        vec4 heights;
+    };
+    layout(std430, binding = 18) readonly buffer Patches { TerrainPatch patches[]; };
+    layout(std430, binding = 19) writeonly buffer Vertices { float vertices[]; }; //position, normal, texcoords, tangent
+
+    //same as TERRAIN_MESH_PATCH_RESOLUTION, TERRAIN_HEIGHT_SCALE/OFFSET
+    const uint resolution = 32;
+    const float heightScale = 64.0f;
+    const float heightOffset = -16.0f;
+
+    uniform sampler2D heightMap;
+    uniform vec2 halfExtent;
+
+    float Height(vec2 xz)
+    {
+        xz = clamp(xz, -halfExtent, halfExtent);
+        return textureLod(heightMap, (xz + halfExtent) / (2.0f * halfExtent), 0.0f).r * heightScale + heightOffset;
+    }
+
+    //xz on an edge along axis, the neighbor's vertices are coarseStep apart (counted from the map's corner like the nodes).
+    //its triangles have a straight edge between them, take the height on that line
+    float EdgeHeight(vec2 xz, vec2 axis, float coarseStep)
+    {
+        float along = dot(xz + halfExtent, axis);
+        float start = floor(along / coarseStep) * coarseStep;
+        float end = min(start + coarseStep, dot(2.0f * halfExtent, axis)); //the last one is clamped to the map
+        vec2 across = xz - axis * dot(xz, axis);
+        float h0 = Height(across + axis * (start - dot(halfExtent, axis)));
+        float h1 = Height(across + axis * (end - dot(halfExtent, axis)));
+        return mix(h0, h1, clamp((along - start) / max(end - start, 1e-6f), 0.0f, 1.0f));
+    }
+
+    void WriteVec(uint base, vec3 v)
+    {
+        vertices[base + 0] = v.x;
+        vertices[base + 1] = v.y;
+        vertices[base + 2] = v.z;
+    }
+
+    void main()
+    {
+        uvec2 id = gl_GlobalInvocationID.xy;
+        if (id.x > resolution || id.y > resolution) return;
+
+        TerrainPatch p = patches[gl_GlobalInvocationID.z];
+        float step = p.node.z / float(resolution);
+        vec2 xz = clamp(p.node.xy + vec2(id) * step, -halfExtent, halfExtent);
+
+        float height = Height(xz);
+        if (id.x == 0 && p.neighbors.x > 1.0f)               height = EdgeHeight(xz, vec2(0.0f, 1.0f), step * p.neighbors.x);
+        else if (id.x == resolution && p.neighbors.z > 1.0f) height = EdgeHeight(xz, vec2(0.0f, 1.0f), step * p.neighbors.z);
+        else if (id.y == 0 && p.neighbors.y > 1.0f)          height = EdgeHeight(xz, vec2(1.0f, 0.0f), step * p.neighbors.y);
+        else if (id.y == resolution && p.neighbors.w > 1.0f) height = EdgeHeight(xz, vec2(1.0f, 0.0f), step * p.neighbors.w);
+
+        //finite differences one texel apart, same as tesTerrain
+        float height_L = Height(xz - vec2(1.0f, 0.0f));
+        float height_R = Height(xz + vec2(1.0f, 0.0f));
+        float height_B = Height(xz - vec2(0.0f, 1.0f));
+        float height_T = Height(xz + vec2(0.0f, 1.0f));
+        vec3 tangentU = vec3(2.0f, height_R - height_L, 0.0f);
+        vec3 tangentV = vec3(0.0f, height_T - height_B, -2.0f);
+        vec3 normal = normalize(cross(tangentU, tangentV));
+        vec3 tangent = normalize(tangentU - dot(tangentU, normal) * normal);
+
+        uint base = (gl_GlobalInvocationID.z * (resolution + 1) * (resolution + 1) + id.y * (resolution + 1) + id.x) * 11;
+        WriteVec(base, vec3(xz.x, height, xz.y));
+        WriteVec(base + 3, normal);
+        vec2 texCoords = (xz + halfExtent) / (2.0f * halfExtent);
+        vertices[base + 6] = texCoords.x;
+        vertices[base + 7] = texCoords.y;
+        WriteVec(base + 8, tangent);
+    }
+    )";
+
+    const char* fsTerrain = R"(
+    #version 450 core
+
+    in float Height;
+    in vec3 Normal;
+
+    out vec4 FragColor;
+
+    void main()
+    {
+        float h = (Height + 16)/64.0f;
+        //FragColor = vec4(h, h, h, 1.0);
+        FragColor = vec4(Normal, 1.0);
+    }             
+    )";
+
+    //clipmap terrain (ClipmapTerrain): one instance per block of a level's window, vertices sit on that level's samples.
+    //heights are blended into the next level toward the window edge so the levels meet without cracks
+    const char* vsTerrainClipmap = R"(
+    #version 450 core
+    layout (location = 0) in vec2 aGrid;   //vertex in the block, 0..CLIPMAP_TILE_SIZE / 2
+    layout (location = 1) in vec4 aBlock;  //block origin (level samples), level
+
+    uniform sampler2DArray heightLevels;   //R16, layer per level. toroidal: sample s is texel s mod size
+    uniform ivec2 windowOrigin[10];        //CLIPMAP_MAX_LEVELS, level samples
+    uniform int windowSamples;             //CLIPMAP_WINDOW_TILES * CLIPMAP_TILE_SIZE
+    uniform int coarsestLevel;             //drawn as is
+    uniform float morphWidth;
+    uniform vec2 halfExtent;               //level 0 samples cover [-halfExtent, halfExtent] in model xz, one per unit
+    uniform vec2 mapSize;                  //level 0 samples
+    uniform mat4 model;
+    uniform mat4 view;
+    uniform mat4 projection;
+
+    const float heightScale = 64.0f;
+    const float heightOffset = -16.0f;
+
+    out vec2 TexCoords;
+    out vec3 Normal;
+    out vec3 FragPos;
+    out mat3 TBN;
+    out vec4 FragPosClipSpace;
+
+    //shared by the lit and the gbuffer clipmap programs, depth has to match for the prepass
+    invariant gl_Position;
+
+    float Fetch(int level, ivec2 s)
+    {
+        s = clamp(s, windowOrigin[level], windowOrigin[level] + windowSamples);
+        ivec2 size = textureSize(heightLevels, 0).xy;
+        return texelFetch(heightLevels, ivec3(s % size, level), 0).r * heightScale + heightOffset;
+    }
+
+    float Height(int level, ivec2 s)
+    {
+        float h = Fetch(level, s);
+        if (level >= coarsestLevel) return h;
+
+        ivec2 o = windowOrigin[level];
+        ivec2 d = min(s - o, o + windowSamples - s);
+        float alpha = clamp(1.0f - float(min(d.x, d.y)) / morphWidth, 0.0f, 1.0f);
+        if (alpha == 0.0f) return h;
+
+        //the coarser level's surface here: its samples at s / 2, odd samples halfway between two like its triangle edges
+        ivec2 c0 = s >> 1;
+        ivec2 c1 = (s + 1) >> 1;
+        float coarse = 0.25f * (Fetch(level + 1, c0) + Fetch(level + 1, ivec2(c1.x, c0.y)) +
+                                Fetch(level + 1, ivec2(c0.x, c1.y)) + Fetch(level + 1, c1));
+        return mix(h, coarse, alpha);
+    }
+
+    void main()
+    {
+        int level = int(aBlock.z);
+        ivec2 s = ivec2(aBlock.xy) + ivec2(aGrid);
+        float spacing = float(1 << level);
+
+        vec2 xz = vec2(s) * spacing - halfExtent;
+        vec4 position = vec4(xz.x, Height(level, s), xz.y, 1.0f);
+
+        //NORMAL - finite differences over the blended neighbors, one sample apart
+        float height_L = Height(level, s - ivec2(1, 0));
+        float height_R = Height(level, s + ivec2(1, 0));
+        float height_B = Height(level, s - ivec2(0, 1)); //-z
+        float height_T = Height(level, s + ivec2(0, 1)); //+z
+
+        vec3 normalLocal = vec3(height_L - height_R, 2.0f * spacing, height_B - height_T);
+        vec3 tangentLocal = vec3(2.0f * spacing, height_R - height_L, 0.0f);
+
+        mat3 normalMatrix = transpose(inverse(mat3(model)));
+        vec3 worldNormal = normalize(normalMatrix * normalLocal);
+        vec3 worldTangent = normalize(mat3(model) * tangentLocal);
+        worldTangent = normalize(worldTangent - dot(worldTangent, worldNormal) * worldNormal);
+        vec3 worldBiTangent = cross(worldNormal, worldTangent);
+
+        //FINAL OUT VALUES
+        gl_Position = projection * view * model * position;
+        FragPos = vec3(model * position);
+        Normal = worldNormal;
+        TexCoords = vec2(s) * spacing / mapSize;
+        TBN = mat3(worldTangent, worldBiTangent, worldNormal);
+        FragPosClipSpace = gl_Position;
+    }
+    )";
+
+    const char* vsGeometryPass = R"(
+    #version 450 core
+
+    layout (location = 0) in vec3 aPos;
+    layout (location = 1) in vec3 aNormal;
+
+    out vec3 Normal;
+    out vec3 WorldPos; //velocity (TAA)
+
+    uniform mat4 model;
+    uniform mat4 view;
+    uniform mat4 projection;
+
+    //depth prepass: must match vs1 bit for bit for GL_EQUAL
+    invariant gl_Position;
+
+    void main()
+    {
+        WorldPos = vec3(model * vec4(aPos, 1.0f));
+
+	    //View space normal matrix
+	    mat3 normalMatrix = transpose(inverse(mat3(view * model)));
+	    Normal = normalMatrix * aNormal; //view space
+
+	    gl_Position = projection * view * model * vec4(aPos, 1.0); //clip space (same expression as vs1)
+    }
+    )";
+
+    //position isn't stored, it is rebuilt from the gbuffer depth
+    const char* fsGeometryPass = R"(
+    #version 450 core
+    layout (location = 0) out vec2 gNormal;   //viewspace, octahedral
+    layout (location = 1) out vec2 gVelocity; //uv delta since last frame, only attached for TAA
+
+    in vec3 Normal;
+    in vec3 WorldPos;
+
+    uniform mat4 currViewProjection; //unjittered
+    uniform mat4 prevViewProjection;
+
+    //unit vector -> octahedral [0,1]^2 (RG16)
+    vec2 EncodeNormal(vec3 n)
+    {
+        n /= abs(n.x) + abs(n.y) + abs(n.z);
+        vec2 e = n.z >= 0.0f ? n.xy : (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+        return e * 0.5f + 0.5f;
+    }
+
+    void main()
+    {
+        gNormal = EncodeNormal(normalize(Normal));
+
+        //camera motion only, draw calls don't keep last frame's model matrix
+        vec4 currClip = currViewProjection * vec4(WorldPos, 1.0f);
+        vec4 prevClip = prevViewProjection * vec4(WorldPos, 1.0f);
+        gVelocity = (currClip.xy / currClip.w - prevClip.xy / prevClip.w) * 0.5f;
+    }             
+    )";
+
+    //gbuffer pass for terrain (vsTerrain -> tcsTerrain -> tesTerrain), tesTerrain outputs are world space
+    const char* fsTerrainGeometryPass = R"(
+    #version 450 core
+    layout (location = 0) out vec2 gNormal;   //viewspace, octahedral
+    layout (location = 1) out vec2 gVelocity; //uv delta since last frame, only attached for TAA
+
+    in vec3 FragPos; //world
+    in vec3 Normal;
+
+    uniform mat4 view;
+    uniform mat4 currViewProjection; //unjittered
+    uniform mat4 prevViewProjection;
+
+    //unit vector -> octahedral [0,1]^2 (RG16)
+    vec2 EncodeNormal(vec3 n)
+    {
+        n /= abs(n.x) + abs(n.y) + abs(n.z);
+        vec2 e = n.z >= 0.0f ? n.xy : (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+        return e * 0.5f + 0.5f;
+    }
+
+    void main()
+    {
+        gNormal = EncodeNormal(normalize(mat3(view) * Normal));
+
+        vec4 currClip = currViewProjection * vec4(FragPos, 1.0f);
+        vec4 prevClip = prevViewProjection * vec4(FragPos, 1.0f);
+        gVelocity = (currClip.xy / currClip.w - prevClip.xy / prevClip.w) * 0.5f;
+    }             
+    )";
+
+    const char* vsSSAO = R"(
+    #version 450 core
+    
+    layout (location = 0) in vec3 aPos;
+    layout (location = 1) in vec2 aTexCoords;
+    
+    out vec2 TexCoords;
 
     void main()
     {
@@ -1680,34 +2405,69 @@ namespace ShaderSources
             
     )";
 
+    //runs at SSAO_WIDTH x SSAO_HEIGHT. out: (raw occlusion, view z of the pixel it was computed for)
     const char* fsSSAO = R"(
     #version 450 core
     
     in vec2 TexCoords;
 
     uniform sampler2D gNormal;              //0
-    uniform sampler2D gPosition;            //1
+    uniform sampler2D gDepth;               //1
     uniform sampler2D ssaoNoiseTexture;     //2
 
     uniform vec3 samples[32];            //hemisphere vectors in tangent space
     uniform mat4 projection;
+    uniform mat4 invProjection;
     
-    uniform float screenWidth;
+    uniform float screenWidth;           //used ssao target size, not the full screen
     uniform float screenHeight;
+    uniform vec2 renderScale = vec2(1.0f);  //used corner of the gbuffer
+
+    uniform int samplesPerFrame;         //SSAO_SAMPLES_PER_FRAME
+    uniform uint frameIndex;             //picks this frame's kernel subset + noise rotation
 
     float radius = 0.5f;
 
-    out float FragColor;
+    out vec2 FragColor;
+
+    vec3 ViewPosFromDepth(vec2 uv, float depth)
+    {
+        vec4 ndc = vec4(uv * 2.0f - 1.0f, depth * 2.0f - 1.0f, 1.0f);
+        vec4 view = invProjection * ndc;
+        return view.xyz / view.w;
+    }
+
+    //octahedral [0,1]^2 -> unit vector
+    vec3 DecodeNormal(vec2 e)
+    {
+        e = e * 2.0f - 1.0f;
+        vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+        float t = max(-n.z, 0.0f);
+        n.xy += vec2(n.x >= 0.0f ? -t : t, n.y >= 0.0f ? -t : t);
+        return normalize(n);
+    }
 
     void main()
     {
+        float depth = texture(gDepth, TexCoords * renderScale).r;
+
+        //nothing drawn here (depth cleared to 1)
+        if (depth == 1.0f)
+        {
+            FragColor = vec2(1.0f, 0.0f);
+            return;
+        }
+
+        vec3 fragPosView = ViewPosFromDepth(TexCoords, depth); 
+
         //The amount to scale TexCoords (currently [0,1]) by for tiling.
         vec2 noiseScale = vec2(screenWidth / 4.0f, screenHeight / 4.0f);
 
-        vec3 fragPosView = texture(gPosition, TexCoords).xyz; 
-        vec3 normalView = normalize(texture(gNormal, TexCoords).rgb);
-        //random vector with z = 0
+        vec3 normalView = DecodeNormal(texture(gNormal, TexCoords * renderScale).rg);
+        //random vector with z = 0, rotated by the golden angle every frame so the history sees new directions
         vec3 randomVec = normalize(texture(ssaoNoiseTexture, TexCoords * noiseScale).xyz);     
+        float angle = float(frameIndex) * 2.39996323f;
+        randomVec.xy = mat2(cos(angle), sin(angle), -sin(angle), cos(angle)) * randomVec.xy;
 
         vec3 tangent   = normalize(randomVec - normalView * dot(randomVec, normalView));
         vec3 bitangent = cross(normalView, tangent);
@@ -1716,9 +2476,15 @@ namespace ShaderSources
         mat3 TBN       = mat3(tangent, bitangent, normalView);  //tangent -> view
         
         float occlusion = 0.0f;
+
+        //interleaved subset: every frame gets short and long samples, all 32 are covered every (32 / samplesPerFrame) frames
+        int stride = 32 / samplesPerFrame;
+        int first = int(frameIndex % uint(stride));
         
-        for (int i = 0; i < 32; i++)
+        for (int n = 0; n < samplesPerFrame; n++)
         {
+            int i = n * stride + first;
+
             vec3 samplePosView = TBN * samples[i]; //hemisphere vector in tangent -> view-space
             samplePosView = fragPosView + samplePosView * radius; //true sample position (og frag + hemisphere vector) IN VIEWSPACE
 
@@ -1729,7 +2495,8 @@ namespace ShaderSources
             samplePosNDC.xyz  = samplePosNDC.xyz * 0.5 + 0.5; // [-1,1] -> [0,1]
             
             //get texture depth at samplePosNDC
-            float gPositionSampleDepthView = texture(gPosition, samplePosNDC.xy).z;
+            vec2 sampleUV = clamp(samplePosNDC.xy, 0.0f, 1.0f); //stay inside the used corner
+            float gPositionSampleDepthView = ViewPosFromDepth(sampleUV, texture(gDepth, sampleUV * renderScale).r).z;
             
             float rangeCheck = smoothstep(0.0, 1.0, radius / abs(fragPosView.z - gPositionSampleDepthView));
             float bias = 0.025f;
@@ -1737,38 +2504,130 @@ namespace ShaderSources
             occlusion += (gPositionSampleDepthView >= samplePosView.z + bias ? 1.0 : 0.0) * rangeCheck;
         }   
         
-        occlusion = 1.0f - (occlusion / 32); //so we can directly multiply fragment in light shader
-        float power = 3.0f;
-	    FragColor = pow(occlusion, power);
+        occlusion = 1.0f - (occlusion / float(samplesPerFrame)); //power is applied after accumulation (fsSSAOUpsample)
+        FragColor = vec2(occlusion, fragPosView.z);
     }        
     )";
 
+    //blends this frame's ssao into the reprojected history. out: same layout as fsSSAO
+    const char* fsSSAOTemporal = R"(
+    #version 450 core
+
+    in vec2 TexCoords;
+
+    uniform sampler2D currentAO;    //0
+    uniform sampler2D historyAO;    //1 (last frame's output)
+    uniform sampler2D gDepth;       //2
 
+    uniform mat4 invView;
+    uniform mat4 invProjection;
+    uniform mat4 prevViewProjection;
 
-    const char* fsSSAOBlur = R"(
+    uniform vec2 renderScale = vec2(1.0f);  //used corner of every input this frame
+    uniform vec2 historyScale = vec2(1.0f); //used corner of the history (last frame's renderScale)
+
+    const float blend = 0.125f;             //weight of the new frame, ~8 frames of history
+    const float depthTolerance = 0.05f;     //relative view depth difference before history is thrown away
+
+    out vec2 FragColor;
+
+    vec3 ViewPosFromDepth(vec2 uv, float depth)
+    {
+        vec4 ndc = vec4(uv * 2.0f - 1.0f, depth * 2.0f - 1.0f, 1.0f);
+        vec4 view = invProjection * ndc;
+        return view.xyz / view.w;
+    }
+
+    void main()
+    {
+        vec2 current = texture(currentAO, TexCoords * renderScale).rg;
+        if (current.g == 0.0f) //sky
+        {
+            FragColor = current;
+            return;
+        }
+
+        //where was this surface last frame
+        vec3 viewPos = ViewPosFromDepth(TexCoords, texture(gDepth, TexCoords * renderScale).r);
+        vec3 worldPos = (invView * vec4(viewPos, 1.0f)).xyz;
+        vec4 prevClip = prevViewProjection * vec4(worldPos, 1.0f);
+        vec2 prevUV = (prevClip.xy / prevClip.w) * 0.5f + 0.5f;
+
+        float ao = current.r;
+
+        if (prevClip.w > 0.0f && all(greaterThanEqual(prevUV, vec2(0.0f))) && all(lessThanEqual(prevUV, vec2(1.0f))))
+        {
+            vec2 history = texture(historyAO, prevUV * historyScale).rg;
+            float expectedZ = -prevClip.w; //view z last frame
+
+            //disocclusion: history belongs to a different surface
+            if (abs(history.g - expectedZ) < depthTolerance * abs(expectedZ))
+            {
+                ao = mix(history.r, current.r, blend);
+            }
+        }
+
+        FragColor = vec2(ao, current.g);
+    }
+    )";
+
+    //low res ssao -> full res. 3x3 low res taps weighted by how close their depth is to this pixel (no bleeding over edges)
+    const char* fsSSAOUpsample = R"(
     #version 450 core
     
     out float FragColor;
 
     in vec2 TexCoords;
     
-    uniform sampler2D ssaoTexture;
+    uniform sampler2D ssaoTexture;  //0 (occlusion, view z)
+    uniform sampler2D gDepth;       //1
+    uniform mat4 invProjection;
+    uniform vec2 renderScale = vec2(1.0f);
+
+    vec3 ViewPosFromDepth(vec2 uv, float depth)
+    {
+        vec4 ndc = vec4(uv * 2.0f - 1.0f, depth * 2.0f - 1.0f, 1.0f);
+        vec4 view = invProjection * ndc;
+        return view.xyz / view.w;
+    }
 
     void main()
     {
-        vec2 texelSize = 1.0 / vec2(textureSize(ssaoTexture, 0));
+        ivec2 pixel = ivec2(gl_FragCoord.xy);
+        float depth = texelFetch(gDepth, pixel, 0).r;
+
+        if (depth == 1.0f)
+        {
+            FragColor = 1.0f;
+            return;
+        }
+
+        float z = ViewPosFromDepth(TexCoords, depth).z;
+
+        ivec2 center = pixel * textureSize(ssaoTexture, 0) / textureSize(gDepth, 0);
+        ivec2 lowSize = ivec2(vec2(textureSize(ssaoTexture, 0)) * renderScale); //used corner
+
         float result = 0.0f;
+        float totalWeight = 0.0f;
 
-        for (int x = -2; x < 2; x++) //dont include +x and +y since noise texture is 4x4
+        for (int x = -1; x <= 1; x++)
         {
-            for (int y = -2; y < 2; y++)
+            for (int y = -1; y <= 1; y++)
             {
-                vec2 offset = vec2(float(x), float(y)) * texelSize;
-                result += texture(ssaoTexture, TexCoords + offset).r;
+                vec2 s = texelFetch(ssaoTexture, clamp(center + ivec2(x, y), ivec2(0), lowSize - 1), 0).rg;
+
+                float spatial = 1.0f / float((1 + abs(x)) * (1 + abs(y)));  //1, 0.5, 0.25
+                float depth = exp(-abs(s.g - z) / (0.02f * abs(z)));         //relative so it works at any distance
+                float w = spatial * depth;
+
+                result += s.r * w;
+                totalWeight += w;
             }
         }
 
-        FragColor = result / (4.0f * 4.0f); //noise texture dimensions
+        float occlusion = totalWeight > 1e-4f ? result / totalWeight : texelFetch(ssaoTexture, center, 0).r;
+        float power = 3.0f;
+        FragColor = pow(occlusion, power);
     }
     )";
 
@@ -1943,27 +2802,49 @@ namespace ShaderSources
     }
     )";
 
-    const char* csParticle = R"(
+    //particle pool (ParticleSystem). every shader sees the same buffers:
+    //5 particles, 6 alive list read this frame, 7 alive list written this frame, 8 dead list, 9 counters, 10 spawn requests
+    const char* csParticleEmit = R"(
     #version 450 core
     
-    layout(local_size_x = 1024) in;
+    layout(local_size_x = 256) in;
 
     struct Particle
     {
         vec4 posLife;
-        vec4 velActive;
+        vec4 velocity;
     };
 
-    layout(std430, binding = 1) buffer Particles
+    struct SpawnRequest
     {
-        Particle particles[];
+        mat4 model;
+        float maxLife;
+        float speed;
+        uint count;
+        uint offset;    //first thread of this request
+        uint emitter;   //gpu state slot, carried by the particle
+    };
+
+    layout(std430, binding = 5) buffer Particles { Particle particles[]; };
+    layout(std430, binding = 6) buffer AliveList { uint alive[]; };
+    layout(std430, binding = 8) buffer DeadList { uint dead[]; };
+    //alive lists: particles of visible emitters at the front (drawn), the rest at the back (from maxParticles - 1 down)
+    layout(std430, binding = 9) buffer ParticleCounters
+    {
+        int aliveCount;         //front + back of the list read this frame
+        int hiddenCountNext;    //back of the list being written
+        int deadCount;
+        uint freshCount;        //indices never used yet start here
+        uint simulateGroups[3]; //DispatchIndirectCommand, byte 16
+        int visibleCountNext;   //front of the list being written
+        uint drawArgs[4];       //DrawArraysIndirectCommand, byte 32. drawArgs[1] = front of the list read this frame
     };
+    layout(std430, binding = 10) readonly buffer SpawnRequests { SpawnRequest requests[]; };
 
-    uniform float dt;
-    uniform vec3 emitterPosition = vec3(0.0f, 0.0f, 0.0f); //model space
-    uniform float maxLife;
-    uniform float particleSpeed = 20.0f;
-    uniform bool doneEmitting;
+    uniform uint requestCount;
+    uniform uint totalSpawns;
+    uniform uint seed;          //different every frame
+    uniform uint maxParticles;
 
     uint WangHash(uint x)
     {
@@ -1983,192 +2864,722 @@ namespace ShaderSources
     void main()
     {
         uint id = gl_GlobalInvocationID.x;
-        
-        particles[id].posLife.w -= dt;
+        if (id >= totalSpawns) return;
+
+        //request this thread belongs to (offsets ascend)
+        uint lo = 0;
+        uint hi = requestCount - 1;
+        while (lo < hi)
+        {
+            uint mid = (lo + hi + 1) / 2;
+            if (requests[mid].offset <= id) lo = mid;
+            else hi = mid - 1;
+        }
+        SpawnRequest r = requests[lo];
 
-        //particle is dead
-        if (particles[id].posLife.w <= 0.0f)
+        //take a dead particle, else one never used. pool full: the spawn is dropped
+        uint index;
+        int d = atomicAdd(deadCount, -1);
+        if (d > 0)
+        {
+            index = dead[d - 1];
+        }
+        else
         {
-            if (!doneEmitting)
+            atomicAdd(deadCount, 1);
+            index = atomicAdd(freshCount, 1u);
+            if (index >= maxParticles)
             {
-                uint seed = id + gl_WorkGroupID.x * 256;
-                //respawn it
-                particles[id].posLife.xyz = emitterPosition;
-                particles[id].posLife.w = maxLife;
-            
-                //give it a random velocity
-                vec3 rnd;
-                rnd.x = Random(seed + 1) * 2.0f - 1.0f; //[-1,1]
-                rnd.y = Random(seed + 2) + 0.75;        //[0,1]
-                rnd.z = Random(seed + 3) * 2.0f - 1.0f; //[-1,1]
-
-                particles[id].velActive.xyz = normalize(rnd) * particleSpeed * Random(seed + 4); 
-                particles[id].velActive.w = 1.0f;
+                atomicMin(freshCount, maxParticles); //keep it from creeping up while full
+                return;
             }
-            else
+        }
+
+        uint s = WangHash(id + seed * 0x9E3779B9u);
+
+        //random velocity in the emitter's space (like before, mostly up)
+        vec3 rnd;
+        rnd.x = Random(s + 1) * 2.0f - 1.0f; //[-1,1]
+        rnd.y = Random(s + 2) + 0.75;        //[0,1]
+        rnd.z = Random(s + 3) * 2.0f - 1.0f; //[-1,1]
+
+        //simulated in world space so every emitter can share the pool
+        particles[index].posLife = vec4(r.model[3].xyz, r.maxLife);
+        particles[index].velocity = vec4(mat3(r.model) * (normalize(rnd) * r.speed * Random(s + 4)), uintBitsToFloat(r.emitter));
+
+        //new particles always go to the front, simulation moves the ones of hidden emitters to the back
+        alive[atomicAdd(drawArgs[1], 1u)] = index;
+
+        //keep the simulate dispatch args at ceil(aliveCount / 256)
+        int slot = atomicAdd(aliveCount, 1);
+        if (slot % 256 == 0) atomicAdd(simulateGroups[0], 1u);
+    }
+    )";
+    //after simulation: the written alive list becomes next frame's, and the indirect args are built from its size
+    const char* csParticleFinish = R"(
+    #version 450 core
+    
+    layout(local_size_x = 1) in;
+
+    //alive lists: particles of visible emitters at the front (drawn), the rest at the back (from maxParticles - 1 down)
+    layout(std430, binding = 9) buffer ParticleCounters
+    {
+        int aliveCount;         //front + back of the list read this frame
+        int hiddenCountNext;    //back of the list being written
+        int deadCount;
+        uint freshCount;        //indices never used yet start here
+        uint simulateGroups[3]; //DispatchIndirectCommand, byte 16
+        int visibleCountNext;   //front of the list being written
+        uint drawArgs[4];       //DrawArraysIndirectCommand, byte 32. drawArgs[1] = front of the list read this frame
+    };
+
+    void main()
+    {
+        aliveCount = visibleCountNext + hiddenCountNext;
+        simulateGroups[0] = (uint(aliveCount) + 255u) / 256u;
+        drawArgs[1] = uint(visibleCountNext);
+
+        visibleCountNext = 0;
+        hiddenCountNext = 0;
+    }
+    )";
+    const char* csParticle = R"(
+    #version 450 core
+    
+    layout(local_size_x = 256) in;
+
+    struct Particle
+    {
+        vec4 posLife;
+        vec4 velocity;
+    };
+
+    layout(std430, binding = 5) buffer Particles { Particle particles[]; };
+    layout(std430, binding = 6) readonly buffer AliveList { uint aliveIn[]; };
+    layout(std430, binding = 7) writeonly buffer AliveListNext { uint aliveOut[]; };
+    layout(std430, binding = 8) buffer DeadList { uint dead[]; };
+    //alive lists: particles of visible emitters at the front (drawn), the rest at the back (from maxParticles - 1 down)
+    layout(std430, binding = 9) buffer ParticleCounters
+    {
+        int aliveCount;         //front + back of the list read this frame
+        int hiddenCountNext;    //back of the list being written
+        int deadCount;
+        uint freshCount;        //indices never used yet start here
+        uint simulateGroups[3]; //DispatchIndirectCommand, byte 16
+        int visibleCountNext;   //front of the list being written
+        uint drawArgs[4];       //DrawArraysIndirectCommand, byte 32. drawArgs[1] = front of the list read this frame
+    };
+    layout(std430, binding = 11) writeonly buffer SortKeys { uint sortKeys[]; }; //next to aliveOut, for GpuSort
+
+    //per emitter slot, filled by ParticleSystem::Simulate
+    struct EmitterState
+    {
+        float dt;       //0 = not stepped this frame (off screen emitters step every few frames)
+        uint visible;
+        float gravity;
+        float drag;
+        float restitution;
+        uint collisions;
+    };
+    layout(std430, binding = 17) readonly buffer EmitterStates { EmitterState emitters[]; };
+
+    //collisions against this frame's gbuffer (depth + viewspace normal), only where the particle is on screen
+    uniform sampler2D gDepth;
+    uniform sampler2D gNormal;
+    uniform bool collisions;    //false when no gbuffer was rendered
+    uniform mat4 view;
+    uniform mat4 projection;
+    uniform mat4 invProjection;
+    uniform vec2 renderScale;   //the gbuffer is filled in this corner
+    uniform float collisionThickness;
+
+    uniform vec3 cameraPos;
+    uniform uint maxParticles;
+
+    vec3 DecodeNormal(vec2 e)
+    {
+        e = e * 2.0f - 1.0f;
+        vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+        float t = max(-n.z, 0.0f);
+        n.xy += vec2(n.x >= 0.0f ? -t : t, n.y >= 0.0f ? -t : t);
+        return normalize(n);
+    }
+
+    //true if pos ended up behind the depth buffer, but by less than collisionThickness (else it is just occluded)
+    bool HitsDepthBuffer(vec3 pos, out vec3 normal)
+    {
+        vec4 viewPos = view * vec4(pos, 1.0f);
+        vec4 clip = projection * viewPos;
+        if (clip.w <= 0.0f) return false;
+
+        vec3 ndc = clip.xyz / clip.w;
+        if (any(greaterThan(abs(ndc.xy), vec2(1.0f)))) return false;
+
+        vec2 uv = (ndc.xy * 0.5f + 0.5f) * renderScale;
+        float depth = textureLod(gDepth, uv, 0.0f).r;
+        if (depth >= 1.0f) return false; //sky
+
+        vec4 surface = invProjection * vec4(ndc.xy, depth * 2.0f - 1.0f, 1.0f);
+        float surfaceZ = surface.z / surface.w;
+
+        //view space looks down -z: behind the surface = more negative
+        float penetration = surfaceZ - viewPos.z;
+        if (penetration <= 0.0f || penetration > collisionThickness) return false;
+
+        normal = transpose(mat3(view)) * DecodeNormal(textureLod(gNormal, uv, 0.0f).rg);
+        return true;
+    }
+
+    void main()
+    {
+        uint i = gl_GlobalInvocationID.x;
+        if (i >= uint(aliveCount)) return;
+
+        uint front = drawArgs[1];
+        uint index = i < front ? aliveIn[i] : aliveIn[maxParticles - 1u - (i - front)];
+        Particle p = particles[index];
+        EmitterState e = emitters[floatBitsToUint(p.velocity.w)];
+
+        if (e.dt > 0.0f)
+        {
+            p.posLife.w -= e.dt;
+
+            //died: back to the pool
+            if (p.posLife.w <= 0.0f)
             {
-                particles[id].velActive.w = -1.0f;
+                dead[atomicAdd(deadCount, 1)] = index;
+                return;
             }
+
+            //alive, time step
+            vec3 previous = p.posLife.xyz;
+            p.velocity.y -= (e.gravity * e.dt);
+            p.velocity.xyz *= exp(-e.drag * e.dt);
+            p.posLife.xyz += (p.velocity.xyz * e.dt);
+
+            //bounce: back to where it was, velocity reflected with the normal part scaled by restitution
+            vec3 n;
+            if (collisions && e.collisions != 0u && e.visible != 0u && HitsDepthBuffer(p.posLife.xyz, n))
+            {
+                float vn = dot(p.velocity.xyz, n);
+                if (vn < 0.0f) p.velocity.xyz -= (1.0f + e.restitution) * vn * n;
+                p.posLife.xyz = previous;
+            }
+
+            particles[index] = p;
         }
-        //alive, time step
-        else
+
+        if (e.visible == 0u)
         {
-            particles[id].velActive.y -= (3.81f * dt);
-            particles[id].posLife.xyz += (particles[id].velActive.xyz * dt);
+            aliveOut[maxParticles - 1u - uint(atomicAdd(hiddenCountNext, 1))] = index;
+            return;
         }
+
+        //far to near after sorting ascending: positive floats order like uints, flipping the bits reverses it
+        int slot = atomicAdd(visibleCountNext, 1);
+        vec3 toCamera = cameraPos - p.posLife.xyz;
+        aliveOut[slot] = index;
+        sortKeys[slot] = ~floatBitsToUint(max(dot(toCamera, toCamera), 1e-8f));
     }
     )";
-
     const char* vsParticle = R"(
     #version 450 core
     
-    layout (location = 0) in vec3 aPos; //from VAO
-    layout (location = 1) in float aLife; //from VAO
-    layout (location = 2) in float aIsActive; //from VAO
+    struct Particle
+    {
+        vec4 posLife;
+        vec4 velocity;
+    };
+
+    layout(std430, binding = 5) readonly buffer Particles { Particle particles[]; };
+    layout(std430, binding = 6) readonly buffer AliveList { uint alive[]; };
 
     uniform mat4 view;
     uniform mat4 projection;
-    uniform mat4 model;
 
     out float life;
-    out float isActive;
 
     void main()
     {
-        gl_Position = projection * view * model * vec4(aPos, 1.0f);
+        //one instance per particle of a visible emitter (indirect draw), no vertex attributes
+        Particle p = particles[alive[gl_InstanceID]];
+        gl_Position = projection * view * vec4(p.posLife.xyz, 1.0f);
         gl_PointSize = 0.5f;
 
-        life = aLife;
-        isActive = aIsActive;
+        life = p.posLife.w;
     }
     )";
-
     const char* fsParticle = R"(
     #version 450 core
     
     out vec4 FragColor;
     
     in float life;
-    in float isActive;
 
     void main()
     {
-        if (isActive > 0.0f) FragColor = vec4(life, 3.0f - life, 0.0f, 1.);
-        else discard;
+        //fades out over the last second, drawn back to front (sorted in ParticleSystem::Simulate)
+        FragColor = vec4(life, 3.0f - life, 0.0f, clamp(life, 0.0f, 1.0f));
     }
     )";
 
-    const char* csTileCulling = R"(
+    //GPU SORT (GpuSort): uint keys ascending, values follow. count = counts[countIndex], written on the gpu
+    //bitonic: every comparator puts the smaller key first (the first step of each stage compares mirrored pairs),
+    //so elements past count act as +inf that never has to move and are simply skipped
+    const char* csSortBitonicLocal = R"(
     #version 450 core
-    layout(local_size_x = 16, local_size_y = 16) in; //16x16 threads per work group
     
-    struct GPUPointLight {    
-        vec4 positionRange;   
-        vec4 colorIntensity; 
-        uint isActive;
-        int shadowMapIndex;
-        uint pad0, pad1; //48 
-    };    
+    layout(local_size_x = 512) in; //1024 elements per work group, 2 per thread
+
+    layout(std430, binding = 11) buffer SortKeys { uint keys[]; };
+    layout(std430, binding = 12) buffer SortValues { uint values[]; };
+    layout(std430, binding = 16) readonly buffer SortCount { uint counts[]; };
+
+    uniform uint countIndex;
+    uniform uint maxCount;   //anything past it is left where it is
+    uniform bool merge; //false: sort each block of 1024 from scratch, true: finish a bigger stage (distances 512 -> 1)
+
+    shared uint sKeys[1024];
+    shared uint sValues[1024];
+
+    void CompareSwap(uint i, uint l)
+    {
+        if (sKeys[l] < sKeys[i])
+        {
+            uint k = sKeys[i]; sKeys[i] = sKeys[l]; sKeys[l] = k;
+            uint v = sValues[i]; sValues[i] = sValues[l]; sValues[l] = v;
+        }
+    }
+
+    void main()
+    {
+        uint t = gl_LocalInvocationID.x;
+        uint base = gl_WorkGroupID.x * 1024u;
+        uint count = min(counts[countIndex], maxCount);
+
+        for (uint e = t; e < 1024u; e += 512u)
+        {
+            uint g = base + e;
+            sKeys[e] = g < count ? keys[g] : 0xFFFFFFFFu;
+            sValues[e] = g < count ? values[g] : 0u;
+        }
+        barrier();
+
+        if (!merge)
+        {
+            for (uint k = 2u; k <= 1024u; k <<= 1)
+            {
+                //mirrored pairs, then plain half cleaners
+                uint d = k >> 1;
+                uint i = (t / d) * k + (t % d);
+                CompareSwap(i, i ^ (k - 1u));
+                barrier();
+
+                for (d = k >> 2; d > 0u; d >>= 1)
+                {
+                    i = (t / d) * 2u * d + (t % d);
+                    CompareSwap(i, i + d);
+                    barrier();
+                }
+            }
+        }
+        else
+        {
+            for (uint d = 512u; d > 0u; d >>= 1)
+            {
+                uint i = (t / d) * 2u * d + (t % d);
+                CompareSwap(i, i + d);
+                barrier();
+            }
+        }
+
+        for (uint e = t; e < 1024u; e += 512u)
+        {
+            uint g = base + e;
+            if (g < count)
+            {
+                keys[g] = sKeys[e];
+                values[g] = sValues[e];
+            }
+        }
+    }
+    )";
+    //one compare/swap step at a distance too big for shared memory (>= 1024), one thread per pair
+    const char* csSortBitonicStep = R"(
+    #version 450 core
     
-    layout(std430, binding = 1) buffer Lights
+    layout(local_size_x = 256) in;
+
+    layout(std430, binding = 11) buffer SortKeys { uint keys[]; };
+    layout(std430, binding = 12) buffer SortValues { uint values[]; };
+    layout(std430, binding = 16) readonly buffer SortCount { uint counts[]; };
+
+    uniform uint countIndex;
+    uniform uint maxCount;   //anything past it is left where it is
+    uniform uint stageSize; //k
+    uniform uint stepDistance; //stageSize / 2 = mirrored step
+
+    void main()
     {
-        GPUPointLight lights[];  
+        uint t = gl_GlobalInvocationID.x;
+        uint i = (t / stepDistance) * 2u * stepDistance + (t % stepDistance);
+        uint l = (2u * stepDistance == stageSize) ? (i ^ (stageSize - 1u)) : (i + stepDistance);
+        if (l >= min(counts[countIndex], maxCount)) return;
+
+        uint ki = keys[i];
+        uint kl = keys[l];
+        if (kl < ki)
+        {
+            keys[i] = kl; keys[l] = ki;
+            uint v = values[i]; values[i] = values[l]; values[l] = v;
+        }
+    }
+    )";
+    //radix pass 1/3: per tile (1024 keys) histogram of the current 4 bit digit, stored digit major
+    const char* csSortRadixCount = R"(
+    #version 450 core
+    
+    layout(local_size_x = 256) in;
+
+    layout(std430, binding = 11) readonly buffer SortKeys { uint keys[]; };
+    layout(std430, binding = 15) writeonly buffer SortHistogram { uint histogram[]; }; //[digit * tileCount + tile]
+    layout(std430, binding = 16) readonly buffer SortCount { uint counts[]; };
+
+    uniform uint countIndex;
+    uniform uint maxCount;   //anything past it is left where it is
+    uniform uint shift;
+    uniform uint tileCount;
+
+    shared uint localHistogram[16];
+
+    void main()
+    {
+        uint t = gl_LocalInvocationID.x;
+        uint tile = gl_WorkGroupID.x;
+        if (t < 16u) localHistogram[t] = 0u;
+        barrier();
+
+        uint count = min(counts[countIndex], maxCount);
+        for (uint e = t; e < 1024u; e += 256u)
+        {
+            uint g = tile * 1024u + e;
+            if (g < count) atomicAdd(localHistogram[(keys[g] >> shift) & 15u], 1u);
+        }
+        barrier();
+
+        //empty tiles still write their zeros
+        if (t < 16u) histogram[t * tileCount + tile] = localHistogram[t];
+    }
+    )";
+    //radix pass 2/3: exclusive prefix sum over the whole histogram = where each tile's keys of each digit go
+    const char* csSortRadixScan = R"(
+    #version 450 core
+    
+    layout(local_size_x = 256) in; //one work group
+
+    layout(std430, binding = 15) buffer SortHistogram { uint histogram[]; };
+
+    uniform uint tileCount;
+
+    shared uint partial[256];
+
+    void main()
+    {
+        uint t = gl_LocalInvocationID.x;
+        uint total = 16u * tileCount;
+        uint chunk = (total + 255u) / 256u;
+        uint begin = min(t * chunk, total);
+        uint end = min(begin + chunk, total);
+
+        uint sum = 0u;
+        for (uint i = begin; i < end; i++) sum += histogram[i];
+        partial[t] = sum;
+        barrier();
+
+        for (uint offset = 1u; offset < 256u; offset <<= 1)
+        {
+            uint v = t >= offset ? partial[t - offset] : 0u;
+            barrier();
+            partial[t] += v;
+            barrier();
+        }
+
+        uint running = partial[t] - sum;
+        for (uint i = begin; i < end; i++)
+        {
+            uint c = histogram[i];
+            histogram[i] = running;
+            running += c;
+        }
+    }
+    )";
+    //radix pass 3/3: stable scatter. each batch of 256 keys ranks itself with a prefix sum of one hot digit
+    //counters (16 buckets x 16 bits packed in two uvec4), tiles keep their input order so the sort stays stable
+    const char* csSortRadixScatter = R"(
+    #version 450 core
+    
+    layout(local_size_x = 256) in;
+
+    layout(std430, binding = 11) readonly buffer SortKeys { uint keysIn[]; };
+    layout(std430, binding = 12) readonly buffer SortValues { uint valuesIn[]; };
+    layout(std430, binding = 13) writeonly buffer SortKeysOut { uint keysOut[]; };
+    layout(std430, binding = 14) writeonly buffer SortValuesOut { uint valuesOut[]; };
+    layout(std430, binding = 15) readonly buffer SortHistogram { uint histogram[]; };
+    layout(std430, binding = 16) readonly buffer SortCount { uint counts[]; };
+
+    uniform uint countIndex;
+    uniform uint maxCount;   //anything past it is left where it is
+    uniform uint shift;
+    uniform uint tileCount;
+
+    shared uint digitOffset[16];
+    shared uvec4 scanLow[256];  //digits 0-7
+    shared uvec4 scanHigh[256]; //digits 8-15
+
+    uint DigitCount(uvec4 low, uvec4 high, uint digit)
+    {
+        uvec4 s = digit < 8u ? low : high;
+        return (s[(digit >> 1) & 3u] >> ((digit & 1u) * 16u)) & 0xFFFFu;
+    }
+
+    void main()
+    {
+        uint t = gl_LocalInvocationID.x;
+        uint tile = gl_WorkGroupID.x;
+        if (t < 16u) digitOffset[t] = histogram[t * tileCount + tile];
+
+        uint count = min(counts[countIndex], maxCount);
+        for (uint batch = 0u; batch < 4u; batch++)
+        {
+            uint g = tile * 1024u + batch * 256u + t;
+            bool valid = g < count;
+            uint key = valid ? keysIn[g] : 0u;
+            uint digit = (key >> shift) & 15u;
+
+            uvec4 low = uvec4(0u);
+            uvec4 high = uvec4(0u);
+            if (valid)
+            {
+                uint one = 1u << ((digit & 1u) * 16u);
+                if (digit < 8u) low[digit >> 1] = one;
+                else high[(digit >> 1) - 4u] = one;
+            }
+            scanLow[t] = low;
+            scanHigh[t] = high;
+            barrier();
+
+            for (uint offset = 1u; offset < 256u; offset <<= 1)
+            {
+                uvec4 l = t >= offset ? scanLow[t - offset] : uvec4(0u);
+                uvec4 h = t >= offset ? scanHigh[t - offset] : uvec4(0u);
+                barrier();
+                scanLow[t] += l;
+                scanHigh[t] += h;
+                barrier();
+            }
+
+            if (valid)
+            {
+                uint dst = digitOffset[digit] + DigitCount(scanLow[t], scanHigh[t], digit) - 1u;
+                keysOut[dst] = key;
+                valuesOut[dst] = valuesIn[g];
+            }
+            barrier();
+
+            //the last thread's inclusive sums are the batch totals
+            if (t < 16u) digitOffset[t] += DigitCount(scanLow[255], scanHigh[255], t);
+            barrier();
+        }
+    }
+    )";
+
+    const char* csTileCulling = R"(
+    #version 450 core
+    layout(local_size_x = 16, local_size_y = 16) in; //256 threads per work group, one work group per cluster
+
+    //Runs twice per frame:
+    //  countPass = true  -> grid[c].y = number of lights touching cluster c
+    //  (csClusterPrefixSum then turns the counts into offsets)
+    //  countPass = false -> write the light indices at indices[grid[c].x ...]
+    
+    //culling only needs the position/range stream
+    layout(std430, binding = 1) buffer LightCull
+    {
+        vec4 lightPositionRange[];  
     };
 
-    layout(std430, binding = 2) buffer TileIndices
+    layout(std430, binding = 2) buffer ClusterIndices
     {
         uint indices[];
     };
     
-    layout(std430, binding = 3) buffer TileCount
+    layout(std430, binding = 3) buffer ClusterGrid
     {
-        uint counts[];
+        uvec2 grid[]; //(offset, count)
     };
     
+    uniform float nearPlane;
     uniform float farPlane;
 
     uniform mat4 view;
     uniform mat4 projection;
     uniform vec2 screen; //w , h
 
-    const uint MAX_LIGHTS_PER_TILE = 256u;
-    const uint tileSize = 16u;
+    uniform uint tileSize = 32u;
+    uniform uint clusterZSlices = 24u;
+    const uint THREADS = 16u * 16u;
     uniform int numLights;
+    uniform bool countPass;
+
+    shared uint clusterLightCount;
+
+    //view space depth of the near side of slice k: near * (far/near)^(k/slices)
+    float SliceDepth(uint k)
+    {
+        return nearPlane * pow(farPlane / nearPlane, float(k) / float(clusterZSlices));
+    }
                  
     void main()
     {
-        uvec2 tileCoords = gl_WorkGroupID.xy;
-        uvec2 groupCount = uvec2( (screen + tileSize - 1u) / tileSize );
+        //x,y = screen tile, z = depth slice
+        uvec3 clusterCoords = gl_WorkGroupID;
+        uvec2 groupCount = uvec2( (uvec2(screen) + tileSize - 1u) / tileSize );
 
-        if (tileCoords.x >= groupCount.x || tileCoords.y >= groupCount.y)
+        if (clusterCoords.x >= groupCount.x || clusterCoords.y >= groupCount.y || clusterCoords.z >= clusterZSlices)
         {
             return;
         }
 
-        uint tileID = tileCoords.y * groupCount.x + tileCoords.x;
-        uint base = tileID * MAX_LIGHTS_PER_TILE;
+        uint clusterID = (clusterCoords.z * groupCount.y + clusterCoords.y) * groupCount.x + clusterCoords.x;
+        uvec2 cluster = countPass ? uvec2(0u) : grid[clusterID];
 
-        if (gl_LocalInvocationIndex == 0u) counts[tileID] = 0u;
-        memoryBarrierBuffer();
+        if (gl_LocalInvocationIndex == 0u) clusterLightCount = 0u;
         barrier();
 
         //corners
-        vec2 pxMin = vec2(tileCoords) * tileSize;
+        vec2 pxMin = vec2(clusterCoords.xy) * tileSize;
         vec2 pxMax = pxMin + tileSize;
+
+        //depth bounds (positive view space distance)
+        float zMin = SliceDepth(clusterCoords.z);
+        float zMax = SliceDepth(clusterCoords.z + 1u);
         
         //t1    -> lights[0],   lights[256], lights[512] ...
         //t2    -> lights[1],   lights[257], lights[513] ...
         // ...
         //t255  -> lights[255], lights[511], lights[767] ...
-        for (uint i = gl_LocalInvocationIndex; i < uint(numLights); i += tileSize * tileSize)
+        for (uint i = gl_LocalInvocationIndex; i < uint(numLights); i += THREADS)
         {
-            GPUPointLight l = lights[i];
-            if (l.isActive == 0u) continue;
+            vec4 positionRange = lightPositionRange[i];
             
-            //IS LIGHT IN TILE CHECK-------------------------------------------
-            vec4 viewPos = view * vec4(l.positionRange.xyz, 1.0f);
+            vec4 viewPos = view * vec4(positionRange.xyz, 1.0f);
             float z = -viewPos.z;
+            float radius = positionRange.w;
+
+            //IS LIGHT IN SLICE CHECK------------------------------------------
+            if (z + radius < zMin || z - radius > zMax) continue;
 
-            float radius = l.positionRange.w;
-            float radiusScreenSpace = (radius / z) * projection[1][1] * screen.y * 0.5;
+            //IS LIGHT IN TILE CHECK-------------------------------------------
+            //sphere crosses the near plane: projected circle is meaningless, keep it (conservative)
+            bool inside = true;
+            if (z - radius > nearPlane)
+            {
+                float radiusScreenSpace = (radius / z) * projection[1][1] * screen.y * 0.5;
             
-            vec4 clip = projection * viewPos;
-            vec2 ndc = clip.xy / clip.w;
+                vec4 clip = projection * viewPos;
+                vec2 ndc = clip.xy / clip.w;
         
-            //light position in pixel coords [(0,0), (SCREEN_WIDTH, SCREEN_HEIGHT)]
-            vec2 center = (ndc * 0.5f + 0.5f) * screen;
+                //light position in pixel coords [(0,0), (SCREEN_WIDTH, SCREEN_HEIGHT)]
+                vec2 center = (ndc * 0.5f + 0.5f) * screen;
             
-            //nearest point to the light position on the current tile
-            vec2 closest = clamp(center, pxMin, pxMax); 
+                //nearest point to the light position on the current tile
+                vec2 closest = clamp(center, pxMin, pxMax); 
 
-            //squared distance between light pos and nearest point in the current tile
-            float d2 = dot(center - closest, center - closest); 
-            bool inside = d2 <= radiusScreenSpace * radiusScreenSpace;
+                //squared distance between light pos and nearest point in the current tile
+                float d2 = dot(center - closest, center - closest); 
+                inside = d2 <= radiusScreenSpace * radiusScreenSpace;
+            }
             //-----------------------------------------------------------------   
 
             if (inside)
             {
                 //NOTE: Without atomic add:
-                //      uint old = counts[tileID];
-                //      counts[tileID] = old + 1;
+                //      uint old = clusterLightCount;
+                //      clusterLightCount = old + 1;
                 //
                 //BUT: But 2 threads can take the same old, losing a count update.
                 //
-                //index = counts[tileID] before increment
-                uint index = atomicAdd(counts[tileID], 1);
-                if (index < MAX_LIGHTS_PER_TILE)
+                //index = clusterLightCount before increment
+                uint index = atomicAdd(clusterLightCount, 1u);
+
+                //grid[c].y was trimmed by the prefix sum if the index buffer ran out of room
+                if (!countPass && index < cluster.y)
                 {
-                    indices[base + index] = i;
+                    indices[cluster.x + index] = i;
                 }        
             }
         }
 
-        memoryBarrierBuffer(); 
         barrier();
 
-        if (gl_LocalInvocationIndex == 0u)
+        if (countPass && gl_LocalInvocationIndex == 0u)
         {
-            counts[tileID] = min(counts[tileID], MAX_LIGHTS_PER_TILE);
+            grid[clusterID] = uvec2(0u, clusterLightCount);
+        }
+    }
+    )";
+
+    const char* csClusterPrefixSum = R"(
+    #version 450 core
+    layout(local_size_x = 1024) in; //single work group
+
+    //exclusive prefix sum over the per cluster light counts: grid[c].x = sum of grid[0..c-1].y
+
+    layout(std430, binding = 3) buffer ClusterGrid
+    {
+        uvec2 grid[]; //(offset, count)
+    };
+
+    uniform uint clusterCount;
+    uniform uint indexCapacity; //size of the index buffer, in uints
+
+    shared uint partialSums[1024];
+
+    void main()
+    {
+        uint t = gl_LocalInvocationIndex;
+
+        //each thread owns a contiguous run of clusters
+        uint perThread = (clusterCount + 1023u) / 1024u;
+        uint begin = min(t * perThread, clusterCount);
+        uint end = min(begin + perThread, clusterCount);
+
+        uint sum = 0u;
+        for (uint c = begin; c < end; c++) sum += grid[c].y;
+
+        partialSums[t] = sum;
+        barrier();
+
+        //inclusive scan of the run totals (Hillis-Steele)
+        for (uint stride = 1u; stride < 1024u; stride <<= 1)
+        {
+            uint v = (t >= stride) ? partialSums[t - stride] : 0u;
+            barrier();
+            partialSums[t] += v;
+            barrier();
+        }
+
+        uint offset = partialSums[t] - sum; //exclusive
+
+        for (uint c = begin; c < end; c++)
+        {
+            uint count = grid[c].y;
+
+            //overflow: drop the lights that don't fit instead of writing out of bounds
+            uint room = (offset < indexCapacity) ? indexCapacity - offset : 0u;
+            grid[c] = uvec2(offset, min(count, room));
+
+            offset += count;
         }
     }
     )";
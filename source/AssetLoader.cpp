@@ -0,0 +1,89 @@
+#include "../include/AssetLoader.h"
+
+#include <chrono>
+#include <stb_image.h>
+
+AssetLoader::AssetLoader()
+{
+    this->running = 0;
+    this->stopping = false;
+
+    for (unsigned int i = 0; i < ASSET_LOADER_THREADS; i++)
+    {
+        this->workers.emplace_back(&AssetLoader::WorkerLoop, this);
+    }
+}
+
+AssetLoader::~AssetLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->jobMutex);
+        this->stopping = true;
+        this->jobs.clear();
+    }
+    this->jobCondition.notify_all();
+    for (std::thread& t : this->workers) t.join();
+}
+
+void AssetLoader::Submit(Job job)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->jobMutex);
+        this->jobs.push_back(std::move(job));
+    }
+    this->jobCondition.notify_one();
+}
+
+void AssetLoader::Update()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->jobMutex);
+        while (!this->finished.empty())
+        {
+            this->uploads.push_back(std::move(this->finished.front()));
+            this->finished.pop_front();
+        }
+    }
+
+    //at least one piece a frame, so a budget smaller than a piece still makes progress
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while (!this->uploads.empty())
+    {
+        if (!this->uploads.front()()) this->uploads.pop_front();
+
+        float elapsedMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (elapsedMs >= ASSET_UPLOAD_BUDGET_MS) break;
+    }
+}
+
+bool AssetLoader::IsBusy()
+{
+    std::lock_guard<std::mutex> lock(this->jobMutex);
+    return !this->jobs.empty() || this->running != 0 || !this->finished.empty() || !this->uploads.empty();
+}
+
+void AssetLoader::WorkerLoop()
+{
+    //the main thread toggles the global flip flag around some of its own loads, decoding here must not see it
+    stbi_set_flip_vertically_on_load_thread(0);
+
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(this->jobMutex);
+            this->jobCondition.wait(lock, [this]() { return this->stopping || !this->jobs.empty(); });
+            if (this->stopping) return;
+
+            job = std::move(this->jobs.front());
+            this->jobs.pop_front();
+            this->running++;
+        }
+
+        Upload upload = job();
+
+        std::lock_guard<std::mutex> lock(this->jobMutex);
+        this->running--;
+        if (upload) this->finished.push_back(std::move(upload));
+    }
+}
@@ -0,0 +1,568 @@
+#include "../include/ClipmapTerrain.h"
+#include "../include/Shader.h"
+
+#include <glad/glad.h>
+#include <glm/gtc/type_ptr.hpp>
+#include <stb_image.h>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <cstring>
+
+static constexpr uint32_t CLIPMAP_FILE_VERSION = 1;
+static constexpr int TILE = (int)CLIPMAP_TILE_SIZE;
+static constexpr int WINDOW = (int)CLIPMAP_WINDOW_TILES;
+static constexpr int SLOTS = WINDOW + 2;    //per axis: the active window's tiles + the row/column it steps into
+static constexpr int BLOCK = TILE / 2;      //quads per block side
+static constexpr uint32_t MAX_MAP_SIZE = (uint32_t)(WINDOW * TILE) << (CLIPMAP_MAX_LEVELS - 1); //samples per side
+
+static inline float SampleHeight(uint16_t sample)
+{
+    return sample / 65535.0f * TERRAIN_HEIGHT_SCALE + TERRAIN_HEIGHT_OFFSET;
+}
+
+static AABB TransformAABB(const AABB& aabb, const glm::mat4& model)
+{
+    AABB result;
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        glm::vec4 corner = glm::vec4(i & 1 ? aabb.max.x : aabb.min.x, i & 2 ? aabb.max.y : aabb.min.y, i & 4 ? aabb.max.z : aabb.min.z, 1.0f);
+        glm::vec4 world = model * corner;
+        result.expand(Vec3(world.x, world.y, world.z));
+    }
+    return result;
+}
+
+bool ClipmapTerrain::ConvertHeightmap(const char* imagePath, const char* outPath)
+{
+    int width, height, channels;
+    stbi_us* pixels = stbi_load_16(imagePath, &width, &height, &channels, 1); //8 bit images are widened
+    if (!pixels)
+    {
+        std::cout << "ERROR: Could not load heightmap " << imagePath << '\n';
+        return false;
+    }
+    //a bigger map's coarsest level wouldn't fit one window and far terrain would be missing
+    if ((uint32_t)width > MAX_MAP_SIZE || (uint32_t)height > MAX_MAP_SIZE)
+    {
+        std::cout << "ERROR: Heightmap " << imagePath << " is over " << MAX_MAP_SIZE << " samples a side, too big for CLIPMAP_MAX_LEVELS\n";
+        stbi_image_free(pixels);
+        return false;
+    }
+
+    //LEVELS: every other sample of the one below, until the map fits in one window
+    std::vector<std::vector<uint16_t>> samples;
+    std::vector<ClipmapFileLevel> levels;
+    samples.emplace_back(pixels, pixels + (size_t)width * height);
+    stbi_image_free(pixels);
+
+    uint32_t w = (uint32_t)width, h = (uint32_t)height;
+    while (true)
+    {
+        ClipmapFileLevel level = {};
+        level.width = w;
+        level.height = h;
+        level.tilesX = std::max((w + TILE - 1) / TILE, (uint32_t)WINDOW + 1);
+        level.tilesY = std::max((h + TILE - 1) / TILE, (uint32_t)WINDOW + 1);
+        levels.push_back(level);
+
+        if (w <= (uint32_t)(WINDOW * TILE) && h <= (uint32_t)(WINDOW * TILE)) break; //within CLIPMAP_MAX_LEVELS, checked above
+
+        const std::vector<uint16_t>& fine = samples.back();
+        uint32_t cw = (w + 1) / 2, ch = (h + 1) / 2;
+        std::vector<uint16_t> coarse((size_t)cw * ch);
+        for (uint32_t y = 0; y < ch; y++)
+        {
+            for (uint32_t x = 0; x < cw; x++) coarse[(size_t)y * cw + x] = fine[(size_t)(y * 2) * w + x * 2];
+        }
+        samples.push_back(std::move(coarse));
+        w = cw;
+        h = ch;
+    }
+
+    //LAYOUT
+    ClipmapFileHeader header = {};
+    std::memcpy(header.magic, "KTHM", 4);
+    header.version = CLIPMAP_FILE_VERSION;
+    header.width = (uint32_t)width;
+    header.height = (uint32_t)height;
+    header.tileSize = TILE;
+    header.levelCount = (uint32_t)levels.size();
+
+    uint64_t offset = sizeof(ClipmapFileHeader) + sizeof(ClipmapFileLevel) * levels.size();
+    for (ClipmapFileLevel& level : levels)
+    {
+        uint64_t tileCount = (uint64_t)level.tilesX * level.tilesY;
+        level.rangeOffset = offset;
+        offset += tileCount * 2 * sizeof(uint16_t);
+        level.tileOffset = offset;
+        offset += tileCount * TILE * TILE * sizeof(uint16_t);
+    }
+
+    std::ofstream file(outPath, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "ERROR: Could not write " << outPath << '\n';
+        return false;
+    }
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)levels.data(), sizeof(ClipmapFileLevel) * levels.size());
+
+    //TILES: past the edge of the level the last sample repeats
+    std::vector<uint16_t> tile((size_t)TILE * TILE);
+    for (size_t l = 0; l < levels.size(); l++)
+    {
+        const ClipmapFileLevel& level = levels[l];
+        const std::vector<uint16_t>& s = samples[l];
+        auto at = [&](uint32_t x, uint32_t y) { return s[(size_t)std::min(y, level.height - 1) * level.width + std::min(x, level.width - 1)]; };
+
+        //min/max includes the far border, a block's last row/column of vertices comes from the next tile
+        for (uint32_t ty = 0; ty < level.tilesY; ty++)
+        {
+            for (uint32_t tx = 0; tx < level.tilesX; tx++)
+            {
+                uint16_t range[2] = { 65535, 0 };
+                for (uint32_t y = ty * TILE; y <= (ty + 1) * TILE; y++)
+                {
+                    for (uint32_t x = tx * TILE; x <= (tx + 1) * TILE; x++)
+                    {
+                        range[0] = std::min(range[0], at(x, y));
+                        range[1] = std::max(range[1], at(x, y));
+                    }
+                }
+                file.write((const char*)range, sizeof(range));
+            }
+        }
+
+        for (uint32_t ty = 0; ty < level.tilesY; ty++)
+        {
+            for (uint32_t tx = 0; tx < level.tilesX; tx++)
+            {
+                for (int y = 0; y < TILE; y++)
+                {
+                    for (int x = 0; x < TILE; x++) tile[(size_t)y * TILE + x] = at(tx * TILE + x, ty * TILE + y);
+                }
+                file.write((const char*)tile.data(), tile.size() * sizeof(uint16_t));
+            }
+        }
+    }
+
+    if (!file)
+    {
+        std::cout << "ERROR: Could not write " << outPath << '\n';
+        return false;
+    }
+    return true;
+}
+
+ClipmapTerrain::ClipmapTerrain(const char* path)
+{
+    this->loaded = false;
+    this->halfExtent = glm::vec2(0.0f);
+    this->heightTexture = 0;
+    this->meshData.VAO = 0;
+    this->gridVBO = 0;
+    this->gridEBO = 0;
+    this->instanceVBO = 0;
+    this->finestLevel = 0;
+    this->coarsestLevel = 0;
+    this->streamedThisFrame = false;
+    this->overflowReported = false;
+    this->stopping = false;
+
+    if (!this->file.Open(path)) return;
+
+    //HEADER + LEVELS
+    const uint8_t* data = this->file.GetData();
+    size_t size = this->file.GetSize();
+    if (size >= sizeof(ClipmapFileHeader)) std::memcpy(&this->header, data, sizeof(ClipmapFileHeader));
+    if (size < sizeof(ClipmapFileHeader) || std::memcmp(this->header.magic, "KTHM", 4) != 0 || this->header.version != CLIPMAP_FILE_VERSION ||
+        this->header.tileSize != CLIPMAP_TILE_SIZE || this->header.levelCount == 0 || this->header.levelCount > CLIPMAP_MAX_LEVELS ||
+        size < sizeof(ClipmapFileHeader) + sizeof(ClipmapFileLevel) * this->header.levelCount)
+    {
+        std::cout << "ERROR: " << path << " is not a tiled heightmap (see ConvertHeightmapToTiles)\n";
+        return;
+    }
+
+    for (uint32_t l = 0; l < this->header.levelCount; l++)
+    {
+        Level level;
+        std::memcpy(&level.info, data + sizeof(ClipmapFileHeader) + sizeof(ClipmapFileLevel) * l, sizeof(ClipmapFileLevel));
+
+        size_t tileCount = (size_t)level.info.tilesX * level.info.tilesY;
+        if (level.info.tilesX < (uint32_t)WINDOW + 1 || level.info.tilesY < (uint32_t)WINDOW + 1 ||
+            level.info.rangeOffset + tileCount * 2 * sizeof(uint16_t) > size || level.info.tileOffset + tileCount * TILE * TILE * sizeof(uint16_t) > size)
+        {
+            std::cout << "ERROR: " << path << " is truncated\n";
+            return;
+        }
+
+        level.ranges.resize(tileCount * 2);
+        std::memcpy(level.ranges.data(), data + level.info.rangeOffset, tileCount * 2 * sizeof(uint16_t));
+        level.origin = glm::ivec2(0);
+        level.ready = false;
+        level.resident.assign(SLOTS * SLOTS, glm::ivec2(-1));
+        level.requested.assign(SLOTS * SLOTS, glm::ivec2(-1));
+        this->levels.push_back(std::move(level));
+    }
+
+    //only the coarsest level's first window (+1 tile) is loaded up front, it has to be the whole map
+    const ClipmapFileLevel& coarsest = this->levels.back().info;
+    if (coarsest.tilesX > (uint32_t)WINDOW + 1 || coarsest.tilesY > (uint32_t)WINDOW + 1)
+    {
+        std::cout << "ERROR: " << path << " is too big, its coarsest level doesn't fit one window\n";
+        return;
+    }
+
+    this->halfExtent = glm::vec2((float)this->header.width, (float)this->header.height) * 0.5f;
+    this->SetupBuffers();
+
+    //the coarsest level is read right away so there is always something to draw, the rest streams around the camera
+    unsigned int top = (unsigned int)this->levels.size() - 1;
+    for (int y = 0; y <= WINDOW; y++)
+    {
+        for (int x = 0; x <= WINDOW; x++)
+        {
+            TileResult result = { top, glm::ivec2(x, y), {} };
+            this->ReadTile({ top, result.tile }, result.samples);
+            this->UploadTile(result);
+        }
+    }
+    this->levels[top].ready = true;
+    this->loaded = true;
+
+    for (unsigned int i = 0; i < CLIPMAP_STREAM_THREADS; i++)
+    {
+        this->workers.emplace_back(&ClipmapTerrain::WorkerLoop, this);
+    }
+}
+
+ClipmapTerrain::~ClipmapTerrain()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->jobMutex);
+        this->stopping = true;
+    }
+    this->jobCondition.notify_all();
+    for (std::thread& t : this->workers) t.join();
+
+    glDeleteTextures(1, &this->heightTexture);
+    glDeleteVertexArrays(1, &this->meshData.VAO);
+    glDeleteBuffers(1, &this->gridVBO);
+    glDeleteBuffers(1, &this->gridEBO);
+    glDeleteBuffers(1, &this->instanceVBO);
+}
+
+void ClipmapTerrain::SetupBuffers()
+{
+    //BLOCK: (BLOCK + 1)^2 vertices on integer sample offsets, counter clockwise seen from +y
+    std::vector<glm::vec2> grid;
+    for (int y = 0; y <= BLOCK; y++)
+    {
+        for (int x = 0; x <= BLOCK; x++) grid.push_back(glm::vec2((float)x, (float)y));
+    }
+
+    std::vector<unsigned int> indices;
+    for (int y = 0; y < BLOCK; y++)
+    {
+        for (int x = 0; x < BLOCK; x++)
+        {
+            unsigned int a = y * (BLOCK + 1) + x;   //(x, y)
+            unsigned int b = a + BLOCK + 1;         //(x, y + 1)
+            indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+        }
+    }
+
+    glCreateBuffers(1, &this->gridVBO);
+    glNamedBufferStorage(this->gridVBO, sizeof(glm::vec2) * grid.size(), grid.data(), 0);
+    glCreateBuffers(1, &this->gridEBO);
+    glNamedBufferStorage(this->gridEBO, sizeof(unsigned int) * indices.size(), indices.data(), 0);
+    glCreateBuffers(1, &this->instanceVBO);
+    glNamedBufferStorage(this->instanceVBO, sizeof(glm::vec4) * CLIPMAP_MAX_BLOCKS, nullptr, GL_DYNAMIC_STORAGE_BIT);
+    this->instances.reserve(CLIPMAP_MAX_BLOCKS);
+
+    //vsTerrainClipmap: 0 grid offset, 1 per block origin + level
+    unsigned int VAO;
+    glCreateVertexArrays(1, &VAO);
+    glVertexArrayVertexBuffer(VAO, 0, this->gridVBO, 0, sizeof(glm::vec2));
+    glVertexArrayAttribFormat(VAO, 0, 2, GL_FLOAT, GL_FALSE, 0);
+    glVertexArrayAttribBinding(VAO, 0, 0);
+    glEnableVertexArrayAttrib(VAO, 0);
+    glVertexArrayVertexBuffer(VAO, 1, this->instanceVBO, 0, sizeof(glm::vec4));
+    glVertexArrayAttribFormat(VAO, 1, 4, GL_FLOAT, GL_FALSE, 0);
+    glVertexArrayAttribBinding(VAO, 1, 1);
+    glVertexArrayBindingDivisor(VAO, 1, 1);
+    glEnableVertexArrayAttrib(VAO, 1);
+    glVertexArrayElementBuffer(VAO, this->gridEBO);
+
+    //HEIGHTS: a layer per level, texelFetch only (wrapping is done in the shader)
+    int texels = SLOTS * TILE;
+    glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &this->heightTexture);
+    glTextureStorage3D(this->heightTexture, 1, GL_R16, texels, texels, (GLsizei)this->levels.size());
+    glTextureParameteri(this->heightTexture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTextureParameteri(this->heightTexture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTextureParameteri(this->heightTexture, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTextureParameteri(this->heightTexture, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    //bounds: the coarsest level's tiles cover the whole map (and its padding)
+    const Level& top = this->levels.back();
+    float topExtent = (float)(TILE << (this->levels.size() - 1));
+    uint16_t low = 65535, high = 0;
+    for (size_t i = 0; i < top.ranges.size(); i += 2)
+    {
+        low = std::min(low, top.ranges[i]);
+        high = std::max(high, top.ranges[i + 1]);
+    }
+
+    this->meshData.VAO = VAO;
+    this->meshData.vertexCount = (unsigned int)grid.size();
+    this->meshData.indexCount = (unsigned int)indices.size();
+    this->meshData.aabb.min = Vec3(-this->halfExtent.x, SampleHeight(low), -this->halfExtent.y);
+    this->meshData.aabb.max = Vec3(-this->halfExtent.x + top.info.tilesX * topExtent, SampleHeight(high), -this->halfExtent.y + top.info.tilesY * topExtent);
+}
+
+bool ClipmapTerrain::IsLoaded() const
+{
+    return this->loaded;
+}
+
+void ClipmapTerrain::BeginFrame()
+{
+    this->instances.clear();
+    this->streamedThisFrame = false;
+}
+
+void ClipmapTerrain::Stream(const glm::vec3& cameraPos)
+{
+    //FINISHED TILES: first, so they count for this frame's window steps. tiles nobody wants anymore are dropped
+    std::vector<TileResult> finished, waiting;
+    {
+        std::lock_guard<std::mutex> lock(this->jobMutex);
+        for (TileResult& r : this->results)
+        {
+            if (this->levels[r.level].requested[this->GetSlot(r.tile)] != r.tile) continue;
+
+            if (finished.size() < CLIPMAP_UPLOADS_PER_FRAME) finished.push_back(std::move(r));
+            else waiting.push_back(std::move(r));
+        }
+        this->results.swap(waiting);
+    }
+
+    for (const TileResult& r : finished)
+    {
+        this->levels[r.level].requested[this->GetSlot(r.tile)] = glm::ivec2(-1);
+        this->UploadTile(r);
+    }
+
+    //WINDOWS
+    bool requested = false;
+    {
+        std::lock_guard<std::mutex> lock(this->jobMutex);
+
+        for (unsigned int l = 0; l < this->levels.size(); l++)
+        {
+            Level& level = this->levels[l];
+
+            //centered on the tile corner closest to the camera (level samples)
+            glm::vec2 camera = (glm::vec2(cameraPos.x, cameraPos.z) + this->halfExtent) / (float)(1u << l);
+            glm::ivec2 maxOrigin = glm::ivec2((int)level.info.tilesX, (int)level.info.tilesY) - (WINDOW + 1);
+            glm::ivec2 target = glm::clamp(glm::ivec2(glm::floor(camera / (float)TILE + 0.5f)) - WINDOW / 2, glm::ivec2(0), maxOrigin);
+            glm::ivec2 offset = target - level.origin;
+
+            if (!level.ready || std::abs(offset.x) > 1 || std::abs(offset.y) > 1)
+            {
+                //first time or a jump: nothing worth keeping, load the target in place. coarser levels draw meanwhile
+                level.origin = target;
+                level.ready = this->RequestWindow(l, target);
+            }
+            else if (offset != glm::ivec2(0))
+            {
+                //one tile toward the camera, once all of it is there
+                if (this->RequestWindow(l, level.origin + offset)) level.origin += offset;
+            }
+        }
+
+        //reads of tiles the windows moved away from are skipped
+        this->jobs.erase(std::remove_if(this->jobs.begin(), this->jobs.end(), [this](const TileRequest& r)
+        {
+            return this->levels[r.level].requested[this->GetSlot(r.tile)] != r.tile;
+        }), this->jobs.end());
+
+        requested = !this->jobs.empty();
+    }
+    if (requested) this->jobCondition.notify_all();
+
+    //CHAIN: coarsest ready level, then finer ones while they are ready and sit inside the one above, at least a block
+    //away from its edge (where it morphs) unless they touch the edge of the map
+    this->coarsestLevel = (unsigned int)this->levels.size() - 1;
+    while (this->coarsestLevel > 0 && !this->levels[this->coarsestLevel].ready) this->coarsestLevel--;
+
+    this->finestLevel = this->coarsestLevel;
+    while (this->finestLevel > 0)
+    {
+        const Level& fine = this->levels[this->finestLevel - 1];
+        const Level& coarse = this->levels[this->finestLevel];
+        if (!fine.ready) break;
+
+        glm::ivec2 rel = fine.origin - coarse.origin * 2; //in fine tiles = coarse blocks
+        glm::ivec2 fineMax = glm::ivec2((int)fine.info.tilesX, (int)fine.info.tilesY) - (WINDOW + 1);
+        bool inside = true;
+        for (int i = 0; i < 2; i++)
+        {
+            inside = inside && (rel[i] >= 1 || (rel[i] == 0 && fine.origin[i] == 0)) &&
+                               (rel[i] <= WINDOW - 1 || (rel[i] == WINDOW && fine.origin[i] == fineMax[i]));
+        }
+        if (!inside) break;
+
+        this->finestLevel--;
+    }
+}
+
+bool ClipmapTerrain::RequestWindow(unsigned int l, const glm::ivec2& origin)
+{
+    //caller holds jobMutex
+    Level& level = this->levels[l];
+    bool resident = true;
+    for (int y = 0; y <= WINDOW; y++)
+    {
+        for (int x = 0; x <= WINDOW; x++)
+        {
+            glm::ivec2 tile = origin + glm::ivec2(x, y);
+            unsigned int slot = this->GetSlot(tile);
+            if (level.resident[slot] == tile) continue;
+
+            resident = false;
+            if (level.requested[slot] == tile) continue; //already on its way
+
+            level.requested[slot] = tile;
+            this->jobs.push_back({ l, tile });
+        }
+    }
+    return resident;
+}
+
+void ClipmapTerrain::UploadTile(const TileResult& result)
+{
+    glm::ivec2 texel = (result.tile % SLOTS) * TILE;
+    glTextureSubImage3D(this->heightTexture, 0, texel.x, texel.y, result.level, TILE, TILE, 1, GL_RED, GL_UNSIGNED_SHORT, result.samples.data());
+    this->levels[result.level].resident[this->GetSlot(result.tile)] = result.tile;
+}
+
+void ClipmapTerrain::ReadTile(const TileRequest& request, std::vector<uint16_t>& samples) const
+{
+    //the page faults of a cold tile happen here, on the worker
+    const ClipmapFileLevel& info = this->levels[request.level].info;
+    size_t count = (size_t)TILE * TILE;
+    size_t offset = info.tileOffset + ((size_t)request.tile.y * info.tilesX + request.tile.x) * count * sizeof(uint16_t);
+
+    samples.resize(count);
+    std::memcpy(samples.data(), this->file.GetData() + offset, count * sizeof(uint16_t));
+}
+
+unsigned int ClipmapTerrain::GetSlot(const glm::ivec2& tile) const
+{
+    return (unsigned int)((tile.y % SLOTS) * SLOTS + tile.x % SLOTS);
+}
+
+void ClipmapTerrain::WorkerLoop()
+{
+    while (true)
+    {
+        TileRequest request;
+        {
+            std::unique_lock<std::mutex> lock(this->jobMutex);
+            this->jobCondition.wait(lock, [this]() { return this->stopping || !this->jobs.empty(); });
+            if (this->stopping) return;
+
+            request = this->jobs.front();
+            this->jobs.pop_front();
+        }
+
+        TileResult result = { request.level, request.tile, {} };
+        this->ReadTile(request, result.samples);
+
+        std::lock_guard<std::mutex> lock(this->jobMutex);
+        this->results.push_back(std::move(result));
+    }
+}
+
+std::pair<unsigned int, unsigned int> ClipmapTerrain::Select(const glm::mat4& model, const glm::vec3& cameraPos,
+                                                             const std::function<bool(const AABB&)>& isVisible)
+{
+    unsigned int first = (unsigned int)this->instances.size();
+    if (!this->loaded) return { first, 0 };
+
+    if (!this->streamedThisFrame)
+    {
+        this->Stream(glm::vec3(glm::inverse(model) * glm::vec4(cameraPos, 1.0f)));
+        this->streamedThisFrame = true;
+    }
+
+    //every level draws its window in blocks, minus the footprint of the finer level (BLOCK x WINDOW of its samples)
+    for (unsigned int l = this->finestLevel; l <= this->coarsestLevel; l++)
+    {
+        const Level& level = this->levels[l];
+        float spacing = (float)(1u << l);
+        glm::ivec2 start = level.origin * 2;
+        bool hasHole = l > this->finestLevel;
+        glm::ivec2 hole = hasHole ? this->levels[l - 1].origin : glm::ivec2(0);
+
+        for (int by = start.y; by < start.y + WINDOW * 2; by++)
+        {
+            for (int bx = start.x; bx < start.x + WINDOW * 2; bx++)
+            {
+                if (hasHole && bx >= hole.x && bx < hole.x + WINDOW && by >= hole.y && by < hole.y + WINDOW) continue;
+                if (bx * BLOCK >= (int)level.info.width || by * BLOCK >= (int)level.info.height) continue; //past the edge of the map
+
+                size_t range = ((size_t)(by / 2) * level.info.tilesX + bx / 2) * 2;
+                AABB bounds;
+                bounds.min = Vec3(bx * BLOCK * spacing - this->halfExtent.x, SampleHeight(level.ranges[range]), by * BLOCK * spacing - this->halfExtent.y);
+                bounds.max = Vec3((bx + 1) * BLOCK * spacing - this->halfExtent.x, SampleHeight(level.ranges[range + 1]), (by + 1) * BLOCK * spacing - this->halfExtent.y);
+                if (!isVisible(TransformAABB(bounds, model))) continue;
+
+                if (this->instances.size() >= CLIPMAP_MAX_BLOCKS)
+                {
+                    if (!this->overflowReported) std::cout << "ERROR: Max clipmap blocks exceeded\n";
+                    this->overflowReported = true;
+                    return { first, (unsigned int)this->instances.size() - first };
+                }
+                this->instances.push_back(glm::vec4((float)(bx * BLOCK), (float)(by * BLOCK), (float)l, 0.0f));
+            }
+        }
+    }
+
+    return { first, (unsigned int)this->instances.size() - first };
+}
+
+void ClipmapTerrain::Upload()
+{
+    if (this->instances.empty()) return;
+    glNamedBufferSubData(this->instanceVBO, 0, sizeof(glm::vec4) * this->instances.size(), this->instances.data());
+}
+
+void ClipmapTerrain::Bind(Shader* shader) const
+{
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, this->heightTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    glm::ivec2 origins[CLIPMAP_MAX_LEVELS] = {};
+    for (size_t l = 0; l < this->levels.size(); l++) origins[l] = this->levels[l].origin * TILE;
+
+    glUniform2iv(glGetUniformLocation(shader->ID, "windowOrigin"), CLIPMAP_MAX_LEVELS, glm::value_ptr(origins[0]));
+    glUniform1i(glGetUniformLocation(shader->ID, "coarsestLevel"), this->coarsestLevel);
+    glUniform2fv(glGetUniformLocation(shader->ID, "halfExtent"), 1, glm::value_ptr(this->halfExtent));
+    glUniform2f(glGetUniformLocation(shader->ID, "mapSize"), (float)this->header.width, (float)this->header.height);
+}
+
+const MeshData& ClipmapTerrain::GetMeshData() const
+{
+    return this->meshData;
+}
+
+size_t ClipmapTerrain::GetResidentMemory() const
+{
+    size_t bytes = (size_t)SLOTS * TILE * SLOTS * TILE * sizeof(uint16_t) * this->levels.size();
+    for (const Level& l : this->levels) bytes += l.ranges.size() * sizeof(uint16_t);
+    return bytes;
+}
@@ -5,6 +5,10 @@
 DrawCall::DrawCall(MeshData meshData, Material material, const glm::mat4& model, GLenum primitive)
 {
     this->heightMapPath = nullptr;  //if this stays null, we are not drawing terrain.
+    this->clipmapPath = nullptr;
+    this->instanced = false;
+    this->firstInstance = 0;
+    this->instanceCount = 0;
 
     //general data
     this->meshData = meshData;
@@ -22,6 +26,10 @@ DrawCall::DrawCall(MeshData meshData, Material material, const glm::mat4& model,
 DrawCall::DrawCall(MeshData meshData, PBRMaterial pbrmaterial, const glm::mat4& model, GLenum primitive)
 {
     this->heightMapPath = nullptr;  //if this stays null, we are not drawing terrain.
+    this->clipmapPath = nullptr;
+    this->instanced = false;
+    this->firstInstance = 0;
+    this->instanceCount = 0;
 
     //general data
     this->meshData = meshData;
@@ -50,7 +58,15 @@ void DrawCall::Render(Shader* shader, bool tempDontCull)
 
     //vind vao and draw
     glBindVertexArray(this->meshData.VAO);
-    if (this->meshData.indexCount != 0)
+    if (this->instanced)
+    {
+        //one instance of the mesh per terrain patch / clipmap block, count can be 0 (nothing on screen)
+        if (this->meshData.indexCount != 0)
+            glDrawElementsInstancedBaseInstance(this->primitive, this->meshData.indexCount, GL_UNSIGNED_INT, 0, this->instanceCount, this->firstInstance);
+        else
+            glDrawArraysInstancedBaseInstance(this->primitive, 0, this->meshData.vertexCount, this->instanceCount, this->firstInstance);
+    }
+    else if (this->meshData.indexCount != 0)
     {
         //we are drawing with an EBO
         glDrawElements(this->primitive, this->meshData.indexCount, GL_UNSIGNED_INT, 0);
@@ -100,6 +116,20 @@ void DrawCall::RenderLOD(Shader* shader, bool tempDontCull)
     }
 }
 
+void DrawCall::RenderPatches(Shader* shader, unsigned int first, unsigned int count)
+{
+    shader->use();
+    glDisable(GL_CULL_FACE);
+
+    glUniformMatrix4fv(glGetUniformLocation(shader->ID, "model"), 1, GL_FALSE, glm::value_ptr(this->modelMatrix));
+
+    glBindVertexArray(this->meshData.VAO);
+    glDrawArraysInstancedBaseInstance(this->primitive, 0, this->meshData.vertexCount, count, first);
+
+    glEnable(GL_CULL_FACE);
+    glBindVertexArray(0);
+}
+
 void DrawCall::BindMaterialUniforms(Shader* shader)
 {
     shader->use();
@@ -175,11 +205,38 @@ const char* DrawCall::GetHeightMapPath()
     return this->heightMapPath;
 }
 
+bool DrawCall::HasAlpha() const
+{
+    return this->material.hasAlpha;
+}
+
 void DrawCall::SetHeightMapPath(const char* path)
 {
     this->heightMapPath = path;
 }
 
+void DrawCall::SetInstanceRange(unsigned int first, unsigned int count)
+{
+    this->instanced = true;
+    this->firstInstance = first;
+    this->instanceCount = count;
+}
+
+const char* DrawCall::GetClipmapPath()
+{
+    return this->clipmapPath;
+}
+
+void DrawCall::SetClipmapPath(const char* path)
+{
+    this->clipmapPath = path;
+}
+
+const glm::mat4& DrawCall::GetModelMatrix() const
+{
+    return this->modelMatrix;
+}
+
 AABB DrawCall::GetWorldAABB() const
 {
     AABB aabb = this->meshData.aabb;
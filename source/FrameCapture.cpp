@@ -0,0 +1,349 @@
+#include "../include/FrameCapture.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+FrameCapture::FrameCapture()
+{
+    for (Slot& s : this->slots)
+    {
+        s.PBO = 0;
+        s.mapped = nullptr;
+        s.fence = 0;
+        s.state = SLOT_FREE;
+    }
+    this->buffersCreated = false;
+    this->stopping = false;
+}
+
+FrameCapture::~FrameCapture()
+{
+    //whatever is still on the gpu gets finished and handed over before the worker stops
+    for (Slot& s : this->slots)
+    {
+        if (s.state == SLOT_IN_FLIGHT)
+        {
+            glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000); //1s
+            glDeleteSync(s.fence);
+            s.state = SLOT_ENCODING;
+            std::lock_guard<std::mutex> lock(this->jobMutex);
+            this->jobs.push_back(&s);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->jobMutex);
+        this->stopping = true;
+    }
+    this->jobCondition.notify_all();
+    if (this->worker.joinable()) this->worker.join();
+
+    for (Slot& s : this->slots)
+    {
+        if (s.PBO == 0) continue;
+        glUnmapNamedBuffer(s.PBO);
+        glDeleteBuffers(1, &s.PBO);
+    }
+}
+
+void FrameCapture::Request(CaptureSource source, FrameCaptureCallback callback)
+{
+    this->pending.push_back({ source, std::move(callback) });
+}
+
+bool FrameCapture::HasPending(CaptureSource source) const
+{
+    for (const PendingRequest& r : this->pending)
+    {
+        if (r.source == source) return true;
+    }
+    return false;
+}
+
+void FrameCapture::SetupBuffers()
+{
+    //big enough for either source at full res (RGB half float)
+    GLsizeiptr size = (GLsizeiptr)SCREEN_WIDTH * SCREEN_HEIGHT * 6;
+    GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    for (Slot& s : this->slots)
+    {
+        glCreateBuffers(1, &s.PBO);
+        glNamedBufferStorage(s.PBO, size, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+        s.mapped = glMapNamedBufferRange(s.PBO, 0, size, flags); //stays mapped, the worker reads from here
+    }
+
+    this->worker = std::thread(&FrameCapture::WorkerLoop, this);
+    this->buffersCreated = true;
+}
+
+void FrameCapture::Capture(CaptureSource source, unsigned int texture, unsigned int width, unsigned int height)
+{
+    if (!this->buffersCreated) this->SetupBuffers();
+
+    GLenum type = source == CAPTURE_HDR ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE;
+    GLsizei bytes = (GLsizei)(width * height * (source == CAPTURE_HDR ? 6 : 3));
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1); //tightly packed RGB rows
+    for (size_t i = 0; i < this->pending.size();)
+    {
+        if (this->pending[i].source != source)
+        {
+            i++;
+            continue;
+        }
+
+        Slot* slot = nullptr;
+        for (Slot& s : this->slots)
+        {
+            if (s.state == SLOT_FREE)
+            {
+                slot = &s;
+                break;
+            }
+        }
+        if (slot == nullptr) break; //ring is full, the request waits for a later frame
+
+        //into the PBO, returns immediately
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->PBO);
+        if (texture != 0)
+            glGetTextureSubImage(texture, 0, 0, 0, 0, width, height, 1, GL_RGB, type, bytes, nullptr);
+        else
+            glReadPixels(0, 0, width, height, GL_RGB, type, nullptr);
+
+        slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot->frame = { source, width, height, slot->mapped };
+        slot->callback = std::move(this->pending[i].callback);
+        slot->state = SLOT_IN_FLIGHT;
+
+        this->pending.erase(this->pending.begin() + i);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+}
+
+void FrameCapture::Poll()
+{
+    for (Slot& s : this->slots)
+    {
+        if (s.state != SLOT_IN_FLIGHT) continue;
+
+        //timeout 0: only asks, never waits
+        GLenum result = glClientWaitSync(s.fence, 0, 0);
+        if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) continue;
+
+        glDeleteSync(s.fence);
+        s.fence = 0;
+        s.state = SLOT_ENCODING;
+        {
+            std::lock_guard<std::mutex> lock(this->jobMutex);
+            this->jobs.push_back(&s);
+        }
+        this->jobCondition.notify_one();
+    }
+}
+
+void FrameCapture::WorkerLoop()
+{
+    while (true)
+    {
+        Slot* slot;
+        {
+            std::unique_lock<std::mutex> lock(this->jobMutex);
+            this->jobCondition.wait(lock, [this]() { return this->stopping || !this->jobs.empty(); });
+            if (this->jobs.empty()) return; //stopping, nothing left
+
+            slot = this->jobs.front();
+            this->jobs.pop_front();
+        }
+
+        slot->callback(slot->frame);
+        slot->callback = nullptr;
+        slot->state = SLOT_FREE; //main thread can reuse the buffer
+    }
+}
+
+namespace CaptureWriter
+{
+    static void PutU32BE(std::vector<unsigned char>& out, uint32_t v)
+    {
+        out.push_back((unsigned char)(v >> 24));
+        out.push_back((unsigned char)(v >> 16));
+        out.push_back((unsigned char)(v >> 8));
+        out.push_back((unsigned char)v);
+    }
+
+    static uint32_t CRC32(const unsigned char* data, size_t size)
+    {
+        static uint32_t table[256] = {};
+        static bool tableBuilt = [] {
+            for (uint32_t n = 0; n < 256; n++)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                table[n] = c;
+            }
+            return true;
+        }();
+        (void)tableBuilt;
+
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    static void WriteChunk(std::ofstream& file, const char* type, const std::vector<unsigned char>& data)
+    {
+        std::vector<unsigned char> chunk;
+        PutU32BE(chunk, (uint32_t)data.size());
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+        PutU32BE(chunk, CRC32(chunk.data() + 4, chunk.size() - 4)); //crc over type + data
+
+        file.write((const char*)chunk.data(), chunk.size());
+    }
+
+    bool WritePNG(const CapturedFrame& frame, const char* path)
+    {
+        if (frame.source != CAPTURE_FINAL)
+        {
+            std::cout << "ERROR: PNG capture needs a CAPTURE_FINAL frame\n";
+            return false;
+        }
+
+        std::ofstream file(path, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "ERROR: Could not open " << path << " for writing\n";
+            return false;
+        }
+
+        const unsigned char* pixels = (const unsigned char*)frame.pixels;
+        size_t rowBytes = (size_t)frame.width * 3;
+
+        //scanlines top row first, filter type 0 each
+        std::vector<unsigned char> raw;
+        raw.reserve((rowBytes + 1) * frame.height);
+        for (int y = (int)frame.height - 1; y >= 0; y--)
+        {
+            raw.push_back(0);
+            raw.insert(raw.end(), pixels + y * rowBytes, pixels + (y + 1) * rowBytes);
+        }
+
+        //zlib stream with stored (uncompressed) deflate blocks, keeps the worker fast and needs no zlib
+        std::vector<unsigned char> idat = { 0x78, 0x01 };
+        uint32_t a = 1, b = 0; //adler32
+        for (size_t offset = 0; offset < raw.size(); offset += 65535)
+        {
+            uint16_t len = (uint16_t)std::min<size_t>(65535, raw.size() - offset);
+            idat.push_back(offset + len == raw.size() ? 1 : 0); //BFINAL
+            idat.push_back(len & 0xFF);
+            idat.push_back(len >> 8);
+            idat.push_back(~len & 0xFF);
+            idat.push_back((~len >> 8) & 0xFF);
+            idat.insert(idat.end(), raw.begin() + offset, raw.begin() + offset + len);
+
+            for (size_t i = offset; i < offset + len; i++)
+            {
+                a = (a + raw[i]) % 65521;
+                b = (b + a) % 65521;
+            }
+        }
+        PutU32BE(idat, (b << 16) | a);
+
+        std::vector<unsigned char> ihdr;
+        PutU32BE(ihdr, frame.width);
+        PutU32BE(ihdr, frame.height);
+        ihdr.insert(ihdr.end(), { 8, 2, 0, 0, 0 }); //8 bit, RGB, deflate, filter 0, no interlace
+
+        const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        file.write((const char*)signature, 8);
+        WriteChunk(file, "IHDR", ihdr);
+        WriteChunk(file, "IDAT", idat);
+        WriteChunk(file, "IEND", {});
+
+        return file.good();
+    }
+
+    static void PutAttribute(std::vector<unsigned char>& out, const char* name, const char* type, const void* value, int32_t size)
+    {
+        out.insert(out.end(), name, name + strlen(name) + 1);
+        out.insert(out.end(), type, type + strlen(type) + 1);
+        out.insert(out.end(), (const unsigned char*)&size, (const unsigned char*)&size + 4);
+        out.insert(out.end(), (const unsigned char*)value, (const unsigned char*)value + size);
+    }
+
+    bool WriteEXR(const CapturedFrame& frame, const char* path)
+    {
+        if (frame.source != CAPTURE_HDR)
+        {
+            std::cout << "ERROR: EXR capture needs a CAPTURE_HDR frame\n";
+            return false;
+        }
+
+        std::ofstream file(path, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "ERROR: Could not open " << path << " for writing\n";
+            return false;
+        }
+
+        //scanline file, no compression, HALF B G R channels (alphabetical, as the format wants). little endian
+        std::vector<unsigned char> header = { 0x76, 0x2F, 0x31, 0x01, 2, 0, 0, 0 };
+
+        std::vector<unsigned char> channels;
+        for (const char* c : { "B", "G", "R" })
+        {
+            int32_t fields[4] = { 1, 0, 1, 1 }; //HALF, pLinear + reserved, x/y sampling
+            channels.insert(channels.end(), c, c + 2);
+            channels.insert(channels.end(), (const unsigned char*)fields, (const unsigned char*)fields + 16);
+        }
+        channels.push_back(0);
+
+        int32_t window[4] = { 0, 0, (int32_t)frame.width - 1, (int32_t)frame.height - 1 };
+        unsigned char compression = 0, lineOrder = 0;
+        float aspect = 1.0f, center[2] = { 0.0f, 0.0f }, screenWidth = 1.0f;
+
+        PutAttribute(header, "channels", "chlist", channels.data(), (int32_t)channels.size());
+        PutAttribute(header, "compression", "compression", &compression, 1);
+        PutAttribute(header, "dataWindow", "box2i", window, 16);
+        PutAttribute(header, "displayWindow", "box2i", window, 16);
+        PutAttribute(header, "lineOrder", "lineOrder", &lineOrder, 1);
+        PutAttribute(header, "pixelAspectRatio", "float", &aspect, 4);
+        PutAttribute(header, "screenWindowCenter", "v2f", center, 8);
+        PutAttribute(header, "screenWindowWidth", "float", &screenWidth, 4);
+        header.push_back(0);
+
+        //offset table, then one chunk per scanline: y, size, B row, G row, R row
+        uint32_t lineBytes = frame.width * 3 * 2;
+        uint64_t offset = header.size() + (uint64_t)frame.height * 8;
+        for (unsigned int y = 0; y < frame.height; y++)
+        {
+            header.insert(header.end(), (const unsigned char*)&offset, (const unsigned char*)&offset + 8);
+            offset += 8 + lineBytes;
+        }
+        file.write((const char*)header.data(), header.size());
+
+        const uint16_t* pixels = (const uint16_t*)frame.pixels;
+        std::vector<uint16_t> line(frame.width * 3);
+        for (unsigned int y = 0; y < frame.height; y++)
+        {
+            const uint16_t* row = pixels + (size_t)(frame.height - 1 - y) * frame.width * 3; //exr is top row first
+            for (unsigned int x = 0; x < frame.width; x++)
+            {
+                line[x] = row[x * 3 + 2];                       //B
+                line[frame.width + x] = row[x * 3 + 1];         //G
+                line[frame.width * 2 + x] = row[x * 3];         //R
+            }
+
+            int32_t chunkHeader[2] = { (int32_t)y, (int32_t)lineBytes };
+            file.write((const char*)chunkHeader, 8);
+            file.write((const char*)line.data(), lineBytes);
+        }
+
+        return file.good();
+    }
+}
@@ -0,0 +1,247 @@
+#include "../include/FrameGraph.h"
+#include "../include/Definitions.h"
+
+static size_t BytesPerPixel(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+        case GL_R8:             return 1;
+        case GL_R16F:
+        case GL_RG8:            return 2;
+        case GL_RGBA16F:
+        case GL_RG32F:          return 8;
+        case GL_RGBA32F:        return 16;
+        default:                return 4; //RGBA8, RG16F, R32F, R11F_G11F_B10F...
+    }
+}
+
+static size_t TextureBytes(const FGTextureDesc& desc)
+{
+    size_t levelBytes = (size_t)desc.width * desc.height * BytesPerPixel(desc.internalFormat);
+    size_t bytes = 0;
+    for (unsigned int l = 0; l < desc.levels; l++) bytes += levelBytes >> (2 * l);
+    return bytes;
+}
+
+FrameGraph::FrameGraph()
+{
+    this->frameIndex = 0;
+}
+
+FrameGraph::~FrameGraph()
+{
+    for (PooledTexture& t : this->pool) glDeleteTextures(1, &t.handle);
+}
+
+void FrameGraph::Reset()
+{
+    this->resources.clear();
+    this->passes.clear();
+}
+
+FGResource FrameGraph::CreateTexture(const char* name, const FGTextureDesc& desc)
+{
+    Resource r = { name, true, false, desc, 0, -1, -1, 0 };
+    this->resources.push_back(r);
+    return (FGResource)this->resources.size() - 1;
+}
+
+FGResource FrameGraph::ImportTexture(const char* name, unsigned int texture)
+{
+    Resource r = { name, false, false, FGTextureDesc(), texture, -1, -1, 0 };
+    this->resources.push_back(r);
+    return (FGResource)this->resources.size() - 1;
+}
+
+FGResource FrameGraph::ImportBuffer(const char* name, unsigned int buffer)
+{
+    Resource r = { name, false, true, FGTextureDesc(), buffer, -1, -1, 0 };
+    this->resources.push_back(r);
+    return (FGResource)this->resources.size() - 1;
+}
+
+void FrameGraph::AddPass(const char* name, FGPassType type, const std::vector<FGResource>& reads, const std::vector<FGResource>& writes,
+                         std::function<void()> execute, bool sideEffect)
+{
+    this->passes.push_back({ name, type, reads, writes, std::move(execute), sideEffect, false });
+}
+
+void FrameGraph::Compile()
+{
+    //CULLING: walk backwards keeping track of which resources still have a reader further down the frame.
+    //a pass survives if it has a side effect or writes something live. what it writes is produced here (not live
+    //before it), what it reads becomes live. read + write (in place passes) keeps the resource live for earlier writers.
+    std::vector<bool> live(this->resources.size(), false);
+    for (int i = (int)this->passes.size() - 1; i >= 0; i--)
+    {
+        Pass& p = this->passes[i];
+
+        bool needed = p.sideEffect;
+        for (FGResource w : p.writes) needed = needed || live[w];
+        p.culled = !needed;
+        if (p.culled) continue;
+
+        for (FGResource w : p.writes) live[w] = false;
+        for (FGResource r : p.reads) live[r] = true;
+    }
+
+    //LIFETIMES: first/last surviving pass touching each resource
+    for (int i = 0; i < (int)this->passes.size(); i++)
+    {
+        const Pass& p = this->passes[i];
+        if (p.culled) continue;
+
+        for (const std::vector<FGResource>* list : { &p.reads, &p.writes })
+        {
+            for (FGResource r : *list)
+            {
+                if (this->resources[r].firstPass < 0) this->resources[r].firstPass = i;
+                this->resources[r].lastPass = i;
+            }
+        }
+    }
+}
+
+void FrameGraph::Execute()
+{
+    for (int i = 0; i < (int)this->passes.size(); i++)
+    {
+        Pass& p = this->passes[i];
+        if (p.culled) continue;
+
+        //allocate transients on first use, collect barriers owed by earlier compute writes
+        GLbitfield barrier = 0;
+        for (const std::vector<FGResource>* list : { &p.reads, &p.writes })
+        {
+            for (FGResource id : *list)
+            {
+                Resource& r = this->resources[id];
+                if (r.transient && r.firstPass == i && r.handle == 0)
+                {
+                    r.handle = this->AcquireTexture(r.desc);
+                }
+                barrier |= r.pendingBarrier;
+                r.pendingBarrier = 0;
+            }
+        }
+        if (barrier) glMemoryBarrier(barrier);
+
+        p.execute();
+
+        //compute writes are incoherent, whoever touches them next has to wait
+        if (p.type == FG_COMPUTE)
+        {
+            for (FGResource id : p.writes)
+            {
+                Resource& r = this->resources[id];
+                r.pendingBarrier = r.buffer ? (GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT)
+                                            : (GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT |
+                                               GL_TEXTURE_UPDATE_BARRIER_BIT); //readbacks
+            }
+        }
+
+        //give transients back after their last use so later passes can alias them
+        for (const std::vector<FGResource>* list : { &p.reads, &p.writes })
+        {
+            for (FGResource id : *list)
+            {
+                Resource& r = this->resources[id];
+                if (r.transient && r.lastPass == i && r.handle != 0)
+                {
+                    this->ReleaseTexture(r.handle);
+                    r.handle = 0;
+                }
+            }
+        }
+    }
+
+    //imported resources written by compute are read again next frame (histories)
+    GLbitfield barrier = 0;
+    for (Resource& r : this->resources) barrier |= r.pendingBarrier;
+    if (barrier) glMemoryBarrier(barrier);
+
+    this->TrimPool();
+    this->frameIndex++;
+}
+
+unsigned int FrameGraph::GetTexture(FGResource resource) const
+{
+    return this->resources[resource].handle;
+}
+
+FrameGraphStats FrameGraph::GetStats() const
+{
+    FrameGraphStats stats;
+    stats.passCount = (unsigned int)this->passes.size();
+    for (const Pass& p : this->passes)
+    {
+        if (p.culled) stats.culledPassCount++;
+    }
+
+    //a transient nobody surviving touches was never allocated
+    for (const Resource& r : this->resources)
+    {
+        if (r.transient && r.firstPass >= 0) stats.transientMemory += TextureBytes(r.desc);
+    }
+    for (const PooledTexture& t : this->pool) stats.poolMemory += TextureBytes(t.desc);
+    return stats;
+}
+
+unsigned int FrameGraph::AcquireTexture(const FGTextureDesc& desc)
+{
+    for (PooledTexture& t : this->pool)
+    {
+        if (!t.inUse && t.desc == desc)
+        {
+            t.inUse = true;
+            t.lastUsedFrame = this->frameIndex;
+            return t.handle;
+        }
+    }
+
+    //nothing free with that desc, grow the pool. immutable so any level can be bound as an image
+    PooledTexture t;
+    t.desc = desc;
+    t.inUse = true;
+    t.lastUsedFrame = this->frameIndex;
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &t.handle);
+    glTextureStorage2D(t.handle, desc.levels, desc.internalFormat, desc.width, desc.height);
+    glTextureParameteri(t.handle, GL_TEXTURE_MIN_FILTER, desc.minFilter);
+    glTextureParameteri(t.handle, GL_TEXTURE_MAG_FILTER, desc.minFilter == GL_NEAREST ? GL_NEAREST : GL_LINEAR);
+    glTextureParameteri(t.handle, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(t.handle, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(t.handle, GL_TEXTURE_MAX_LEVEL, desc.levels - 1);
+
+    this->pool.push_back(t);
+    return t.handle;
+}
+
+void FrameGraph::ReleaseTexture(unsigned int handle)
+{
+    for (PooledTexture& t : this->pool)
+    {
+        if (t.handle == handle)
+        {
+            t.inUse = false;
+            return;
+        }
+    }
+}
+
+void FrameGraph::TrimPool()
+{
+    std::vector<PooledTexture> kept;
+    for (PooledTexture& t : this->pool)
+    {
+        if (this->frameIndex - t.lastUsedFrame > FG_POOL_IDLE_FRAMES)
+        {
+            glDeleteTextures(1, &t.handle);
+        }
+        else
+        {
+            kept.push_back(t);
+        }
+    }
+    this->pool = kept;
+}
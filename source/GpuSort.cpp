@@ -0,0 +1,229 @@
+#include "../include/GpuSort.h"
+#include "../include/Definitions.h"
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <algorithm>
+
+#include "../include/ComputeShader.h"
+
+GpuSort::GpuSort(ComputeShader* bitonicLocalShader, ComputeShader* bitonicStepShader,
+                 ComputeShader* radixCountShader, ComputeShader* radixScanShader, ComputeShader* radixScatterShader)
+{
+    this->bitonicLocalShader = bitonicLocalShader;
+    this->bitonicStepShader = bitonicStepShader;
+    this->radixCountShader = radixCountShader;
+    this->radixScanShader = radixScanShader;
+    this->radixScatterShader = radixScatterShader;
+
+    this->scratchKeys = 0;
+    this->scratchValues = 0;
+    this->histogram = 0;
+    this->scratchCapacity = 0;
+}
+
+GpuSort::~GpuSort()
+{
+    glDeleteBuffers(1, &this->scratchKeys);
+    glDeleteBuffers(1, &this->scratchValues);
+    glDeleteBuffers(1, &this->histogram);
+}
+
+void GpuSort::Sort(unsigned int keyBuffer, unsigned int valueBuffer, unsigned int countBuffer, unsigned int countIndex,
+                   unsigned int maxCount, unsigned int keyBits, GpuSortAlgorithm algorithm)
+{
+    if (maxCount < 2) return;
+
+    if (algorithm == SORT_AUTO)
+    {
+        algorithm = maxCount <= GPU_SORT_BITONIC_MAX_KEYS ? SORT_BITONIC : SORT_RADIX;
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, countBuffer);
+
+    if (algorithm == SORT_BITONIC)
+    {
+        this->SortBitonic(keyBuffer, valueBuffer, countIndex, maxCount);
+    }
+    else
+    {
+        this->SortRadix(keyBuffer, valueBuffer, countIndex, maxCount, keyBits);
+    }
+}
+
+void GpuSort::SortBitonic(unsigned int keyBuffer, unsigned int valueBuffer, unsigned int countIndex, unsigned int maxCount)
+{
+    //padded to a power of two (>= one local block), the padding never exists in memory
+    unsigned int n = 1024;
+    while (n < maxCount) n <<= 1;
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, keyBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, valueBuffer);
+
+    for (ComputeShader* s : { this->bitonicLocalShader, this->bitonicStepShader })
+    {
+        s->use();
+        glUniform1ui(glGetUniformLocation(s->ID, "countIndex"), countIndex);
+        glUniform1ui(glGetUniformLocation(s->ID, "maxCount"), maxCount);
+    }
+
+    //every block of 1024 sorted in shared memory
+    this->bitonicLocalShader->use();
+    glUniform1i(glGetUniformLocation(this->bitonicLocalShader->ID, "merge"), 0);
+    glDispatchCompute(n / 1024, 1, 1);
+
+    //bigger stages: the long distance steps go through memory, the last 10 (distance 512 -> 1) back in shared memory
+    for (unsigned int k = 2048; k <= n; k <<= 1)
+    {
+        this->bitonicStepShader->use();
+        glUniform1ui(glGetUniformLocation(this->bitonicStepShader->ID, "stageSize"), k);
+        for (unsigned int d = k / 2; d >= 1024; d >>= 1)
+        {
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            glUniform1ui(glGetUniformLocation(this->bitonicStepShader->ID, "stepDistance"), d);
+            glDispatchCompute(n / 2 / 256, 1, 1);
+        }
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        this->bitonicLocalShader->use();
+        glUniform1i(glGetUniformLocation(this->bitonicLocalShader->ID, "merge"), 1);
+        glDispatchCompute(n / 1024, 1, 1);
+    }
+}
+
+void GpuSort::SortRadix(unsigned int keyBuffer, unsigned int valueBuffer, unsigned int countIndex, unsigned int maxCount, unsigned int keyBits)
+{
+    this->EnsureScratch(maxCount);
+
+    //even number of passes so the result ends up back in keyBuffer/valueBuffer
+    keyBits = std::min((keyBits + 7) / 8 * 8, 32u);
+    unsigned int tileCount = (maxCount + 1023) / 1024;
+
+    for (ComputeShader* s : { this->radixCountShader, this->radixScanShader, this->radixScatterShader })
+    {
+        s->use();
+        glUniform1ui(glGetUniformLocation(s->ID, "countIndex"), countIndex);
+        glUniform1ui(glGetUniformLocation(s->ID, "maxCount"), maxCount);
+        glUniform1ui(glGetUniformLocation(s->ID, "tileCount"), tileCount);
+    }
+
+    unsigned int keysIn = keyBuffer;
+    unsigned int valuesIn = valueBuffer;
+    unsigned int keysOut = this->scratchKeys;
+    unsigned int valuesOut = this->scratchValues;
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, this->histogram);
+
+    for (unsigned int shift = 0; shift < keyBits; shift += 4)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, keysIn);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, valuesIn);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, keysOut);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, valuesOut);
+
+        if (shift > 0) glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT); //last pass' scatter
+        this->radixCountShader->use();
+        glUniform1ui(glGetUniformLocation(this->radixCountShader->ID, "shift"), shift);
+        glDispatchCompute(tileCount, 1, 1);
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        this->radixScanShader->use();
+        glDispatchCompute(1, 1, 1);
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        this->radixScatterShader->use();
+        glUniform1ui(glGetUniformLocation(this->radixScatterShader->ID, "shift"), shift);
+        glDispatchCompute(tileCount, 1, 1);
+
+        std::swap(keysIn, keysOut);
+        std::swap(valuesIn, valuesOut);
+    }
+}
+
+void GpuSort::EnsureScratch(unsigned int maxCount)
+{
+    if (maxCount <= this->scratchCapacity) return;
+
+    glDeleteBuffers(1, &this->scratchKeys);
+    glDeleteBuffers(1, &this->scratchValues);
+    glDeleteBuffers(1, &this->histogram);
+
+    this->scratchCapacity = (maxCount + 1023) / 1024 * 1024;
+    unsigned int tileCount = this->scratchCapacity / 1024;
+
+    glCreateBuffers(1, &this->scratchKeys);
+    glNamedBufferStorage(this->scratchKeys, sizeof(uint32_t) * this->scratchCapacity, nullptr, 0);
+    glCreateBuffers(1, &this->scratchValues);
+    glNamedBufferStorage(this->scratchValues, sizeof(uint32_t) * this->scratchCapacity, nullptr, 0);
+    glCreateBuffers(1, &this->histogram);
+    glNamedBufferStorage(this->histogram, sizeof(uint32_t) * 16 * tileCount, nullptr, 0);
+}
+
+double GpuSort::Benchmark(unsigned int keyCount, GpuSortAlgorithm algorithm, unsigned int iterations)
+{
+    if (keyCount < 2 || iterations == 0) return 0.0;
+
+    std::mt19937 rng(keyCount);
+    std::vector<uint32_t> keys(keyCount);
+    std::vector<uint32_t> values(keyCount);
+    for (unsigned int i = 0; i < keyCount; i++)
+    {
+        keys[i] = std::min((uint32_t)rng(), 0xFFFFFFFEu);
+        values[i] = i;
+    }
+
+    unsigned int keyBuffer, valueBuffer, countBuffer;
+    glCreateBuffers(1, &keyBuffer);
+    glNamedBufferStorage(keyBuffer, sizeof(uint32_t) * keyCount, nullptr, GL_DYNAMIC_STORAGE_BIT);
+    glCreateBuffers(1, &valueBuffer);
+    glNamedBufferStorage(valueBuffer, sizeof(uint32_t) * keyCount, nullptr, GL_DYNAMIC_STORAGE_BIT);
+    glCreateBuffers(1, &countBuffer);
+    glNamedBufferStorage(countBuffer, sizeof(uint32_t), &keyCount, 0);
+
+    //timestamps, not GL_TIME_ELAPSED, so this doesn't collide with the frame timer
+    unsigned int queries[2];
+    glCreateQueries(GL_TIMESTAMP, 2, queries);
+
+    GLuint64 totalNs = 0;
+    for (unsigned int it = 0; it <= iterations; it++) //the first run only warms up
+    {
+        glNamedBufferSubData(keyBuffer, 0, sizeof(uint32_t) * keyCount, keys.data());
+        glNamedBufferSubData(valueBuffer, 0, sizeof(uint32_t) * keyCount, values.data());
+
+        glQueryCounter(queries[0], GL_TIMESTAMP);
+        this->Sort(keyBuffer, valueBuffer, countBuffer, 0, keyCount, 32, algorithm);
+        glQueryCounter(queries[1], GL_TIMESTAMP);
+
+        GLuint64 begin, end;
+        glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &end);
+        if (it > 0) totalNs += end - begin;
+    }
+
+    //last run: ascending keys and every value still next to its own key
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    std::vector<uint32_t> sortedKeys(keyCount);
+    std::vector<uint32_t> sortedValues(keyCount);
+    glGetNamedBufferSubData(keyBuffer, 0, sizeof(uint32_t) * keyCount, sortedKeys.data());
+    glGetNamedBufferSubData(valueBuffer, 0, sizeof(uint32_t) * keyCount, sortedValues.data());
+
+    bool sorted = true;
+    for (unsigned int i = 0; i < keyCount && sorted; i++)
+    {
+        sorted = (i == 0 || sortedKeys[i - 1] <= sortedKeys[i]) &&
+                 sortedValues[i] < keyCount && keys[sortedValues[i]] == sortedKeys[i];
+    }
+    if (!sorted)
+    {
+        std::cout << "ERROR: GPU sort benchmark result is not sorted (" << keyCount << " keys)\n";
+    }
+
+    glDeleteQueries(2, queries);
+    glDeleteBuffers(1, &keyBuffer);
+    glDeleteBuffers(1, &valueBuffer);
+    glDeleteBuffers(1, &countBuffer);
+
+    double seconds = (double)totalNs * 1e-9;
+    return seconds > 0.0 ? (double)keyCount * iterations / seconds : 0.0;
+}
@@ -0,0 +1,130 @@
+#include "../include/HeightPyramid.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+static inline float TexelHeight(uint8_t texel)
+{
+    return texel / 255.0f * TERRAIN_HEIGHT_SCALE + TERRAIN_HEIGHT_OFFSET;
+}
+
+HeightPyramid::HeightPyramid(const unsigned char* pixels, int width, int height, int channels)
+{
+    this->width = width;
+    this->height = height;
+
+    //LEVEL 0: cell c covers [c * size, (c + 1) * size] in texel units. the bilinear lookup there touches one more texel on
+    //each side, wrapped like the GL_REPEAT heightmap
+    const int size = (int)TERRAIN_HEIGHT_CELL_SIZE;
+    Level base;
+    base.width = (width + size - 1) / size;
+    base.height = (height + size - 1) / size;
+    base.cells.resize((size_t)base.width * base.height);
+
+    for (int cy = 0; cy < base.height; cy++)
+    {
+        for (int cx = 0; cx < base.width; cx++)
+        {
+            Cell c = { 255, 0 };
+            for (int ty = cy * size - 1; ty <= (cy + 1) * size; ty++)
+            {
+                int y = (ty % height + height) % height;
+                for (int tx = cx * size - 1; tx <= (cx + 1) * size; tx++)
+                {
+                    int x = (tx % width + width) % width;
+                    uint8_t texel = pixels[((size_t)y * width + x) * channels];
+                    c.min = std::min(c.min, texel);
+                    c.max = std::max(c.max, texel);
+                }
+            }
+            base.cells[(size_t)cy * base.width + cx] = c;
+        }
+    }
+    this->levels.push_back(std::move(base));
+
+    //LEVELS ABOVE: 2x2 cells of the one below, until a single cell is left
+    while (this->levels.back().width > 1 || this->levels.back().height > 1)
+    {
+        const Level& below = this->levels.back();
+        Level level;
+        level.width = (below.width + 1) / 2;
+        level.height = (below.height + 1) / 2;
+        level.cells.resize((size_t)level.width * level.height);
+
+        for (int y = 0; y < level.height; y++)
+        {
+            for (int x = 0; x < level.width; x++)
+            {
+                Cell c = { 255, 0 };
+                for (int i = 0; i < 4; i++)
+                {
+                    int bx = std::min(x * 2 + (i & 1), below.width - 1);
+                    int by = std::min(y * 2 + (i >> 1), below.height - 1);
+                    const Cell& b = below.cells[(size_t)by * below.width + bx];
+                    c.min = std::min(c.min, b.min);
+                    c.max = std::max(c.max, b.max);
+                }
+                level.cells[(size_t)y * level.width + x] = c;
+            }
+        }
+        this->levels.push_back(std::move(level));
+    }
+}
+
+glm::vec2 HeightPyramid::GetHeightRange(const glm::vec2& lo, const glm::vec2& hi) const
+{
+    //model -> texel units
+    glm::vec2 halfExtent = this->GetHalfExtent();
+    glm::vec2 t0 = glm::max(lo + halfExtent, glm::vec2(0.0f));
+    glm::vec2 t1 = glm::min(hi + halfExtent, glm::vec2((float)this->width, (float)this->height));
+    if (t0.x >= t1.x || t0.y >= t1.y) return glm::vec2(FLT_MAX, -FLT_MAX);
+
+    //level 0 cells touched (a cell already includes its far border), then the first level where that is <= 2x2 cells
+    const Level& base = this->levels[0];
+    const float size = (float)TERRAIN_HEIGHT_CELL_SIZE;
+    int x0 = std::min((int)(t0.x / size), base.width - 1);
+    int y0 = std::min((int)(t0.y / size), base.height - 1);
+    int x1 = std::clamp((int)std::ceil(t1.x / size) - 1, x0, base.width - 1);
+    int y1 = std::clamp((int)std::ceil(t1.y / size) - 1, y0, base.height - 1);
+
+    unsigned int l = 0;
+    while (l + 1 < this->levels.size() && ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1)) l++;
+
+    const Level& level = this->levels[l];
+    Cell c = { 255, 0 };
+    for (int y = y0 >> l; y <= (y1 >> l); y++)
+    {
+        for (int x = x0 >> l; x <= (x1 >> l); x++)
+        {
+            const Cell& cell = level.cells[(size_t)y * level.width + x];
+            c.min = std::min(c.min, cell.min);
+            c.max = std::max(c.max, cell.max);
+        }
+    }
+
+    return glm::vec2(TexelHeight(c.min), TexelHeight(c.max));
+}
+
+AABB HeightPyramid::GetBounds() const
+{
+    glm::vec2 halfExtent = this->GetHalfExtent();
+    const Cell& top = this->levels.back().cells[0];
+
+    AABB aabb;
+    aabb.min = Vec3(-halfExtent.x, TexelHeight(top.min), -halfExtent.y);
+    aabb.max = Vec3(halfExtent.x, TexelHeight(top.max), halfExtent.y);
+    return aabb;
+}
+
+glm::vec2 HeightPyramid::GetHalfExtent() const
+{
+    return glm::vec2((float)this->width, (float)this->height) * 0.5f;
+}
+
+size_t HeightPyramid::GetMemoryUsage() const
+{
+    size_t bytes = 0;
+    for (const Level& l : this->levels) bytes += l.cells.size() * sizeof(Cell);
+    return bytes;
+}
@@ -11,6 +11,7 @@
 #include "../include/Shader.h"
 #include "../include/Camera.h"
 #include "../include/Renderer.h"
+#include "../include/ClipmapTerrain.h"
 
 #include <iostream>
 
@@ -49,10 +50,11 @@ KoopaEngine::KoopaEngine() {
 
 KoopaEngine::~KoopaEngine() 
 {
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    //the renderer finishes captures, loads and streaming with gl calls, so it goes while the context is still there
     delete this->renderer;
     delete this->camera;
+    glfwDestroyWindow(window);
+    glfwTerminate();
     //delete this->window; glfwDestroyWindow
     std::cout << "Engine destroyed." << std::endl;
 }
@@ -71,9 +73,9 @@ void KoopaEngine::BeginFrame()
 
     glm::mat4 view = this->camera->GetViewMatrix();
     glm::mat4 projection = glm::perspective(glm::radians(this->camera->zoom), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, DEFAULT_NEAR, DEFAULT_FAR);
+    this->renderer->BeginRenderFrame(); //picks the render resolution, the camera uniforms depend on it
     this->renderer->SendCameraUniforms(view, projection, this->camera->position);
     this->renderer->SendOtherUniforms();
-    this->renderer->BeginRenderFrame(); //sets to screen FB
 
     //TEMP
     this->renderer->cam = this->camera;
@@ -158,6 +160,71 @@ void KoopaEngine::SetBloomThreshold(float threshold)
     this->renderer->SetBloomThreshold(threshold);
 }
 
+void KoopaEngine::SetPostProcessSettings(const PostProcessSettings& settings)
+{
+    this->renderer->SetPostProcessSettings(settings);
+}
+
+void KoopaEngine::SetAntiAliasing(AAMode mode)
+{
+    this->renderer->SetAntiAliasing(mode);
+}
+
+void KoopaEngine::SetRenderScale(float scale)
+{
+    this->renderer->SetRenderScale(scale);
+}
+
+void KoopaEngine::SetDynamicResolution(bool on, float frameTimeBudgetMs, float minScale)
+{
+    this->renderer->SetDynamicResolution(on, frameTimeBudgetMs, minScale);
+}
+
+void KoopaEngine::RequestFrameCapture(FrameCaptureCallback callback, CaptureSource source)
+{
+    this->renderer->RequestFrameCapture(callback, source);
+}
+
+void KoopaEngine::BenchmarkGpuSort()
+{
+    this->renderer->BenchmarkGpuSort();
+}
+
+FrameGraphStats KoopaEngine::GetFrameGraphStats()
+{
+    return this->renderer->GetFrameGraphStats();
+}
+
+bool KoopaEngine::ConvertHeightmapToTiles(const char* imagePath, const char* outPath)
+{
+    return ClipmapTerrain::ConvertHeightmap(imagePath, outPath);
+}
+
+void KoopaEngine::SetDepthPrepass(bool on)
+{
+    this->renderer->SetDepthPrepass(on);
+}
+
+void KoopaEngine::SetSSAO(bool on)
+{
+    this->renderer->SetSSAO(on);
+}
+
+void KoopaEngine::SetTerrainMeshMode(bool on)
+{
+    this->renderer->SetTerrainMeshMode(on);
+}
+
+void KoopaEngine::SetAsyncLoading(bool on)
+{
+    this->renderer->SetAsyncLoading(on);
+}
+
+bool KoopaEngine::IsLoadingAssets()
+{
+    return this->renderer->IsLoadingAssets();
+}
+
 void KoopaEngine::SetSkybox(const std::vector<const char*>& faces)
 {
     this->renderer->SetSkybox(faces);
@@ -198,19 +265,49 @@ void KoopaEngine::DrawTerrain(const char* path, Vec3 pos, Vec3 size, Vec4 rotati
     this->renderer->DrawTerrain(path, pos, size, rotation);
 }
 
+void KoopaEngine::DrawClipmapTerrain(const char* path, Vec3 pos, Vec3 size, Vec4 rotation)
+{
+    this->renderer->DrawClipmapTerrain(path, pos, size, rotation);
+}
+
 void KoopaEngine::DrawPointLight(Vec3 pos, Vec3 col, float range, float intensity, bool shadows)
 {
     this->renderer->AddPointLightToFrame(pos, col, range, intensity, shadows);
 }
 
+void KoopaEngine::SubmitPointLights(const PointLightDesc* lights, size_t count)
+{
+    this->renderer->AddPointLightsToFrame(lights, count);
+}
+
+void KoopaEngine::SubmitPointLights(const std::vector<PointLightDesc>& lights)
+{
+    this->renderer->AddPointLightsToFrame(lights.data(), lights.size());
+}
+
+PointLightHandle KoopaEngine::CreatePointLight(const PointLightDesc& light)
+{
+    return this->renderer->CreatePersistentPointLight(light);
+}
+
+void KoopaEngine::UpdatePointLight(PointLightHandle handle, const PointLightDesc& light)
+{
+    this->renderer->UpdatePersistentPointLight(handle, light);
+}
+
+void KoopaEngine::DestroyPointLight(PointLightHandle handle)
+{
+    this->renderer->DestroyPersistentPointLight(handle);
+}
+
 void KoopaEngine::DrawDirLight(Vec3 dir, Vec3 col, float intensity, bool shadows)
 {
     this->renderer->AddDirLightToFrame(dir, col, intensity, shadows);
 }
 
-void KoopaEngine::CreateParticleEmitter(double duration, unsigned int particleCount, Vec3 pos, Vec3 scale, Vec4 rotation)
+void KoopaEngine::CreateParticleEmitter(double duration, unsigned int particleCount, Vec3 pos, Vec3 scale, Vec4 rotation, const ParticlePhysics& physics)
 {
-    this->renderer->CreateParticleEmitter(duration, particleCount, pos, scale, rotation);
+    this->renderer->CreateParticleEmitter(duration, particleCount, pos, scale, rotation, physics);
 }
 
 void KoopaEngine::SetDrawLightsDebug(bool on)
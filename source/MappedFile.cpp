@@ -0,0 +1,124 @@
+#include "../include/MappedFile.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+    this->data = nullptr;
+    this->size = 0;
+    this->fileHandle = nullptr;
+    this->mappingHandle = nullptr;
+    this->fd = -1;
+}
+
+MappedFile::~MappedFile()
+{
+    this->Close();
+}
+
+bool MappedFile::Open(const char* path)
+{
+    this->Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        std::cout << "ERROR: Could not open " << path << '\n';
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        std::cout << "ERROR: " << path << " is empty\n";
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view)
+    {
+        std::cout << "ERROR: Could not map " << path << '\n';
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    this->fileHandle = file;
+    this->mappingHandle = mapping;
+    this->data = (const uint8_t*)view;
+    this->size = (size_t)fileSize.QuadPart;
+#else
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+    {
+        std::cout << "ERROR: Could not open " << path << '\n';
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0)
+    {
+        std::cout << "ERROR: " << path << " is empty\n";
+        close(file);
+        return false;
+    }
+
+    void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (view == MAP_FAILED)
+    {
+        std::cout << "ERROR: Could not map " << path << '\n';
+        close(file);
+        return false;
+    }
+
+    this->fd = file;
+    this->data = (const uint8_t*)view;
+    this->size = (size_t)info.st_size;
+#endif
+
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (!this->data) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(this->data);
+    CloseHandle((HANDLE)this->mappingHandle);
+    CloseHandle((HANDLE)this->fileHandle);
+#else
+    munmap((void*)this->data, this->size);
+    close(this->fd);
+#endif
+
+    this->data = nullptr;
+    this->size = 0;
+    this->fileHandle = nullptr;
+    this->mappingHandle = nullptr;
+    this->fd = -1;
+}
+
+const uint8_t* MappedFile::GetData() const
+{
+    return this->data;
+}
+
+size_t MappedFile::GetSize() const
+{
+    return this->size;
+}
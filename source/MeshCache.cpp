@@ -0,0 +1,225 @@
+#include "../include/MeshCache.h"
+
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+static constexpr uint32_t KMESH_VERSION = 1;
+
+static inline uint64_t Align16(uint64_t offset)
+{
+    return (offset + 15) & ~(uint64_t)15;
+}
+
+MeshCache::MeshCache()
+{
+    this->header = nullptr;
+    this->entries = nullptr;
+}
+
+uint64_t MeshCache::HashFile(const char* path)
+{
+    MappedFile source;
+    if (!source.Open(path)) return 0;
+
+    //FNV-1a, 64 bit
+    uint64_t hash = 14695981039346656037ull;
+    const uint8_t* data = source.GetData();
+    for (size_t i = 0; i < source.GetSize(); i++)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+std::string MeshCache::GetCachePath(const std::string& sourcePath)
+{
+    return sourcePath + ".kmesh";
+}
+
+bool MeshCache::Write(const std::string& sourcePath, const MeshCacheKey& key, const std::vector<MeshCacheMesh>& meshes)
+{
+    //LAYOUT: header, entries, then per mesh its vertices, indices, lod vertices, lod indices and texture refs, strings last
+    KMeshHeader header = {};
+    std::memcpy(header.magic, "KMSH", 4);
+    header.version = KMESH_VERSION;
+    header.sourceHash = key.sourceHash;
+    header.importFlags = key.importFlags;
+    header.vertexSize = key.vertexSize;
+    header.lodRatio = key.lodRatio;
+    header.lodError = key.lodError;
+    header.meshCount = (uint32_t)meshes.size();
+
+    std::vector<KMeshEntry> entries(meshes.size());
+    std::vector<std::vector<KMeshTextureRef>> refs(meshes.size());
+    std::string strings;
+
+    uint64_t offset = Align16(sizeof(KMeshHeader) + sizeof(KMeshEntry) * entries.size());
+    auto place = [&offset](KMeshRange& range, uint64_t count, uint64_t elementSize)
+    {
+        range.offset = offset;
+        range.count = count;
+        offset = Align16(offset + count * elementSize);
+    };
+
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        const MeshCacheMesh& m = meshes[i];
+        KMeshEntry& e = entries[i];
+        place(e.vertices, m.vertexCount, key.vertexSize);
+        place(e.indices, m.indexCount, sizeof(unsigned int));
+        place(e.lodVertices, m.lodVertexCount, key.vertexSize);
+        place(e.lodIndices, m.lodIndexCount, sizeof(unsigned int));
+        place(e.textures, m.textures.size(), sizeof(KMeshTextureRef));
+        e.aabbMin[0] = m.aabb.min.x; e.aabbMin[1] = m.aabb.min.y; e.aabbMin[2] = m.aabb.min.z;
+        e.aabbMax[0] = m.aabb.max.x; e.aabbMax[1] = m.aabb.max.y; e.aabbMax[2] = m.aabb.max.z;
+
+        for (const std::pair<std::string, std::string>& t : m.textures)
+        {
+            KMeshTextureRef ref;
+            ref.typeOffset = (uint32_t)strings.size();
+            ref.typeLength = (uint32_t)t.first.size();
+            strings += t.first;
+            ref.pathOffset = (uint32_t)strings.size();
+            ref.pathLength = (uint32_t)t.second.size();
+            strings += t.second;
+            refs[i].push_back(ref);
+        }
+    }
+
+    //string offsets were relative to the blob
+    uint64_t stringsOffset = offset;
+    for (std::vector<KMeshTextureRef>& meshRefs : refs)
+    {
+        for (KMeshTextureRef& ref : meshRefs)
+        {
+            ref.typeOffset += (uint32_t)stringsOffset;
+            ref.pathOffset += (uint32_t)stringsOffset;
+        }
+    }
+
+    std::string cachePath = GetCachePath(sourcePath);
+    std::ofstream out(cachePath, std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        std::cout << "ERROR: Could not write mesh cache " << cachePath << '\n';
+        return false;
+    }
+
+    uint64_t written = 0;
+    auto write = [&out, &written](uint64_t at, const void* data, uint64_t size)
+    {
+        static const char zeros[16] = {};
+        while (written < at)
+        {
+            uint64_t pad = std::min<uint64_t>(at - written, sizeof(zeros));
+            out.write(zeros, (std::streamsize)pad);
+            written += pad;
+        }
+        if (size != 0) out.write((const char*)data, (std::streamsize)size);
+        written += size;
+    };
+
+    write(0, &header, sizeof(header));
+    write(sizeof(header), entries.data(), sizeof(KMeshEntry) * entries.size());
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        const MeshCacheMesh& m = meshes[i];
+        const KMeshEntry& e = entries[i];
+        write(e.vertices.offset, m.vertices, m.vertexCount * key.vertexSize);
+        write(e.indices.offset, m.indices, m.indexCount * sizeof(unsigned int));
+        write(e.lodVertices.offset, m.lodVertices, m.lodVertexCount * key.vertexSize);
+        write(e.lodIndices.offset, m.lodIndices, m.lodIndexCount * sizeof(unsigned int));
+        write(e.textures.offset, refs[i].data(), refs[i].size() * sizeof(KMeshTextureRef));
+    }
+    write(stringsOffset, strings.data(), strings.size());
+
+    if (!out)
+    {
+        std::cout << "ERROR: Could not write mesh cache " << cachePath << '\n';
+        return false;
+    }
+    return true;
+}
+
+bool MeshCache::Open(const std::string& sourcePath, const MeshCacheKey& key)
+{
+    this->Close();
+
+    //no cache yet is the normal first load, not an error
+    std::string cachePath = GetCachePath(sourcePath);
+    if (!std::ifstream(cachePath).good() || !this->file.Open(cachePath.c_str())) return false;
+
+    const KMeshHeader* h = (const KMeshHeader*)this->file.GetData();
+    if (this->file.GetSize() < sizeof(KMeshHeader) || std::memcmp(h->magic, "KMSH", 4) != 0 || h->version != KMESH_VERSION ||
+        h->sourceHash != key.sourceHash || h->importFlags != key.importFlags || h->vertexSize != key.vertexSize ||
+        h->lodRatio != key.lodRatio || h->lodError != key.lodError ||
+        !this->IsInside(sizeof(KMeshHeader), h->meshCount, sizeof(KMeshEntry)))
+    {
+        this->file.Close();
+        return false;
+    }
+
+    //a cut short or damaged file is treated like a stale one, it gets rebuilt
+    const KMeshEntry* e = (const KMeshEntry*)(this->file.GetData() + sizeof(KMeshHeader));
+    for (uint32_t i = 0; i < h->meshCount; i++)
+    {
+        bool valid = this->IsInside(e[i].vertices.offset, e[i].vertices.count, h->vertexSize) &&
+                     this->IsInside(e[i].indices.offset, e[i].indices.count, sizeof(unsigned int)) &&
+                     this->IsInside(e[i].lodVertices.offset, e[i].lodVertices.count, h->vertexSize) &&
+                     this->IsInside(e[i].lodIndices.offset, e[i].lodIndices.count, sizeof(unsigned int)) &&
+                     this->IsInside(e[i].textures.offset, e[i].textures.count, sizeof(KMeshTextureRef));
+
+        const KMeshTextureRef* refs = valid ? (const KMeshTextureRef*)(this->file.GetData() + e[i].textures.offset) : nullptr;
+        for (uint64_t t = 0; valid && t < e[i].textures.count; t++)
+        {
+            valid = this->IsInside(refs[t].typeOffset, refs[t].typeLength, 1) && this->IsInside(refs[t].pathOffset, refs[t].pathLength, 1);
+        }
+
+        if (!valid)
+        {
+            std::cout << "ERROR: Mesh cache " << cachePath << " is damaged, rebuilding it\n";
+            this->file.Close();
+            return false;
+        }
+    }
+
+    this->header = h;
+    this->entries = e;
+    return true;
+}
+
+void MeshCache::Close()
+{
+    this->file.Close();
+    this->header = nullptr;
+    this->entries = nullptr;
+}
+
+unsigned int MeshCache::GetMeshCount() const
+{
+    return this->header ? this->header->meshCount : 0;
+}
+
+const KMeshEntry& MeshCache::GetMesh(unsigned int index) const
+{
+    return this->entries[index];
+}
+
+const void* MeshCache::GetRange(const KMeshRange& range) const
+{
+    return this->file.GetData() + range.offset;
+}
+
+std::string MeshCache::GetString(uint32_t offset, uint32_t length) const
+{
+    return std::string((const char*)this->file.GetData() + offset, length);
+}
+
+bool MeshCache::IsInside(uint64_t offset, uint64_t count, uint64_t elementSize) const
+{
+    //count * elementSize could wrap on a damaged file
+    return offset <= this->file.GetSize() && count <= (this->file.GetSize() - offset) / elementSize;
+}
@@ -1,88 +1,88 @@
 #include "../include/ParticleEmitter.h"
 
-#include <glad/glad.h>
-#include <glm/gtc/type_ptr.hpp>
-#include <GLFW/glfw3.h>
-#include <vector>
-
-#include "../include/Shader.h"
-#include "../include/ComputeShader.h"
-
-ParticleEmitter::ParticleEmitter(glm::mat4 model, unsigned int particleCount, double time)
+ParticleEmitter::ParticleEmitter(glm::mat4 model, unsigned int particleCount, double time, const ParticlePhysics& physics, unsigned int slot)
 {
     this->model = model;
     this->particleCount = particleCount;
+    this->slot = slot;
     this->timeLeft = time;
     this->maxLife = 3.0f;
+    this->speed = 20.0f;
+    this->spawnAccumulator = 0.0f;
+    this->physics = physics;
+    this->pendingDt = 0.0f;
+    this->skippedFrames = 0;
+}
 
-    std::vector<Particle> particles = std::vector<Particle>(particleCount);
-
-    //TODO: Do this setup on the gpu woth compute shader.
-    //PARTICLES
-    for (auto& p : particles)
-    {
-        p.positionLife = glm::vec4(0.0f, 0.0f, 0.0f, maxLife * RandomFloat01());
-        p.velocityActive = glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
-        //rest will be overwritten in compute shader
-    }
+float ParticleEmitter::Step(float dt, bool visible)
+{
+    this->pendingDt += dt;
+    if (!visible && ++this->skippedFrames < PARTICLE_OFFSCREEN_UPDATE_INTERVAL) return 0.0f;
 
-    glGenBuffers(1, &this->ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->ssbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Particle) * this->particleCount, particles.data(), GL_DYNAMIC_COPY);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->ssbo); //binding = 1
-    //unbind
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    float step = this->pendingDt;
+    this->pendingDt = 0.0f;
+    this->skippedFrames = 0;
+    return step;
+}
 
-    glGenVertexArrays(1, &this->vao);
-    glBindVertexArray(this->vao);
-    glBindBuffer(GL_ARRAY_BUFFER, this->ssbo); //just contains all particles
+unsigned int ParticleEmitter::RequestSpawns(float dt, float lod)
+{
+    this->timeLeft -= dt;
+    if (this->timeLeft < 0) return 0; //done, waiting for the last particles to die
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, positionLife)); //location = 0
-    glVertexAttribDivisor(0, 1); //1 move per instance
-    glEnableVertexAttribArray(0);
+    this->spawnAccumulator += dt * lod * (float)this->particleCount / this->maxLife;
+    unsigned int spawns = (unsigned int)this->spawnAccumulator;
+    this->spawnAccumulator -= (float)spawns;
 
-    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)(offsetof(Particle, positionLife) + sizeof(float) * 3)); //location = 1
-    glVertexAttribDivisor(1, 1); //1 move per instance
-    glEnableVertexAttribArray(1);
+    return spawns;
+}
 
-    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)(offsetof(Particle, velocityActive) + sizeof(float) * 3)); //location = 2
-    glVertexAttribDivisor(2, 1); //1 move per instance
-    glEnableVertexAttribArray(2);
+bool ParticleEmitter::DoneEmitting() const
+{
+    return this->timeLeft + (double)this->maxLife < 0;
+}
 
-    glBindVertexArray(0);
+AABB ParticleEmitter::GetWorldBounds() const
+{
+    //launched from the origin at up to speed (scaled like the model), then pulled by gravity for the rest of maxLife.
+    //drag only shrinks this, bounces stay inside it (restitution <= 1)
+    glm::vec3 origin = glm::vec3(this->model[3]);
+    float scale = std::max(glm::length(glm::vec3(this->model[0])), std::max(glm::length(glm::vec3(this->model[1])), glm::length(glm::vec3(this->model[2]))));
+    float reach = this->speed * scale * this->maxLife;
+    float pull = 0.5f * this->physics.gravity * this->maxLife * this->maxLife;
+
+    AABB bounds;
+    bounds.min = Vec3(origin.x - reach, origin.y - reach - std::max(pull, 0.0f), origin.z - reach);
+    bounds.max = Vec3(origin.x + reach, origin.y + reach - std::min(pull, 0.0f), origin.z + reach);
+    return bounds;
 }
 
-ParticleEmitter::~ParticleEmitter()
+const glm::mat4& ParticleEmitter::GetModel() const
 {
-    glDeleteVertexArrays(1, &this->vao);
-    glDeleteBuffers(1, &this->ssbo);
+    return this->model;
 }
 
-void ParticleEmitter::Update(ComputeShader* particleShader, float dt)
+unsigned int ParticleEmitter::GetParticleCount() const
 {
-    particleShader->use();
+    return this->particleCount;
+}
 
-    this->timeLeft -= dt;
-    glUniform1f(glGetUniformLocation(particleShader->ID, "dt"), dt);
-    glUniform1i(glGetUniformLocation(particleShader->ID, "doneEmitting"), this->timeLeft < 0);
-    glUniform1f(glGetUniformLocation(particleShader->ID, "maxLife"), this->maxLife);
+unsigned int ParticleEmitter::GetSlot() const
+{
+    return this->slot;
+}
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->ssbo); 
-    unsigned int groups = (this->particleCount + 1023) / 1024; //ceil(groups / localsize);
-    glDispatchCompute(groups, 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+const ParticlePhysics& ParticleEmitter::GetPhysics() const
+{
+    return this->physics;
 }
 
-void ParticleEmitter::Render(Shader* shader)
+float ParticleEmitter::GetMaxLife() const
 {
-    shader->use();
-    glUniformMatrix4fv(glGetUniformLocation(shader->ID, "model"), 1, false, glm::value_ptr(this->model));
-    glBindVertexArray(this->vao);
-    glDrawArraysInstanced(GL_POINTS, 0, 1, this->particleCount);
-    glBindVertexArray(0);
+    return this->maxLife;
 }
 
-bool ParticleEmitter::DoneEmitting()
+float ParticleEmitter::GetSpeed() const
 {
-    return this->timeLeft + (double)this->maxLife < 0;
+    return this->speed;
 }
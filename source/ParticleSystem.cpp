@@ -0,0 +1,259 @@
+#include "../include/ParticleSystem.h"
+#include "../include/Definitions.h"
+
+#include <glad/glad.h>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <iostream>
+
+#include "../include/Shader.h"
+#include "../include/ComputeShader.h"
+#include "../include/GpuSort.h"
+
+ParticleSystem::ParticleSystem()
+{
+    //everything is allocated once here. zeroed counters = nothing alive, nothing dead, no index handed out yet
+    glCreateBuffers(1, &this->particleSSBO);
+    glNamedBufferStorage(this->particleSSBO, sizeof(Particle) * MAX_PARTICLES, nullptr, 0);
+
+    glCreateBuffers(2, this->aliveListSSBO);
+    glNamedBufferStorage(this->aliveListSSBO[0], sizeof(uint32_t) * MAX_PARTICLES, nullptr, 0);
+    glNamedBufferStorage(this->aliveListSSBO[1], sizeof(uint32_t) * MAX_PARTICLES, nullptr, 0);
+
+    glCreateBuffers(1, &this->deadListSSBO);
+    glNamedBufferStorage(this->deadListSSBO, sizeof(uint32_t) * MAX_PARTICLES, nullptr, 0);
+
+    //aliveCount, aliveCountNext, deadCount, freshCount | simulate dispatch (x, y, z), pad | draw (count, instanceCount, first, baseInstance)
+    uint32_t counters[12] = { 0, 0, 0, 0,   0, 1, 1, 0,   1, 0, 0, 0 };
+    glCreateBuffers(1, &this->counterSSBO);
+    glNamedBufferStorage(this->counterSSBO, sizeof(counters), counters, GL_DYNAMIC_STORAGE_BIT);
+
+    glCreateBuffers(1, &this->spawnSSBO);
+    glNamedBufferStorage(this->spawnSSBO, sizeof(SpawnRequestGPU) * MAX_PARTICLE_SPAWN_REQUESTS, nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+    glCreateBuffers(1, &this->sortKeySSBO);
+    glNamedBufferStorage(this->sortKeySSBO, sizeof(uint32_t) * MAX_PARTICLES, nullptr, 0);
+
+    glCreateBuffers(1, &this->emitterStateSSBO);
+    glNamedBufferStorage(this->emitterStateSSBO, sizeof(EmitterStateGPU) * MAX_PARTICLE_EMITTERS, nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+    glCreateVertexArrays(1, &this->emptyVAO);
+
+    GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &this->countReadbackBuffer);
+    glNamedBufferStorage(this->countReadbackBuffer, sizeof(uint32_t) * PARTICLE_COUNT_READBACKS, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+    this->countReadback = (const uint32_t*)glMapNamedBufferRange(this->countReadbackBuffer, 0, sizeof(uint32_t) * PARTICLE_COUNT_READBACKS, flags);
+    for (unsigned int i = 0; i < PARTICLE_COUNT_READBACKS; i++)
+    {
+        this->countFences[i] = 0;
+        this->countSpawnTotals[i] = 0;
+    }
+    this->countReadbackIndex = 0;
+    this->spawnTotal = 0;
+    this->aliveMinusSpawns = 0;
+
+    this->spawnRequests.reserve(MAX_PARTICLE_SPAWN_REQUESTS);
+    this->emitterStates.resize(MAX_PARTICLE_EMITTERS, { 0.0f, 0, 0.0f, 0.0f, 0.0f, 0 });
+    this->slotCount = 0;
+    this->frameSeed = 0;
+}
+
+ParticleSystem::~ParticleSystem()
+{
+    glDeleteBuffers(1, &this->particleSSBO);
+    glDeleteBuffers(2, this->aliveListSSBO);
+    glDeleteBuffers(1, &this->deadListSSBO);
+    glDeleteBuffers(1, &this->counterSSBO);
+    glDeleteBuffers(1, &this->spawnSSBO);
+    glDeleteBuffers(1, &this->sortKeySSBO);
+    glDeleteBuffers(1, &this->emitterStateSSBO);
+    glDeleteVertexArrays(1, &this->emptyVAO);
+
+    for (GLsync fence : this->countFences)
+    {
+        if (fence) glDeleteSync(fence);
+    }
+    glUnmapNamedBuffer(this->countReadbackBuffer);
+    glDeleteBuffers(1, &this->countReadbackBuffer);
+}
+
+void ParticleSystem::AddEmitter(const glm::mat4& model, unsigned int particleCount, double duration, const ParticlePhysics& physics)
+{
+    unsigned int slot;
+    if (!this->freeSlots.empty())
+    {
+        slot = this->freeSlots.back();
+        this->freeSlots.pop_back();
+    }
+    else if (this->slotCount < MAX_PARTICLE_EMITTERS)
+    {
+        slot = this->slotCount++;
+    }
+    else
+    {
+        std::cout << "ERROR: Max particle emitters reached\n";
+        return;
+    }
+
+    this->emitters.emplace_back(model, particleCount, duration, physics, slot);
+}
+
+void ParticleSystem::RemoveFinishedEmitters()
+{
+    //their particles are dead by now and already back on the dead list, so the slot can be reused
+    this->emitters.erase(std::remove_if(this->emitters.begin(), this->emitters.end(),
+        [this](const ParticleEmitter& e)
+        {
+            if (!e.DoneEmitting()) return false;
+            this->freeSlots.push_back(e.GetSlot());
+            return true;
+        }), this->emitters.end());
+}
+
+size_t ParticleSystem::GetEmitterCount() const
+{
+    return this->emitters.size();
+}
+
+bool ParticleSystem::HasCollidingEmitters() const
+{
+    for (const ParticleEmitter& e : this->emitters)
+    {
+        if (e.GetPhysics().collisions) return true;
+    }
+    return false;
+}
+
+unsigned int ParticleSystem::GetParticleBuffer() const
+{
+    return this->particleSSBO;
+}
+
+void ParticleSystem::Simulate(ComputeShader* emitShader, ComputeShader* simulateShader, ComputeShader* finishShader, GpuSort* sorter,
+                              const std::function<bool(const AABB&)>& isVisible, const glm::vec3& cameraPos, bool collisions, float dt)
+{
+    //EMITTERS (cpu, one record each): culling, update rate, LOD---
+    this->spawnRequests.clear();
+    unsigned int totalSpawns = 0;
+    bool overflow = false;
+
+    for (ParticleEmitter& e : this->emitters)
+    {
+        AABB bounds = e.GetWorldBounds();
+        bool visible = isVisible(bounds);
+
+        //distance to the bounds, not the origin, so big emitters don't drop detail while the camera is inside them
+        glm::vec3 boundsMin = glm::vec3(bounds.min.x, bounds.min.y, bounds.min.z);
+        glm::vec3 boundsMax = glm::vec3(bounds.max.x, bounds.max.y, bounds.max.z);
+        float distance = glm::length(glm::max(glm::max(boundsMin - cameraPos, cameraPos - boundsMax), glm::vec3(0.0f)));
+        float lod = glm::clamp(PARTICLE_LOD_DISTANCE / std::max(distance, 1e-3f), PARTICLE_MIN_LOD, 1.0f);
+
+        float step = e.Step(dt, visible);
+        const ParticlePhysics& physics = e.GetPhysics();
+        this->emitterStates[e.GetSlot()] = { step, visible ? 1u : 0u, physics.gravity, physics.drag, physics.restitution, physics.collisions ? 1u : 0u };
+
+        unsigned int spawns = step > 0.0f ? e.RequestSpawns(step, lod) : 0;
+        if (spawns == 0) continue;
+
+        if (this->spawnRequests.size() >= MAX_PARTICLE_SPAWN_REQUESTS)
+        {
+            overflow = true;
+            continue;
+        }
+
+        this->spawnRequests.push_back({ e.GetModel(), e.GetMaxLife(), e.GetSpeed(), spawns, totalSpawns, e.GetSlot(), {} });
+        totalSpawns += spawns;
+    }
+    if (overflow)
+    {
+        std::cout << "ERROR: Max particle spawn requests exceeded\n";
+    }
+    this->spawnTotal += totalSpawns;
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, this->particleSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, this->aliveListSSBO[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, this->aliveListSSBO[1]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, this->deadListSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, this->counterSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, this->spawnSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, this->sortKeySSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 17, this->emitterStateSSBO);
+
+    if (this->slotCount > 0)
+    {
+        glNamedBufferSubData(this->emitterStateSSBO, 0, sizeof(EmitterStateGPU) * this->slotCount, this->emitterStates.data());
+    }
+
+    //EMIT: one thread per new particle, appended to the alive list being read this frame---
+    if (totalSpawns > 0)
+    {
+        glNamedBufferSubData(this->spawnSSBO, 0, sizeof(SpawnRequestGPU) * this->spawnRequests.size(), this->spawnRequests.data());
+
+        emitShader->use();
+        glUniform1ui(glGetUniformLocation(emitShader->ID, "requestCount"), (unsigned int)this->spawnRequests.size());
+        glUniform1ui(glGetUniformLocation(emitShader->ID, "totalSpawns"), totalSpawns);
+        glUniform1ui(glGetUniformLocation(emitShader->ID, "seed"), this->frameSeed++);
+        glUniform1ui(glGetUniformLocation(emitShader->ID, "maxParticles"), MAX_PARTICLES);
+        glDispatchCompute((totalSpawns + 255) / 256, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT); //emission grows the dispatch args
+    }
+
+    //SIMULATE: alive[0] -> alive[1] (survivors, visible front / hidden back) / dead list, one thread per alive particle---
+    simulateShader->use();
+    glUniform1ui(glGetUniformLocation(simulateShader->ID, "maxParticles"), MAX_PARTICLES);
+    glUniform1i(glGetUniformLocation(simulateShader->ID, "collisions"), collisions);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, this->counterSSBO);
+    glDispatchComputeIndirect(4 * sizeof(uint32_t));
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    //FINISH: counts for next frame + indirect args---
+    finishShader->use();
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    //SORT BOUND: newest alive count that made it back + the spawns requested after it. emission can only add what was
+    //requested, so the visible front never outgrows it (a cpu estimate could, leaving the tail unsorted)---
+    for (unsigned int i = 0; i < PARTICLE_COUNT_READBACKS; i++)
+    {
+        if (this->countFences[i] == 0) continue;
+
+        //timeout 0: only asks, never waits
+        GLenum result = glClientWaitSync(this->countFences[i], 0, 0);
+        if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) continue;
+
+        glDeleteSync(this->countFences[i]);
+        this->countFences[i] = 0;
+        this->aliveMinusSpawns = std::min(this->aliveMinusSpawns, (int64_t)this->countReadback[i] - (int64_t)this->countSpawnTotals[i]);
+    }
+    unsigned int sortBound = (unsigned int)std::min<int64_t>(this->aliveMinusSpawns + (int64_t)this->spawnTotal, MAX_PARTICLES);
+
+    //this frame's aliveCount, skipped while the gpu is more than PARTICLE_COUNT_READBACKS copies behind
+    unsigned int slot = this->countReadbackIndex;
+    if (this->countFences[slot] == 0)
+    {
+        glCopyNamedBufferSubData(this->counterSSBO, this->countReadbackBuffer, 0, sizeof(uint32_t) * slot, sizeof(uint32_t));
+        this->countFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        this->countSpawnTotals[slot] = this->spawnTotal;
+        this->countReadbackIndex = (slot + 1) % PARTICLE_COUNT_READBACKS;
+    }
+
+    //SORT: the visible front of the new alive list far to near (count = drawArgs.instanceCount, counters[9]).
+    //barrier before the draw is placed by the frame graph---
+    sorter->Sort(this->sortKeySSBO, this->aliveListSSBO[1], this->counterSSBO, 9, sortBound);
+    std::swap(this->aliveListSSBO[0], this->aliveListSSBO[1]);
+}
+
+void ParticleSystem::Render(Shader* shader)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, this->particleSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, this->aliveListSSBO[0]);
+
+    //instanceCount = aliveCount, written on the GPU by csParticleFinish
+    shader->use();
+    glBindVertexArray(this->emptyVAO);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->counterSSBO);
+    glDrawArraysIndirect(GL_POINTS, (void*)(8 * sizeof(uint32_t)));
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+}
@@ -3,6 +3,7 @@
 
 #include <glad/glad.h>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/packing.hpp>
 #include <stb_image.h>
 #include <GLFW/glfw3.h>
 
@@ -13,9 +14,18 @@
 #include "../include/Setup.h"
 #include "../include/Camera.h"
 #include "../include/Model.h"
-#include "../include/ParticleEmitter.h"
+#include "../include/ParticleSystem.h"
+#include "../include/FrameGraph.h"
+#include "../include/FrameCapture.h"
+#include "../include/GpuSort.h"
+#include "../include/TerrainQuadtree.h"
+#include "../include/HeightPyramid.h"
+#include "../include/ClipmapTerrain.h"
+#include "../include/TerrainMesh.h"
+#include "../include/AssetLoader.h"
 
 #include <iostream>
+#include <memory>
 #include <random>
 
 //temp
@@ -37,8 +47,6 @@ Renderer::Renderer()
     //initial setup   
     this->drawCalls = {};                                             
     this->cascadeLevels = { DEFAULT_FAR / 35.0f, DEFAULT_FAR / 15.0f, DEFAULT_FAR / 6.0f, DEFAULT_FAR / 2.0f };
-    this->cascadeMultipliers = {12.0f, 10.0f, 4.0f, 2.0f, 1.2f}; //minecraft{12.0f, 10.0f, 4.0f, 2.0f, 1.2f}
-    assert(cascadeLevels.size() == cascadeMultipliers.size() - 1);
 
     this->usingSkybox = false;
     this->clearColor = Vec4(0.0f, 0.0f, 0.0f, 1.0f);
@@ -46,13 +54,40 @@ Renderer::Renderer()
     this->expFogDensity = 0.15f;
     this->linearFogStart = 70.0f;
     this->fogType = EXPONENTIAL_SQUARED;
-    this->msaa = true;
+    this->antiAliasing = AA_MSAA_4X;
+    this->hdrMSAAFBO = this->hdrMSAATextureRGBA = this->hdrMSAARBO = 0;
+    this->gVelocityTextureRG = this->taaHistoryTextureRGBA[0] = this->taaHistoryTextureRGBA[1] = 0;
+    this->taaFrameIndex = 0;
+    this->taaHistoryIndex = 0;
+    this->taaHistoryValid = false;
+    this->taaPrevViewProjection = glm::mat4(1.0f);
+    this->dynamicResolution = false;
+    this->frameTimeBudgetMs = DEFAULT_FRAME_TIME_BUDGET_MS;
+    this->minRenderScale = MIN_RENDER_SCALE;
+    this->gpuTimerFrame = 0;
+    this->prevRenderScaleXY = glm::vec2(1.0f);
+    this->cameraPosition = glm::vec3(0.0f);
+    this->cameraPixelsPerUnit = 0.5f * SCREEN_HEIGHT;
+    this->depthPrepass = false;
+    this->ssao = true;
+    this->terrainMeshMode = false;
+    this->asyncLoading = true;
+    this->postProcess = PostProcessSettings();
+    this->frameGraph = new FrameGraph();
+    this->frameCapture = new FrameCapture();
+    this->assetLoader = new AssetLoader();
+    this->particleSystem = new ParticleSystem();
     
     // shaders
     this->InitializeShaders();
 
     //NOTE: DO THIS AFTER THE POINT LIGHT VECTOR IS INITIALIZED... facepalm
     this->SetupFramebuffers();
+
+    //full res until told otherwise (sends the resolution dependent uniforms)
+    glGenQueries(GPU_TIMER_QUERY_COUNT, this->gpuTimerQueries);
+    this->ApplyRenderScale(1.0f);
+
     this->SetupVertexBuffers();
 
    
@@ -63,6 +98,9 @@ Renderer::Renderer()
     this->InitializeDirLight();
     this->currentFramePointLightCount = 0;
     this->currentFrameShadowArrayIndex = 0;
+    this->framePointLights.reserve(MAX_POINT_LIGHTS);
+    this->pointLightCullData.reserve(MAX_POINT_LIGHTS);
+    this->pointLightShadingData.reserve(MAX_POINT_LIGHTS);
 
     //Since these texture units are exclusivley for these wont change, we can just set them once
     //here in the constructor.
@@ -72,10 +110,6 @@ Renderer::Renderer()
     //cascade
     glActiveTexture(GL_TEXTURE4);
     glBindTexture(GL_TEXTURE_2D_ARRAY, this->cascadeShadowMapTextureArrayDepth);
-    //ssao
-    glActiveTexture(GL_TEXTURE10);
-    glBindTexture(GL_TEXTURE_2D, this->ssaoBlurTextureR);
-
     glActiveTexture(GL_TEXTURE0);
 
     int major = 0, minor = 0;
@@ -142,22 +176,36 @@ void Renderer::InitializeShaders()
     this->debugLightShader = new Shader(ShaderSources::vs1, ShaderSources::fsLight);
     this->drawDebugLights = false;
 
-    //Final quad shader
-    this->screenShader = new Shader(ShaderSources::vsScreenQuad, ShaderSources::fsScreenQuad);
-    this->screenShader->use();
-    glUniform1i(glGetUniformLocation(this->screenShader->ID, "hdrBuffer"), 0); //GL_TEXTIRE0
-    glUniform1i(glGetUniformLocation(this->screenShader->ID, "blurBuffer"), 1); //GL_TEXTIRE1
-    glUniform1f(glGetUniformLocation(this->screenShader->ID, "exposure"), DEFAULT_EXPOSURE); //set exposure
-
-    //extract bright parts from hdrScene
-    this->brightShader = new Shader(ShaderSources::vsScreenQuad, ShaderSources::fsBright);
-    glUniform1i(glGetUniformLocation(this->screenShader->ID, "hdrScene"), 0); //GL_TEXTIRE0
-
-    //2 pass blur shader
-    this->blurShader = new Shader(ShaderSources::vsScreenQuad, ShaderSources::fsBlur);
-    this->blurShader->use();
-    glUniform1i(glGetUniformLocation(this->blurShader->ID, "scene"), 0); //GL_TEXTIRE0
-    //horizontal is set in BlurBrightScene()
+    //Post process (final image)
+    this->postProcessShader = new ComputeShader(ShaderSources::csPostProcess);
+    this->postProcessShader->use();
+    glUniform1i(glGetUniformLocation(this->postProcessShader->ID, "hdrBuffer"), 0); //GL_TEXTIRE0
+    glUniform1i(glGetUniformLocation(this->postProcessShader->ID, "blurBuffer"), 1); //GL_TEXTIRE1
+    glUniform1i(glGetUniformLocation(this->postProcessShader->ID, "gDepth"), 2); //GL_TEXTIRE2
+    glUniform1f(glGetUniformLocation(this->postProcessShader->ID, "exposure"), DEFAULT_EXPOSURE); //set exposure
+    glUniform1f(glGetUniformLocation(this->postProcessShader->ID, "bloomStrength"), 1.0f / BLOOM_MIP_COUNT); //mip 0 is the sum of every level
+    glUniform1f(glGetUniformLocation(this->postProcessShader->ID, "nearPlane"), DEFAULT_NEAR);
+    glUniform1f(glGetUniformLocation(this->postProcessShader->ID, "farPlane"), DEFAULT_FAR);
+
+    //anti aliasing
+    this->fxaaShader = new Shader(ShaderSources::vsScreenQuad, ShaderSources::fsFXAA);
+    this->fxaaShader->use();
+    glUniform1i(glGetUniformLocation(this->fxaaShader->ID, "screenTexture"), 0); //GL_TEXTURE0
+    this->taaResolveShader = new ComputeShader(ShaderSources::csTAAResolve);
+    this->taaResolveShader->use();
+    glUniform1i(glGetUniformLocation(this->taaResolveShader->ID, "currentColor"), 0);     //GL_TEXTURE0
+    glUniform1i(glGetUniformLocation(this->taaResolveShader->ID, "historyColor"), 1);     //GL_TEXTURE1
+    glUniform1i(glGetUniformLocation(this->taaResolveShader->ID, "velocityBuffer"), 2);   //GL_TEXTURE2
+    glUniform1i(glGetUniformLocation(this->taaResolveShader->ID, "gDepth"), 3);           //GL_TEXTURE3
+
+    //bloom mip chain. threshold is folded into the first downsample
+    this->bloomDownsampleShader = new ComputeShader(ShaderSources::csBloomDownsample);
+    this->bloomDownsampleShader->use();
+    glUniform1i(glGetUniformLocation(this->bloomDownsampleShader->ID, "source"), 0); //GL_TEXTURE0
+    this->bloomUpsampleShader = new ComputeShader(ShaderSources::csBloomUpsample);
+    this->bloomUpsampleShader->use();
+    glUniform1i(glGetUniformLocation(this->bloomUpsampleShader->ID, "bloomMips"), 0); //GL_TEXTURE0
+    glUniform1i(glGetUniformLocation(this->bloomUpsampleShader->ID, "source"), 1);    //GL_TEXTURE1
 
     //Dir shadow shader
     this->dirShadowShader = new Shader(ShaderSources::vsDirShadow, ShaderSources::fsDirShadow);
@@ -165,6 +213,18 @@ void Renderer::InitializeShaders()
     this->cascadeShadowShader = new Shader(ShaderSources::vsCascadedShadow, ShaderSources::fsCascadedShadow);
     //point shadow shader
     this->pointShadowShader = new Shader(ShaderSources::vsPointShadow, ShaderSources::fsPointShadow);
+    //terrain shadows: the quadtree's shadow grid, coarsely tessellated (RenderTerrainShadow)
+    this->terrainCascadeShadowShader = new Shader(ShaderSources::vsTerrain, ShaderSources::fsCascadedShadow, nullptr,
+        ShaderSources::tcsTerrainShadow, ShaderSources::tesTerrainShadow);
+    this->terrainPointShadowShader = new Shader(ShaderSources::vsTerrain, ShaderSources::fsPointShadow, nullptr,
+        ShaderSources::tcsTerrainShadow, ShaderSources::tesTerrainShadow);
+    for (Shader* s : { this->terrainCascadeShadowShader, this->terrainPointShadowShader })
+    {
+        s->use();
+        glUniform1i(glGetUniformLocation(s->ID, "heightMap"), 9);     //GL_TEXTURE9
+        glUniform1f(glGetUniformLocation(s->ID, "targetEdgeTexels"), TERRAIN_SHADOW_TARGET_EDGE_TEXELS);
+        glUniform1i(glGetUniformLocation(s->ID, "perspective"), s == this->terrainPointShadowShader);
+    }
 
     //skybox shader
     this->skyShader = new Shader(ShaderSources::vsSkybox, ShaderSources::fsSkybox);
@@ -173,58 +233,128 @@ void Renderer::InitializeShaders()
     //tesselation for heightmap
     this->terrainShader = new Shader(ShaderSources::vsTerrain, ShaderSources::fs1, nullptr,
         ShaderSources::tcsTerrain, ShaderSources::tesTerrain);
-    this->terrainShader->use();
-    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "heightMap"), 9);             //GL_TEXTURE9
-    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "material.diffuse"), 0);      //GL_TEXTURE0
-    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "material.normal"), 1);       //GL_TEXTURE1
-    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "material.specular"), 2);     //GL_TEXTURE2
-    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "pointShadowMapArray"), 3);
-    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "cascadeShadowMaps"), 4);
-    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "ssao"), 10);
-    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "irradianceMap"), 7);         //GL_TEXTURE7
-    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "prefilterMap"), 8);         //GL_TEXTURE8
-
-
-    //Stuff for cascade shadows
-    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "cascadeCount"), (unsigned int)this->cascadeLevels.size()); //4 (5 matrices)
-    for (int i = 0; i < this->cascadeLevels.size(); i++)
+    //clipmap terrain (streamed), same shading
+    this->terrainClipmapShader = new Shader(ShaderSources::vsTerrainClipmap, ShaderSources::fs1);
+    for (Shader* s : { this->terrainShader, this->terrainClipmapShader })
     {
-        std::string l = "cascadeDistances[" + std::to_string(i) + "]";
-        glUniform1f(glGetUniformLocation(this->terrainShader->ID, l.c_str()), this->cascadeLevels[i]);
+        s->use();
+        glUniform1i(glGetUniformLocation(s->ID, "material.diffuse"), 0);      //GL_TEXTURE0
+        glUniform1i(glGetUniformLocation(s->ID, "material.normal"), 1);       //GL_TEXTURE1
+        glUniform1i(glGetUniformLocation(s->ID, "material.specular"), 2);     //GL_TEXTURE2
+        glUniform1i(glGetUniformLocation(s->ID, "pointShadowMapArray"), 3);
+        glUniform1i(glGetUniformLocation(s->ID, "cascadeShadowMaps"), 4);
+        glUniform1i(glGetUniformLocation(s->ID, "ssao"), 10);
+        glUniform1i(glGetUniformLocation(s->ID, "irradianceMap"), 7);         //GL_TEXTURE7
+        glUniform1i(glGetUniformLocation(s->ID, "prefilterMap"), 8);         //GL_TEXTURE8
+
+        //Stuff for cascade shadows
+        glUniform1i(glGetUniformLocation(s->ID, "cascadeCount"), (unsigned int)this->cascadeLevels.size()); //4 (5 matrices)
+        for (int i = 0; i < this->cascadeLevels.size(); i++)
+        {
+            std::string l = "cascadeDistances[" + std::to_string(i) + "]";
+            glUniform1f(glGetUniformLocation(s->ID, l.c_str()), this->cascadeLevels[i]);
+        }
     }
+    this->terrainShader->use();
+    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "heightMap"), 9);             //GL_TEXTURE9
 
     //gBuffer
     this->geometryPassShader = new Shader(ShaderSources::vsGeometryPass, ShaderSources::fsGeometryPass);
+    this->terrainGeometryPassShader = new Shader(ShaderSources::vsTerrain, ShaderSources::fsTerrainGeometryPass, nullptr,
+        ShaderSources::tcsTerrain, ShaderSources::tesTerrain);
+    this->terrainGeometryPassShader->use();
+    glUniform1i(glGetUniformLocation(this->terrainGeometryPassShader->ID, "heightMap"), 9);     //GL_TEXTURE9
+    for (Shader* s : { this->terrainShader, this->terrainGeometryPassShader })
+    {
+        s->use();
+        glUniform1f(glGetUniformLocation(s->ID, "targetEdgePixels"), TERRAIN_TARGET_EDGE_PIXELS);
+    }
+    this->terrainClipmapGeometryPassShader = new Shader(ShaderSources::vsTerrainClipmap, ShaderSources::fsTerrainGeometryPass);
+    //terrain mesh mode: writes TerrainMesh's vertices
+    this->terrainMeshShader = new ComputeShader(ShaderSources::csTerrainMesh);
+    this->terrainMeshShader->use();
+    glUniform1i(glGetUniformLocation(this->terrainMeshShader->ID, "heightMap"), 0);     //GL_TEXTURE0
+    for (Shader* s : { this->terrainClipmapShader, this->terrainClipmapGeometryPassShader })
+    {
+        s->use();
+        glUniform1i(glGetUniformLocation(s->ID, "heightLevels"), 9);     //GL_TEXTURE9
+        glUniform1i(glGetUniformLocation(s->ID, "windowSamples"), CLIPMAP_WINDOW_TILES * CLIPMAP_TILE_SIZE);
+        glUniform1f(glGetUniformLocation(s->ID, "morphWidth"), CLIPMAP_MORPH_WIDTH);
+    }
 
     //SSAAO shader
     this->SetupSSAOData();
     this->ssaoShader = new Shader(ShaderSources::vsSSAO, ShaderSources::fsSSAO);
     this->ssaoShader->use();
     glUniform1i(glGetUniformLocation(this->ssaoShader->ID, "gNormal"), 0);              //GL_TEXTURE0
-    glUniform1i(glGetUniformLocation(this->ssaoShader->ID, "gPosition"), 1);            //GL_TEXTURE1
+    glUniform1i(glGetUniformLocation(this->ssaoShader->ID, "gDepth"), 1);               //GL_TEXTURE1
     glUniform1i(glGetUniformLocation(this->ssaoShader->ID, "ssaoNoiseTexture"), 2);     //GL_TEXTURE2
-    glUniform1f(glGetUniformLocation(this->ssaoShader->ID, "screenWidth"), SCREEN_WIDTH);
-    glUniform1f(glGetUniformLocation(this->ssaoShader->ID, "screenHeight"), SCREEN_HEIGHT);
+    glUniform1f(glGetUniformLocation(this->ssaoShader->ID, "screenWidth"), SSAO_WIDTH);
+    glUniform1f(glGetUniformLocation(this->ssaoShader->ID, "screenHeight"), SSAO_HEIGHT);
+    glUniform1i(glGetUniformLocation(this->ssaoShader->ID, "samplesPerFrame"), SSAO_SAMPLES_PER_FRAME);
 
-    for (unsigned int i = 0; i < 32; ++i) //send sample kernels
+    for (unsigned int i = 0; i < SSAO_KERNEL_SIZE; ++i) //send sample kernels
     {
         std::string s = "samples[" + std::to_string(i) + "]";
         const char* cs = s.c_str();
         glUniform3fv(glGetUniformLocation(this->ssaoShader->ID, cs), 1, glm::value_ptr(ssaoKernel[i]));
     }
 
-    //ssao blur
-    this->ssaoBlurShader = new Shader(ShaderSources::vsSSAO, ShaderSources::fsSSAOBlur);
-    glUniform1i(glGetUniformLocation(this->ssaoShader->ID, "ssaoTexture"), 0);            //GL_TEXTURE0
+    //ssao temporal accumulation
+    this->ssaoTemporalShader = new Shader(ShaderSources::vsSSAO, ShaderSources::fsSSAOTemporal);
+    this->ssaoTemporalShader->use();
+    glUniform1i(glGetUniformLocation(this->ssaoTemporalShader->ID, "currentAO"), 0);      //GL_TEXTURE0
+    glUniform1i(glGetUniformLocation(this->ssaoTemporalShader->ID, "historyAO"), 1);      //GL_TEXTURE1
+    glUniform1i(glGetUniformLocation(this->ssaoTemporalShader->ID, "gDepth"), 2);         //GL_TEXTURE2
+    this->ssaoFrameIndex = 0;
+    this->ssaoHistoryIndex = 0;
+    this->ssaoPrevViewProjection = glm::mat4(1.0f);
+
+    //ssao bilateral upsample (writes the texture the lit pass reads)
+    this->ssaoUpsampleShader = new Shader(ShaderSources::vsSSAO, ShaderSources::fsSSAOUpsample);
+    this->ssaoUpsampleShader->use();
+    glUniform1i(glGetUniformLocation(this->ssaoUpsampleShader->ID, "ssaoTexture"), 0);    //GL_TEXTURE0
+    glUniform1i(glGetUniformLocation(this->ssaoUpsampleShader->ID, "gDepth"), 1);         //GL_TEXTURE1
 
     //vsm blur
     this->vsmPointBlurShader = new Shader(ShaderSources::vsScreenQuad, ShaderSources::fsVSMPointBlur);
     glUniform1i(glGetUniformLocation(this->vsmPointBlurShader->ID, "source"), 0);            //GL_TEXTURE0
 
     this->particleUpdateComputeShader = new ComputeShader(ShaderSources::csParticle);
+    this->particleUpdateComputeShader->use();
+    glUniform1i(glGetUniformLocation(this->particleUpdateComputeShader->ID, "gDepth"), 0);     //GL_TEXTURE0
+    glUniform1i(glGetUniformLocation(this->particleUpdateComputeShader->ID, "gNormal"), 1);    //GL_TEXTURE1
+    glUniform1f(glGetUniformLocation(this->particleUpdateComputeShader->ID, "collisionThickness"), PARTICLE_COLLISION_THICKNESS);
+    this->particleEmitShader = new ComputeShader(ShaderSources::csParticleEmit);
+    this->particleFinishShader = new ComputeShader(ShaderSources::csParticleFinish);
+
+    this->sortBitonicLocalShader = new ComputeShader(ShaderSources::csSortBitonicLocal);
+    this->sortBitonicStepShader = new ComputeShader(ShaderSources::csSortBitonicStep);
+    this->sortRadixCountShader = new ComputeShader(ShaderSources::csSortRadixCount);
+    this->sortRadixScanShader = new ComputeShader(ShaderSources::csSortRadixScan);
+    this->sortRadixScatterShader = new ComputeShader(ShaderSources::csSortRadixScatter);
+    this->gpuSort = new GpuSort(this->sortBitonicLocalShader, this->sortBitonicStepShader,
+                                this->sortRadixCountShader, this->sortRadixScanShader, this->sortRadixScatterShader);
     this->particleShader = new Shader(ShaderSources::vsParticle, ShaderSources::fsParticle);
                     
     this->tileCullShader = new ComputeShader(ShaderSources::csTileCulling);
+    this->tileCullShader->use();
+    glUniform1ui(glGetUniformLocation(this->tileCullShader->ID, "tileSize"), TILE_SIZE);
+    glUniform1ui(glGetUniformLocation(this->tileCullShader->ID, "clusterZSlices"), CLUSTER_Z_SLICES);
+
+    this->clusterScanShader = new ComputeShader(ShaderSources::csClusterPrefixSum);
+    this->clusterScanShader->use();
+    glUniform1ui(glGetUniformLocation(this->clusterScanShader->ID, "clusterCount"), CLUSTER_COUNT);
+    glUniform1ui(glGetUniformLocation(this->clusterScanShader->ID, "indexCapacity"), CLUSTER_LIGHT_INDEX_CAPACITY);
+
+    //cluster grid layout has to match between culling and shading
+    for (Shader* s : { this->lightingShader, this->terrainShader, this->terrainClipmapShader })
+    {
+        s->use();
+        glUniform1ui(glGetUniformLocation(s->ID, "tileSize"), TILE_SIZE);
+        glUniform2ui(glGetUniformLocation(s->ID, "screen"), SCREEN_WIDTH, SCREEN_HEIGHT);
+        glUniform1ui(glGetUniformLocation(s->ID, "clusterZSlices"), CLUSTER_Z_SLICES);
+    }
 
     this->equiToCubeShader = new Shader(ShaderSources::vsCube, ShaderSources::fsEquirectangularToCubemap);
 
@@ -239,9 +369,8 @@ void Renderer::InitializeShaders()
 void Renderer::SetupFramebuffers()
 {
     FramebufferSetup::SetupHDRFramebuffer(this->hdrFBO, this->hdrTextureRGBA);
-    FramebufferSetup::SetupMSAAHDRFramebuffer(this->hdrMSAAFBO, this->hdrMSAATextureRGBA);
-    FramebufferSetup::SetupHalfResBrightFramebuffer(this->halfResBrightFBO, this->halfResBrightTextureRGBA);
-    FramebufferSetup::SetupTwoPassBlurFramebuffers(this->twoPassBlurFBOs, this->twoPassBlurTexturesRGBA);
+    this->sceneColorTexture = this->hdrTextureRGBA;
+    FramebufferSetup::SetupTransientFramebuffer(this->postProcessFBO);
     FramebufferSetup::SetupVSMTwoPassBlurFramebuffer(this->vsmBlurFBO[0], this->vsmBlurTextureArrayRG[0], this->P_SHADOW_WIDTH, this->P_SHADOW_HEIGHT);
     FramebufferSetup::SetupVSMTwoPassBlurFramebuffer(this->vsmBlurFBO[1], this->vsmBlurTextureArrayRG[1], this->P_SHADOW_WIDTH, this->P_SHADOW_HEIGHT);
 
@@ -258,13 +387,73 @@ void Renderer::SetupFramebuffers()
     TextureSetup::SetupPointShadowMapTextureArray(this->pointShadowMapTextureArrayRG, P_SHADOW_WIDTH, P_SHADOW_HEIGHT);
 
     //SSAO
-    FramebufferSetup::SetupGBufferFramebuffer(this->gBufferFBO, this->gNormalTextureRGBA, this->gPositionTextureRGBA);
-    FramebufferSetup::SetupSSAOFramebuffer(this->ssaoFBO, this->ssaoQuadTextureR);
-    FramebufferSetup::SetupSSAOFramebuffer(this->ssaoBlurFBO, this->ssaoBlurTextureR);
+    FramebufferSetup::SetupGBufferFramebuffer(this->gBufferFBO, this->gNormalTextureRG, this->gDepthTexture);
+    FramebufferSetup::SetupTransientFramebuffer(this->ssaoFBO);
+    FramebufferSetup::SetupSSAOLowResFramebuffer(this->ssaoHistoryFBO[0], this->ssaoHistoryTextureRG[0]);
+    FramebufferSetup::SetupSSAOLowResFramebuffer(this->ssaoHistoryFBO[1], this->ssaoHistoryTextureRG[1]);
+    FramebufferSetup::SetupTransientFramebuffer(this->ssaoBlurFBO);
     TextureSetup::SetupSSAONoiseTexture(this->ssaoNoiseTexture, this->ssaoNoise);
 
-    FramebufferSetup::SetupTiledSSBOs(this->lightSSBO, this->countSSBO, this->indexSSBO);
+    FramebufferSetup::SetupTiledSSBOs(this->lightCullSSBO, this->lightShadingSSBO, this->clusterGridSSBO, this->indexSSBO);
+
+    //after the gbuffer (TAA adds a velocity attachment to it)
+    this->SetupAntiAliasingTargets();
+}
+
+void Renderer::SetupAntiAliasingTargets()
+{
+    unsigned int samples = this->GetMSAASamples();
+    if (samples > 0)
+    {
+        FramebufferSetup::SetupMSAAHDRFramebuffer(this->hdrMSAAFBO, this->hdrMSAATextureRGBA, this->hdrMSAARBO, samples);
+    }
+
+    if (this->antiAliasing == AA_TAA)
+    {
+        FramebufferSetup::SetupGBufferVelocityTexture(this->gBufferFBO, this->gVelocityTextureRG);
+        TextureSetup::SetupTAAHistoryTexture(this->taaHistoryTextureRGBA[0]);
+        TextureSetup::SetupTAAHistoryTexture(this->taaHistoryTextureRGBA[1]);
+        this->taaHistoryValid = false;
+    }
 
+    //FXAA / NONE: nothing extra, FXAA reads the post process output
+}
+
+void Renderer::DeleteAntiAliasingTargets()
+{
+    if (this->hdrMSAAFBO != 0)
+    {
+        glDeleteFramebuffers(1, &this->hdrMSAAFBO);
+        glDeleteTextures(1, &this->hdrMSAATextureRGBA);
+        glDeleteRenderbuffers(1, &this->hdrMSAARBO);
+        this->hdrMSAAFBO = this->hdrMSAATextureRGBA = this->hdrMSAARBO = 0;
+    }
+
+    if (this->gVelocityTextureRG != 0)
+    {
+        //back to normals only
+        glBindFramebuffer(GL_FRAMEBUFFER, this->gBufferFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glDeleteTextures(1, &this->gVelocityTextureRG);
+        glDeleteTextures(2, this->taaHistoryTextureRGBA);
+        this->gVelocityTextureRG = this->taaHistoryTextureRGBA[0] = this->taaHistoryTextureRGBA[1] = 0;
+    }
+
+    this->sceneColorTexture = this->hdrTextureRGBA;
+}
+
+unsigned int Renderer::GetMSAASamples()
+{
+    switch (this->antiAliasing)
+    {
+        case AA_MSAA_2X: return 2;
+        case AA_MSAA_4X: return 4;
+        case AA_MSAA_8X: return 8;
+        default: return 0;
+    }
 }
 
 void Renderer::SetupSSAOData()
@@ -272,7 +461,7 @@ void Renderer::SetupSSAOData()
     //TEMP
     std::uniform_real_distribution<float> randomFloats(0.0, 1.0); // random floats between [0.0, 1.0]
     std::default_random_engine generator;
-    for (unsigned int i = 0; i < 32; ++i)
+    for (unsigned int i = 0; i < SSAO_KERNEL_SIZE; ++i)
     {
         glm::vec3 sample(
             randomFloats(generator) * 2.0 - 1.0, //(-1, 1) x
@@ -283,7 +472,7 @@ void Renderer::SetupSSAOData()
         sample *= randomFloats(generator); //magnitude
 
         //bias more near center of hemisphere
-        float scale = float(i) / 32.0f;
+        float scale = float(i) / float(SSAO_KERNEL_SIZE);
         scale = ourLerp(0.1f, 1.0f, scale * scale);
         sample *= scale;
 
@@ -563,49 +752,61 @@ Renderer::~Renderer()
     //VBO/VAO
     glDeleteVertexArrays(1, &this->triangleMeshData.VAO);
     glDeleteVertexArrays(1, &this->screenQuadMeshData.VAO);
+    glDeleteQueries(GPU_TIMER_QUERY_COUNT, this->gpuTimerQueries);
 
     //delete VBOs? reference is lost right now.
 
+    delete this->assetLoader; //joins its workers before anything they fill is deleted
     delete this->lightingShader;
     delete this->debugLightShader;
-    delete this->screenShader;
+    delete this->postProcessShader;
+    delete this->frameGraph;
+    delete this->frameCapture; //waits for captures still in flight
+    delete this->particleSystem;
+    delete this->gpuSort;
+    for (auto& t : this->pathToTerrainData)
+    {
+        for (TerrainMeshPlacement& p : t.second.meshes) delete p.mesh;
+        delete t.second.quadtree;
+        delete t.second.heights;
+    }
+    for (auto& c : this->pathToClipmap) delete c.second; //joins its streaming threads
 
     for (DrawCall* d : this->drawCalls) delete d;
 }
 
 void Renderer::BeginRenderFrame()
 {
+    //assets the loader threads finished go up (within ASSET_UPLOAD_BUDGET_MS) before this frame's draws look for them
+    this->assetLoader->Update();
+
+    //pick this frame's internal resolution first, the camera's jitter and LOD pixel metric are made for it
+    this->UpdateDynamicResolution();
+
     //glBindFramebuffer(GL_FRAMEBUFFER, this->hdrFBO); //off screen render
     //glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 }
 
 void Renderer::EndRenderFrame()
 {
-    //RENDER SHADOW MAPS---
-    this->RenderShadowMaps();
+    //time the whole frame on the gpu (its internal resolution was picked in BeginRenderFrame)
+    glBeginQuery(GL_TIME_ELAPSED, this->gpuTimerQueries[this->gpuTimerFrame % GPU_TIMER_QUERY_COUNT]);
 
-    //Render the ssao Texture
-    this->RenderSSAO();
+    //captures from earlier frames that finished copying go to the worker
+    this->frameCapture->Poll();
 
-    this->DoTileCulling();
+    //cull and upload this frame's point lights (only GL work done for lights all frame)
+    this->UploadPointLights();
 
-    glEnable(GL_BLEND);
+    //terrain LOD for this camera, the gbuffer and the lit pass have to draw identical patches (GL_EQUAL depth test)
+    this->SelectTerrainPatches();
 
-    //Render the main scene into hdrMSAATexture, then blit that to hdrTexture
-    this->RenderMainScene();
-
-    //draw debug lights into hdrFBO is applicable
-    this->DrawLightsDebug();
-    
-    glDisable(GL_BLEND);
-    //Draw skybox last (using z = w optimization)
-    this->DrawSkybox();
-
-    //DO BLOOM STUFF---
-    this->BlurBrightScene();
-    //DRAW QUAD ONTO SCREEN---
-    //Draw the final scene on a full screen quad.
-    this->DrawFinalQuad();
+    //RENDER---
+    //passes and what they read/write are declared in BuildFrameGraph(). passes nobody reads from are skipped,
+    //transient targets come out of a pool and barriers after compute passes are placed by the graph.
+    this->BuildFrameGraph();
+    this->frameGraph->Compile();
+    this->frameGraph->Execute();
 
     //CLEANUP---
     //reset lights for the next frame
@@ -614,17 +815,37 @@ void Renderer::EndRenderFrame()
 
     this->CleanUpParticles();
 
+    glEndQuery(GL_TIME_ELAPSED);
+    this->gpuTimerFrame++;
+    this->prevRenderScaleXY = this->renderScaleXY;
 }
 
 void Renderer::RenderMainScene()
 {
     //DRAW INTO FINAL IMAGE---
-    //bind FBO
-    glBindFramebuffer(GL_FRAMEBUFFER, this->hdrMSAAFBO);
+    if (this->depthPrepass)
+    {
+        //reuse the gbuffer depth, every visible pixel gets shaded once.
+        //(can't blit single sample depth into the msaa target, so this mode draws straight into hdrFBO, MSAA modes lose their MSAA)
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, this->gBufferFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->hdrFBO);
+        glBlitFramebuffer(0, 0, this->renderWidth, this->renderHeight,
+                          0, 0, this->renderWidth, this->renderHeight,
+                          GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT,
+                          GL_NEAREST);
 
-    //clear main scene with current color, clear bright scene with black always.
-    glClear(GL_STENCIL_BUFFER_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->hdrFBO);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    else
+    {
+        //bind FBO (single sample modes draw straight into hdrFBO)
+        glBindFramebuffer(GL_FRAMEBUFFER, this->GetMSAASamples() > 0 ? this->hdrMSAAFBO : this->hdrFBO);
+
+        //clear main scene with current color, clear bright scene with black always.
+        glClear(GL_STENCIL_BUFFER_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    glViewport(0, 0, this->renderWidth, this->renderHeight);
 
     //Note: binding vsmtexture is expected in renderdoc (only horiz blur) but uses empty in realtime (OG)
     //      binding pointshadowmaptexture is expected in renderdoc (2 tap blur) but uses OG texture in realtime.
@@ -634,18 +855,18 @@ void Renderer::RenderMainScene()
     //glBindTexture(GL_TEXTURE_CUBE_MAP, this->irradianceMap);
     glActiveTexture(GL_TEXTURE0);
     glEnable(GL_DEPTH_TEST);
-    //render
-    for (DrawCall* d : this->drawCalls)
+
+    auto drawLit = [this](DrawCall* d)
     {
-        //Frustum culling
-        AABB worldAABB = d->GetWorldAABB();
-        if (!this->IsAABBVisible(worldAABB, this->cameraFrustumPlanes))
+        //Draw with shader. (model matrix is sent here)
+        if (d->GetClipmapPath() != nullptr)
         {
-            continue;
+            this->terrainClipmapShader->use();
+            this->pathToClipmap[d->GetClipmapPath()]->Bind(this->terrainClipmapShader); //heights on GL_TEXTURE9
+            d->BindMaterialUniforms(this->terrainClipmapShader);
+            d->Render(this->terrainClipmapShader);
         }
-
-        //Draw with shader. (model matrix is sent here)
-        if (d->GetHeightMapPath() == nullptr) //not drawing terrain
+        else if (d->GetHeightMapPath() == nullptr) //not drawing terrain
         {
             this->lightingShader->use();
             if (!this->usingPBR) d->BindMaterialUniforms(this->lightingShader); //set the material unique to each draw call
@@ -657,35 +878,65 @@ void Renderer::RenderMainScene()
         {
             this->terrainShader->use();
             glActiveTexture(GL_TEXTURE9); // Activate unit 9, the heightmap
-            glBindTexture(GL_TEXTURE_2D, this->pathToTerrainMeshDataAndTextureID[d->GetHeightMapPath()].second); // Bind the stored heightmap ID
+            glBindTexture(GL_TEXTURE_2D, this->pathToTerrainData[d->GetHeightMapPath()].heightMapTexture); // Bind the stored heightmap ID
+            this->SendTerrainExtent(this->terrainShader, d->GetHeightMapPath());
             d->BindMaterialUniforms(this->terrainShader); //set the material unique to each draw call
             d->Render(this->terrainShader);
         }
         glActiveTexture(GL_TEXTURE0);
+    };
+
+    if (this->depthPrepass)
+    {
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
     }
 
-    //PARTICLE
-    this->particleUpdateComputeShader->use();
-    static double lastTime = glfwGetTime();
-    double now = glfwGetTime();
-    float dt = float(now - lastTime);
-    lastTime = now;
+    //render
+    for (DrawCall* d : this->drawCalls)
+    {
+        //Frustum culling
+        AABB worldAABB = d->GetWorldAABB();
+        if (!this->IsAABBVisible(worldAABB, this->cameraFrustumPlanes))
+        {
+            continue;
+        }
+
+        if (this->depthPrepass && d->HasAlpha()) continue; //drawn below
+
+        drawLit(d);
+    }
 
-    for (ParticleEmitter* p : this->particleEmitters)
+    if (this->depthPrepass)
     {
-        p->Update(this->particleUpdateComputeShader, dt);
-        p->Render(this->particleShader);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+
+        //blended surfaces weren't in the prepass, draw them normally on top
+        for (DrawCall* d : this->drawCalls)
+        {
+            if (!d->HasAlpha() || !this->IsAABBVisible(d->GetWorldAABB(), this->cameraFrustumPlanes))
+            {
+                continue;
+            }
+
+            drawLit(d);
+        }
     }
 
-    std::cout << "Size: " << this->particleEmitters.size() << '\n';
+    //PARTICLE (simulated in SimulateParticles())
+    this->particleSystem->Render(this->particleShader);
 
-    //blit msaa hdr texture to normal hdr texture
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, this->hdrMSAAFBO);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->hdrFBO);
-    glBlitFramebuffer(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT,   // src rect
-                      0, 0, SCREEN_WIDTH, SCREEN_HEIGHT,   // dst rect
-                      GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT,
-                      GL_NEAREST);                         // average samples
+    if (!this->depthPrepass && this->GetMSAASamples() > 0)
+    {
+        //blit msaa hdr texture to normal hdr texture
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, this->hdrMSAAFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->hdrFBO);
+        glBlitFramebuffer(0, 0, this->renderWidth, this->renderHeight,   // src rect
+                          0, 0, this->renderWidth, this->renderHeight,   // dst rect
+                          GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT,
+                          GL_NEAREST);                         // average samples
+    }
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
@@ -699,7 +950,7 @@ void Renderer::RenderShadowMaps()
     
     for (unsigned int i = 0; i < currentFramePointLightCount; i++)
     {
-        if (this->pointLights[i].shadowMapIndex != -1)
+        if (this->pointLightShadingData[i].shadowMapIndex != -1)
         {
             this->RenderPointShadowMap(i);
         }
@@ -707,164 +958,484 @@ void Renderer::RenderShadowMaps()
     
 }
 
-void Renderer::RenderSSAO()
+void Renderer::BuildFrameGraph()
+{
+    FrameGraph* fg = this->frameGraph;
+    fg->Reset();
+
+    //RESOURCES---
+    //persistent: histories, targets sharing a depth attachment, what the shadow/cluster code owns
+    FGResource shadowMaps = fg->ImportTexture("shadowMaps", this->pointShadowMapTextureArrayRG);
+    FGResource lightClusters = fg->ImportBuffer("lightClusters", this->clusterGridSSBO);
+    FGResource gBuffer = fg->ImportTexture("gBuffer", this->gDepthTexture);
+    FGResource ssaoHistory = fg->ImportTexture("ssaoHistory", this->ssaoHistoryTextureRG[this->ssaoHistoryIndex]);
+    FGResource hdr = fg->ImportTexture("hdr", this->hdrTextureRGBA);
+    FGResource taaHistory = fg->ImportTexture("taaHistory", this->taaHistoryTextureRGBA[this->taaHistoryIndex]);
+    FGResource backbuffer = fg->ImportTexture("backbuffer", 0);
+    FGResource particles = fg->ImportBuffer("particles", this->particleSystem->GetParticleBuffer());
+
+    //transient: pooled, only exist between their first and last use
+    FGResource ssaoRaw = fg->CreateTexture("ssaoRaw", { SSAO_WIDTH, SSAO_HEIGHT, GL_RG16F });
+    FGResource ssaoResult = fg->CreateTexture("ssaoResult", { SCREEN_WIDTH, SCREEN_HEIGHT, GL_R8, 1, GL_NEAREST });
+    FGResource bloom = fg->CreateTexture("bloom", { SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, TextureSetup::GetHDRInternalFormat(),
+                                                    BLOOM_MIP_COUNT, GL_LINEAR_MIPMAP_NEAREST }); //textureLod picks the level
+    FGResource bloomUpsample = fg->CreateTexture("bloomUpsample", { SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, TextureSetup::GetHDRInternalFormat(),
+                                                                    BLOOM_MIP_COUNT - 1, GL_LINEAR_MIPMAP_NEAREST }); //the smallest level isn't upsampled into
+    FGResource postOutput = fg->CreateTexture("postOutput", { SCREEN_WIDTH, SCREEN_HEIGHT, GL_RGBA8 });
+
+    //what the consumers read depends on the settings, that is what culls the producers
+    //(no shadowed lights -> no shadow pass, ssao off -> no ssao, nothing needing the gbuffer -> no gbuffer)
+    bool shadows = this->dirLight.castShadows || this->currentFrameShadowArrayIndex > 0;
+    FGResource sceneColor = this->antiAliasing == AA_TAA ? taaHistory : hdr;
+
+    std::vector<FGResource> mainReads = { lightClusters, particles };
+    if (shadows) mainReads.push_back(shadowMaps);
+    if (this->ssao) mainReads.push_back(ssaoResult);
+    if (this->depthPrepass) mainReads.push_back(gBuffer);
+
+    std::vector<FGResource> postReads = { sceneColor };
+    if (this->postProcess.bloom) postReads.push_back(bloomUpsample);
+    if (this->postProcess.fog) postReads.push_back(gBuffer);
+
+    this->sceneColorTexture = this->hdrTextureRGBA;
+    this->sceneColorScale = this->renderScaleXY;
+
+    //PASSES (run in this order)---
+    fg->AddPass("Shadows", FG_RASTER, {}, { shadowMaps }, [this]() { this->RenderShadowMaps(); });
+
+    fg->AddPass("GBuffer", FG_RASTER, {}, { gBuffer }, [this]() { this->RenderGBuffer(); });
+
+    fg->AddPass("SSAO", FG_RASTER, { gBuffer, ssaoHistory }, { ssaoRaw, ssaoHistory, ssaoResult }, [this, fg, ssaoRaw, ssaoResult]()
+    {
+        this->RenderSSAO(fg->GetTexture(ssaoRaw), fg->GetTexture(ssaoResult));
+    });
+
+    fg->AddPass("LightCulling", FG_COMPUTE, {}, { lightClusters }, [this]() { this->DoTileCulling(); });
+
+    //collisions read the gbuffer, which keeps the gbuffer pass alive
+    bool particleCollisions = this->particleSystem->HasCollidingEmitters();
+    std::vector<FGResource> particleReads;
+    if (particleCollisions) particleReads.push_back(gBuffer);
+
+    fg->AddPass("Particles", FG_COMPUTE, particleReads, { particles }, [this, particleCollisions]()
+    {
+        this->SimulateParticles(particleCollisions);
+    });
+
+    //main scene into hdrMSAATexture (resolved to hdrTexture) or straight into hdrTexture
+    fg->AddPass("MainScene", FG_RASTER, mainReads, { hdr }, [this, fg, ssaoResult]()
+    {
+        glActiveTexture(GL_TEXTURE10);
+        glBindTexture(GL_TEXTURE_2D, this->ssao ? fg->GetTexture(ssaoResult) : 0);
+        glActiveTexture(GL_TEXTURE0);
+
+        glEnable(GL_BLEND);
+        this->RenderMainScene();
+        this->DrawLightsDebug(); //draw debug lights into hdrFBO if applicable
+        glDisable(GL_BLEND);
+    });
+
+    //skybox last (using z = w optimization)
+    fg->AddPass("Skybox", FG_RASTER, { hdr }, { hdr }, [this]() { this->DrawSkybox(); });
+
+    //readbacks only exist on frames someone asked for one, async (PBO + fence)
+    if (this->frameCapture->HasPending(CAPTURE_HDR))
+    {
+        fg->AddPass("CaptureHDR", FG_RASTER, { hdr }, {}, [this]()
+        {
+            this->frameCapture->Capture(CAPTURE_HDR, this->hdrTextureRGBA, this->renderWidth, this->renderHeight);
+        }, true);
+    }
+
+    //sceneColorTexture = resolved image, upscaled to full res
+    fg->AddPass("TAAResolve", FG_COMPUTE, { hdr, gBuffer, taaHistory }, { taaHistory }, [this]() { this->ResolveTAA(); });
+
+    fg->AddPass("Bloom", FG_COMPUTE, { sceneColor }, { bloom, bloomUpsample }, [this, fg, bloom, bloomUpsample]()
+    {
+        this->BlurBrightScene(fg->GetTexture(bloom), fg->GetTexture(bloomUpsample));
+    });
+
+    //one compute pass for every per pixel post effect
+    fg->AddPass("PostProcess", FG_COMPUTE, postReads, { postOutput }, [this, fg, bloomUpsample, postOutput]()
+    {
+        this->PostProcess(this->postProcess.bloom ? fg->GetTexture(bloomUpsample) : 0, fg->GetTexture(postOutput));
+    });
+
+    fg->AddPass("Present", FG_RASTER, { postOutput }, { backbuffer }, [this, fg, postOutput]()
+    {
+        this->DrawFinalQuad(fg->GetTexture(postOutput));
+    }, true);
+
+    if (this->frameCapture->HasPending(CAPTURE_FINAL))
+    {
+        fg->AddPass("CaptureFinal", FG_RASTER, { backbuffer }, {}, [this]()
+        {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+            this->frameCapture->Capture(CAPTURE_FINAL, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+        }, true);
+    }
+}
+
+void Renderer::RenderGBuffer()
 {
-    //GBUFFER-------------------------------------------------
     glBindFramebuffer(GL_FRAMEBUFFER, this->gBufferFBO);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
-
-    this->geometryPassShader->use();
+    glViewport(0, 0, this->renderWidth, this->renderHeight);
 
     for (DrawCall* d : this->drawCalls)
     {
-        d->Render(this->geometryPassShader);
+        //Frustum culling (same test as RenderMainScene so the prepass depth matches)
+        if (!this->IsAABBVisible(d->GetWorldAABB(), this->cameraFrustumPlanes))
+        {
+            continue;
+        }
+
+        //blended surfaces stay out of the prepass, otherwise whatever is behind them fails GL_EQUAL
+        if (this->depthPrepass && d->HasAlpha())
+        {
+            continue;
+        }
+
+        if (d->GetClipmapPath() != nullptr)
+        {
+            this->terrainClipmapGeometryPassShader->use();
+            this->pathToClipmap[d->GetClipmapPath()]->Bind(this->terrainClipmapGeometryPassShader);
+            d->Render(this->terrainClipmapGeometryPassShader);
+        }
+        else if (d->GetHeightMapPath() == nullptr)
+        {
+            d->Render(this->geometryPassShader);
+        }
+        else
+        {
+            glActiveTexture(GL_TEXTURE9); //heightmap
+            glBindTexture(GL_TEXTURE_2D, this->pathToTerrainData[d->GetHeightMapPath()].heightMapTexture);
+            this->SendTerrainExtent(this->terrainGeometryPassShader, d->GetHeightMapPath());
+            d->Render(this->terrainGeometryPassShader);
+            glActiveTexture(GL_TEXTURE0);
+        }
     }
-    
-    //SSAO-------------------------------------------------
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void Renderer::RenderSSAO(unsigned int rawTexture, unsigned int resultTexture)
+{
+    //SSAO (low res, SSAO_SAMPLES_PER_FRAME samples)------
+    glNamedFramebufferTexture(this->ssaoFBO, GL_COLOR_ATTACHMENT0, rawTexture, 0);
     glBindFramebuffer(GL_FRAMEBUFFER, this->ssaoFBO);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    //viewport set
+    glClear(GL_COLOR_BUFFER_BIT);
+    glViewport(0, 0, this->renderWidth / SSAO_DOWNSCALE, this->renderHeight / SSAO_DOWNSCALE);
 
     this->ssaoShader->use();
+    glUniform1ui(glGetUniformLocation(this->ssaoShader->ID, "frameIndex"), this->ssaoFrameIndex);
 
     //Textures
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, this->gNormalTextureRGBA);
+    glBindTexture(GL_TEXTURE_2D, this->gNormalTextureRG);
     glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, this->gPositionTextureRGBA);
+    glBindTexture(GL_TEXTURE_2D, this->gDepthTexture);
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, this->ssaoNoiseTexture);
 
     glBindVertexArray(this->screenQuadMeshData.VAO); //whole screen
     glDrawArrays(GL_TRIANGLES, 0, 6); //drwa quad
 
-    //BLUR------
+    //TEMPORAL------
+    //history[read] is last frame, history[write] becomes this frame's result
+    unsigned int historyRead = this->ssaoHistoryIndex;
+    unsigned int historyWrite = 1 - historyRead;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, this->ssaoHistoryFBO[historyWrite]);
+    this->ssaoTemporalShader->use(); //matrices sent in SendCameraUniforms()
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, rawTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, this->ssaoHistoryTextureRG[historyRead]);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, this->gDepthTexture);
+
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    //UPSAMPLE------
+    glNamedFramebufferTexture(this->ssaoBlurFBO, GL_COLOR_ATTACHMENT0, resultTexture, 0);
     glBindFramebuffer(GL_FRAMEBUFFER, this->ssaoBlurFBO);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glViewport(0, 0, this->renderWidth, this->renderHeight);
 
-    this->ssaoBlurShader->use();
+    this->ssaoUpsampleShader->use();
 
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, this->ssaoQuadTextureR); //blurring
+    glBindTexture(GL_TEXTURE_2D, this->ssaoHistoryTextureRG[historyWrite]);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, this->gDepthTexture);
 
     //whole screen
-    glBindVertexArray(this->screenQuadMeshData.VAO); //whole screen
     glDrawArrays(GL_TRIANGLES, 0, 6); //drwa quad
 
+    glActiveTexture(GL_TEXTURE0);
     glBindVertexArray(0);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    this->ssaoHistoryIndex = historyWrite;
+    this->ssaoFrameIndex++;
+
 }
 
-void Renderer::DrawFinalQuad()
+void Renderer::PostProcess(unsigned int bloomTexture, unsigned int outputTexture)
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glClear(GL_COLOR_BUFFER_BIT);
+    //runs at output res, this is where the render res scene gets upscaled
+    this->postProcessShader->use();
+    glUniform2fv(glGetUniformLocation(this->postProcessShader->ID, "sceneScale"), 1, glm::value_ptr(this->sceneColorScale));
 
-    glDisable(GL_DEPTH_TEST); //will be drawing directly in front screen
-    this->screenShader->use();
-    glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
-
-    glBindVertexArray(this->screenQuadMeshData.VAO); //whole screen
     glActiveTexture(GL_TEXTURE0); //0
-    glBindTexture(GL_TEXTURE_2D, this->hdrTextureRGBA);
+    glBindTexture(GL_TEXTURE_2D, this->sceneColorTexture);
     glActiveTexture(GL_TEXTURE1); //1: blurBuffer in shader
-    glBindTexture(GL_TEXTURE_2D, this->twoPassBlurTexturesRGBA[1]);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, bloomTexture); //0 with bloom off (not sampled)
+    glActiveTexture(GL_TEXTURE2); //2: only read with fog on
+    glBindTexture(GL_TEXTURE_2D, this->gDepthTexture);
+    glBindImageTexture(0, outputTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+    glDispatchCompute((SCREEN_WIDTH + 7) / 8, (SCREEN_HEIGHT + 7) / 8, 1);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void Renderer::DrawFinalQuad(unsigned int outputTexture)
+{
+    if (this->antiAliasing == AA_FXAA)
+    {
+        //FXAA draws the finished image onto the screen (replaces the copy below)
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+        this->fxaaShader->use();
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, outputTexture);
+        glBindVertexArray(this->screenQuadMeshData.VAO); //whole screen
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        glBindVertexArray(0);
+        return;
+    }
+
+    //default framebuffer can't be bound as an image, so copy the finished image over.
+    glNamedFramebufferTexture(this->postProcessFBO, GL_COLOR_ATTACHMENT0, outputTexture, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, this->postProcessFBO);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT,
+                      0, 0, SCREEN_WIDTH, SCREEN_HEIGHT,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void Renderer::SimulateParticles(bool collisions)
+{
+    static double lastTime = glfwGetTime();
+    double now = glfwGetTime();
+    float dt = float(now - lastTime);
+    lastTime = now;
+
+    //emitters are culled against the camera frustum by their bounds
+    auto isVisible = [this](const AABB& bounds) { return !FRUSTUM_CULLING || this->IsAABBVisible(bounds, this->cameraFrustumPlanes); };
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, this->gDepthTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, this->gNormalTextureRG);
+    glActiveTexture(GL_TEXTURE0);
+
+    this->particleSystem->Simulate(this->particleEmitShader, this->particleUpdateComputeShader, this->particleFinishShader, this->gpuSort,
+                                   isVisible, this->cameraPosition, collisions, dt);
+}
+
+FrameGraphStats Renderer::GetFrameGraphStats() const
+{
+    return this->frameGraph->GetStats();
+}
+
+void Renderer::BenchmarkGpuSort()
+{
+    //both algorithms everywhere, to see where SORT_AUTO should switch (GPU_SORT_BITONIC_MAX_KEYS) on this gpu
+    std::cout << "GPU sort benchmark: " << (const char*)glGetString(GL_RENDERER) << '\n';
+    for (unsigned int n = 1u << 10; n <= MAX_PARTICLES; n <<= 2)
+    {
+        double bitonic = this->gpuSort->Benchmark(n, SORT_BITONIC);
+        double radix = this->gpuSort->Benchmark(n, SORT_RADIX);
+        std::cout << "  " << n << " keys: bitonic " << bitonic / 1e6 << " Mkeys/s, radix " << radix / 1e6 << " Mkeys/s\n";
+    }
 }
 
 void Renderer::CleanUpParticles()
 {
-    std::vector<ParticleEmitter*> temp;
+    //emitter records only, no GL work
+    this->particleSystem->RemoveFinishedEmitters();
+}
+
+void Renderer::UploadPointLights()
+{
+    this->currentFramePointLightCount = 0;
+    this->currentFrameShadowArrayIndex = 0;
+    this->pointLightCullData.clear();
+    this->pointLightShadingData.clear();
+
+    bool overflow = false;
 
-    for (ParticleEmitter* p : this->particleEmitters)
+    auto gather = [this, &overflow](const PointLightDesc& l)
     {
-        if (!p->DoneEmitting())
+        float range = std::min(l.range, 100.0f);
+        glm::vec3 pos = glm::vec3(l.position.x, l.position.y, l.position.z);
+
+        //light volume fully outside the camera frustum can't touch anything visible
+        if (FRUSTUM_CULLING && !this->IsSphereVisible(pos, range, this->cameraFrustumPlanes))
         {
-            temp.push_back(p);
+            return;
         }
-        else
+
+        if (this->currentFramePointLightCount >= MAX_POINT_LIGHTS)
         {
-            delete p;
+            overflow = true;
+            return;
         }
+
+        this->currentFramePointLightCount++;
+        this->pointLightCullData.push_back(glm::vec4(pos, range));
+
+        PointLightShadingGPU p;
+        p.colorRG = glm::packHalf2x16(glm::vec2(l.color.r, l.color.g));
+        p.colorBIntensity = glm::packHalf2x16(glm::vec2(l.color.b, l.intensity));
+
+        //shadow slots only go to lights that survived culling
+        if (l.castShadows && this->currentFrameShadowArrayIndex < MAX_SHADOW_CASTING_POINT_LIGHTS)
+            p.shadowMapIndex = this->currentFrameShadowArrayIndex++;
+        else
+            p.shadowMapIndex = -1;
+
+        this->pointLightShadingData.push_back(p);
+    };
+
+    for (size_t i = 0; i < this->persistentPointLights.size(); i++)
+    {
+        if (this->persistentPointLightAlive[i]) gather(this->persistentPointLights[i]);
     }
 
-    this->particleEmitters = temp;
+    for (const PointLightDesc& l : this->framePointLights)
+    {
+        gather(l);
+    }
+
+    if (overflow)
+    {
+        std::cout << "ERROR: Max pointlights exceeded\n";
+    }
+
+    //one upload per stream, one uniform. no need to clear, we loop with numLights
+    glNamedBufferSubData(this->lightCullSSBO, 0, sizeof(glm::vec4) * this->currentFramePointLightCount, this->pointLightCullData.data());
+    glNamedBufferSubData(this->lightShadingSSBO, 0, sizeof(PointLightShadingGPU) * this->currentFramePointLightCount, this->pointLightShadingData.data());
+
+    this->tileCullShader->use();
+    glUniform1i(glGetUniformLocation(this->tileCullShader->ID, "numLights"), this->currentFramePointLightCount);
 }
 
 void Renderer::DoTileCulling()
 {
-    uint32_t nx = (SCREEN_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
-    uint32_t ny = (SCREEN_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
-    uint32_t nTiles = nx * ny;
+    //no clears: the count pass writes every cluster's grid entry, indices past grid[c].count are never read
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, lightCullSSBO); //binding = 1
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, indexSSBO); //binding = 2
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, clusterGridSSBO); //binding = 3
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, lightShadingSSBO); //binding = 4
+
+    //1. COUNT: one work group per froxel
+    this->tileCullShader->use();
+    glUniform1i(glGetUniformLocation(this->tileCullShader->ID, "countPass"), 1);
+    glDispatchCompute(CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_Z_SLICES);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    //2. PREFIX SUM: counts -> offsets into the compact index list
+    this->clusterScanShader->use();
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    //3. FILL (barrier before the lit pass is placed by the frame graph)
+    this->tileCullShader->use();
+    glUniform1i(glGetUniformLocation(this->tileCullShader->ID, "countPass"), 0);
+    glDispatchCompute(CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_Z_SLICES);
+}
 
-    glClearBufferSubData(countSSBO, GL_R32UI, 0, nTiles * sizeof(uint32_t), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
-    glClearBufferSubData(indexSSBO, GL_R32UI, 0, nTiles * MAX_LIGHTS_PER_TILE * sizeof(uint32_t), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+void Renderer::ResolveTAA()
+{
+    //history[read] is last frame's resolve, history[write] is this frame's (and next frame's history)
+    unsigned int historyRead = this->taaHistoryIndex;
+    unsigned int historyWrite = 1 - historyRead;
 
-    size_t n = std::min(currentFramePointLightCount, MAX_POINT_LIGHTS);
+    this->taaResolveShader->use();
+    glUniform1i(glGetUniformLocation(this->taaResolveShader->ID, "historyValid"), this->taaHistoryValid);
 
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightSSBO);
-    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(PointLightGPU) * n, this->pointLights); //no need to clear, we loop with numLights
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, this->hdrTextureRGBA);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, this->taaHistoryTextureRGBA[historyRead]);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, this->gVelocityTextureRG);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, this->gDepthTexture);
+    glBindImageTexture(0, this->taaHistoryTextureRGBA[historyWrite], 0, GL_FALSE, 0, GL_WRITE_ONLY, TextureSetup::GetHDRInternalFormat());
 
-    this->tileCullShader->use();
+    glDispatchCompute((SCREEN_WIDTH + 7) / 8, (SCREEN_HEIGHT + 7) / 8, 1);
 
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, lightSSBO); //binding = 1
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, indexSSBO); //binding = 2
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, countSSBO); //binding = 3
+    glActiveTexture(GL_TEXTURE0);
 
-    glDispatchCompute(nx,ny, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    this->sceneColorTexture = this->taaHistoryTextureRGBA[historyWrite];
+    this->sceneColorScale = glm::vec2(1.0f); //resolve is full res
+    this->taaHistoryIndex = historyWrite;
+    this->taaHistoryValid = true;
 }
 
-void Renderer::BlurBrightScene()
+void Renderer::BlurBrightScene(unsigned int bloomTexture, unsigned int upsampleTexture)
 {
-    //EXTRACT BRIGHT BRIGHT SCENE INTO HALFRES------------------------------------------
-    //bind fb
-    glBindFramebuffer(GL_FRAMEBUFFER, this->halfResBrightFBO);
-    glViewport(0, 0, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2);
-    glClear(GL_COLOR_BUFFER_BIT);
-    glDisable(GL_DEPTH_TEST); //will be drawing directly in front screen
+    //only the used part of each level is processed (scene may be render res, see sceneColorScale)
+    unsigned int sceneWidth = (unsigned int)(SCREEN_WIDTH * this->sceneColorScale.x);
+    unsigned int sceneHeight = (unsigned int)(SCREEN_HEIGHT * this->sceneColorScale.y);
+    auto mipWidth = [sceneWidth](unsigned int level) { return std::max(1u, (sceneWidth / 2) >> level); };
+    auto mipHeight = [sceneHeight](unsigned int level) { return std::max(1u, (sceneHeight / 2) >> level); };
+
+    //DOWNSAMPLE------------------------------------------------------------------------
+    //hdrScene -> mip 0 (bright pass), then mip i-1 -> mip i
+    this->bloomDownsampleShader->use();
+    int sourceLevelLoc = glGetUniformLocation(this->bloomDownsampleShader->ID, "sourceLevel");
+    int firstPassLoc = glGetUniformLocation(this->bloomDownsampleShader->ID, "firstPass");
+    int sourceSizeLoc = glGetUniformLocation(this->bloomDownsampleShader->ID, "sourceSize");
 
-    this->brightShader->use();
-    
-    //Bind texture
-    glActiveTexture(GL_TEXTURE0);   //hdrScene
-    glBindTexture(GL_TEXTURE_2D, this->hdrTextureRGBA);
+    glActiveTexture(GL_TEXTURE0);
+    for (unsigned int i = 0; i < BLOOM_MIP_COUNT; i++)
+    {
+        bool first = (i == 0);
+        glBindTexture(GL_TEXTURE_2D, first ? this->sceneColorTexture : bloomTexture);
+        glUniform1i(sourceLevelLoc, first ? 0 : i - 1);
+        glUniform1i(firstPassLoc, first);
+        glUniform2i(sourceSizeLoc, first ? sceneWidth : mipWidth(i - 1), first ? sceneHeight : mipHeight(i - 1));
+        glBindImageTexture(0, bloomTexture, i, GL_FALSE, 0, GL_WRITE_ONLY, TextureSetup::GetHDRInternalFormat());
+
+        glDispatchCompute((mipWidth(i) + 7) / 8, (mipHeight(i) + 7) / 8, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
 
-    //draw quad
-    glBindVertexArray(this->screenQuadMeshData.VAO); //whole screen
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
+    //UPSAMPLE--------------------------------------------------------------------------
+    //up i = down i + tent(up i+1), smallest first. into a second chain, a level can't be fetched and stored in one dispatch.
+    //up 0 ends up with the whole chain
+    this->bloomUpsampleShader->use();
+    sourceLevelLoc = glGetUniformLocation(this->bloomUpsampleShader->ID, "sourceLevel");
 
-    glEnable(GL_DEPTH_TEST);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    
-    //NOW BLUR THAT BRIGHT SCENE---------------------------------------------------------
-    blurShader->use();
-
-    constexpr unsigned int amount = BLUR_PASSES * 2; //* 2 since its a two pass blur
-    bool horizontal = true;
-    bool first = true;
-    for (unsigned int i = 0; i < amount; i++)
-    {
-        glUniform1i(glGetUniformLocation(blurShader->ID, "horizontal"), horizontal);
-        //Bind the correct FBO
-        glBindFramebuffer(GL_FRAMEBUFFER, this->twoPassBlurFBOs[horizontal]);
-        glViewport(0, 0, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2);
-        //Bind textures
-        glActiveTexture(GL_TEXTURE0);  
-        glBindTexture(GL_TEXTURE_2D, first ? this->halfResBrightTextureRGBA : this->twoPassBlurTexturesRGBA[!horizontal]);
-        
-        glBindVertexArray(this->screenQuadMeshData.VAO);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindTexture(GL_TEXTURE_2D, bloomTexture);
+    glActiveTexture(GL_TEXTURE1);
+    for (int i = BLOOM_MIP_COUNT - 2; i >= 0; i--)
+    {
+        glBindTexture(GL_TEXTURE_2D, i == BLOOM_MIP_COUNT - 2 ? bloomTexture : upsampleTexture);
+        glUniform1i(sourceLevelLoc, i + 1);
+        glBindImageTexture(0, upsampleTexture, i, GL_FALSE, 0, GL_WRITE_ONLY, TextureSetup::GetHDRInternalFormat());
 
-        horizontal = !horizontal;
-        if (first) first = false;
+        glDispatchCompute((mipWidth(i) + 7) / 8, (mipHeight(i) + 7) / 8, 1);
+        if (i > 0) glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT); //last one: frame graph
     }
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
 }
 
 void Renderer::GetFrustumPlanes(const glm::mat4& vp, glm::vec4* frustumPlanes)
@@ -1004,12 +1575,24 @@ bool Renderer::IsAABBVisible(const AABB& worldAABB, glm::vec4* frustumPlanes)
     return true; //is in all planes
 }
 
+bool Renderer::IsSphereVisible(const glm::vec3& center, float radius, glm::vec4* frustumPlanes)
+{
+    //same idea as IsAABBVisible, but the "projected radius" is just the radius
+    for (int i = 0; i < 6; i++)
+    {
+        const glm::vec4& plane = frustumPlanes[i];
+        if (glm::dot(glm::vec3(plane), center) + plane.w + radius < 0) return false;
+    }
+
+    return true;
+}
+
 void Renderer::DrawSkybox()
 {
     if (this->usingSkybox)
     {
         glBindFramebuffer(GL_FRAMEBUFFER, this->hdrFBO);
-        glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+        glViewport(0, 0, this->renderWidth, this->renderHeight);
 
         this->skyShader->use();
         glEnable(GL_DEPTH_TEST);
@@ -1050,7 +1633,7 @@ std::vector<glm::vec4> Renderer::GetFrustumCornersWorldSpace(const glm::mat4& pr
     return corners;
 }
 
-glm::mat4 Renderer::CalculateLightSpaceCascadeMatrix(float near, float far, int index)
+glm::mat4 Renderer::CalculateLightSpaceCascadeMatrix(float near, float far)
 {
     glm::mat4 proj = glm::perspective(glm::radians(cam->zoom), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, near, far);
     glm::mat4 view = cam->GetViewMatrix();
@@ -1101,12 +1684,39 @@ glm::mat4 Renderer::CalculateLightSpaceCascadeMatrix(float near, float far, int
 
     //'#include "pch.h"'
 
-    //Pull in near plane, push out far plane because things can be outside view frustum but still cast shadows.
-    float zMult = this->cascadeMultipliers[index];
-    minZ = (minZ < 0) ? minZ * zMult : minZ / zMult;
-    maxZ = (maxZ < 0) ? maxZ / zMult : maxZ * zMult;
-        
-    glm::mat4 lightProjection = glm::ortho(minX, maxX, minY, maxY, minZ, maxZ);
+    //Pull in the near plane because things outside the view frustum can still cast shadows into it: up to the highest caster
+    //(toward the light is +z) over this cascade's xy rectangle. draw calls by their bounds, terrain per quadtree node.
+    //the far plane stays at the farthest receiver
+    float casterMaxZ = maxZ;
+    for (DrawCall* d : this->drawCalls)
+    {
+        if (d->GetClipmapPath() != nullptr) continue; //doesn't cast (see IsShadowCasterVisible)
+
+        if (d->GetHeightMapPath() != nullptr)
+        {
+            TerrainQuadtree* quadtree = this->pathToTerrainData[d->GetHeightMapPath()].quadtree;
+            if (quadtree)
+            {
+                casterMaxZ = std::max(casterMaxZ, quadtree->GetMaxZ(lightView * d->GetModelMatrix(), glm::vec2(minX, minY), glm::vec2(maxX, maxY)));
+            }
+            continue;
+        }
+
+        AABB worldAABB = d->GetWorldAABB();
+        AABB lightAABB;
+        for (unsigned int i = 0; i < 8; i++)
+        {
+            glm::vec4 c = lightView * glm::vec4(i & 1 ? worldAABB.max.x : worldAABB.min.x, i & 2 ? worldAABB.max.y : worldAABB.min.y,
+                                                i & 4 ? worldAABB.max.z : worldAABB.min.z, 1.0f);
+            lightAABB.expand(Vec3(c.x, c.y, c.z));
+        }
+
+        if (lightAABB.max.x < minX || lightAABB.min.x > maxX || lightAABB.max.y < minY || lightAABB.min.y > maxY) continue;
+        casterMaxZ = std::max(casterMaxZ, lightAABB.max.z);
+    }
+
+    //view space looks down -z: near/far are distances
+    glm::mat4 lightProjection = glm::ortho(minX, maxX, minY, maxY, -casterMaxZ, -minZ);
 
     return lightProjection * lightView;
 }
@@ -1119,15 +1729,15 @@ std::vector<glm::mat4> Renderer::GetCascadeMatrices()
     {
         if (i == 0)
         {
-            ret.push_back(CalculateLightSpaceCascadeMatrix(DEFAULT_NEAR, this->cascadeLevels[i], i));
+            ret.push_back(CalculateLightSpaceCascadeMatrix(DEFAULT_NEAR, this->cascadeLevels[i]));
         }
         else if (i < this->cascadeLevels.size())
         {
-            ret.push_back(CalculateLightSpaceCascadeMatrix(this->cascadeLevels[i - 1], this->cascadeLevels[i], i));
+            ret.push_back(CalculateLightSpaceCascadeMatrix(this->cascadeLevels[i - 1], this->cascadeLevels[i]));
         }
         else
         {
-            ret.push_back(CalculateLightSpaceCascadeMatrix(this->cascadeLevels[i - 1], DEFAULT_FAR, i));
+            ret.push_back(CalculateLightSpaceCascadeMatrix(this->cascadeLevels[i - 1], DEFAULT_FAR));
         }
     }
 
@@ -1170,10 +1780,13 @@ void Renderer::RenderCascadedShadowMap()
         glUniformMatrix4fv(glGetUniformLocation(this->lightingShader->ID, l.c_str()), 1,
             false, glm::value_ptr(lightSpaceMatrices[i]));
 
-        //give it to terrain shader too
-        this->terrainShader->use();
-        glUniformMatrix4fv(glGetUniformLocation(this->terrainShader->ID, l.c_str()), 1,
-            false, glm::value_ptr(lightSpaceMatrices[i]));
+        //give it to terrain shaders too
+        for (Shader* s : { this->terrainShader, this->terrainClipmapShader })
+        {
+            s->use();
+            glUniformMatrix4fv(glGetUniformLocation(s->ID, l.c_str()), 1,
+                false, glm::value_ptr(lightSpaceMatrices[i]));
+        }
 
         //send lightspace matrix to cascade vertex shader for current use
         this->cascadeShadowShader->use();
@@ -1186,16 +1799,29 @@ void Renderer::RenderCascadedShadowMap()
         glm::vec4 frustumPlanes[6];
         //note: model matrix is sent in d->Render()
         //glCullFace(GL_FRONT);
+        this->GetFrustumPlanes(lightSpaceMatrices[i], frustumPlanes);
+
+        //orthographic, one texel covers the same area everywhere in the cascade. ndc spans 2 units of the matrix's x/y rows
+        const glm::mat4& m = lightSpaceMatrices[i];
+        float texelsPerUnit = 0.5f * std::max(CASCADE_SHADOW_WIDTH * glm::length(glm::vec3(m[0][0], m[1][0], m[2][0])),
+                                              CASCADE_SHADOW_HEIGHT * glm::length(glm::vec3(m[0][1], m[1][1], m[2][1])));
+        this->terrainCascadeShadowShader->use();
+        glUniformMatrix4fv(glGetUniformLocation(this->terrainCascadeShadowShader->ID, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(m));
+        glUniform4fv(glGetUniformLocation(this->terrainCascadeShadowShader->ID, "frustumPlanes"), 6, glm::value_ptr(frustumPlanes[0]));
+        glUniform1f(glGetUniformLocation(this->terrainCascadeShadowShader->ID, "texelsPerUnit"), texelsPerUnit);
+
         for (DrawCall* d : this->drawCalls)
         {
-            AABB worldAABB = d->GetWorldAABB();
-            this->GetFrustumPlanes(lightSpaceMatrices[i], frustumPlanes);
-
-            if (FRUSTUM_CULLING && !this->IsAABBVisible(worldAABB, frustumPlanes))
+            if (FRUSTUM_CULLING && !this->IsShadowCasterVisible(d, frustumPlanes))
             {
                 continue;
             }
 
+            if (d->GetHeightMapPath() != nullptr)
+            {
+                this->RenderTerrainShadow(d, this->terrainCascadeShadowShader);
+                continue;
+            }
             d->RenderLOD(this->cascadeShadowShader, true);
         }
         glCullFace(GL_BACK);
@@ -1205,6 +1831,22 @@ void Renderer::RenderCascadedShadowMap()
 
 }
 
+bool Renderer::IsShadowCasterVisible(DrawCall* d, glm::vec4* frustumPlanes)
+{
+    //clipmap terrain only has camera centered windows and no shadow program, it receives shadows but doesn't cast them
+    if (d->GetClipmapPath() != nullptr) return false;
+
+    //the terrain's bounds cover the whole map and are nearly always in a shadow frustum, its nodes often aren't
+    if (d->GetHeightMapPath() != nullptr)
+    {
+        TerrainQuadtree* quadtree = this->pathToTerrainData[d->GetHeightMapPath()].quadtree;
+        if (!quadtree) return false;
+        return quadtree->IsVisible(d->GetModelMatrix(), [this, frustumPlanes](const AABB& bounds) { return this->IsAABBVisible(bounds, frustumPlanes); });
+    }
+
+    return this->IsAABBVisible(d->GetWorldAABB(), frustumPlanes);
+}
+
 void Renderer::RenderPointShadowMap(unsigned int index)
 {
     glDisable(GL_CULL_FACE);
@@ -1218,7 +1860,7 @@ void Renderer::RenderPointShadowMap(unsigned int index)
                                     
     //Set shadow transforms
     this->shadowTransforms.clear();
-    glm::vec3 lightPos = glm::vec3(this->pointLights[index].positionRange);   //view
+    glm::vec3 lightPos = glm::vec3(this->pointLightCullData[index]);   //view
 
     this->shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(1.0, 0.0, 0.0),  glm::vec3(0.0, -1.0, 0.0)));
     this->shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(-1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0)));
@@ -1234,11 +1876,18 @@ void Renderer::RenderPointShadowMap(unsigned int index)
     //send some uniforms
     this->lightingShader->use();
     glUniform1f(glGetUniformLocation(this->lightingShader->ID, "pointShadowProjFarPlane"), far);
-    this->terrainShader->use();
-    glUniform1f(glGetUniformLocation(this->terrainShader->ID, "pointShadowProjFarPlane"), far);
+    for (Shader* s : { this->terrainShader, this->terrainClipmapShader })
+    {
+        s->use();
+        glUniform1f(glGetUniformLocation(s->ID, "pointShadowProjFarPlane"), far);
+    }
     this->pointShadowShader->use();
     glUniform1f(glGetUniformLocation(this->pointShadowShader->ID, "pointShadowProjFarPlane"), far);
     glUniform3fv(glGetUniformLocation(this->pointShadowShader->ID, "lightPos"), 1, glm::value_ptr(lightPos));
+    this->terrainPointShadowShader->use();
+    glUniform1f(glGetUniformLocation(this->terrainPointShadowShader->ID, "pointShadowProjFarPlane"), far);
+    glUniform3fv(glGetUniformLocation(this->terrainPointShadowShader->ID, "lightPos"), 1, glm::value_ptr(lightPos));
+    glUniform1f(glGetUniformLocation(this->terrainPointShadowShader->ID, "texelsPerUnit"), 0.5f * this->P_SHADOW_HEIGHT * shadowProj[1][1]);
 
     glm::vec4 shadowProjFrustumPlanes[6];
 
@@ -1257,6 +1906,9 @@ void Renderer::RenderPointShadowMap(unsigned int index)
         glClearColor(this->clearColor.r, this->clearColor.g, this->clearColor.b, this->clearColor.a);
 
         this->GetFrustumPlanes(shadowTransforms[i], shadowProjFrustumPlanes);
+        this->terrainPointShadowShader->use();
+        glUniformMatrix4fv(glGetUniformLocation(this->terrainPointShadowShader->ID, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(shadowTransforms[i]));
+        glUniform4fv(glGetUniformLocation(this->terrainPointShadowShader->ID, "frustumPlanes"), 6, glm::value_ptr(shadowProjFrustumPlanes[0]));
 
         static int count = 0;
         //if (count % 60 == 0 && count != 0) std::cout << "Draw calls culled in point shadow mapping: " << count << '\n';
@@ -1265,13 +1917,17 @@ void Renderer::RenderPointShadowMap(unsigned int index)
         //glCullFace(GL_FRONT);      // <<< CULL the _front_ faces
         for (DrawCall* d : this->drawCalls)
         {
-            AABB worldAABB = d->GetWorldAABB();
-            if (FRUSTUM_CULLING && !this->IsAABBVisible(worldAABB, shadowProjFrustumPlanes) )
+            if (FRUSTUM_CULLING && !this->IsShadowCasterVisible(d, shadowProjFrustumPlanes))
             {
                 count++;
                 continue; //object is not in that side of the cubemap, dont bother with it.
             }
 
+            if (d->GetHeightMapPath() != nullptr)
+            {
+                this->RenderTerrainShadow(d, this->terrainPointShadowShader);
+                continue;
+            }
             //d->Render(this->pointShadowShader, true);
             d->RenderLOD(this->pointShadowShader, true);
         }
@@ -1350,15 +2006,35 @@ void Renderer::ClearScreen(Vec4 col)
     //note: All draw calls draw onto this buffer so each glClearColor will be updated.
 }
 
-void Renderer::AddToTextureMap(const char* path)
+bool Renderer::AddToTextureMap(const char* path, const unsigned char placeholder[4])
 {
     auto it = this->textureToID.find(path);
 
-    if (it == this->textureToID.end())
+    if (it != this->textureToID.end()) return this->loadingTextures.count(path) == 0;
+
+    if (!this->asyncLoading)
     {
-        unsigned int textureID = TextureSetup::LoadTexture(path);
-        this->textureToID[path] = textureID;
+        this->textureToID[path] = TextureSetup::LoadTexture(path);
+        return true;
     }
+
+    //the id is handed out now with a 1x1 placeholder, the decoded image replaces it later under the same id
+    unsigned int textureID = TextureSetup::CreatePlaceholderTexture(placeholder);
+    this->textureToID[path] = textureID;
+    this->loadingTextures.insert(path);
+
+    std::string file = path;
+    this->assetLoader->Submit([this, path, file, textureID]()
+    {
+        TextureSetup::DecodedImage image = TextureSetup::DecodeImage(file.c_str(), false);
+        return AssetLoader::Upload([this, path, textureID, image = std::move(image)]()
+        {
+            TextureSetup::UploadImage(textureID, image);
+            this->loadingTextures.erase(path);
+            return false;
+        });
+    });
+    return false;
 }
 
 void Renderer::ResetMaterial()
@@ -1376,12 +2052,13 @@ void Renderer::ResetMaterial()
 
 void Renderer::SetCurrentDiffuse(const char* path)
 {
-    AddToTextureMap(path);
+    //while it loads the base color is used instead
+    bool loaded = AddToTextureMap(path, PLACEHOLDER_TEXEL_GREY);
     this->currentMaterial.diffuse = this->textureToID[path];
-    this->currentMaterial.useDiffuseMap = true;
-                    
-    GLint bits;
-    glGetTextureLevelParameteriv(this->currentMaterial.diffuse, 0, GL_TEXTURE_ALPHA_SIZE, &bits);
+    this->currentMaterial.useDiffuseMap = loaded;
+
+    GLint bits = 0;
+    if (loaded) glGetTextureLevelParameteriv(this->currentMaterial.diffuse, 0, GL_TEXTURE_ALPHA_SIZE, &bits);
     this->currentMaterial.hasAlpha = bits > 0;
 }
 
@@ -1392,26 +2069,27 @@ void Renderer::SetCurrentBaseColor(Vec3 col)
 
 void Renderer::SetCurrentNormal(const char* path)
 {
-    AddToTextureMap(path);
+    bool loaded = AddToTextureMap(path, PLACEHOLDER_TEXEL_FLAT_NORMAL);
     this->currentMaterial.normal = this->textureToID[path];
-    this->currentMaterial.useNormalMap = true;
+    this->currentMaterial.useNormalMap = loaded;
 }
 
 void Renderer::SetCurrentSpecular(const char* path)
 {
-    AddToTextureMap(path);
+    bool loaded = AddToTextureMap(path, PLACEHOLDER_TEXEL_BLACK);
     this->currentMaterial.specular = this->textureToID[path];
-    this->currentMaterial.useSpecularMap = true;
+    this->currentMaterial.useSpecularMap = loaded;
 }
 
 void Renderer::SetCurrentPBRMaterial(const char* albedo, const char* normal, const char* height, const char* metallic, const char* roughness, const char* ao)
 {
-    AddToTextureMap(albedo);
-    AddToTextureMap(normal);
-    AddToTextureMap(height);
-    AddToTextureMap(metallic);
-    AddToTextureMap(roughness);
-    AddToTextureMap(ao);
+    //no use flags here, the placeholders are neutral for their map
+    AddToTextureMap(albedo, PLACEHOLDER_TEXEL_GREY);
+    AddToTextureMap(normal, PLACEHOLDER_TEXEL_FLAT_NORMAL);
+    AddToTextureMap(height, PLACEHOLDER_TEXEL_BLACK);
+    AddToTextureMap(metallic, PLACEHOLDER_TEXEL_BLACK);
+    AddToTextureMap(roughness, PLACEHOLDER_TEXEL_WHITE);
+    AddToTextureMap(ao, PLACEHOLDER_TEXEL_WHITE);
 
     this->currentPBRMaterial.albedo = this->textureToID[albedo];
     this->currentPBRMaterial.normal = this->textureToID[normal];
@@ -1436,8 +2114,8 @@ void Renderer::SetSkybox(const std::vector<const char*>& faces)
 
 void Renderer::SetExposure(float exposure)
 {
-    this->screenShader->use();
-    glUniform1f(glGetUniformLocation(this->screenShader->ID, "exposure"), exposure);
+    this->postProcessShader->use();
+    glUniform1f(glGetUniformLocation(this->postProcessShader->ID, "exposure"), exposure);
 }
 
 void Renderer::SetFogType(FogType fog)
@@ -1470,6 +2148,153 @@ void Renderer::SetBloomThreshold(float threshold)
     this->bloomThreshold = threshold;
 }
 
+void Renderer::SetDepthPrepass(bool on)
+{
+    this->depthPrepass = on;
+}
+
+void Renderer::SetTerrainMeshMode(bool on)
+{
+    this->terrainMeshMode = on;
+}
+
+void Renderer::SetAsyncLoading(bool on)
+{
+    this->asyncLoading = on; //loads already started still finish on the loader
+}
+
+bool Renderer::IsLoadingAssets()
+{
+    return this->assetLoader->IsBusy();
+}
+
+void Renderer::RequestFrameCapture(FrameCaptureCallback callback, CaptureSource source)
+{
+    this->frameCapture->Request(source, callback);
+}
+
+void Renderer::SetSSAO(bool on)
+{
+    //the lit pass stops reading the ssao result, so the frame graph culls the ssao pass
+    this->ssao = on;
+    this->lightingShader->use();
+    glUniform1i(glGetUniformLocation(this->lightingShader->ID, "ssaoEnabled"), on);
+}
+
+void Renderer::SetPostProcessSettings(const PostProcessSettings& settings)
+{
+    this->postProcess = settings;
+}
+
+void Renderer::SetRenderScale(float scale)
+{
+    this->dynamicResolution = false;
+    this->ApplyRenderScale(scale);
+}
+
+void Renderer::SetDynamicResolution(bool on, float frameTimeBudgetMs, float minScale)
+{
+    this->dynamicResolution = on;
+    this->frameTimeBudgetMs = frameTimeBudgetMs;
+    this->minRenderScale = std::clamp(minScale, 0.25f, 1.0f);
+}
+
+void Renderer::UpdateDynamicResolution()
+{
+    //result of the oldest query in the ring, a few frames old so reading it never stalls
+    if (!this->dynamicResolution || this->gpuTimerFrame < GPU_TIMER_QUERY_COUNT - 1)
+    {
+        this->ApplyRenderScale(this->renderScale); //still resends the per frame uniforms
+        return;
+    }
+
+    unsigned int query = this->gpuTimerQueries[(this->gpuTimerFrame + 1) % GPU_TIMER_QUERY_COUNT];
+    int available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+    float scale = this->renderScale;
+    if (available)
+    {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        float gpuMs = std::max((float)ns / 1000000.0f, 0.01f);
+
+        //cost ~ pixel count ~ scale^2. aim a bit under the budget and move part of the way there so it doesn't oscillate
+        float target = this->renderScale * sqrtf((this->frameTimeBudgetMs * 0.9f) / gpuMs);
+        target = std::clamp(target, this->minRenderScale, 1.0f);
+        float next = this->renderScale + (target - this->renderScale) * 0.25f;
+
+        if (fabsf(next - this->renderScale) > 0.02f || (target == 1.0f && next > 0.98f))
+            scale = next;
+    }
+
+    this->ApplyRenderScale(scale);
+}
+
+void Renderer::ApplyRenderScale(float scale)
+{
+    this->renderScale = std::clamp(scale, 0.25f, 1.0f);
+
+    //multiple of 8 so the half res bloom and 1/SSAO_DOWNSCALE ssao rects divide exactly
+    this->renderWidth = std::max(64u, (unsigned int)(SCREEN_WIDTH * this->renderScale) & ~7u);
+    this->renderHeight = std::max(64u, (unsigned int)(SCREEN_HEIGHT * this->renderScale) & ~7u);
+    this->renderScaleXY = glm::vec2((float)this->renderWidth / SCREEN_WIDTH, (float)this->renderHeight / SCREEN_HEIGHT);
+    this->sceneColorScale = this->renderScaleXY;
+
+    //cluster grid is built for the render res
+    for (Shader* s : { this->lightingShader, this->terrainShader, this->terrainClipmapShader })
+    {
+        s->use();
+        glUniform2ui(glGetUniformLocation(s->ID, "screen"), this->renderWidth, this->renderHeight);
+    }
+    this->tileCullShader->use();
+    glUniform2f(glGetUniformLocation(this->tileCullShader->ID, "screen"), (float)this->renderWidth, (float)this->renderHeight);
+    unsigned int activeClusters = ((this->renderWidth + TILE_SIZE - 1) / TILE_SIZE) * ((this->renderHeight + TILE_SIZE - 1) / TILE_SIZE) * CLUSTER_Z_SLICES;
+    this->clusterScanShader->use();
+    glUniform1ui(glGetUniformLocation(this->clusterScanShader->ID, "clusterCount"), activeClusters);
+
+    //screen space passes sample the used corner
+    this->ssaoShader->use();
+    glUniform2fv(glGetUniformLocation(this->ssaoShader->ID, "renderScale"), 1, glm::value_ptr(this->renderScaleXY));
+    glUniform1f(glGetUniformLocation(this->ssaoShader->ID, "screenWidth"), (float)(this->renderWidth / SSAO_DOWNSCALE));
+    glUniform1f(glGetUniformLocation(this->ssaoShader->ID, "screenHeight"), (float)(this->renderHeight / SSAO_DOWNSCALE));
+    this->ssaoTemporalShader->use();
+    glUniform2fv(glGetUniformLocation(this->ssaoTemporalShader->ID, "renderScale"), 1, glm::value_ptr(this->renderScaleXY));
+    glUniform2fv(glGetUniformLocation(this->ssaoTemporalShader->ID, "historyScale"), 1, glm::value_ptr(this->prevRenderScaleXY));
+    this->ssaoUpsampleShader->use();
+    glUniform2fv(glGetUniformLocation(this->ssaoUpsampleShader->ID, "renderScale"), 1, glm::value_ptr(this->renderScaleXY));
+    this->taaResolveShader->use();
+    glUniform2fv(glGetUniformLocation(this->taaResolveShader->ID, "renderScale"), 1, glm::value_ptr(this->renderScaleXY));
+    this->postProcessShader->use();
+    glUniform2fv(glGetUniformLocation(this->postProcessShader->ID, "renderScale"), 1, glm::value_ptr(this->renderScaleXY));
+    this->particleUpdateComputeShader->use();
+    glUniform2fv(glGetUniformLocation(this->particleUpdateComputeShader->ID, "renderScale"), 1, glm::value_ptr(this->renderScaleXY));
+}
+
+void Renderer::SetAntiAliasing(AAMode mode)
+{
+    if (mode == this->antiAliasing) return;
+
+    //free the old mode's targets first so two modes are never resident at once
+    this->DeleteAntiAliasingTargets();
+    this->antiAliasing = mode;
+    this->SetupAntiAliasingTargets();
+}
+
+//low discrepancy sequence for the TAA subpixel jitter
+static float Halton(unsigned int index, unsigned int base)
+{
+    float f = 1.0f;
+    float result = 0.0f;
+    while (index > 0)
+    {
+        f /= (float)base;
+        result += f * (float)(index % base);
+        index /= base;
+    }
+    return result;
+}
+
 static glm::mat4 CreateModelMatrix(const Vec3& pos, const Vec4& rotation, const Vec3& scale)
 {
     glm::mat4 model = glm::mat4(1.0f);
@@ -1511,20 +2336,33 @@ void Renderer::DrawSphere(Vec3 pos, Vec3 size, Vec4 rotation)
 
 void Renderer::DrawModel(const char* path, bool flipTexture, Vec3 pos, Vec3 size, Vec4 rotation)
 {
-    if (flipTexture) stbi_set_flip_vertically_on_load(true);
-
     auto it = this->pathToModel.find(path);
 
     if (it == this->pathToModel.end())
     {
-        this->pathToModel[path] = new Model(path);
+        if (this->asyncLoading)
+        {
+            //imported on a loader thread, then uploaded a texture or mesh at a time at the start of the next frames
+            Model* loading = new Model();
+            std::string file = path;
+            this->assetLoader->Submit([loading, file, flipTexture]()
+            {
+                loading->Import(file, flipTexture);
+                return AssetLoader::Upload([loading]() { return loading->UploadNext(); });
+            });
+            it = this->pathToModel.emplace(path, loading).first;
+        }
+        else
+        {
+            it = this->pathToModel.emplace(path, new Model(path, false, flipTexture)).first;
+        }
     }
-    stbi_set_flip_vertically_on_load(false);
+    if (!it->second->IsLoaded()) return; //nothing is drawn until all of it is uploaded
 
     glm::mat4 model = CreateModelMatrix(pos, rotation, size);
 
     //for every mesh in the model, create a drawcall
-    for (ModelMesh& mesh : this->pathToModel[path]->meshes)
+    for (ModelMesh& mesh : it->second->meshes)
     {
         DrawCall* drawCall = new DrawCall(mesh.GetMeshData(), mesh.GetMaterial(), model);
         if (mesh.lodMeshData.has_value()) drawCall->SetLODMesh(*mesh.lodMeshData);
@@ -1535,21 +2373,157 @@ void Renderer::DrawModel(const char* path, bool flipTexture, Vec3 pos, Vec3 size
 
 void Renderer::DrawTerrain(const char* path, Vec3 pos, Vec3 size, Vec4 rotation)
 {
-    auto it = this->pathToTerrainMeshDataAndTextureID.find(path);
+    auto it = this->pathToTerrainData.find(path);
+
+    if (it == this->pathToTerrainData.end())
+    {
+        //a load started before async loading was turned off still finishes on the loader, its upload fills this in
+        if (!this->asyncLoading && this->loadingTerrains.count(path) == 0)
+        {
+            this->pathToTerrainData[path] = VertexBufferSetup::SetupTerrainBuffers(path);
+        }
+        else
+        {
+            //decode and min/max pyramid on a loader thread, nothing is drawn until the GL half is done
+            if (this->loadingTerrains.insert(path).second)
+            {
+                std::string file = path;
+                this->assetLoader->Submit([this, path, file]()
+                {
+                    TextureSetup::DecodedImage heightMap = TextureSetup::DecodeImage(file.c_str(), false);
+                    //shared so an upload the loader drops at shutdown still frees it, the terrain gets its own (cells moved, not copied)
+                    std::shared_ptr<HeightPyramid> heights;
+                    if (!heightMap.pixels.empty()) heights = std::make_shared<HeightPyramid>(heightMap.pixels.data(), heightMap.width, heightMap.height, heightMap.channels);
+
+                    return AssetLoader::Upload([this, path, heights, heightMap = std::move(heightMap)]()
+                    {
+                        HeightPyramid* owned = heights ? new HeightPyramid(std::move(*heights)) : nullptr;
+                        this->pathToTerrainData[path] = VertexBufferSetup::SetupTerrainBuffers(heightMap, owned);
+                        this->loadingTerrains.erase(path);
+                        return false;
+                    });
+                });
+            }
+            return;
+        }
+    }
+
+    glm::mat4 model = CreateModelMatrix(pos, rotation, size);
 
-    if (it == this->pathToTerrainMeshDataAndTextureID.end())
+    //mesh mode: a plain mesh, every pass draws it like any other. without a heightmap there is nothing to build from
+    TerrainData& terrain = this->pathToTerrainData[path];
+    if (this->terrainMeshMode && terrain.quadtree)
     {
-        this->pathToTerrainMeshDataAndTextureID[path] = VertexBufferSetup::SetupTerrainBuffers(path);
+        //one mesh per placement, so every draw call owns the buffers it points at. found by its model matrix, a placement
+        //that moved takes a mesh nothing else drew this frame and rebuilds it
+        TerrainMeshPlacement* placement = nullptr;
+        for (TerrainMeshPlacement& p : terrain.meshes)
+        {
+            if (p.usedFrame == this->gpuTimerFrame) continue;
+            if (!placement || p.mesh->GetModel() == model) placement = &p;
+        }
+        if (!placement)
+        {
+            terrain.meshes.push_back({ new TerrainMesh(terrain.quadtree, terrain.heightMapTexture), this->gpuTimerFrame });
+            placement = &terrain.meshes.back();
+        }
+        placement->usedFrame = this->gpuTimerFrame;
+
+        placement->mesh->Update(this->terrainMeshShader, model, this->cameraPosition, this->cameraPixelsPerUnit);
+        this->drawCalls.push_back(new DrawCall(placement->mesh->GetMeshData(), this->currentMaterial, model));
+        return;
     }
 
-    glm::mat4 model = CreateModelMatrix(pos, rotation, size);                       //MeshData
-    this->drawCalls.push_back(new DrawCall(this->pathToTerrainMeshDataAndTextureID[path].first, 
-        this->currentMaterial, model, GL_PATCHES));
+    this->drawCalls.push_back(new DrawCall(terrain.meshData, this->currentMaterial, model, GL_PATCHES));
 
     this->drawCalls.back()->SetHeightMapPath(path);
+    this->drawCalls.back()->SetInstanceRange(0, 0); //patches are picked in SelectTerrainPatches()
+}
+
+void Renderer::DrawClipmapTerrain(const char* path, Vec3 pos, Vec3 size, Vec4 rotation)
+{
+    auto it = this->pathToClipmap.find(path);
+
+    if (it == this->pathToClipmap.end())
+    {
+        it = this->pathToClipmap.emplace(path, new ClipmapTerrain(path)).first;
+    }
+    if (!it->second->IsLoaded()) return; //error printed when it was opened
+
+    glm::mat4 model = CreateModelMatrix(pos, rotation, size);
+    this->drawCalls.push_back(new DrawCall(it->second->GetMeshData(), this->currentMaterial, model));
+
+    this->drawCalls.back()->SetClipmapPath(path);
+    this->drawCalls.back()->SetInstanceRange(0, 0); //blocks are picked in SelectTerrainPatches()
+}
+
+void Renderer::SelectTerrainPatches()
+{
+    for (auto& t : this->pathToTerrainData)
+    {
+        if (t.second.quadtree) t.second.quadtree->BeginFrame();
+
+        //meshes of placements not drawn this frame, no draw call points at them
+        std::vector<TerrainMeshPlacement>& meshes = t.second.meshes;
+        for (TerrainMeshPlacement& p : meshes)
+        {
+            if (p.usedFrame != this->gpuTimerFrame) delete p.mesh;
+        }
+        meshes.erase(std::remove_if(meshes.begin(), meshes.end(), [this](const TerrainMeshPlacement& p) { return p.usedFrame != this->gpuTimerFrame; }), meshes.end());
+    }
+    for (auto& c : this->pathToClipmap) c.second->BeginFrame();
+
+    auto isVisible = [this](const AABB& bounds) { return !FRUSTUM_CULLING || this->IsAABBVisible(bounds, this->cameraFrustumPlanes); };
+
+    for (DrawCall* d : this->drawCalls)
+    {
+        if (d->GetClipmapPath() != nullptr)
+        {
+            //the first draw of a clipmap also moves its windows toward the camera
+            std::pair<unsigned int, unsigned int> range = this->pathToClipmap[d->GetClipmapPath()]->Select(d->GetModelMatrix(), this->cameraPosition, isVisible);
+            d->SetInstanceRange(range.first, range.second);
+            continue;
+        }
+        if (d->GetHeightMapPath() == nullptr) continue;
+
+        TerrainQuadtree* quadtree = this->pathToTerrainData[d->GetHeightMapPath()].quadtree;
+        if (!quadtree) continue;
+
+        std::pair<unsigned int, unsigned int> range = quadtree->Select(d->GetModelMatrix(), this->cameraPosition, this->cameraPixelsPerUnit, isVisible);
+        d->SetInstanceRange(range.first, range.second);
+    }
+
+    for (auto& t : this->pathToTerrainData)
+    {
+        if (t.second.quadtree) t.second.quadtree->Upload();
+    }
+    for (auto& c : this->pathToClipmap) c.second->Upload();
 }
 
-void Renderer::CreateParticleEmitter(double duration, unsigned int count, Vec3 pos, Vec3 size, Vec4 rotation)
+void Renderer::SendTerrainExtent(Shader* shader, const char* path)
+{
+    TerrainQuadtree* quadtree = this->pathToTerrainData[path].quadtree;
+    glm::vec2 halfExtent = quadtree ? quadtree->GetHalfExtent() : glm::vec2(1.0f);
+    glUniform2fv(glGetUniformLocation(shader->ID, "halfExtent"), 1, glm::value_ptr(halfExtent));
+}
+
+void Renderer::RenderTerrainShadow(DrawCall* d, Shader* shader)
+{
+    TerrainData& terrain = this->pathToTerrainData[d->GetHeightMapPath()];
+    if (!terrain.quadtree) return;
+
+    //not this frame's patches: those were picked for the camera, a shadow map also needs what is behind it
+    shader->use();
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, terrain.heightMapTexture);
+    this->SendTerrainExtent(shader, d->GetHeightMapPath());
+
+    std::pair<unsigned int, unsigned int> patches = terrain.quadtree->GetShadowPatches();
+    d->RenderPatches(shader, patches.first, patches.second);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void Renderer::CreateParticleEmitter(double duration, unsigned int count, Vec3 pos, Vec3 size, Vec4 rotation, const ParticlePhysics& physics)
 {
     glm::mat4 model = CreateModelMatrix(pos, rotation, size );
     static double lastTime = glfwGetTime();
@@ -1557,13 +2531,13 @@ void Renderer::CreateParticleEmitter(double duration, unsigned int count, Vec3 p
     float dt = float(now - lastTime);
     lastTime = now;
     
-    this->particleEmitters.push_back(new ParticleEmitter(model, count, duration));
+    this->particleSystem->AddEmitter(model, count, duration, physics);
 }
 
 void Renderer::DrawLightsDebug()
 {
     glBindFramebuffer(GL_FRAMEBUFFER, this->hdrFBO);
-    glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    glViewport(0, 0, this->renderWidth, this->renderHeight);
 
     if (this->drawDebugLights)
     {
@@ -1571,17 +2545,18 @@ void Renderer::DrawLightsDebug()
         this->debugLightShader->use();
         glBindVertexArray(this->cubeMeshData.VAO);
 
-        for (int i = 0; i < MAX_POINT_LIGHTS; i++)
+        for (unsigned int i = 0; i < this->currentFramePointLightCount; i++)
         {
-            PointLightGPU curr = this->pointLights[i];
-            if (!curr.isActive) continue;
+            const glm::vec4& positionRange = this->pointLightCullData[i];
+            glm::vec2 rg = glm::unpackHalf2x16(this->pointLightShadingData[i].colorRG);
+            glm::vec2 bIntensity = glm::unpackHalf2x16(this->pointLightShadingData[i].colorBIntensity);
 
             glm::mat4 model = glm::mat4(1.0f);
-            model = glm::translate(model, glm::vec3(curr.positionRange.x, curr.positionRange.y, curr.positionRange.z));
+            model = glm::translate(model, glm::vec3(positionRange));
             model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));
             glUniformMatrix4fv(glGetUniformLocation(this->debugLightShader->ID, "model"), 1, GL_FALSE, glm::value_ptr(model));
-            glUniform3fv(glGetUniformLocation(debugLightShader->ID, "lightColor"), 1, glm::value_ptr(glm::vec3(curr.colorIntensity.r, curr.colorIntensity.g, curr.colorIntensity.b)));
-            glUniform1f(glGetUniformLocation(debugLightShader->ID, "intensity"), curr.colorIntensity.w);
+            glUniform3fv(glGetUniformLocation(debugLightShader->ID, "lightColor"), 1, glm::value_ptr(glm::vec3(rg, bIntensity.x)));
+            glUniform1f(glGetUniformLocation(debugLightShader->ID, "intensity"), bIntensity.y);
             glDrawArrays(GL_TRIANGLES, 0, 36);
         }
         
@@ -1592,34 +2567,80 @@ void Renderer::DrawLightsDebug()
 
 void Renderer::AddPointLightToFrame(Vec3 pos, Vec3 col, float range, float intensity, bool shadow)
 {
-    if (this->currentFramePointLightCount + 1 <= MAX_POINT_LIGHTS)
-    {
-        PointLightGPU p = PointLightGPU();
+    PointLightDesc p;
+    p.position = pos;
+    p.color = col;
+    p.range = range;
+    p.intensity = intensity;
+    p.castShadows = shadow;
+
+    this->framePointLights.push_back(p); //culled and uploaded in EndRenderFrame()
+}
 
-        p.isActive = true;
-        p.positionRange = { pos.x, pos.y, pos.z, std::min(range, 100.0f) };
-        p.colorIntensity = { col.r, col.g, col.b, intensity };
+void Renderer::AddPointLightsToFrame(const PointLightDesc* lights, size_t count)
+{
+    this->framePointLights.insert(this->framePointLights.end(), lights, lights + count);
+}
 
-        if (shadow) p.shadowMapIndex = this->currentFrameShadowArrayIndex++;
-        else p.shadowMapIndex = -1;
-        assert(this->currentFrameShadowArrayIndex <= MAX_SHADOW_CASTING_POINT_LIGHTS);
-        
-        this->pointLights[this->currentFramePointLightCount] = p;
-        this->currentFramePointLightCount++;
+PointLightHandle Renderer::CreatePersistentPointLight(const PointLightDesc& light)
+{
+    unsigned int slot;
 
-        this->tileCullShader->use();
-        glUniform1i(glGetUniformLocation(this->tileCullShader->ID, "numLights"), this->currentFramePointLightCount);
-        this->lightingShader->use();
-        glUniform1i(glGetUniformLocation(this->lightingShader->ID, "numPointLights"), this->currentFramePointLightCount);
-        this->terrainShader->use();
-        glUniform1i(glGetUniformLocation(this->terrainShader->ID, "numPointLights"), this->currentFramePointLightCount);
+    if (!this->freePointLightSlots.empty())
+    {
+        slot = this->freePointLightSlots.back();
+        this->freePointLightSlots.pop_back();
+        this->persistentPointLights[slot] = light;
+        this->persistentPointLightAlive[slot] = true;
     }
     else
     {
-        std::cout << "ERROR: Max pointlights exceeded\n";
+        if (this->persistentPointLights.size() >= POINT_LIGHT_HANDLE_INDEX_MASK)
+        {
+            std::cout << "ERROR: Too many persistent point lights\n";
+            return INVALID_POINT_LIGHT_HANDLE;
+        }
+        slot = (unsigned int)this->persistentPointLights.size();
+        this->persistentPointLights.push_back(light);
+        this->persistentPointLightAlive.push_back(true);
+        this->persistentPointLightGenerations.push_back(0);
+    }
+
+    return (this->persistentPointLightGenerations[slot] << POINT_LIGHT_HANDLE_INDEX_BITS) | slot;
+}
+
+bool Renderer::IsPointLightHandleValid(PointLightHandle handle) const
+{
+    unsigned int slot = handle & POINT_LIGHT_HANDLE_INDEX_MASK;
+    return slot < this->persistentPointLights.size() && this->persistentPointLightAlive[slot] &&
+           (handle >> POINT_LIGHT_HANDLE_INDEX_BITS) == this->persistentPointLightGenerations[slot];
+}
+
+void Renderer::UpdatePersistentPointLight(PointLightHandle handle, const PointLightDesc& light)
+{
+    if (!this->IsPointLightHandleValid(handle))
+    {
+        std::cout << "ERROR: Invalid point light handle " << handle << '\n';
+        return;
+    }
+
+    this->persistentPointLights[handle & POINT_LIGHT_HANDLE_INDEX_MASK] = light;
+}
+
+void Renderer::DestroyPersistentPointLight(PointLightHandle handle)
+{
+    if (!this->IsPointLightHandleValid(handle))
+    {
+        std::cout << "ERROR: Invalid point light handle " << handle << '\n';
+        return;
     }
 
+    //wraps within the high bits. slots stop below the index mask, so no handle equals INVALID_POINT_LIGHT_HANDLE
+    unsigned int slot = handle & POINT_LIGHT_HANDLE_INDEX_MASK;
+    this->persistentPointLightGenerations[slot] = (this->persistentPointLightGenerations[slot] + 1) & (0xFFFFFFFFu >> POINT_LIGHT_HANDLE_INDEX_BITS);
 
+    this->persistentPointLightAlive[slot] = false;
+    this->freePointLightSlots.push_back(slot);
 }
 
 void Renderer::AddDirLightToFrame(Vec3 dir, Vec3 col, float intensity, bool shadow)
@@ -1640,14 +2661,8 @@ void Renderer::SetAndSendAllLightsToFalse()
     this->dirLight.isActive = false;
     this->SendDirLightUniforms();
 
-    this->lightingShader->use();
-    glUniform1i(glGetUniformLocation(this->lightingShader->ID, "numPointLights"), 0);
-    this->terrainShader->use();
-    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "numPointLights"), 0);
-    this->tileCullShader->use();
-    glUniform1i(glGetUniformLocation(this->tileCullShader->ID, "numLights"), 0);
-    this->currentFramePointLightCount = 0;
-    this->currentFrameShadowArrayIndex = 0;
+    //count and numLights are rebuilt in UploadPointLights(), persistent lights are kept
+    this->framePointLights.clear();
 }
 
 void Renderer::SendDirLightUniforms()
@@ -1660,19 +2675,33 @@ void Renderer::SendDirLightUniforms()
     glUniform1i(glGetUniformLocation(this->lightingShader->ID, "dirLight.isActive"), dirLight.isActive);
     glUniform1i(glGetUniformLocation(this->lightingShader->ID, "dirLight.shadowMapIndex"), dirLight.castShadows);
 
-    this->terrainShader->use();
+    for (Shader* s : { this->terrainShader, this->terrainClipmapShader })
+    {
+        s->use();
 
-    glUniform3fv(glGetUniformLocation(this->terrainShader->ID, "dirLight.direction"), 1, glm::value_ptr(dirLight.direction));
-    glUniform3fv(glGetUniformLocation(this->terrainShader->ID, "dirLight.color"), 1, glm::value_ptr(dirLight.color));
-    glUniform1f(glGetUniformLocation(this->terrainShader->ID, "dirLight.intensity"), dirLight.intensity);
-    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "dirLight.isActive"), dirLight.isActive);
-    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "dirLight.shadowMapIndex"), dirLight.castShadows);
+        glUniform3fv(glGetUniformLocation(s->ID, "dirLight.direction"), 1, glm::value_ptr(dirLight.direction));
+        glUniform3fv(glGetUniformLocation(s->ID, "dirLight.color"), 1, glm::value_ptr(dirLight.color));
+        glUniform1f(glGetUniformLocation(s->ID, "dirLight.intensity"), dirLight.intensity);
+        glUniform1i(glGetUniformLocation(s->ID, "dirLight.isActive"), dirLight.isActive);
+        glUniform1i(glGetUniformLocation(s->ID, "dirLight.shadowMapIndex"), dirLight.castShadows);
+    }
 }
 
-void Renderer::SendCameraUniforms(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& position)
+void Renderer::SendCameraUniforms(const glm::mat4& view, const glm::mat4& cameraProjection, const glm::vec3& position)
 {
     //update camerea frustum planes since we have access to the camera here
-    this->GetFrustumPlanes(projection * view, this->cameraFrustumPlanes);
+    this->GetFrustumPlanes(cameraProjection * view, this->cameraFrustumPlanes);
+    this->cameraPosition = position;
+    this->cameraPixelsPerUnit = 0.5f * (float)this->renderHeight * cameraProjection[1][1];
+
+    //TAA: everything rasterized gets a subpixel jitter (8 sample halton 2,3), culling + velocity use the real projection
+    glm::mat4 projection = cameraProjection;
+    if (this->antiAliasing == AA_TAA)
+    {
+        unsigned int i = (this->taaFrameIndex++ % 8) + 1;
+        projection[2][0] += (Halton(i, 2) - 0.5f) * 2.0f / (float)this->renderWidth;
+        projection[2][1] += (Halton(i, 3) - 0.5f) * 2.0f / (float)this->renderHeight;
+    }
 
     this->lightingShader->use();
     glUniformMatrix4fv(glGetUniformLocation(this->lightingShader->ID, "view"), 1, GL_FALSE, glm::value_ptr(view));
@@ -1697,51 +2726,121 @@ void Renderer::SendCameraUniforms(const glm::mat4& view, const glm::mat4& projec
         glUniformMatrix4fv(glGetUniformLocation(skyShader->ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
     }
 
-    this->terrainShader->use();
-    glUniformMatrix4fv(glGetUniformLocation(this->terrainShader->ID, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(this->terrainShader->ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-    glUniform3fv(glGetUniformLocation(this->terrainShader->ID, "viewPos"), 1, glm::value_ptr(position));
-    glUniform1f(glGetUniformLocation(this->terrainShader->ID, "farPlane"), DEFAULT_FAR);
-    glUniform1f(glGetUniformLocation(this->terrainShader->ID, "nearPlane"), DEFAULT_NEAR);
+    for (Shader* s : { this->terrainShader, this->terrainClipmapShader })
+    {
+        s->use();
+        glUniformMatrix4fv(glGetUniformLocation(s->ID, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(s->ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glUniform3fv(glGetUniformLocation(s->ID, "viewPos"), 1, glm::value_ptr(position));
+        glUniform1f(glGetUniformLocation(s->ID, "farPlane"), DEFAULT_FAR);
+        glUniform1f(glGetUniformLocation(s->ID, "nearPlane"), DEFAULT_NEAR);
+    }
 
     this->geometryPassShader->use();
     glUniformMatrix4fv(glGetUniformLocation(geometryPassShader->ID, "view"), 1, GL_FALSE, glm::value_ptr(view));
     glUniformMatrix4fv(glGetUniformLocation(geometryPassShader->ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
 
+    for (Shader* s : { this->terrainGeometryPassShader, this->terrainClipmapGeometryPassShader })
+    {
+        s->use();
+        glUniformMatrix4fv(glGetUniformLocation(s->ID, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(s->ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    }
+
+    //terrain tessellation (tcsTerrain): both programs get the same values so their patches match
+    for (Shader* s : { this->terrainShader, this->terrainGeometryPassShader })
+    {
+        s->use();
+        glUniform3fv(glGetUniformLocation(s->ID, "viewPos"), 1, glm::value_ptr(position));
+        glUniform4fv(glGetUniformLocation(s->ID, "frustumPlanes"), 6, glm::value_ptr(this->cameraFrustumPlanes[0]));
+        glUniform1f(glGetUniformLocation(s->ID, "pixelsPerUnit"), this->cameraPixelsPerUnit);
+    }
+
     this->ssaoShader->use();
     glUniformMatrix4fv(glGetUniformLocation(ssaoShader->ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
 
+    //gbuffer stores depth only, these rebuild view space positions
+    glm::mat4 invProjection = glm::inverse(projection);
+    glUniformMatrix4fv(glGetUniformLocation(ssaoShader->ID, "invProjection"), 1, GL_FALSE, glm::value_ptr(invProjection));
+    this->ssaoUpsampleShader->use();
+    glUniformMatrix4fv(glGetUniformLocation(ssaoUpsampleShader->ID, "invProjection"), 1, GL_FALSE, glm::value_ptr(invProjection));
+    this->postProcessShader->use();
+    glUniformMatrix4fv(glGetUniformLocation(postProcessShader->ID, "invProjection"), 1, GL_FALSE, glm::value_ptr(invProjection));
+
+    //history is reprojected with last frame's matrices, then they are replaced with this frame's
+    this->ssaoTemporalShader->use();
+    glUniformMatrix4fv(glGetUniformLocation(ssaoTemporalShader->ID, "invView"), 1, GL_FALSE, glm::value_ptr(glm::inverse(view)));
+    glUniformMatrix4fv(glGetUniformLocation(ssaoTemporalShader->ID, "invProjection"), 1, GL_FALSE, glm::value_ptr(invProjection));
+    glUniformMatrix4fv(glGetUniformLocation(ssaoTemporalShader->ID, "prevViewProjection"), 1, GL_FALSE, glm::value_ptr(this->ssaoPrevViewProjection));
+    this->ssaoPrevViewProjection = projection * view;
+
     this->particleShader->use();
     glUniformMatrix4fv(glGetUniformLocation(particleShader->ID, "view"), 1, GL_FALSE, glm::value_ptr(view));
     glUniformMatrix4fv(glGetUniformLocation(particleShader->ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    this->particleUpdateComputeShader->use(); //sort keys + depth buffer collisions (same jittered projection as the gbuffer)
+    glUniform3fv(glGetUniformLocation(particleUpdateComputeShader->ID, "cameraPos"), 1, glm::value_ptr(position));
+    glUniformMatrix4fv(glGetUniformLocation(particleUpdateComputeShader->ID, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(particleUpdateComputeShader->ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glUniformMatrix4fv(glGetUniformLocation(particleUpdateComputeShader->ID, "invProjection"), 1, GL_FALSE, glm::value_ptr(invProjection));
+
+    //velocity (gbuffer) + TAA reprojection, unjittered
+    glm::mat4 viewProjection = cameraProjection * view;
+    for (Shader* s : { this->geometryPassShader, this->terrainGeometryPassShader, this->terrainClipmapGeometryPassShader })
+    {
+        s->use();
+        glUniformMatrix4fv(glGetUniformLocation(s->ID, "currViewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+        glUniformMatrix4fv(glGetUniformLocation(s->ID, "prevViewProjection"), 1, GL_FALSE, glm::value_ptr(this->taaPrevViewProjection));
+    }
+    this->taaResolveShader->use();
+    glUniformMatrix4fv(glGetUniformLocation(taaResolveShader->ID, "invViewProjection"), 1, GL_FALSE, glm::value_ptr(glm::inverse(viewProjection)));
+    glUniformMatrix4fv(glGetUniformLocation(taaResolveShader->ID, "prevViewProjection"), 1, GL_FALSE, glm::value_ptr(this->taaPrevViewProjection));
+    this->taaPrevViewProjection = viewProjection;
 
     //temp
     this->tileCullShader->use();
     glUniformMatrix4fv(glGetUniformLocation(tileCullShader->ID, "view"), 1, GL_FALSE, glm::value_ptr(view));
     glUniformMatrix4fv(glGetUniformLocation(tileCullShader->ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-    glUniform2f(glGetUniformLocation(tileCullShader->ID, "screen"), SCREEN_WIDTH, SCREEN_HEIGHT);
     glUniform1f(glGetUniformLocation(tileCullShader->ID, "farPlane"), DEFAULT_FAR);
+    glUniform1f(glGetUniformLocation(tileCullShader->ID, "nearPlane"), DEFAULT_NEAR);
 
 }
 
 void Renderer::SendOtherUniforms()
 {
+    //fog done in post process -> lit passes see it as disabled
+    glm::vec3 litFogColor = this->postProcess.fog ? glm::vec3(0.0f) : this->fogColor;
+
     this->lightingShader->use();
-    glUniform3fv(glGetUniformLocation(this->lightingShader->ID, "fogColor"), 1, glm::value_ptr(this->fogColor));
+    glUniform3fv(glGetUniformLocation(this->lightingShader->ID, "fogColor"), 1, glm::value_ptr(litFogColor));
     glUniform1i(glGetUniformLocation(this->lightingShader->ID, "fogType"), this->fogType);
     glUniform1f(glGetUniformLocation(this->lightingShader->ID, "expFogDensity"), this->expFogDensity);
     glUniform1f(glGetUniformLocation(this->lightingShader->ID, "linearFogStart"), this->linearFogStart);
     glUniform1f(glGetUniformLocation(this->lightingShader->ID, "sceneAmbient"), this->ambientLighting);
     
-    this->terrainShader->use();
-    glUniform3fv(glGetUniformLocation(this->terrainShader->ID, "fogColor"), 1, glm::value_ptr(this->fogColor));
-    glUniform1i(glGetUniformLocation(this->terrainShader->ID, "fogType"), this->fogType);
-    glUniform1f(glGetUniformLocation(this->terrainShader->ID, "expFogDensity"), this->expFogDensity);
-    glUniform1f(glGetUniformLocation(this->terrainShader->ID, "linearFogStart"), this->linearFogStart);
-    glUniform1f(glGetUniformLocation(this->terrainShader->ID, "sceneAmbient"), this->ambientLighting);
-
-    this->brightShader->use();
-    glUniform1f(glGetUniformLocation(this->brightShader->ID, "bloomThreshold"), this->bloomThreshold);
+    for (Shader* s : { this->terrainShader, this->terrainClipmapShader })
+    {
+        s->use();
+        glUniform3fv(glGetUniformLocation(s->ID, "fogColor"), 1, glm::value_ptr(litFogColor));
+        glUniform1i(glGetUniformLocation(s->ID, "fogType"), this->fogType);
+        glUniform1f(glGetUniformLocation(s->ID, "expFogDensity"), this->expFogDensity);
+        glUniform1f(glGetUniformLocation(s->ID, "linearFogStart"), this->linearFogStart);
+        glUniform1f(glGetUniformLocation(s->ID, "sceneAmbient"), this->ambientLighting);
+    }
+
+    this->bloomDownsampleShader->use();
+    glUniform1f(glGetUniformLocation(this->bloomDownsampleShader->ID, "bloomThreshold"), this->bloomThreshold);
+
+    this->postProcessShader->use();
+    glUniform1i(glGetUniformLocation(this->postProcessShader->ID, "bloom"), this->postProcess.bloom);
+    glUniform1i(glGetUniformLocation(this->postProcessShader->ID, "toneMap"), this->postProcess.toneMap);
+    glUniform1i(glGetUniformLocation(this->postProcessShader->ID, "gammaCorrection"), this->postProcess.gammaCorrection);
+    glUniform1i(glGetUniformLocation(this->postProcessShader->ID, "vignette"), this->postProcess.vignette);
+    glUniform1f(glGetUniformLocation(this->postProcessShader->ID, "vignetteStrength"), this->postProcess.vignetteStrength);
+    glUniform1i(glGetUniformLocation(this->postProcessShader->ID, "fog"), this->postProcess.fog && this->fogColor != glm::vec3(0.0f));
+    glUniform3fv(glGetUniformLocation(this->postProcessShader->ID, "fogColor"), 1, glm::value_ptr(this->fogColor));
+    glUniform1i(glGetUniformLocation(this->postProcessShader->ID, "fogType"), this->fogType);
+    glUniform1f(glGetUniformLocation(this->postProcessShader->ID, "expFogDensity"), this->expFogDensity);
+    glUniform1f(glGetUniformLocation(this->postProcessShader->ID, "linearFogStart"), this->linearFogStart);
 }
 
 /*
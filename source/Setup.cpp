@@ -5,7 +5,11 @@
 #include <stb_image.h>
 
 #include <iostream>
+#include <cstddef>
+#include <algorithm>
 #include "../include/Definitions.h"
+#include "../include/TerrainQuadtree.h"
+#include "../include/HeightPyramid.h"
 
 
 static inline AABB GetAABB(float* vertexData, unsigned int vertexCount, unsigned int stride)
@@ -432,10 +436,21 @@ namespace VertexBufferSetup
         return result;
     }
     
-    std::pair<MeshData, unsigned int> SetupTerrainBuffers(const char* path)
+    TerrainData SetupTerrainBuffers(const char* path)
     {
-        // load and create a texture
+        //only the min/max pyramid outlives the pixels, the quadtree takes its node bounds from it
+        TextureSetup::DecodedImage heightMap = TextureSetup::DecodeImage(path, false);
+        HeightPyramid* heights = nullptr;
+        if (!heightMap.pixels.empty()) heights = new HeightPyramid(heightMap.pixels.data(), heightMap.width, heightMap.height, heightMap.channels);
+
+        return SetupTerrainBuffers(heightMap, heights);
+    }
+
+    TerrainData SetupTerrainBuffers(const TextureSetup::DecodedImage& heightMap, HeightPyramid* heights)
+    {
+        // create the texture
         // -------------------------
+        TerrainData terrain;
         unsigned int heightMapTexture;
 
         glGenTextures(1, &heightMapTexture);
@@ -446,11 +461,9 @@ namespace VertexBufferSetup
         // set texture filtering parameters
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        // load image, create texture and generate mipmaps
-        int width, height, nrChannels;
-        // The FileSystem::getPath(...) is part of the GitHub repository so we can find files on any IDE/platform; replace it with your own image path.
-        unsigned char* data = stbi_load(path, &width, &height, &nrChannels, 0);
-        if (data)
+        // create texture and generate mipmaps
+        int width = heightMap.width, height = heightMap.height, nrChannels = heightMap.channels;
+        if (heights)
         {
             GLenum format = GL_RGBA; // Assuming RGBA for now
             if (nrChannels == 1)
@@ -460,7 +473,7 @@ namespace VertexBufferSetup
             // else format = GL_RGBA; // Default
 
             // Use the determined format
-            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, heightMap.pixels.data());
             GLenum err = glGetError();
             if (err != GL_NO_ERROR) {
                 std::cerr << "!!! OpenGL Error after glTexImage2D for heightmap: " << err << std::endl;
@@ -471,82 +484,61 @@ namespace VertexBufferSetup
             if (err != GL_NO_ERROR) {
                 std::cerr << "!!! OpenGL Error after glGenerateMipmap for heightmap: " << err << std::endl;
             }
+
+            terrain.heights = heights;
+            terrain.quadtree = new TerrainQuadtree(terrain.heights);
         }
-        else // stbi_load failed
+        else // decoding failed
         {
             std::cout << "Failed to load heightmap texture" << std::endl;
         }
-        stbi_image_free(data); // Free data regardless of glTexImage2D success
 
-        // set up vertex data (and buffer(s)) and configure vertex attributes
-        // ------------------------------------------------------------------
-
-        //vertex data for a flat plane with rez * rez patches and size: width * height
-        std::vector<float> vertices;
-
-        //rez * rez patches generated.
-        unsigned rez = 20;
-        for (unsigned i = 0; i <= rez - 1; i++)
+        //one patch, TL TR BL BR corners in [0,1]. drawn instanced, once per quadtree node picked that frame:
+        //vsTerrain places it with the per instance node (TerrainPatchGPU)
+        float corners[] =
         {
-            for (unsigned j = 0; j <= rez - 1; j++)
-            {
-                //GENERATE PATCH
-                //TL WORLD
-                vertices.push_back(-width / 2.0f + width * i / (float)rez); // v.x
-                vertices.push_back(0.0f); // v.y
-                vertices.push_back(-height / 2.0f + height * j / (float)rez); // v.z
-                vertices.push_back(i / (float)rez); // u
-                vertices.push_back(j / (float)rez); // v
-
-                //TR WORLD
-                vertices.push_back(-width / 2.0f + width * (i + 1) / (float)rez); // v.x
-                vertices.push_back(0.0f); // v.y
-                vertices.push_back(-height / 2.0f + height * j / (float)rez); // v.z
-                vertices.push_back((i + 1) / (float)rez); // u
-                vertices.push_back(j / (float)rez); // v
-
-                //BL WORLD
-                vertices.push_back(-width / 2.0f + width * i / (float)rez); // v.x
-                vertices.push_back(0.0f); // v.y
-                vertices.push_back(-height / 2.0f + height * (j + 1) / (float)rez); // v.z
-                vertices.push_back(i / (float)rez); // u
-                vertices.push_back((j + 1) / (float)rez); // v
-
-                //BR WORLD
-                vertices.push_back(-width / 2.0f + width * (i + 1) / (float)rez); // v.x
-                vertices.push_back(0.0f); // v.y
-                vertices.push_back(-height / 2.0f + height * (j + 1) / (float)rez); // v.z
-                vertices.push_back((i + 1) / (float)rez); // u
-                vertices.push_back((j + 1) / (float)rez); // v
-            }
-        }
+            0.0f, 0.0f,
+            1.0f, 0.0f,
+            0.0f, 1.0f,
+            1.0f, 1.0f
+        };
 
-        // first, configure the cube's VAO (and terrainVBO)
         unsigned int VBO, VAO;
         glGenVertexArrays(1, &VAO);
         glBindVertexArray(VAO);
 
         glGenBuffers(1, &VBO);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
 
-        // position attribute
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+        // corner attribute
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
         glEnableVertexAttribArray(0);
-        // texCoord attribute
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(sizeof(float) * 3));
-        glEnableVertexAttribArray(1);
+
+        if (terrain.quadtree)
+        {
+            // per patch attributes: node, neighbor ratios, min/max height
+            glBindBuffer(GL_ARRAY_BUFFER, terrain.quadtree->GetPatchBuffer());
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainPatchGPU), (void*)offsetof(TerrainPatchGPU, node));
+            glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainPatchGPU), (void*)offsetof(TerrainPatchGPU, neighbors));
+            glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(TerrainPatchGPU), (void*)offsetof(TerrainPatchGPU, heights));
+            for (unsigned int i = 1; i <= 3; i++)
+            {
+                glEnableVertexAttribArray(i);
+                glVertexAttribDivisor(i, 1);
+            }
+        }
 
         glPatchParameteri(GL_PATCH_VERTICES, 4);
 
         glBindVertexArray(0);
 
-        MeshData result;
-        result.VAO = VAO;
-        result.vertexCount = rez * rez * 4;
-        result.aabb = GetAABB(&vertices[0], result.vertexCount, 5);
+        terrain.meshData.VAO = VAO;
+        terrain.meshData.vertexCount = 4;
+        if (terrain.heights) terrain.meshData.aabb = terrain.heights->GetBounds();
+        terrain.heightMapTexture = heightMapTexture;
 
-        return {result, heightMapTexture};
+        return terrain;
     }
 }
 
@@ -605,7 +597,7 @@ namespace FramebufferSetup
 
 
         glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL); //16f to hold greater than 1.0
+        glTexImage2D(GL_TEXTURE_2D, 0, TextureSetup::GetHDRInternalFormat(), SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL); //float to hold greater than 1.0
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -626,9 +618,8 @@ namespace FramebufferSetup
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
-    void SetupMSAAHDRFramebuffer(unsigned int& FBO, unsigned int& texture)
+    void SetupMSAAHDRFramebuffer(unsigned int& FBO, unsigned int& texture, unsigned int& RBO, unsigned int samples)
     {
-        unsigned int RBO;
         //create and bind
         glGenFramebuffers(1, &FBO);
         glBindFramebuffer(GL_FRAMEBUFFER, FBO);
@@ -636,13 +627,13 @@ namespace FramebufferSetup
         glGenTextures(1, &texture);
 
         glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, texture);
-        glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, 4, GL_RGBA16F, SCREEN_WIDTH, SCREEN_HEIGHT, GL_TRUE); //16f to hold greater than 1.0
+        glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples, TextureSetup::GetHDRInternalFormat(), SCREEN_WIDTH, SCREEN_HEIGHT, GL_TRUE); //same format as hdrTexture for the resolve blit
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 , GL_TEXTURE_2D_MULTISAMPLE, texture, 0); //attach to framebuffer
         
         //renderbuffer attachment (depth/stencil)
         glGenRenderbuffers(1, &RBO);
         glBindRenderbuffer(GL_RENDERBUFFER, RBO);
-        glRenderbufferStorageMultisample(GL_RENDERBUFFER, 4, GL_DEPTH24_STENCIL8, SCREEN_WIDTH, SCREEN_HEIGHT); //allocate memory 
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH24_STENCIL8, SCREEN_WIDTH, SCREEN_HEIGHT); //allocate memory 
         glBindRenderbuffer(GL_RENDERBUFFER, 0);
         glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, RBO);
 
@@ -653,52 +644,6 @@ namespace FramebufferSetup
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
-    void SetupHalfResBrightFramebuffer(unsigned int& FBO, unsigned int& texture)
-    {
-        glGenFramebuffers(1, &FBO);
-        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, 0, GL_RGBA, GL_FLOAT, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-        //attach
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
-
-        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-            std::cout << "Half-resolution framebuffer not complete!" << std::endl;
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    }
-
-    void SetupTwoPassBlurFramebuffers(unsigned int FBOs[2], unsigned int colorBuffers[2])
-    {
-        //generate
-        glGenFramebuffers(2, FBOs);
-        glGenTextures(2, colorBuffers);
-                  
-        for (int i = 0; i < 2; i++)
-        {
-            glBindFramebuffer(GL_FRAMEBUFFER, FBOs[i]);
-            glBindTexture(GL_TEXTURE_2D, colorBuffers[i]);
-            //set texture params
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, 0, GL_RGBA, GL_FLOAT, NULL);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); // clamp to the edge as the blur filter would otherwise sample repeated texture values
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); //eg 1.1 -> 1.0 , -22.2 -> 0.0
-            //attach to fb
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorBuffers[i], 0);
-
-            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-                std::cout << "Framebuffer not complete!" << std::endl;
-        }
-    }
-
     void SetupVSMTwoPassBlurFramebuffer(unsigned int& FBO, unsigned int& textureArray, unsigned int w, unsigned int h)
     {
         //generate
@@ -814,96 +759,118 @@ namespace FramebufferSetup
         //to render to when doing the shadow pass. For this we need to know which face to render to.
     }
 
-    void SetupSSAOFramebuffer(unsigned int& FBO, unsigned int& texture)
+    void SetupSSAOLowResFramebuffer(unsigned int& FBO, unsigned int& texture)
     {
         glGenFramebuffers(1, &FBO);
         glBindFramebuffer(GL_FRAMEBUFFER, FBO);
 
         glGenTextures(1, &texture);
         glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RED, GL_FLOAT, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, SSAO_WIDTH, SSAO_HEIGHT, 0, GL_RG, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); //history is sampled at reprojected uvs
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+
+        //start with no history (view z 0 never matches, so the first frame takes the current result)
+        float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glClearBufferfv(GL_COLOR, 0, zero);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: SSAO low res framebuffer is not complete!" << std::endl;
+
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
-    static struct PointLightGPU
-    {
-        glm::vec4 positionRange;
-        glm::vec4 colorIntensity;
-        uint32_t  isActive;
-        int32_t  shadowMapIndex;
-        uint32_t  pad0, pad1;
-    };
-
-    void SetupTiledSSBOs(unsigned int& lightSSBO, unsigned int& countSSBO, unsigned int& indexSSBO)
+    void SetupTransientFramebuffer(unsigned int& FBO)
     {
+        //the color attachment is a pooled texture that can change every frame,
+        //the pass using it attaches it with glNamedFramebufferTexture first.
+        glCreateFramebuffers(1, &FBO);
+        glNamedFramebufferDrawBuffer(FBO, GL_COLOR_ATTACHMENT0);
+    }
 
-        uint32_t nx = (SCREEN_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
-        uint32_t ny = (SCREEN_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
-        uint32_t nTiles = nx * ny;
+    void SetupTiledSSBOs(unsigned int& lightCullSSBO, unsigned int& lightShadingSSBO, unsigned int& clusterGridSSBO, unsigned int& indexSSBO)
+    {
 
         //TEMP
-        glCreateBuffers(1, &lightSSBO);
+        glCreateBuffers(1, &lightCullSSBO);
+        glCreateBuffers(1, &lightShadingSSBO);
         glCreateBuffers(1, &indexSSBO);
-        glCreateBuffers(1, &countSSBO);
+        glCreateBuffers(1, &clusterGridSSBO);
 
-        //lights
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightSSBO);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(PointLightGPU) * MAX_POINT_LIGHTS, NULL, GL_DYNAMIC_COPY);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, lightSSBO); //binding = 1
+        //lights, culling stream (positionRange)
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightCullSSBO);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * MAX_POINT_LIGHTS, NULL, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, lightCullSSBO); //binding = 1
 
-        //indexSSBO
-        size_t indexBufBytes = nTiles * MAX_LIGHTS_PER_TILE * sizeof(GLuint);
+        //lights, shading stream (half color/intensity, shadow index)
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightShadingSSBO);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(PointLightShadingGPU) * MAX_POINT_LIGHTS, NULL, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, lightShadingSSBO); //binding = 4
+
+        //indexSSBO (compact list, clusters index into it with their offset)
+        size_t indexBufBytes = CLUSTER_LIGHT_INDEX_CAPACITY * sizeof(GLuint);
         glBindBuffer(GL_SHADER_STORAGE_BUFFER, indexSSBO);
         glBufferData(GL_SHADER_STORAGE_BUFFER, indexBufBytes, nullptr, GL_DYNAMIC_COPY);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, indexSSBO);
 
-        //count
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, countSSBO);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, nTiles * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, countSSBO);
-
-        static_assert(sizeof(PointLightGPU) % 16 == 0, "std430 alignment");
-
+        //cluster grid (offset, count)
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterGridSSBO);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, CLUSTER_COUNT * 2 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, clusterGridSSBO);
     }
 
-    void SetupGBufferFramebuffer(unsigned int& FBO, unsigned int& gNormal, unsigned int& gPosition)
+    void SetupGBufferFramebuffer(unsigned int& FBO, unsigned int& gNormal, unsigned int& gDepth)
     {
         //fbo
         glGenFramebuffers(1, &FBO);
         glBindFramebuffer(GL_FRAMEBUFFER, FBO);
 
-        //normal texture (view space) ATTACHMENT 0
+        //normal texture (view space, octahedral) ATTACHMENT 0
         glGenTextures(1, &gNormal);
         glBindTexture(GL_TEXTURE_2D, gNormal);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RG, GL_UNSIGNED_SHORT, NULL);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gNormal, 0); //attach
 
-        // position texture (view space) ATTACHMENT 1
-        glGenTextures(1, &gPosition);
-        glBindTexture(GL_TEXTURE_2D, gPosition);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
+        //depth (view space position is reconstructed from this). texture so it can be sampled,
+        //same format as the hdr fbo so it can be blitted there for the depth prepass
+        glGenTextures(1, &gDepth);
+        glBindTexture(GL_TEXTURE_2D, gDepth);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gPosition, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, gDepth, 0);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: GBuffer framebuffer is not complete!" << std::endl;
 
-        //depth testing
-        unsigned int rboDepth; //LOST
-        glGenRenderbuffers(1, &rboDepth);
-        glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, SCREEN_WIDTH, SCREEN_HEIGHT);
-        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void SetupGBufferVelocityTexture(unsigned int gBufferFBO, unsigned int& texture)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, gBufferFBO);
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RG, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, texture, 0);
 
         unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
         glDrawBuffers(2, attachments);
 
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: GBuffer framebuffer (velocity) is not complete!" << std::endl;
+
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 }
@@ -939,59 +906,85 @@ namespace TextureSetup
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     }
 
+    void SetupTAAHistoryTexture(unsigned int& texture)
+    {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GetHDRInternalFormat(), SCREEN_WIDTH, SCREEN_HEIGHT); //immutable for image binding
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); //history is read at reprojected uvs
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    unsigned int GetHDRInternalFormat()
+    {
+        return HDR_PACKED_FORMAT ? GL_R11F_G11F_B10F : GL_RGBA16F;
+    }
+
     unsigned int LoadTexture(char const* path)
     {
         unsigned int textureID;
         glGenTextures(1, &textureID);
+        UploadImage(textureID, DecodeImage(path, false));
 
-        int width, height, nrComponents;
-        unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
-        if (data)
+        return textureID;
+    }
+
+    DecodedImage DecodeImage(char const* path, bool flip)
+    {
+        DecodedImage image;
+        unsigned char* data = stbi_load(path, &image.width, &image.height, &image.channels, 0);
+        if (!data)
         {
-            GLenum format;
-            GLenum internalFormat;
-            if (nrComponents == 1)
-            {
-                format = GL_RED;
-                internalFormat = GL_RED;
-            }
-            else if (nrComponents == 3)
-            {
-                internalFormat = GL_RGB;
-                format = GL_RGB;
-            }
+            std::cout << "Texture failed to load at path: " << path << std::endl;
+            return image;
+        }
 
-            else if (nrComponents == 4)
+        image.pixels.assign(data, data + (size_t)image.width * image.height * image.channels);
+        stbi_image_free(data);
+
+        //flipped here instead of stbi_set_flip_vertically_on_load, that flag is shared by every thread
+        if (flip)
+        {
+            size_t row = (size_t)image.width * image.channels;
+            for (int y = 0; y < image.height / 2; y++)
             {
-                internalFormat = GL_RGBA;
-                format = GL_RGBA;
+                std::swap_ranges(image.pixels.begin() + y * row, image.pixels.begin() + (y + 1) * row,
+                                 image.pixels.begin() + (image.height - 1 - y) * row);
             }
+        }
+        return image;
+    }
 
-            glBindTexture(GL_TEXTURE_2D, textureID);
-            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-            glGenerateMipmap(GL_TEXTURE_2D);
+    void UploadImage(unsigned int texture, const DecodedImage& image)
+    {
+        if (image.pixels.empty()) return;
 
-            if (format == GL_RGBA)
-            {
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-            }
-            else
-            {
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-            }
+        const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+        GLenum format = formats[std::min(std::max(image.channels, 1), 4) - 1];
 
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1); //rows of 1 and 3 channel images aren't always 4 byte aligned
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glGenerateMipmap(GL_TEXTURE_2D);
 
-            stbi_image_free(data);
-        }
-        else
-        {
-            std::cout << "Texture failed to load at path: " << path << std::endl;
-            stbi_image_free(data);
-        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    unsigned int CreatePlaceholderTexture(const unsigned char texel[4])
+    {
+        //mutable storage (not glTextureStorage2D) so UploadImage can swap the real image in under the same id
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
         return textureID;
     }
@@ -0,0 +1,133 @@
+#include "../include/TerrainMesh.h"
+#include "../include/ComputeShader.h"
+
+#include <glad/glad.h>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+
+static constexpr unsigned int RESOLUTION = TERRAIN_MESH_PATCH_RESOLUTION;
+static constexpr unsigned int PATCH_VERTICES = (RESOLUTION + 1) * (RESOLUTION + 1);
+static constexpr unsigned int PATCH_INDICES = RESOLUTION * RESOLUTION * 6;
+static constexpr unsigned int VERTEX_FLOATS = 11; //position, normal, texcoords, tangent: like every other mesh
+
+TerrainMesh::TerrainMesh(TerrainQuadtree* quadtree, unsigned int heightMapTexture)
+{
+    this->quadtree = quadtree;
+    this->heightMapTexture = heightMapTexture;
+    this->patchSSBO = 0;
+    this->vertexBuffer = 0;
+    this->indexBuffer = 0;
+    this->capacity = 0;
+    this->built = false;
+    this->builtModel = glm::mat4(1.0f);
+    this->builtCameraPos = glm::vec3(0.0f);
+
+    //attributes stay, the buffers behind them are replaced when they grow
+    unsigned int VAO;
+    glCreateVertexArrays(1, &VAO);
+    const unsigned int sizes[] = { 3, 3, 2, 3 };
+    const unsigned int offsets[] = { 0, 3, 6, 8 };
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        glVertexArrayAttribFormat(VAO, i, sizes[i], GL_FLOAT, GL_FALSE, offsets[i] * sizeof(float));
+        glVertexArrayAttribBinding(VAO, i, 0);
+        glEnableVertexArrayAttrib(VAO, i);
+    }
+
+    this->meshData.VAO = VAO;
+    this->meshData.vertexCount = 0;
+    this->meshData.indexCount = 0;
+    this->meshData.aabb = quadtree->GetBounds();
+}
+
+TerrainMesh::~TerrainMesh()
+{
+    glDeleteVertexArrays(1, &this->meshData.VAO);
+    glDeleteBuffers(1, &this->patchSSBO);
+    glDeleteBuffers(1, &this->vertexBuffer);
+    glDeleteBuffers(1, &this->indexBuffer);
+}
+
+void TerrainMesh::Update(ComputeShader* shader, const glm::mat4& model, const glm::vec3& cameraPos, float pixelsPerUnit)
+{
+    if (this->built && model == this->builtModel && glm::distance(cameraPos, this->builtCameraPos) < TERRAIN_MESH_REBUILD_DISTANCE) return;
+    this->Build(shader, model, cameraPos, pixelsPerUnit);
+}
+
+void TerrainMesh::Build(ComputeShader* shader, const glm::mat4& model, const glm::vec3& cameraPos, float pixelsPerUnit)
+{
+    this->built = true;
+    this->builtModel = model;
+    this->builtCameraPos = cameraPos;
+
+    this->quadtree->SelectMesh(model, cameraPos, pixelsPerUnit, (float)RESOLUTION, this->patches);
+    unsigned int count = (unsigned int)this->patches.size();
+    this->meshData.vertexCount = count * PATCH_VERTICES;
+    this->meshData.indexCount = count * PATCH_INDICES;
+    if (count == 0) return;
+
+    this->EnsureCapacity(count);
+    glNamedBufferSubData(this->patchSSBO, 0, sizeof(TerrainPatchGPU) * count, this->patches.data());
+
+    //one thread per vertex, z = patch
+    glm::vec2 halfExtent = this->quadtree->GetHalfExtent();
+    shader->use();
+    glUniform2fv(glGetUniformLocation(shader->ID, "halfExtent"), 1, glm::value_ptr(halfExtent));
+    glBindTextureUnit(0, this->heightMapTexture);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 18, this->patchSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, this->vertexBuffer);
+
+    unsigned int groups = (RESOLUTION + 1 + 7) / 8;
+    glDispatchCompute(groups, groups, count);
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void TerrainMesh::EnsureCapacity(unsigned int patchCount)
+{
+    if (patchCount <= this->capacity) return;
+
+    //some headroom so walking around doesn't reallocate every rebuild (see TERRAIN_MESH_MAX_PATCHES for the cost)
+    unsigned int capacity = std::min(std::max(patchCount + patchCount / 4, 64u), TERRAIN_MESH_MAX_PATCHES);
+
+    //indices: the patch grid, counter clockwise seen from +y, every patch's copy offset by its vertices
+    std::vector<unsigned int> indices;
+    indices.reserve((size_t)capacity * PATCH_INDICES);
+    for (unsigned int p = 0; p < capacity; p++)
+    {
+        unsigned int base = p * PATCH_VERTICES;
+        for (unsigned int y = 0; y < RESOLUTION; y++)
+        {
+            for (unsigned int x = 0; x < RESOLUTION; x++)
+            {
+                unsigned int a = base + y * (RESOLUTION + 1) + x;   //(x, y)
+                unsigned int b = a + RESOLUTION + 1;                //(x, y + 1)
+                indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+            }
+        }
+    }
+
+    glDeleteBuffers(1, &this->patchSSBO);
+    glDeleteBuffers(1, &this->vertexBuffer);
+    glDeleteBuffers(1, &this->indexBuffer);
+
+    glCreateBuffers(1, &this->patchSSBO);
+    glNamedBufferStorage(this->patchSSBO, sizeof(TerrainPatchGPU) * capacity, nullptr, GL_DYNAMIC_STORAGE_BIT);
+    glCreateBuffers(1, &this->vertexBuffer);
+    glNamedBufferStorage(this->vertexBuffer, sizeof(float) * VERTEX_FLOATS * PATCH_VERTICES * capacity, nullptr, 0);
+    glCreateBuffers(1, &this->indexBuffer);
+    glNamedBufferStorage(this->indexBuffer, sizeof(unsigned int) * indices.size(), indices.data(), 0);
+
+    glVertexArrayVertexBuffer(this->meshData.VAO, 0, this->vertexBuffer, 0, VERTEX_FLOATS * sizeof(float));
+    glVertexArrayElementBuffer(this->meshData.VAO, this->indexBuffer);
+    this->capacity = capacity;
+}
+
+const MeshData& TerrainMesh::GetMeshData() const
+{
+    return this->meshData;
+}
+
+const glm::mat4& TerrainMesh::GetModel() const
+{
+    return this->builtModel;
+}
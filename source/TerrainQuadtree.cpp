@@ -0,0 +1,339 @@
+#include "../include/TerrainQuadtree.h"
+#include "../include/HeightPyramid.h"
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <iostream>
+#include <cfloat>
+#include <cmath>
+
+static inline uint64_t NodeKey(unsigned int depth, unsigned int x, unsigned int y)
+{
+    return ((uint64_t)depth << 48) | ((uint64_t)y << 24) | (uint64_t)x;
+}
+
+static AABB TransformAABB(const AABB& aabb, const glm::mat4& model)
+{
+    AABB result;
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        glm::vec4 corner = glm::vec4(i & 1 ? aabb.max.x : aabb.min.x, i & 2 ? aabb.max.y : aabb.min.y, i & 4 ? aabb.max.z : aabb.min.z, 1.0f);
+        glm::vec4 world = model * corner;
+        result.expand(Vec3(world.x, world.y, world.z));
+    }
+    return result;
+}
+
+TerrainQuadtree::TerrainQuadtree(const HeightPyramid* heights)
+{
+    this->heights = heights;
+    this->halfExtent = heights->GetHalfExtent();
+
+    //root: the smallest power of two number of leaves covering the whole map
+    unsigned int mapSize = (unsigned int)std::ceil(std::max(this->halfExtent.x, this->halfExtent.y) * 2.0f);
+    this->maxDepth = 0;
+    while ((TERRAIN_LEAF_SIZE << this->maxDepth) < mapSize) this->maxDepth++;
+    this->rootSize = (float)(TERRAIN_LEAF_SIZE << this->maxDepth);
+
+    glCreateBuffers(1, &this->patchVBO);
+    glNamedBufferStorage(this->patchVBO, sizeof(TerrainPatchGPU) * (TERRAIN_SHADOW_GRID_PATCHES + TERRAIN_MAX_PATCHES), nullptr, GL_DYNAMIC_STORAGE_BIT);
+    this->patches.reserve(TERRAIN_SHADOW_GRID_PATCHES + TERRAIN_MAX_PATCHES);
+    this->overflowReported = false;
+
+    //shadow grid: the deepest level that fits, all its nodes that touch the heightmap. same size everywhere, so no neighbor ratios
+    unsigned int gridDepth = 0;
+    while (gridDepth < this->maxDepth && (4u << (gridDepth * 2)) <= TERRAIN_SHADOW_GRID_PATCHES) gridDepth++;
+
+    float size = this->rootSize / (float)(1u << gridDepth);
+    for (unsigned int y = 0; y < (1u << gridDepth); y++)
+    {
+        for (unsigned int x = 0; x < (1u << gridDepth); x++)
+        {
+            AABB bounds = this->GetNodeBounds(gridDepth, x, y);
+            if (bounds.min.y > bounds.max.y) continue;
+
+            glm::vec2 origin = -this->halfExtent + glm::vec2((float)x, (float)y) * size;
+            this->patches.push_back({ glm::vec4(origin, size, 0.0f), glm::vec4(1.0f), glm::vec4(bounds.min.y, bounds.max.y, 0.0f, 0.0f) });
+        }
+    }
+    this->shadowPatchCount = (unsigned int)this->patches.size();
+    glNamedBufferSubData(this->patchVBO, 0, sizeof(TerrainPatchGPU) * this->shadowPatchCount, this->patches.data());
+}
+
+TerrainQuadtree::~TerrainQuadtree()
+{
+    glDeleteBuffers(1, &this->patchVBO);
+}
+
+void TerrainQuadtree::BeginFrame()
+{
+    this->patches.resize(this->shadowPatchCount);
+}
+
+std::pair<unsigned int, unsigned int> TerrainQuadtree::Select(const glm::mat4& model, const glm::vec3& cameraPos, float pixelsPerUnit,
+                                                              const std::function<bool(const AABB&)>& isVisible)
+{
+    this->SelectCut(model, cameraPos, pixelsPerUnit, TERRAIN_MAX_TESS_LEVEL, isVisible);
+
+    unsigned int first = (unsigned int)this->patches.size();
+    this->AppendSelected(this->patches, this->shadowPatchCount + TERRAIN_MAX_PATCHES);
+    return { first, (unsigned int)this->patches.size() - first };
+}
+
+void TerrainQuadtree::SelectMesh(const glm::mat4& model, const glm::vec3& cameraPos, float pixelsPerUnit, float patchResolution,
+                                 std::vector<TerrainPatchGPU>& out)
+{
+    //drawn from every camera and light until the next rebuild, nothing is culled
+    auto all = [](const AABB&) { return true; };
+    this->SelectCut(model, cameraPos, pixelsPerUnit, patchResolution, all);
+
+    //halving the pixels per unit about quarters the nodes, the root alone always fits
+    while (this->selected.size() > TERRAIN_MESH_MAX_PATCHES && this->selected.size() > 1)
+    {
+        pixelsPerUnit *= 0.5f;
+        this->SelectCut(model, cameraPos, pixelsPerUnit, patchResolution, all);
+    }
+
+    out.clear();
+    this->AppendSelected(out, TERRAIN_MESH_MAX_PATCHES);
+}
+
+void TerrainQuadtree::SelectCut(const glm::mat4& model, const glm::vec3& cameraPos, float pixelsPerUnit, float patchResolution,
+                                const std::function<bool(const AABB&)>& isVisible)
+{
+    this->selected.clear();
+    this->selectedKeys.clear();
+
+    //node sizes are model space, the error is measured in world space
+    glm::mat3 m = glm::mat3(model);
+    float modelScale = std::max({ glm::length(m[0]), glm::length(m[1]), glm::length(m[2]) });
+    this->SelectNode(0, 0, 0, model, cameraPos, pixelsPerUnit * modelScale, patchResolution, isVisible);
+    this->LimitNeighborRatio(model, isVisible);
+}
+
+void TerrainQuadtree::LimitNeighborRatio(const glm::mat4& model, const std::function<bool(const AABB&)>& isVisible)
+{
+    //a patch next to a node more than TERRAIN_MIN_TESS_LEVEL times its size would need an edge level below 1 to match it,
+    //its edge would end between the big node's vertices (cracks). split big nodes until that can't happen, splits only
+    //go deeper so this ends
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        std::vector<glm::uvec3> current = this->selected;
+        for (const glm::uvec3& n : current)
+        {
+            if (!this->selectedKeys.count(NodeKey(n.x, n.y, n.z))) continue; //split earlier in this pass
+
+            float size = this->rootSize / (float)(1u << n.x);
+            glm::vec2 origin = -this->halfExtent + glm::vec2((float)n.y, (float)n.z) * size;
+            float half = size * 0.5f;
+            const glm::vec2 probes[4] = { origin + glm::vec2(-0.5f, half), origin + glm::vec2(half, -0.5f),
+                                          origin + glm::vec2(size + 0.5f, half), origin + glm::vec2(half, size + 0.5f) };
+
+            for (const glm::vec2& probe : probes)
+            {
+                glm::uvec3 big;
+                if (!this->FindBiggerSelected(probe, size, big)) continue;
+                if (this->rootSize / (float)(1u << big.x) <= size * TERRAIN_MIN_TESS_LEVEL) continue;
+
+                this->selectedKeys.erase(NodeKey(big.x, big.y, big.z));
+                for (unsigned int i = 0; i < 4; i++)
+                {
+                    this->AddSelected(big.x + 1, big.y * 2 + (i & 1), big.z * 2 + (i >> 1), model, isVisible);
+                }
+                changed = true;
+            }
+        }
+
+        //drop the nodes that were split
+        this->selected.erase(std::remove_if(this->selected.begin(), this->selected.end(), [this](const glm::uvec3& n)
+        {
+            return !this->selectedKeys.count(NodeKey(n.x, n.y, n.z));
+        }), this->selected.end());
+    }
+}
+
+void TerrainQuadtree::AddSelected(unsigned int depth, unsigned int x, unsigned int y, const glm::mat4& model,
+                                  const std::function<bool(const AABB&)>& isVisible)
+{
+    AABB nodeBounds = this->GetNodeBounds(depth, x, y);
+    if (nodeBounds.min.y > nodeBounds.max.y || !isVisible(TransformAABB(nodeBounds, model))) return;
+
+    this->selected.push_back(glm::uvec3(depth, x, y));
+    this->selectedKeys.insert(NodeKey(depth, x, y));
+}
+
+void TerrainQuadtree::AppendSelected(std::vector<TerrainPatchGPU>& out, size_t maxSize)
+{
+    for (const glm::uvec3& n : this->selected)
+    {
+        if (out.size() >= maxSize)
+        {
+            if (!this->overflowReported) std::cout << "ERROR: Max terrain patches exceeded\n";
+            this->overflowReported = true;
+            break;
+        }
+
+        float size = this->rootSize / (float)(1u << n.x);
+        glm::vec2 origin = -this->halfExtent + glm::vec2((float)n.y, (float)n.z) * size;
+        AABB bounds = this->GetNodeBounds(n.x, n.y, n.z);
+
+        //probe half a unit across the middle of each edge
+        float half = size * 0.5f;
+        glm::vec4 neighbors = glm::vec4(this->GetNeighborRatio(origin + glm::vec2(-0.5f, half), size),
+                                        this->GetNeighborRatio(origin + glm::vec2(half, -0.5f), size),
+                                        this->GetNeighborRatio(origin + glm::vec2(size + 0.5f, half), size),
+                                        this->GetNeighborRatio(origin + glm::vec2(half, size + 0.5f), size));
+
+        out.push_back({ glm::vec4(origin, size, 0.0f), neighbors, glm::vec4(bounds.min.y, bounds.max.y, 0.0f, 0.0f) });
+    }
+}
+
+void TerrainQuadtree::SelectNode(unsigned int depth, unsigned int x, unsigned int y, const glm::mat4& model, const glm::vec3& cameraPos,
+                                 float pixelsPerUnit, float patchResolution, const std::function<bool(const AABB&)>& isVisible)
+{
+    AABB nodeBounds = this->GetNodeBounds(depth, x, y);
+    if (nodeBounds.min.y > nodeBounds.max.y) return; //past the edge of the heightmap
+
+    AABB bounds = TransformAABB(nodeBounds, model);
+    if (!isVisible(bounds)) return;
+
+    //distance to the bounds, so whatever the camera is above always splits
+    glm::vec3 boundsMin = glm::vec3(bounds.min.x, bounds.min.y, bounds.min.z);
+    glm::vec3 boundsMax = glm::vec3(bounds.max.x, bounds.max.y, bounds.max.z);
+    float distance = glm::length(glm::max(glm::max(boundsMin - cameraPos, cameraPos - boundsMax), glm::vec3(0.0f)));
+
+    //screen size of one triangle edge if the node were drawn as a single patch at full tessellation (patchResolution quads across)
+    float size = this->rootSize / (float)(1u << depth);
+    float edgePixels = size * pixelsPerUnit / std::max(distance, 1e-3f) / patchResolution;
+
+    if (depth < this->maxDepth && edgePixels > TERRAIN_TARGET_EDGE_PIXELS)
+    {
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            this->SelectNode(depth + 1, x * 2 + (i & 1), y * 2 + (i >> 1), model, cameraPos, pixelsPerUnit, patchResolution, isVisible);
+        }
+        return;
+    }
+
+    this->selected.push_back(glm::uvec3(depth, x, y));
+    this->selectedKeys.insert(NodeKey(depth, x, y));
+}
+
+AABB TerrainQuadtree::GetNodeBounds(unsigned int depth, unsigned int x, unsigned int y) const
+{
+    float size = this->rootSize / (float)(1u << depth);
+    glm::vec2 lo = glm::max(-this->halfExtent + glm::vec2((float)x, (float)y) * size, -this->halfExtent);
+    glm::vec2 hi = glm::min(-this->halfExtent + glm::vec2((float)x + 1.0f, (float)y + 1.0f) * size, this->halfExtent);
+    glm::vec2 heights = this->heights->GetHeightRange(lo, hi);
+
+    AABB aabb;
+    aabb.min = Vec3(lo.x, heights.x, lo.y);
+    aabb.max = Vec3(hi.x, heights.y, hi.y);
+    return aabb;
+}
+
+float TerrainQuadtree::GetNeighborRatio(const glm::vec2& point, float size) const
+{
+    glm::uvec3 node;
+    if (!this->FindBiggerSelected(point, size, node)) return 1.0f;
+    return this->rootSize / (float)(1u << node.x) / size;
+}
+
+bool TerrainQuadtree::FindBiggerSelected(const glm::vec2& point, float size, glm::uvec3& node) const
+{
+    glm::vec2 p = point + this->halfExtent; //root at 0
+    if (p.x < 0.0f || p.y < 0.0f || p.x >= this->rootSize || p.y >= this->rootSize) return false;
+
+    //selected nodes don't overlap, only a bigger one matters
+    for (unsigned int d = 0; d <= this->maxDepth; d++)
+    {
+        float nodeSize = this->rootSize / (float)(1u << d);
+        if (nodeSize <= size) break;
+
+        unsigned int x = (unsigned int)(p.x / nodeSize), y = (unsigned int)(p.y / nodeSize);
+        if (this->selectedKeys.count(NodeKey(d, x, y)))
+        {
+            node = glm::uvec3(d, x, y);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TerrainQuadtree::Upload()
+{
+    if (this->patches.size() == this->shadowPatchCount) return;
+    glNamedBufferSubData(this->patchVBO, sizeof(TerrainPatchGPU) * this->shadowPatchCount,
+                         sizeof(TerrainPatchGPU) * (this->patches.size() - this->shadowPatchCount), this->patches.data() + this->shadowPatchCount);
+}
+
+std::pair<unsigned int, unsigned int> TerrainQuadtree::GetShadowPatches() const
+{
+    return { 0, this->shadowPatchCount };
+}
+
+unsigned int TerrainQuadtree::GetPatchBuffer() const
+{
+    return this->patchVBO;
+}
+
+glm::vec2 TerrainQuadtree::GetHalfExtent() const
+{
+    return this->halfExtent;
+}
+
+AABB TerrainQuadtree::GetBounds() const
+{
+    return this->heights->GetBounds();
+}
+
+bool TerrainQuadtree::IsVisible(const glm::mat4& model, const std::function<bool(const AABB&)>& isVisible) const
+{
+    return this->IsNodeVisible(0, 0, 0, model, isVisible);
+}
+
+bool TerrainQuadtree::IsNodeVisible(unsigned int depth, unsigned int x, unsigned int y, const glm::mat4& model,
+                                    const std::function<bool(const AABB&)>& isVisible) const
+{
+    AABB nodeBounds = this->GetNodeBounds(depth, x, y);
+    if (nodeBounds.min.y > nodeBounds.max.y || !isVisible(TransformAABB(nodeBounds, model))) return false;
+    if (depth == this->maxDepth) return true;
+
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        if (this->IsNodeVisible(depth + 1, x * 2 + (i & 1), y * 2 + (i >> 1), model, isVisible)) return true;
+    }
+    return false;
+}
+
+float TerrainQuadtree::GetMaxZ(const glm::mat4& toSpace, const glm::vec2& rectMin, const glm::vec2& rectMax) const
+{
+    float maxZ = -FLT_MAX;
+    this->GetNodeMaxZ(0, 0, 0, toSpace, rectMin, rectMax, maxZ);
+    return maxZ;
+}
+
+void TerrainQuadtree::GetNodeMaxZ(unsigned int depth, unsigned int x, unsigned int y, const glm::mat4& toSpace,
+                                  const glm::vec2& rectMin, const glm::vec2& rectMax, float& maxZ) const
+{
+    AABB nodeBounds = this->GetNodeBounds(depth, x, y);
+    if (nodeBounds.min.y > nodeBounds.max.y) return;
+
+    //off the rectangle, or can't beat what was already found
+    AABB bounds = TransformAABB(nodeBounds, toSpace);
+    if (bounds.max.x < rectMin.x || bounds.min.x > rectMax.x || bounds.max.y < rectMin.y || bounds.min.y > rectMax.y) return;
+    if (bounds.max.z <= maxZ) return;
+
+    if (depth == this->maxDepth)
+    {
+        maxZ = bounds.max.z;
+        return;
+    }
+
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        this->GetNodeMaxZ(depth + 1, x * 2 + (i & 1), y * 2 + (i >> 1), toSpace, rectMin, rectMax, maxZ);
+    }
+}